@@ -0,0 +1,154 @@
+#include "acpi.h"
+#include "paging.h"
+#include "klib.h"
+#include "klog.h"
+
+// Only the MADT is read: it lists the CPUs, the IOAPICs and how the ISA
+// IRQs are wired to them
+
+static int cpu_count = 0;
+static uint32_t cpu_apic_ids[ACPI_MAX_CPUS];
+static int ioapic_count = 0;
+static acpi_ioapic_t ioapics[ACPI_MAX_IOAPICS];
+static uint32_t isa_gsi[ACPI_ISA_IRQS];
+static uint16_t isa_flags[ACPI_ISA_IRQS];
+
+static int checksum_ok(const void *data, uint32_t len) {
+    const uint8_t *p = data;
+    uint8_t sum = 0;
+    for (uint32_t i = 0; i < len; i++) sum += p[i];
+    return sum == 0;
+}
+
+// Tables normally sit in RAM covered by the direct map; anything beyond it
+// goes through the ioremap window
+static void *acpi_map(uint32_t phys, uint32_t len) {
+    if (phys + len <= KERNEL_DIRECT_MAP_SIZE &&
+        paging_translate((uint32_t)phys_to_virt(phys)) == phys &&
+        paging_translate((uint32_t)phys_to_virt(phys + len - 1)) == phys + len - 1) {
+        return phys_to_virt(phys);
+    }
+    return paging_map_mmio(phys, len);
+}
+
+// Map a whole table, header first to learn its length
+static acpi_header_t *map_table(uint32_t phys) {
+    acpi_header_t *header = acpi_map(phys, sizeof(acpi_header_t));
+    if (!header) return 0;
+    uint32_t len = header->length;
+    if (len < sizeof(acpi_header_t)) return 0;
+    header = acpi_map(phys, len);
+    if (!header || !checksum_ok(header, len)) return 0;
+    return header;
+}
+
+static acpi_rsdp_t *scan_rsdp(uint32_t start, uint32_t end) {
+    for (uint32_t addr = start; addr + sizeof(acpi_rsdp_t) <= end; addr += 16) {
+        acpi_rsdp_t *rsdp = phys_to_virt(addr);
+        if (memcmp(rsdp->signature, "RSD PTR ", 8) == 0 &&
+            checksum_ok(rsdp, sizeof(acpi_rsdp_t))) {
+            return rsdp;
+        }
+    }
+    return 0;
+}
+
+static acpi_rsdp_t *find_rsdp(void) {
+    uint32_t ebda = (uint32_t)*(uint16_t *)phys_to_virt(ACPI_EBDA_SEGMENT_PTR) << 4;
+    acpi_rsdp_t *rsdp = 0;
+    if (ebda) {
+        rsdp = scan_rsdp(ebda, ebda + 1024);
+    }
+    if (!rsdp) {
+        rsdp = scan_rsdp(ACPI_BIOS_ROM_START, ACPI_BIOS_ROM_END);
+    }
+    return rsdp;
+}
+
+static void parse_madt(const acpi_madt_t *madt) {
+    const uint8_t *entry = (const uint8_t *)(madt + 1);
+    const uint8_t *end = (const uint8_t *)madt + madt->header.length;
+
+    while (entry + 2 <= end && entry[1] >= 2 && entry + entry[1] <= end) {
+        switch (entry[0]) {
+        case MADT_LAPIC:
+            // acpi processor id, apic id, flags
+            if ((*(const uint32_t *)(entry + 4) & (MADT_LAPIC_ENABLED | MADT_LAPIC_ONLINE_CAPABLE)) &&
+                cpu_count < ACPI_MAX_CPUS) {
+                cpu_apic_ids[cpu_count++] = entry[3];
+            }
+            break;
+        case MADT_IOAPIC:
+            // id, reserved, address, gsi base
+            if (ioapic_count < ACPI_MAX_IOAPICS) {
+                ioapics[ioapic_count].id = entry[2];
+                ioapics[ioapic_count].address = *(const uint32_t *)(entry + 4);
+                ioapics[ioapic_count].gsi_base = *(const uint32_t *)(entry + 8);
+                ioapic_count++;
+            }
+            break;
+        case MADT_ISO:
+            // bus (0 = ISA), source irq, gsi, flags
+            if (entry[2] == 0 && entry[3] < ACPI_ISA_IRQS) {
+                isa_gsi[entry[3]] = *(const uint32_t *)(entry + 4);
+                isa_flags[entry[3]] = *(const uint16_t *)(entry + 8);
+            }
+            break;
+        }
+        entry += entry[1];
+    }
+}
+
+void acpi_init(void) {
+    // ISA IRQs are identity mapped, edge triggered and active high unless
+    // an override says otherwise
+    for (int irq = 0; irq < ACPI_ISA_IRQS; irq++) {
+        isa_gsi[irq] = irq;
+        isa_flags[irq] = 0;
+    }
+
+    acpi_rsdp_t *rsdp = find_rsdp();
+    if (!rsdp) {
+        klog(KLOG_WARN, KLOG_KERNEL, "acpi: no RSDP");
+        return;
+    }
+    acpi_header_t *rsdt = map_table(rsdp->rsdt);
+    if (!rsdt || memcmp(rsdt->signature, "RSDT", 4) != 0) {
+        klog(KLOG_WARN, KLOG_KERNEL, "acpi: bad RSDT at %08x", rsdp->rsdt);
+        return;
+    }
+
+    uint32_t tables = (rsdt->length - sizeof(acpi_header_t)) / 4;
+    const uint32_t *entries = (const uint32_t *)(rsdt + 1);
+    for (uint32_t i = 0; i < tables; i++) {
+        acpi_header_t *table = map_table(entries[i]);
+        if (table && memcmp(table->signature, "APIC", 4) == 0) {
+            parse_madt((const acpi_madt_t *)table);
+            break;
+        }
+    }
+    klog(KLOG_INFO, KLOG_KERNEL, "acpi: %d CPUs, %d IOAPICs, revision %u",
+         cpu_count, ioapic_count, rsdp->revision);
+}
+
+int acpi_cpu_count(void) {
+    return cpu_count;
+}
+
+uint32_t acpi_cpu_apic_id(int index) {
+    return cpu_apic_ids[index];
+}
+
+int acpi_ioapic_count(void) {
+    return ioapic_count;
+}
+
+const acpi_ioapic_t *acpi_ioapic(int index) {
+    return index < ioapic_count ? &ioapics[index] : 0;
+}
+
+// Global system interrupt an ISA IRQ is wired to, with its MPS INTI flags
+uint32_t acpi_isa_gsi(int irq, uint16_t *flags) {
+    if (flags) *flags = isa_flags[irq];
+    return isa_gsi[irq];
+}
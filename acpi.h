@@ -0,0 +1,68 @@
+#ifndef ACPI_H
+#define ACPI_H
+
+#include <stdint.h>
+
+// Where the RSDP may live: the first KiB of the EBDA, or the BIOS ROM
+#define ACPI_EBDA_SEGMENT_PTR 0x40E
+#define ACPI_BIOS_ROM_START   0xE0000
+#define ACPI_BIOS_ROM_END     0x100000
+
+#define ACPI_MAX_CPUS     16
+#define ACPI_MAX_IOAPICS  4
+#define ACPI_ISA_IRQS     16
+
+// MADT entry types
+#define MADT_LAPIC          0
+#define MADT_IOAPIC         1
+#define MADT_ISO            2 // interrupt source override
+
+#define MADT_LAPIC_ENABLED  0x1
+#define MADT_LAPIC_ONLINE_CAPABLE 0x2
+
+// MPS INTI flags of an interrupt source override
+#define ACPI_POLARITY_MASK  0x3
+#define ACPI_POLARITY_LOW   0x3
+#define ACPI_TRIGGER_MASK   0xC
+#define ACPI_TRIGGER_LEVEL  0xC
+
+typedef struct {
+    char signature[8]; // "RSD PTR "
+    uint8_t checksum;
+    char oem_id[6];
+    uint8_t revision;
+    uint32_t rsdt;
+} __attribute__((packed)) acpi_rsdp_t;
+
+typedef struct {
+    char signature[4];
+    uint32_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed)) acpi_header_t;
+
+typedef struct {
+    acpi_header_t header;
+    uint32_t lapic_address;
+    uint32_t flags;
+} __attribute__((packed)) acpi_madt_t;
+
+typedef struct {
+    uint8_t id;
+    uint32_t address;
+    uint32_t gsi_base;
+} acpi_ioapic_t;
+
+void acpi_init(void);
+int acpi_cpu_count(void);
+uint32_t acpi_cpu_apic_id(int index);
+int acpi_ioapic_count(void);
+const acpi_ioapic_t *acpi_ioapic(int index);
+uint32_t acpi_isa_gsi(int irq, uint16_t *flags);
+
+#endif // ACPI_H
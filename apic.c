@@ -0,0 +1,63 @@
+#include "apic.h"
+#include "cpu.h"
+#include "io.h"
+#include "paging.h"
+
+// MMIO base of the local APIC, taken from IA32_APIC_BASE
+static volatile uint32_t *lapic_base = 0;
+
+int lapic_present(void) {
+    uint32_t edx = cpuid_edx(1);
+    return (edx & CPUID_EDX_APIC) && (edx & CPUID_EDX_MSR);
+}
+
+uint32_t lapic_read(uint32_t reg) {
+    return lapic_base[reg / 4];
+}
+
+void lapic_write(uint32_t reg, uint32_t value) {
+    lapic_base[reg / 4] = value;
+}
+
+void lapic_eoi(void) {
+    lapic_write(LAPIC_EOI, 0);
+}
+
+uint32_t lapic_id(void) {
+    return lapic_read(LAPIC_ID) >> 24;
+}
+
+// Send an interprocessor interrupt once the previous one has been accepted
+void lapic_send_ipi(uint32_t apic_id, uint32_t icr) {
+    // Threads on the boot CPU send IPIs too: keep the two ICR writes together
+    unsigned long flags = irq_save();
+    while (lapic_read(LAPIC_ICR_LOW) & LAPIC_ICR_PENDING) {
+        cpu_relax();
+    }
+    lapic_write(LAPIC_ICR_HIGH, apic_id << 24);
+    lapic_write(LAPIC_ICR_LOW, icr);
+    irq_restore(flags);
+}
+
+// Software-enable the local APIC. LINT0/LINT1 keep the virtual wire setup
+// left by the BIOS, so the 8259 PIC keeps delivering legacy IRQs unless
+// ioapic_init() takes them over. Every CPU calls this for its own APIC.
+void lapic_init(void) {
+    uint64_t base = rdmsr(MSR_APIC_BASE);
+    lapic_base = paging_map_mmio(base & 0xFFFFF000, 0x1000);
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | LAPIC_SPURIOUS_VECTOR);
+    lapic_timer_stop();
+}
+
+// Run the timer in periodic mode, raising LAPIC_TIMER_VECTOR every
+// `count` bus clocks divided by 16
+void lapic_timer_start(uint32_t count) {
+    lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIV_16);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_PERIODIC | LAPIC_TIMER_VECTOR);
+    lapic_write(LAPIC_TIMER_INIT, count);
+}
+
+void lapic_timer_stop(void) {
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED | LAPIC_TIMER_VECTOR);
+    lapic_write(LAPIC_TIMER_INIT, 0);
+}
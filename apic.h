@@ -0,0 +1,45 @@
+#ifndef APIC_H
+#define APIC_H
+
+#include <stdint.h>
+
+// Local APIC register offsets
+#define LAPIC_ID            0x020
+#define LAPIC_EOI           0x0B0
+#define LAPIC_SVR           0x0F0
+#define LAPIC_ICR_LOW       0x300
+#define LAPIC_ICR_HIGH      0x310
+#define LAPIC_LVT_TIMER     0x320
+#define LAPIC_TIMER_INIT    0x380
+#define LAPIC_TIMER_CURRENT 0x390
+#define LAPIC_TIMER_DIVIDE  0x3E0
+
+#define LAPIC_SVR_ENABLE    0x100
+#define LAPIC_LVT_MASKED    0x10000
+#define LAPIC_TIMER_PERIODIC 0x20000
+#define LAPIC_TIMER_DIV_16  0x3
+
+// Interrupt command register: delivery mode and level bits of the low word
+#define LAPIC_ICR_FIXED     0x00000
+#define LAPIC_ICR_INIT      0x00500
+#define LAPIC_ICR_STARTUP   0x00600
+#define LAPIC_ICR_PENDING   0x01000 // delivery status, read only
+#define LAPIC_ICR_ASSERT    0x04000
+#define LAPIC_ICR_LEVEL     0x08000
+
+// Interrupt vectors owned by the local APIC
+#define LAPIC_TIMER_VECTOR    0x30
+#define LAPIC_IPI_VECTOR      0x31 // wakes an idle CPU for new work (smp.c)
+#define LAPIC_SPURIOUS_VECTOR 0xFF
+
+int lapic_present(void);
+void lapic_init(void);
+uint32_t lapic_read(uint32_t reg);
+void lapic_write(uint32_t reg, uint32_t value);
+void lapic_eoi(void);
+uint32_t lapic_id(void);
+void lapic_send_ipi(uint32_t apic_id, uint32_t icr);
+void lapic_timer_start(uint32_t count);
+void lapic_timer_stop(void);
+
+#endif // APIC_H
@@ -0,0 +1,401 @@
+#include "ata.h"
+#include "pci.h"
+#include "pmm.h"
+#include "idt.h"
+#include "sched.h"
+#include "timer.h"
+#include "klib.h"
+#include "klog.h"
+#include "cpu.h"
+#include "io.h"
+
+// ATA disks on the legacy IDE channels. Drives are found with PIO
+// IDENTIFY; data moves by bus-master DMA when the PCI IDE controller has a
+// bus master (BAR4), and the calling thread sleeps until the channel's IRQ
+// reports completion. Without one, transfers fall back to polled PIO.
+//
+// Only threads call into the driver: a command blocks in the scheduler,
+// and each channel runs one command at a time.
+
+typedef struct {
+    uint16_t io;
+    uint16_t ctrl;
+    uint16_t bm;               // bus master registers, 0 for PIO only
+    int irq;
+    ata_prd_t *prdt;
+    uint32_t prdt_phys;
+    mutex_t lock;              // one command at a time
+    volatile int done;         // set by the IRQ handler
+    volatile uint8_t status;
+    volatile uint8_t bm_status;
+    wait_queue_t waiters;      // the owner, waiting for the IRQ
+    uint32_t irqs;
+} ata_channel_t;
+
+static ata_channel_t channels[ATA_CHANNELS] = {
+    {.io = ATA_PRIMARY_IO,   .ctrl = ATA_PRIMARY_CTRL,   .irq = ATA_PRIMARY_IRQ},
+    {.io = ATA_SECONDARY_IO, .ctrl = ATA_SECONDARY_CTRL, .irq = ATA_SECONDARY_IRQ},
+};
+static ata_drive_t drives[ATA_DRIVES];
+static int drive_count = 0;
+
+static inline uint8_t inb(uint16_t port) {
+    return (uint8_t)read_port(port);
+}
+
+static inline ata_channel_t *channel_of(int drive) {
+    return &channels[drive / 2];
+}
+
+// Reading the alternate status four times gives the drive the 400 ns it
+// needs to present a valid status after a select or command
+static void delay400(ata_channel_t *ch) {
+    for (int i = 0; i < 4; i++) inb(ch->ctrl);
+}
+
+// Poll until BSY clears and the `mask` bits are set. Returns the status,
+// or -1 on a timeout or an error.
+static int poll(ata_channel_t *ch, uint8_t mask) {
+    uint64_t deadline = timer_ticks() + ATA_TIMEOUT_MS * TIMER_HZ / 1000;
+    while (1) {
+        uint8_t status = inb(ch->ctrl);
+        if (!(status & ATA_SR_BSY)) {
+            if (status & (ATA_SR_ERR | ATA_SR_DF)) return -1;
+            if ((status & mask) == mask) return status;
+        }
+        if (timer_ticks() >= deadline) return -1;
+        cpu_relax();
+    }
+}
+
+static void channel_irq(ata_channel_t *ch) {
+    uint8_t bm_status = 0;
+    if (ch->bm) {
+        bm_status = inb(ch->bm + ATA_BM_STATUS);
+        if (!(bm_status & ATA_BM_SR_IRQ)) return;
+        // Writing the IRQ and error bits back clears them
+        outb(ch->bm + ATA_BM_STATUS, bm_status);
+    }
+    ch->status = inb(ch->io + ATA_REG_STATUS);   // acknowledges INTRQ
+    ch->bm_status = bm_status;
+    ch->irqs++;
+    ch->done = 1;
+    sched_wake_all(&ch->waiters);
+}
+
+static void ata_irq_primary(struct regs *r) {
+    channel_irq(&channels[0]);
+}
+
+static void ata_irq_secondary(struct regs *r) {
+    channel_irq(&channels[1]);
+}
+
+// Native-mode channels share the controller's one PCI line; channel_irq()
+// ignores the channel whose bus master did not interrupt
+static void ata_irq_shared(struct regs *r) {
+    channel_irq(&channels[0]);
+    channel_irq(&channels[1]);
+}
+
+// Sleep until the IRQ handler has seen the command complete. -1 after
+// ATA_TIMEOUT_MS without it, so a lost interrupt fails one command instead
+// of holding the channel forever.
+static int wait_irq(ata_channel_t *ch) {
+    uint64_t deadline = timer_ticks() + ATA_TIMEOUT_MS * TIMER_HZ / 1000;
+    while (1) {
+        cli();
+        if (ch->done) {
+            sti();
+            return 0;
+        }
+        if (timer_ticks() >= deadline) {
+            sti();
+            return -1;
+        }
+        if (sched_active()) {
+            sched_block_timeout(&ch->waiters, deadline);
+        } else {
+            sti_hlt();
+        }
+    }
+}
+
+// Select the drive and load the address and sector count; 256 sectors is
+// written as 0 (LBA28) and only LBA48 commands use the high bytes
+static void load_taskfile(ata_channel_t *ch, int slave, int lba48, uint32_t lba, uint32_t count) {
+    if (lba48) {
+        outb(ch->io + ATA_REG_DRIVE, ATA_DRIVE_LBA | (slave << 4));
+        delay400(ch);
+        outb(ch->io + ATA_REG_COUNT, count >> 8);
+        outb(ch->io + ATA_REG_LBA_LO, lba >> 24);
+        outb(ch->io + ATA_REG_LBA_MID, 0);
+        outb(ch->io + ATA_REG_LBA_HI, 0);
+    } else {
+        outb(ch->io + ATA_REG_DRIVE, ATA_DRIVE_LBA | (slave << 4) | ((lba >> 24) & 0x0F));
+        delay400(ch);
+    }
+    outb(ch->io + ATA_REG_COUNT, count & 0xFF);
+    outb(ch->io + ATA_REG_LBA_LO, lba & 0xFF);
+    outb(ch->io + ATA_REG_LBA_MID, (lba >> 8) & 0xFF);
+    outb(ch->io + ATA_REG_LBA_HI, (lba >> 16) & 0xFF);
+}
+
+// Fill the PRD table from the segments, splitting at 64 KiB boundaries
+static int build_prdt(ata_channel_t *ch, const blk_segment_t *segs, int count) {
+    int n = 0;
+    for (int i = 0; i < count; i++) {
+        uint32_t phys = virt_to_phys(segs[i].buf);
+        uint32_t left = segs[i].len;
+        while (left) {
+            uint32_t chunk = ATA_PRD_MAX_BYTES - (phys & (ATA_PRD_MAX_BYTES - 1));
+            if (chunk > left) chunk = left;
+            if (n == ATA_PRD_ENTRIES) return -1;
+            ch->prdt[n].phys = phys;
+            ch->prdt[n].bytes = (uint16_t)chunk;   // 64 KiB wraps to 0
+            ch->prdt[n].flags = 0;
+            n++;
+            phys += chunk;
+            left -= chunk;
+        }
+    }
+    if (n == 0) return -1;
+    ch->prdt[n - 1].flags = ATA_PRD_EOT;
+    return 0;
+}
+
+static int dma_transfer(ata_channel_t *ch, int slave, int write,
+                        uint32_t lba, uint32_t sectors, const blk_segment_t *segs, int count) {
+    if (build_prdt(ch, segs, count) < 0) return -1;
+    int lba48 = lba + sectors > 0x0FFFFFFF;
+    uint8_t cmd = write ? (lba48 ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_WRITE_DMA)
+                        : (lba48 ? ATA_CMD_READ_DMA_EXT : ATA_CMD_READ_DMA);
+
+    outl(ch->bm + ATA_BM_PRDT, ch->prdt_phys);
+    outb(ch->bm + ATA_BM_COMMAND, write ? 0 : ATA_BM_CMD_READ);
+    outb(ch->bm + ATA_BM_STATUS, inb(ch->bm + ATA_BM_STATUS) | ATA_BM_SR_IRQ | ATA_BM_SR_ERROR);
+    load_taskfile(ch, slave, lba48, lba, sectors);
+
+    ch->done = 0;
+    outb(ch->io + ATA_REG_COMMAND, cmd);
+    outb(ch->bm + ATA_BM_COMMAND, (write ? 0 : ATA_BM_CMD_READ) | ATA_BM_CMD_START);
+    int timed_out = wait_irq(ch) < 0;
+    outb(ch->bm + ATA_BM_COMMAND, 0);
+
+    if (timed_out) {
+        klog(KLOG_ERR, KLOG_KERNEL, "ata: no DMA completion IRQ %u", ch->irq);
+        return -1;
+    }
+    if ((ch->bm_status & ATA_BM_SR_ERROR) || (ch->status & (ATA_SR_ERR | ATA_SR_DF))) {
+        return -1;
+    }
+    return 0;
+}
+
+static int pio_transfer(ata_channel_t *ch, int slave, int write,
+                        uint32_t lba, uint32_t sectors, const blk_segment_t *segs, int count) {
+    int lba48 = lba + sectors > 0x0FFFFFFF;
+    uint8_t cmd = write ? (lba48 ? ATA_CMD_WRITE_PIO_EXT : ATA_CMD_WRITE_PIO)
+                        : (lba48 ? ATA_CMD_READ_PIO_EXT : ATA_CMD_READ_PIO);
+    load_taskfile(ch, slave, lba48, lba, sectors);
+    outb(ch->io + ATA_REG_COMMAND, cmd);
+
+    for (int i = 0; i < count; i++) {
+        uint8_t *p = segs[i].buf;
+        for (uint32_t off = 0; off < segs[i].len; off += ATA_SECTOR_SIZE) {
+            delay400(ch);
+            if (poll(ch, ATA_SR_DRQ) < 0) return -1;
+            if (write) {
+                outsw(ch->io + ATA_REG_DATA, p + off, ATA_SECTOR_SIZE / 2);
+            } else {
+                insw(ch->io + ATA_REG_DATA, p + off, ATA_SECTOR_SIZE / 2);
+            }
+        }
+    }
+    delay400(ch);
+    return poll(ch, 0) < 0 ? -1 : 0;
+}
+
+// Read or write the sectors starting at `lba` into or from the segments,
+// in one command. At most ATA_MAX_SECTORS in ATA_MAX_SEGMENTS pieces.
+int ata_transfer(int drive, int write, uint32_t lba, const blk_segment_t *segs, int count) {
+    if (drive < 0 || drive >= ATA_DRIVES || !drives[drive].present) return -1;
+    if (count <= 0 || count > ATA_MAX_SEGMENTS) return -1;
+    ata_drive_t *d = &drives[drive];
+    uint32_t sectors = 0;
+    for (int i = 0; i < count; i++) {
+        if (segs[i].len == 0 || segs[i].len % ATA_SECTOR_SIZE) return -1;
+        sectors += segs[i].len / ATA_SECTOR_SIZE;
+    }
+    if (sectors > ATA_MAX_SECTORS || lba >= d->sectors || sectors > d->sectors - lba) return -1;
+
+    ata_channel_t *ch = channel_of(drive);
+    mutex_lock(&ch->lock);
+    int err = d->dma ? dma_transfer(ch, drive & 1, write, lba, sectors, segs, count)
+                     : pio_transfer(ch, drive & 1, write, lba, sectors, segs, count);
+    mutex_unlock(&ch->lock);
+    return err;
+}
+
+// Write the drive's own cache to the medium
+int ata_flush(int drive) {
+    if (drive < 0 || drive >= ATA_DRIVES || !drives[drive].present) return -1;
+    ata_drive_t *d = &drives[drive];
+    ata_channel_t *ch = channel_of(drive);
+    mutex_lock(&ch->lock);
+    outb(ch->io + ATA_REG_DRIVE, ATA_DRIVE_LBA | ((drive & 1) << 4));
+    delay400(ch);
+    int err = poll(ch, 0) < 0 ? -1 : 0;
+    if (err == 0) {
+        outb(ch->io + ATA_REG_COMMAND, d->lba48 ? ATA_CMD_FLUSH_EXT : ATA_CMD_FLUSH);
+        delay400(ch);
+        err = poll(ch, 0) < 0 ? -1 : 0;
+    }
+    mutex_unlock(&ch->lock);
+    return err;
+}
+
+// Block device operations: the IDE channel runs one command at a time, so
+// a batch is just issued in order
+static int ata_submit(blkdev_t *blk, blk_request_t *reqs, int count) {
+    int drive = (ata_drive_t *)blk->priv - drives;
+    for (int i = 0; i < count; i++) {
+        reqs[i].status = ata_transfer(drive, reqs[i].write, reqs[i].lba, reqs[i].segs, reqs[i].count);
+    }
+    return 0;
+}
+
+static int ata_blk_flush(blkdev_t *blk) {
+    return ata_flush((ata_drive_t *)blk->priv - drives);
+}
+
+// IDENTIFY one drive by PIO, with the channel's interrupts off
+static void identify(ata_channel_t *ch, int slave, ata_drive_t *d) {
+    uint16_t id[256];
+
+    outb(ch->io + ATA_REG_DRIVE, ATA_DRIVE_LBA | (slave << 4));
+    delay400(ch);
+    outb(ch->io + ATA_REG_COUNT, 0);
+    outb(ch->io + ATA_REG_LBA_LO, 0);
+    outb(ch->io + ATA_REG_LBA_MID, 0);
+    outb(ch->io + ATA_REG_LBA_HI, 0);
+    outb(ch->io + ATA_REG_COMMAND, ATA_CMD_IDENTIFY);
+    delay400(ch);
+    if (inb(ch->io + ATA_REG_STATUS) == 0) return;   // no drive
+
+    if (poll(ch, 0) < 0) return;
+    // ATAPI and SATA devices answer with a signature instead
+    if (inb(ch->io + ATA_REG_LBA_MID) || inb(ch->io + ATA_REG_LBA_HI)) return;
+    if (poll(ch, ATA_SR_DRQ) < 0) return;
+    insw(ch->io + ATA_REG_DATA, id, 256);
+
+    if (!(id[ATA_ID_CAPABILITIES] & ATA_CAP_LBA)) return;
+    d->lba48 = (id[ATA_ID_COMMAND_SETS] & ATA_CMDSET_LBA48) != 0;
+    if (d->lba48 && (id[ATA_ID_LBA48_SECTORS + 2] || id[ATA_ID_LBA48_SECTORS + 3])) {
+        d->sectors = 0xFFFFFFFF;   // beyond 2 TiB: the first 2 TiB are usable
+    } else if (d->lba48) {
+        d->sectors = id[ATA_ID_LBA48_SECTORS] | ((uint32_t)id[ATA_ID_LBA48_SECTORS + 1] << 16);
+    } else {
+        d->sectors = id[ATA_ID_LBA28_SECTORS] | ((uint32_t)id[ATA_ID_LBA28_SECTORS + 1] << 16);
+    }
+    d->dma = (id[ATA_ID_CAPABILITIES] & ATA_CAP_DMA) != 0;
+
+    for (int i = 0; i < ATA_ID_MODEL_LEN / 2; i++) {
+        d->model[2 * i] = id[ATA_ID_MODEL + i] >> 8;
+        d->model[2 * i + 1] = id[ATA_ID_MODEL + i] & 0xFF;
+    }
+    int len = ATA_ID_MODEL_LEN;
+    while (len > 0 && d->model[len - 1] == ' ') len--;
+    d->model[len] = '\0';
+    d->present = 1;
+}
+
+static uint16_t bm_base = 0;
+
+// Bound to the PCI IDE controller: native-mode channels take their ports
+// from BAR0-3 and share the function's interrupt line, and BAR4 holds the
+// bus master registers
+static int ide_probe(pci_device_t *dev) {
+    for (int i = 0; i < ATA_CHANNELS; i++) {
+        if (!(dev->prog_if & (1 << (2 * i)))) continue;
+        channels[i].io = dev->bar[2 * i].base;
+        channels[i].ctrl = dev->bar[2 * i + 1].base + 2;
+        channels[i].irq = dev->irq_line;
+    }
+    if ((dev->bar[4].flags & PCI_BAR_FLAG_IO) && dev->bar[4].size) {
+        bm_base = dev->bar[4].base;
+        pci_enable_master(dev);
+    }
+    return 0;
+}
+
+static const pci_driver_t ide_driver = {
+    .name = "ata",
+    .vendor = PCI_ANY,
+    .device = PCI_ANY,
+    .class = PCI_CLASS_STORAGE,
+    .subclass = PCI_SUBCLASS_IDE,
+    .probe = ide_probe,
+};
+
+// Claim the IDE controller and its bus master, then probe both channels.
+// Without a controller the legacy ports are still probed, PIO only.
+// Needs pci_init(), the tick (for PIO timeouts) and the PMM.
+void ata_init(void) {
+    pci_register_driver(&ide_driver);
+
+    for (int c = 0; c < ATA_CHANNELS; c++) {
+        ata_channel_t *ch = &channels[c];
+        outb(ch->ctrl, ATA_CTRL_NIEN);
+        if (inb(ch->io + ATA_REG_STATUS) == 0xFF) continue;   // floating bus
+
+        identify(ch, 0, &drives[2 * c]);
+        identify(ch, 1, &drives[2 * c + 1]);
+        if (!drives[2 * c].present && !drives[2 * c + 1].present) continue;
+
+        uint32_t frame = bm_base && ch->irq < IRQ_COUNT ? pmm_alloc_frame() : 0;
+        if (frame) {
+            ch->bm = bm_base + 8 * c;
+            ch->prdt_phys = frame;
+            ch->prdt = phys_to_virt(frame);
+            irq_handler_t handler = c == 0 ? ata_irq_primary : ata_irq_secondary;
+            if (c == 1 && channels[0].bm && channels[0].irq == ch->irq) {
+                handler = ata_irq_shared;
+            }
+            register_irq_handler(IRQ_VECTOR(ch->irq), handler);
+            irq_unmask(ch->irq);
+            outb(ch->ctrl, 0);
+        }
+        for (int s = 0; s < 2; s++) {
+            ata_drive_t *d = &drives[2 * c + s];
+            if (!d->present) continue;
+            d->dma = d->dma && ch->bm;
+            drive_count++;
+            blkdev_t *blk = &d->blk;
+            memcpy(blk->name, "ata0", 5);
+            blk->name[3] += 2 * c + s;
+            blk->model = d->model;
+            blk->mode = d->dma ? "DMA" : "PIO";
+            blk->sectors = d->sectors;
+            blk->max_sectors = ATA_MAX_SECTORS;
+            blk->max_segments = ATA_MAX_SEGMENTS;
+            blk->submit = ata_submit;
+            blk->flush = ata_blk_flush;
+            blk->priv = d;
+            blkdev_register(blk);
+        }
+    }
+    if (drive_count == 0) {
+        klog(KLOG_INFO, KLOG_KERNEL, "ata: no drives");
+    }
+}
+
+int ata_drive_count(void) {
+    return drive_count;
+}
+
+// 0 when there is no drive at that position
+const ata_drive_t *ata_drive(int drive) {
+    if (drive < 0 || drive >= ATA_DRIVES || !drives[drive].present) return 0;
+    return &drives[drive];
+}
@@ -0,0 +1,111 @@
+#ifndef ATA_H
+#define ATA_H
+
+#include <stdint.h>
+#include "blkdev.h"
+
+#define ATA_SECTOR_SIZE 512
+#define ATA_CHANNELS    2
+#define ATA_DRIVES      4   // master and slave on each channel
+
+// Legacy (compatibility mode) channel ports and IRQs
+#define ATA_PRIMARY_IO     0x1F0
+#define ATA_PRIMARY_CTRL   0x3F6
+#define ATA_PRIMARY_IRQ    14
+#define ATA_SECONDARY_IO   0x170
+#define ATA_SECONDARY_CTRL 0x376
+#define ATA_SECONDARY_IRQ  15
+
+// Task file registers, offsets from the I/O base
+#define ATA_REG_DATA     0
+#define ATA_REG_ERROR    1
+#define ATA_REG_FEATURES 1
+#define ATA_REG_COUNT    2
+#define ATA_REG_LBA_LO   3
+#define ATA_REG_LBA_MID  4
+#define ATA_REG_LBA_HI   5
+#define ATA_REG_DRIVE    6
+#define ATA_REG_STATUS   7
+#define ATA_REG_COMMAND  7
+
+// Control block: alternate status (read) and device control (write)
+#define ATA_CTRL_NIEN 0x02  // interrupts off
+
+#define ATA_SR_BSY  0x80
+#define ATA_SR_DRDY 0x40
+#define ATA_SR_DF   0x20
+#define ATA_SR_DRQ  0x08
+#define ATA_SR_ERR  0x01
+
+#define ATA_DRIVE_LBA 0xE0  // LBA addressing, master; | 0x10 for the slave
+
+#define ATA_CMD_READ_PIO      0x20
+#define ATA_CMD_READ_PIO_EXT  0x24
+#define ATA_CMD_READ_DMA_EXT  0x25
+#define ATA_CMD_WRITE_PIO     0x30
+#define ATA_CMD_WRITE_PIO_EXT 0x34
+#define ATA_CMD_WRITE_DMA_EXT 0x35
+#define ATA_CMD_READ_DMA      0xC8
+#define ATA_CMD_WRITE_DMA     0xCA
+#define ATA_CMD_FLUSH         0xE7
+#define ATA_CMD_FLUSH_EXT     0xEA
+#define ATA_CMD_IDENTIFY      0xEC
+
+// IDENTIFY words
+#define ATA_ID_MODEL        27   // 20 words, bytes swapped
+#define ATA_ID_MODEL_LEN    40
+#define ATA_ID_CAPABILITIES 49
+#define ATA_ID_LBA28_SECTORS 60
+#define ATA_ID_COMMAND_SETS 83
+#define ATA_ID_LBA48_SECTORS 100
+#define ATA_CAP_DMA   0x0100
+#define ATA_CAP_LBA   0x0200
+#define ATA_CMDSET_LBA48 0x0400
+
+// Bus master IDE registers, offsets from BAR4 plus 8 per channel
+#define ATA_BM_COMMAND 0
+#define ATA_BM_STATUS  2
+#define ATA_BM_PRDT    4
+#define ATA_BM_CMD_START 0x01
+#define ATA_BM_CMD_READ  0x08  // device to memory
+#define ATA_BM_SR_ACTIVE 0x01
+#define ATA_BM_SR_ERROR  0x02
+#define ATA_BM_SR_IRQ    0x04
+
+// A physical region descriptor covers up to 64 KiB and must not cross a
+// 64 KiB boundary. The table is one page per channel.
+#define ATA_PRD_MAX_BYTES 0x10000
+#define ATA_PRD_EOT       0x8000
+#define ATA_PRD_ENTRIES   512
+
+// Sectors per command: the LBA28 count register limit
+#define ATA_MAX_SECTORS 256
+
+// Most scatter segments one ata_transfer() takes
+#define ATA_MAX_SEGMENTS 64
+
+// Boot-time PIO waits give up after this long
+#define ATA_TIMEOUT_MS 1000
+
+typedef struct {
+    uint32_t phys;
+    uint16_t bytes;   // 0 means 64 KiB
+    uint16_t flags;
+} __attribute__((packed)) ata_prd_t;
+
+typedef struct {
+    int present;
+    int lba48;
+    int dma;          // the channel has a bus master and the drive does DMA
+    uint32_t sectors;
+    char model[ATA_ID_MODEL_LEN + 1];
+    blkdev_t blk;     // registered as ata0-ata3
+} ata_drive_t;
+
+void ata_init(void);
+int ata_drive_count(void);
+const ata_drive_t *ata_drive(int drive);
+int ata_transfer(int drive, int write, uint32_t lba, const blk_segment_t *segs, int count);
+int ata_flush(int drive);
+
+#endif // ATA_H
@@ -0,0 +1,355 @@
+#include "bcache.h"
+#include "blkdev.h"
+#include "pmm.h"
+#include "sched.h"
+#include "timer.h"
+#include "klib.h"
+#include "klog.h"
+
+// Write-back cache of disk blocks. Blocks are found through a hash of
+// (device, block number) and recycled in LRU order; each holds one page,
+// so a run of blocks is a ready-made DMA scatter list. A miss that follows
+// the previous read also fetches the next few blocks in the same request,
+// and dirty blocks go back to disk in runs of adjacent blocks, from the
+// flush thread or when they are evicted. A flush hands the device up to
+// BCACHE_FLUSH_RUNS runs at once, so a queueing device (virtio-blk) gets
+// them with one notification.
+//
+// One mutex covers the whole cache, held across the disk I/O of a miss.
+
+#define BLOCK_VALID     0x01
+#define BLOCK_DIRTY     0x02
+#define BLOCK_READAHEAD 0x04  // read ahead, not asked for yet
+#define BLOCK_QUEUED    0x08  // in the write batch being built
+#define BLOCK_TAKEN     0x10  // handed out by recycle(), not filled yet
+
+#define NO_BLOCK 0xFFFFFFFF
+
+typedef struct cblock {
+    int dev;
+    uint32_t block;
+    uint32_t flags;
+    uint8_t *data;
+    struct cblock *prev;       // LRU list, most recently used first
+    struct cblock *next;
+    struct cblock *hash_next;
+} cblock_t;
+
+static cblock_t blocks[BCACHE_BLOCKS];
+static cblock_t *buckets[BCACHE_BUCKETS];
+static cblock_t lru;           // list head: lru.next is the newest
+static mutex_t cache_lock = MUTEX_INIT;
+static bcache_stats_t stats;
+static uint32_t last_block[BLKDEV_MAX];
+
+// The write batch; only touched with cache_lock held
+static blk_request_t batch[BCACHE_FLUSH_RUNS];
+static blk_segment_t batch_segs[BCACHE_FLUSH_RUNS][BCACHE_WRITE_BATCH];
+static cblock_t *batch_blocks[BCACHE_FLUSH_RUNS][BCACHE_WRITE_BATCH];
+static int ready = 0;
+
+static inline uint32_t bucket_of(int dev, uint32_t block) {
+    return ((block ^ ((uint32_t)dev << 28)) * 2654435761u >> 16) & (BCACHE_BUCKETS - 1);
+}
+
+static cblock_t *lookup(int dev, uint32_t block) {
+    for (cblock_t *b = buckets[bucket_of(dev, block)]; b; b = b->hash_next) {
+        if (b->dev == dev && b->block == block) return b;
+    }
+    return 0;
+}
+
+static void hash_insert(cblock_t *b) {
+    uint32_t i = bucket_of(b->dev, b->block);
+    b->hash_next = buckets[i];
+    buckets[i] = b;
+    stats.cached++;
+}
+
+static void hash_remove(cblock_t *b) {
+    cblock_t **p = &buckets[bucket_of(b->dev, b->block)];
+    while (*p && *p != b) p = &(*p)->hash_next;
+    if (*p) {
+        *p = b->hash_next;
+        stats.cached--;
+    }
+    b->hash_next = 0;
+}
+
+static void lru_unlink(cblock_t *b) {
+    b->prev->next = b->next;
+    b->next->prev = b->prev;
+}
+
+// Most recently used
+static void lru_front(cblock_t *b) {
+    lru_unlink(b);
+    b->next = lru.next;
+    b->prev = &lru;
+    lru.next->prev = b;
+    lru.next = b;
+}
+
+// First to be recycled
+static void lru_back(cblock_t *b) {
+    lru_unlink(b);
+    b->prev = lru.prev;
+    b->next = &lru;
+    lru.prev->next = b;
+    lru.prev = b;
+}
+
+static uint32_t dev_blocks(int dev) {
+    const blkdev_t *d = blkdev_get(dev);
+    return d ? d->sectors / BCACHE_BLOCK_SECTORS : 0;
+}
+
+// Most blocks one request to the device may carry
+static int dev_run_limit(int dev, int limit) {
+    const blkdev_t *d = blkdev_get(dev);
+    if (d->max_segments < limit) limit = d->max_segments;
+    if (d->max_sectors / BCACHE_BLOCK_SECTORS < (uint32_t)limit) {
+        limit = d->max_sectors / BCACHE_BLOCK_SECTORS;
+    }
+    return limit;
+}
+
+static inline int writable(const cblock_t *b) {
+    return (b->flags & (BLOCK_DIRTY | BLOCK_QUEUED)) == BLOCK_DIRTY;
+}
+
+// Put `b` and the dirty blocks right after it in batch slot `n`
+static void queue_run(int n, cblock_t *b) {
+    int limit = dev_run_limit(b->dev, BCACHE_WRITE_BATCH);
+    int len = 0;
+    for (cblock_t *p = b; p && writable(p) && len < limit; p = lookup(b->dev, b->block + len)) {
+        p->flags |= BLOCK_QUEUED;
+        batch_blocks[n][len] = p;
+        batch_segs[n][len].buf = p->data;
+        batch_segs[n][len].len = BCACHE_BLOCK_SIZE;
+        len++;
+    }
+    batch[n].write = 1;
+    batch[n].lba = b->block * BCACHE_BLOCK_SECTORS;
+    batch[n].segs = batch_segs[n];
+    batch[n].count = len;
+}
+
+// Write the first `n` batch slots in one submission
+static int write_batch(int dev, int n) {
+    int err = blkdev_submit(dev, batch, n);
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < batch[i].count; j++) {
+            cblock_t *b = batch_blocks[i][j];
+            b->flags &= ~BLOCK_QUEUED;
+            if (batch[i].status == 0) b->flags &= ~BLOCK_DIRTY;
+        }
+        if (batch[i].status == 0) {
+            stats.dirty -= batch[i].count;
+            stats.writebacks += batch[i].count;
+            stats.flush_commands++;
+        }
+    }
+    return err;
+}
+
+// Write every dirty block of `dev`, starting each run at its lowest block
+static int write_dirty(int dev) {
+    int n = 0;
+    for (int i = 0; i < BCACHE_BLOCKS; i++) {
+        cblock_t *b = &blocks[i];
+        if (b->dev != dev) continue;
+        // A run from an earlier block may stop short of this one
+        while (writable(b)) {
+            cblock_t *start = b, *p;
+            while (start->block > 0 && (p = lookup(dev, start->block - 1)) && writable(p)) {
+                start = p;
+            }
+            queue_run(n++, start);
+            if (n == BCACHE_FLUSH_RUNS) {
+                if (write_batch(dev, n) < 0) return -1;
+                n = 0;
+            }
+        }
+    }
+    return n ? write_batch(dev, n) : 0;
+}
+
+// Empty `b` for reuse and make it the most recent block
+static cblock_t *take(cblock_t *b) {
+    if (b->flags & BLOCK_VALID) {
+        hash_remove(b);
+        stats.evictions++;
+    }
+    b->flags = BLOCK_TAKEN;
+    lru_front(b);
+    return b;
+}
+
+// The least recently used clean block. When every block is dirty, the
+// least recently used one that can be written back; one whose write fails
+// moves to the front, still dirty, so a bad sector does not fail every
+// later miss. 0 when no write-back succeeds.
+static cblock_t *recycle(void) {
+    cblock_t *b = lru.prev;
+    for (; b != &lru; b = b->prev) {
+        if (!(b->flags & (BLOCK_DIRTY | BLOCK_TAKEN))) return take(b);
+    }
+    for (int i = 0; i < BCACHE_RECYCLE_TRIES; i++) {
+        b = lru.prev;
+        queue_run(0, b);
+        if (write_batch(b->dev, 1) == 0) return take(b);
+        lru_front(b);
+    }
+    return 0;
+}
+
+// Read `block` and up to `ahead` following blocks that are not cached yet
+static cblock_t *fill(int dev, uint32_t block, int ahead) {
+    cblock_t *run[1 + BCACHE_READAHEAD];
+    blk_segment_t segs[1 + BCACHE_READAHEAD];
+    uint32_t limit = dev_blocks(dev);
+    int most = dev_run_limit(dev, 1 + ahead);
+    int n = 1;
+    while (n < most && block + n < limit && !lookup(dev, block + n)) n++;
+
+    for (int i = 0; i < n; i++) {
+        run[i] = recycle();
+        if (!run[i]) {
+            n = i;
+            break;
+        }
+        segs[i].buf = run[i]->data;
+        segs[i].len = BCACHE_BLOCK_SIZE;
+    }
+    if (n == 0 || blkdev_transfer(dev, 0, block * BCACHE_BLOCK_SECTORS, segs, n) < 0) {
+        for (int i = 0; i < n; i++) {
+            run[i]->flags = 0;
+            lru_back(run[i]);
+        }
+        return 0;
+    }
+    // The requested block ends up most recent, the read-ahead behind it
+    for (int i = n - 1; i >= 0; i--) {
+        run[i]->dev = dev;
+        run[i]->block = block + i;
+        run[i]->flags = BLOCK_VALID | (i ? BLOCK_READAHEAD : 0);
+        hash_insert(run[i]);
+        lru_front(run[i]);
+    }
+    stats.readahead += n - 1;
+    return run[0];
+}
+
+int bcache_read(int dev, uint32_t block, void *buf) {
+    if (!ready || block >= dev_blocks(dev)) return -1;
+    mutex_lock(&cache_lock);
+    cblock_t *b = lookup(dev, block);
+    if (b) {
+        stats.hits++;
+        if (b->flags & BLOCK_READAHEAD) {
+            stats.readahead_hits++;
+            b->flags &= ~BLOCK_READAHEAD;
+        }
+        lru_front(b);
+    } else {
+        stats.misses++;
+        int sequential = last_block[dev] != NO_BLOCK && block == last_block[dev] + 1;
+        b = fill(dev, block, sequential ? BCACHE_READAHEAD : 0);
+    }
+    if (b) memcpy(buf, b->data, BCACHE_BLOCK_SIZE);
+    last_block[dev] = block;
+    mutex_unlock(&cache_lock);
+    return b ? 0 : -1;
+}
+
+// Whole-block write; reaches the disk on the next flush or eviction
+int bcache_write(int dev, uint32_t block, const void *buf) {
+    if (!ready || block >= dev_blocks(dev)) return -1;
+    mutex_lock(&cache_lock);
+    cblock_t *b = lookup(dev, block);
+    if (!b) {
+        b = recycle();
+        if (b) {
+            b->dev = dev;
+            b->block = block;
+            b->flags = BLOCK_VALID;
+            hash_insert(b);
+        }
+    }
+    if (b) {
+        memcpy(b->data, buf, BCACHE_BLOCK_SIZE);
+        if (!(b->flags & BLOCK_DIRTY)) stats.dirty++;
+        b->flags = BLOCK_VALID | BLOCK_DIRTY;
+        lru_front(b);
+    }
+    mutex_unlock(&cache_lock);
+    return b ? 0 : -1;
+}
+
+static int flush_locked(int dev) {
+    int err = 0;
+    for (int d = 0; d < blkdev_count(); d++) {
+        if (dev >= 0 && d != dev) continue;
+        if (write_dirty(d) < 0 || blkdev_flush(d) < 0) err = -1;
+    }
+    return err;
+}
+
+// Write all dirty blocks and the drives' own caches
+int bcache_flush(void) {
+    if (!ready) return 0;
+    mutex_lock(&cache_lock);
+    int err = stats.dirty ? flush_locked(-1) : 0;
+    mutex_unlock(&cache_lock);
+    return err;
+}
+
+// Flush a drive, then forget its blocks, so the next reads go to the disk
+int bcache_drop(int dev) {
+    if (!ready) return 0;
+    mutex_lock(&cache_lock);
+    int err = flush_locked(dev);
+    for (int i = 0; i < BCACHE_BLOCKS; i++) {
+        cblock_t *b = &blocks[i];
+        if ((b->flags & BLOCK_VALID) && b->dev == dev && !(b->flags & BLOCK_DIRTY)) {
+            hash_remove(b);
+            b->flags = 0;
+            lru_back(b);
+        }
+    }
+    last_block[dev] = NO_BLOCK;
+    mutex_unlock(&cache_lock);
+    return err;
+}
+
+void bcache_get_stats(bcache_stats_t *out) {
+    *out = stats;
+}
+
+static void flush_thread(void *arg) {
+    while (1) {
+        sleep_ms(BCACHE_FLUSH_MS);
+        if (stats.dirty && bcache_flush() < 0) {
+            klog(KLOG_ERR, KLOG_KERNEL, "bcache: write-back failed, %u blocks dirty", stats.dirty);
+        }
+    }
+}
+
+// Allocate the cache when there is a disk and start the flush thread.
+// Needs the scheduler and the disk drivers.
+void bcache_init(void) {
+    if (blkdev_count() == 0) return;
+    lru.next = lru.prev = &lru;
+    for (int i = 0; i < BCACHE_BLOCKS; i++) {
+        uint32_t frame = pmm_alloc_frame();
+        if (!frame) break;
+        blocks[i].data = phys_to_virt(frame);
+        blocks[i].next = blocks[i].prev = &blocks[i];
+        lru_back(&blocks[i]);
+    }
+    if (lru.next == &lru) return;
+    for (int i = 0; i < BLKDEV_MAX; i++) last_block[i] = NO_BLOCK;
+    ready = 1;
+    thread_create("bcache", flush_thread, 0, SCHED_PRIO_LOW);
+}
@@ -0,0 +1,49 @@
+#ifndef BCACHE_H
+#define BCACHE_H
+
+#include <stdint.h>
+
+// Cache block: one page, eight sectors
+#define BCACHE_BLOCK_SIZE   4096
+#define BCACHE_BLOCK_SECTORS (BCACHE_BLOCK_SIZE / 512)
+
+// Blocks kept in memory (1 MiB) and hash buckets indexing them; both
+// powers of two
+#define BCACHE_BLOCKS  256
+#define BCACHE_BUCKETS 128
+
+// A miss right after the previous block also reads up to this many
+// following blocks, in the same command
+#define BCACHE_READAHEAD 8
+
+// Dirty blocks are written back at least this often, at most this many
+// adjacent ones go out in one request, and a flush submits up to this
+// many requests together
+#define BCACHE_FLUSH_MS     1000
+#define BCACHE_WRITE_BATCH  32
+#define BCACHE_FLUSH_RUNS   16
+
+// Dirty blocks a cache miss tries to write back before giving up, when no
+// clean block is left to evict
+#define BCACHE_RECYCLE_TRIES 4
+
+typedef struct {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t readahead;     // blocks read ahead of a request
+    uint32_t readahead_hits;
+    uint32_t evictions;
+    uint32_t writebacks;    // dirty blocks written to disk
+    uint32_t flush_commands;  // write requests
+    uint32_t dirty;         // dirty blocks right now
+    uint32_t cached;        // valid blocks right now
+} bcache_stats_t;
+
+void bcache_init(void);
+int bcache_read(int dev, uint32_t block, void *buf);
+int bcache_write(int dev, uint32_t block, const void *buf);
+int bcache_flush(void);
+int bcache_drop(int dev);
+void bcache_get_stats(bcache_stats_t *stats);
+
+#endif // BCACHE_H
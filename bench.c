@@ -0,0 +1,540 @@
+#include "bench.h"
+#include "kernel.h"
+#include "console.h"
+#include "serial.h"
+#include "bignum.h"
+#include "timer.h"
+#include "heap.h"
+#include "klib.h"
+#include "task.h"
+#include "initrd.h"
+#include "blkdev.h"
+#include "bcache.h"
+#include "idt.h"
+#include "cpu.h"
+#include "io.h"
+#include "process.h"
+
+static const bench_t *benches[BENCH_MAX];
+static int bench_total = 0;
+
+// Timed samples of the benchmark being run; only the shell runs benchmarks
+static uint32_t samples[BENCH_MAX_ITERATIONS];
+
+// Fencing around rdtsc: lfence where SSE2 has it, cpuid (fully serializing
+// but slower) otherwise, and rdtscp to end a measurement when available
+static int has_lfence = 0;
+static int has_rdtscp = 0;
+static uint32_t overhead = 0;
+
+static inline void serialize(void) {
+    if (has_lfence) {
+        lfence();
+    } else {
+        uint32_t a, b, c, d;
+        cpuid(0, &a, &b, &c, &d);
+    }
+}
+
+// Earlier instructions retire before the TSC is read, and the timed code
+// does not start before it
+static inline uint64_t tsc_begin(void) {
+    serialize();
+    uint64_t t = rdtsc();
+    serialize();
+    return t;
+}
+
+// The timed code finishes before the TSC is read, and nothing after it is
+// pulled in ahead of the read
+static inline uint64_t tsc_end(void) {
+    uint64_t t;
+    if (has_rdtscp) {
+        t = rdtscp();
+    } else {
+        serialize();
+        t = rdtsc();
+    }
+    serialize();
+    return t;
+}
+
+void debugcon_write(const char *str) {
+    while (*str) {
+        outb(DEBUGCON_PORT, *str++);
+    }
+}
+
+int bench_register(const bench_t *bench) {
+    if (bench_total >= BENCH_MAX) return -1;
+    benches[bench_total++] = bench;
+    return 0;
+}
+
+int bench_count(void) {
+    return bench_total;
+}
+
+const bench_t *bench_get(int index) {
+    if (index < 0 || index >= bench_total) return 0;
+    return benches[index];
+}
+
+// Cycles an empty measurement takes, subtracted from every sample
+uint32_t bench_overhead(void) {
+    return overhead;
+}
+
+static void sort_samples(uint32_t *v, uint32_t n) {
+    for (uint32_t i = 1; i < n; i++) {
+        uint32_t x = v[i];
+        uint32_t j = i;
+        while (j > 0 && v[j - 1] > x) {
+            v[j] = v[j - 1];
+            j--;
+        }
+        v[j] = x;
+    }
+}
+
+// Run the warmup and timed iterations. Interrupts are off around each
+// sample unless the benchmark asks otherwise. Returns -1 if setup declined.
+int bench_run(const bench_t *bench, bench_result_t *result) {
+    uint32_t n = bench->iterations;
+    if (n == 0) n = 1;
+    if (n > BENCH_MAX_ITERATIONS) n = BENCH_MAX_ITERATIONS;
+
+    if (bench->setup && bench->setup(bench->arg) != 0) return -1;
+
+    for (uint32_t i = 0; i < BENCH_WARMUP + n; i++) {
+        unsigned long flags = 0;
+        if (!(bench->flags & BENCH_IRQS_ON)) flags = irq_save();
+        uint64_t start = tsc_begin();
+        bench->fn(bench->arg);
+        uint64_t end = tsc_end();
+        if (!(bench->flags & BENCH_IRQS_ON)) irq_restore(flags);
+
+        if (i < BENCH_WARMUP) continue;
+        uint64_t cycles = end - start;
+        cycles = cycles > overhead ? cycles - overhead : 0;
+        samples[i - BENCH_WARMUP] = cycles > 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t)cycles;
+    }
+
+    if (bench->teardown) bench->teardown(bench->arg);
+
+    sort_samples(samples, n);
+    result->iterations = n;
+    result->min = samples[0];
+    result->median = samples[n / 2];
+    result->p99 = samples[(n * 99 + 99) / 100 - 1];
+    result->max = samples[n - 1];
+    return 0;
+}
+
+static char *append_str(char *p, const char *s) {
+    while (*s) *p++ = *s++;
+    return p;
+}
+
+static char *append_u32(char *p, uint32_t v) {
+    char digits[10];
+    int n = 0;
+    do {
+        digits[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    while (n) *p++ = digits[--n];
+    return p;
+}
+
+// Machine-readable result line, for scripts comparing builds:
+// "bench name=<name> iters=<n> min=<c> median=<c> p99=<c> max=<c>\n".
+// `line` needs BENCH_LINE_MAX bytes.
+void bench_format_result(const bench_t *bench, const bench_result_t *r, char *line) {
+    char *p = append_str(line, "bench name=");
+    p = append_str(p, bench->name);
+    p = append_str(p, " iters=");
+    p = append_u32(p, r->iterations);
+    p = append_str(p, " min=");
+    p = append_u32(p, r->min);
+    p = append_str(p, " median=");
+    p = append_u32(p, r->median);
+    p = append_str(p, " p99=");
+    p = append_u32(p, r->p99);
+    p = append_str(p, " max=");
+    p = append_u32(p, r->max);
+    p = append_str(p, "\n");
+    *p = '\0';
+}
+
+static void print_padded(const char *s, int width) {
+    print(s);
+    for (int len = strlen(s); len < width; len++) print(" ");
+}
+
+static void print_column(uint32_t v) {
+    char buf[12];
+    char *end = append_u32(buf, v);
+    *end = '\0';
+    for (int len = end - buf; len < 11; len++) print(" ");
+    print(buf);
+}
+
+// Run every benchmark whose name starts with `pattern` ("all" runs all of
+// them), printing a table and reporting each result on the debug port.
+// Returns how many ran.
+int bench_run_matching(const char *pattern) {
+    int all = strcmp(pattern, "all") == 0;
+    int plen = strlen(pattern);
+    int ran = 0;
+
+    char line[BENCH_LINE_MAX];
+    char *p = append_str(line, "bench-info tsc_khz=");
+    p = append_u32(p, timer_tsc_khz());
+    p = append_str(p, " overhead=");
+    p = append_u32(p, overhead);
+    p = append_str(p, "\n");
+    *p = '\0';
+    debugcon_write(line);
+
+    print_colored("Benchmark                 Iters        Min     Median        P99 (cycles)\n", COLOR_LIGHT_GREEN);
+    for (int i = 0; i < bench_total; i++) {
+        const bench_t *bench = benches[i];
+        if (!all && memcmp(bench->name, pattern, plen) != 0) continue;
+
+        bench_result_t r;
+        if (bench_run(bench, &r) < 0) {
+            print_padded(bench->name, 20);
+            print_colored("  unsupported\n", COLOR_DARK_GRAY);
+            continue;
+        }
+        bench_format_result(bench, &r, line);
+        debugcon_write(line);
+        print_padded(bench->name, 20);
+        print_column(r.iterations);
+        print_column(r.min);
+        print_column(r.median);
+        print_column(r.p99);
+        print("\n");
+        ran++;
+    }
+    return ran;
+}
+
+void bench_list(void) {
+    print_colored("Benchmarks:\n", COLOR_LIGHT_GREEN);
+    for (int i = 0; i < bench_total; i++) {
+        print("  ");
+        print_padded(benches[i]->name, 20);
+        print(benches[i]->help);
+        print("\n");
+    }
+}
+
+// Built-in benchmarks
+
+static int saved_mirror;
+
+// Console output is measured without the serial mirror, which would start
+// waiting on the line once its buffer fills
+static int mirror_off(void *arg) {
+    saved_mirror = serial_mirror();
+    serial_set_mirror(SERIAL_MIRROR_OFF);
+    return 0;
+}
+
+static void mirror_restore(void *arg) {
+    serial_set_mirror(saved_mirror);
+}
+
+static void bench_print(void *arg) {
+    print_colored("The quick brown fox jumps over the lazy dog 0123456789\n", COLOR_LIGHT_GRAY);
+}
+
+static void bench_clear(void *arg) {
+    clear_screen();
+}
+
+static void bench_cursor(void *arg) {
+    update_cursor(console_get_pos());
+}
+
+static const char strcmp_a[] = "benchmark-string-compare-0123456789";
+static const char strcmp_b[] = "benchmark-string-compare-0123456789";
+
+static void bench_strcmp(void *arg) {
+    volatile int r = strcmp(strcmp_a, strcmp_b);
+    (void)r;
+}
+
+static void bench_atoi(void *arg) {
+    volatile int r = atoi("-123456789");
+    (void)r;
+}
+
+static uint32_t factorial_sizes[] = {1000, 20000};
+
+static void bench_factorial(void *arg) {
+    bignum_t r;
+    if (bn_init(&r, 1) == 0) {
+        bn_factorial(&r, *(const uint32_t *)arg);
+        bn_free(&r);
+    }
+}
+
+static void breakpoint_nop(struct regs *r) {
+}
+
+static int int3_setup(void *arg) {
+    register_irq_handler(EXCEPTION_BREAKPOINT, breakpoint_nop);
+    return 0;
+}
+
+static void int3_teardown(void *arg) {
+    register_irq_handler(EXCEPTION_BREAKPOINT, 0);
+}
+
+// int3 goes through the stub, isr_common and isr_dispatch and back, with no
+// EOI and no reschedule
+static void bench_int3(void *arg) {
+    __asm__ volatile ("int3" ::: "memory");
+}
+
+// A user program run to completion, with its arguments
+typedef struct {
+    const char *path;
+    int argc;
+    char *argv[3];
+} program_case_t;
+
+static program_case_t program_cases[] = {
+    {"bin/true", 1, {"true"}},
+    {"bin/nullcall", 3, {"nullcall", "1000", "-q"}},
+};
+
+static int program_setup(void *arg) {
+    const program_case_t *c = arg;
+    return process_supported() && initrd_lookup(c->path) ? 0 : -1;
+}
+
+// Address space, ELF copy, thread, ring 3 entry, exit and the switch back
+// to the waiting shell
+static void bench_program(void *arg) {
+    program_case_t *c = arg;
+    process_run(c->path, c->argc, c->argv);
+}
+
+typedef struct {
+    int impl;
+    uint32_t size;
+} copy_case_t;
+
+static void *copy_src = 0;
+static void *copy_dst = 0;
+static memcpy_fn_t copy_fn = 0;
+
+static int copy_setup(void *arg) {
+    const copy_case_t *c = arg;
+    copy_fn = klib_memcpy_variant(c->impl);
+    if (!copy_fn) return -1;
+    copy_src = kmalloc(c->size);
+    copy_dst = kmalloc(c->size);
+    if (!copy_src || !copy_dst) {
+        kfree(copy_src);
+        kfree(copy_dst);
+        return -1;
+    }
+    memset(copy_src, 0x5A, c->size);
+    return 0;
+}
+
+static void copy_teardown(void *arg) {
+    kfree(copy_src);
+    kfree(copy_dst);
+    copy_src = copy_dst = 0;
+}
+
+static void bench_copy(void *arg) {
+    const copy_case_t *c = arg;
+    copy_fn(copy_dst, copy_src, c->size);
+}
+
+// 1 MiB through memcpy on the calling CPU, or split over all of them
+#define BIG_COPY_SIZE (1024 * 1024)
+
+static int big_copy_setup(void *arg) {
+    copy_src = kmalloc(BIG_COPY_SIZE);
+    copy_dst = kmalloc(BIG_COPY_SIZE);
+    if (!copy_src || !copy_dst) {
+        kfree(copy_src);
+        kfree(copy_dst);
+        return -1;
+    }
+    memset(copy_src, 0x5A, BIG_COPY_SIZE);
+    return 0;
+}
+
+static void bench_big_copy(void *arg) {
+    memcpy(copy_dst, copy_src, BIG_COPY_SIZE);
+}
+
+static void bench_parallel_copy(void *arg) {
+    parallel_memcpy(copy_dst, copy_src, BIG_COPY_SIZE);
+}
+
+static int initrd_setup(void *arg) {
+    return initrd_lookup(arg) ? 0 : -1;
+}
+
+// Hash the path and walk its chain
+static void bench_initrd_lookup(void *arg) {
+    volatile const void *f = initrd_lookup(arg);
+    (void)f;
+}
+
+static void *disk_buf = 0;
+static int disk_dev = -1;
+
+static int disk_setup(void *arg) {
+    disk_dev = blkdev_find("ata0");
+    if (disk_dev < 0) return -1;
+    disk_buf = kmalloc(BCACHE_BLOCK_SIZE);
+    if (!disk_buf) return -1;
+    // Leaves block 0 in the cache for disk-cached
+    return bcache_read(disk_dev, 0, disk_buf);
+}
+
+static void disk_teardown(void *arg) {
+    kfree(disk_buf);
+    disk_buf = 0;
+}
+
+// One 4 KiB DMA read, waiting for the IRQ
+static void bench_disk_read(void *arg) {
+    blkdev_read(disk_dev, 0, BCACHE_BLOCK_SECTORS, disk_buf);
+}
+
+static void bench_disk_cached(void *arg) {
+    bcache_read(disk_dev, 0, disk_buf);
+}
+
+// Reads from vda, past the block cache: sequential 64 KiB requests, single
+// random 4 KiB ones, and 32 random 4 KiB ones submitted together so they
+// share one notification and one interrupt
+#define VBLK_BENCH_SEQ_SECTORS 128
+#define VBLK_BENCH_DEPTH       32
+
+static uint8_t *vblk_buf = 0;
+static int vblk_dev = -1;
+static uint32_t vblk_next = 0;
+static uint32_t vblk_seed = 0;
+static blk_request_t vblk_reqs[VBLK_BENCH_DEPTH];
+static blk_segment_t vblk_segs[VBLK_BENCH_DEPTH];
+
+static int vblk_setup(void *arg) {
+    vblk_dev = blkdev_find("vda");
+    const blkdev_t *d = blkdev_get(vblk_dev);
+    if (!d || d->sectors < 2 * VBLK_BENCH_SEQ_SECTORS) return -1;
+    vblk_buf = kmalloc(VBLK_BENCH_DEPTH * BCACHE_BLOCK_SIZE);
+    if (!vblk_buf) return -1;
+    vblk_next = 0;
+    vblk_seed = 2463534242u;
+    return 0;
+}
+
+static void vblk_teardown(void *arg) {
+    kfree(vblk_buf);
+    vblk_buf = 0;
+}
+
+// A random 4 KiB-aligned sector on vda
+static uint32_t vblk_random_lba(void) {
+    vblk_seed ^= vblk_seed << 13;
+    vblk_seed ^= vblk_seed >> 17;
+    vblk_seed ^= vblk_seed << 5;
+    return vblk_seed % (blkdev_get(vblk_dev)->sectors / BCACHE_BLOCK_SECTORS) * BCACHE_BLOCK_SECTORS;
+}
+
+static void bench_vblk_seq(void *arg) {
+    if (vblk_next + VBLK_BENCH_SEQ_SECTORS > blkdev_get(vblk_dev)->sectors) vblk_next = 0;
+    blkdev_read(vblk_dev, vblk_next, VBLK_BENCH_SEQ_SECTORS, vblk_buf);
+    vblk_next += VBLK_BENCH_SEQ_SECTORS;
+}
+
+static void bench_vblk_random(void *arg) {
+    blkdev_read(vblk_dev, vblk_random_lba(), BCACHE_BLOCK_SECTORS, vblk_buf);
+}
+
+static void bench_vblk_batch(void *arg) {
+    for (int i = 0; i < VBLK_BENCH_DEPTH; i++) {
+        vblk_segs[i].buf = vblk_buf + i * BCACHE_BLOCK_SIZE;
+        vblk_segs[i].len = BCACHE_BLOCK_SIZE;
+        vblk_reqs[i].write = 0;
+        vblk_reqs[i].lba = vblk_random_lba();
+        vblk_reqs[i].segs = &vblk_segs[i];
+        vblk_reqs[i].count = 1;
+    }
+    blkdev_submit(vblk_dev, vblk_reqs, VBLK_BENCH_DEPTH);
+}
+
+static copy_case_t copy_cases[] = {
+    {KLIB_IMPL_MOVSD, 64},
+    {KLIB_IMPL_MOVSD, 4096},
+    {KLIB_IMPL_ERMS,  4096},
+    {KLIB_IMPL_SSE2,  4096},
+    {KLIB_IMPL_MOVSD, 65536},
+    {KLIB_IMPL_ERMS,  65536},
+    {KLIB_IMPL_SSE2,  65536},
+};
+
+static const bench_t builtin[] = {
+    {"print",        bench_print,     0, 256, 0, mirror_off, mirror_restore, "print_colored of one 56-byte line"},
+    {"clear",        bench_clear,     0, 128, 0, mirror_off, mirror_restore, "clear_screen"},
+    {"cursor",       bench_cursor,    0, 256, 0, 0, 0, "update_cursor (four CRTC port writes)"},
+    {"strcmp",       bench_strcmp,    0, 1024, 0, 0, 0, "strcmp of equal 35-byte strings"},
+    {"atoi",         bench_atoi,      0, 1024, 0, 0, 0, "atoi of a 10-character number"},
+    {"factorial",    bench_factorial, &factorial_sizes[0], 64, BENCH_IRQS_ON, 0, 0, "bn_factorial(1000)"},
+    {"factorial-20k", bench_factorial, &factorial_sizes[1], 8, BENCH_IRQS_ON, 0, 0, "bn_factorial(20000), spread over all CPUs"},
+    {"initrd-lookup", bench_initrd_lookup, "etc/motd", 1024, 0, initrd_setup, 0, "initrd_lookup of a two-level path"},
+    {"disk-read-4k",  bench_disk_read,   0, 64, BENCH_IRQS_ON, disk_setup, disk_teardown, "4 KiB from ata0 by DMA, IRQ completion"},
+    {"disk-cached",   bench_disk_cached, 0, 1024, BENCH_IRQS_ON, disk_setup, disk_teardown, "4 KiB block cache hit"},
+    {"vblk-seq-64k",  bench_vblk_seq,    0, 64, BENCH_IRQS_ON, vblk_setup, vblk_teardown, "64 KiB sequential read from vda"},
+    {"vblk-rand-4k",  bench_vblk_random, 0, 64, BENCH_IRQS_ON, vblk_setup, vblk_teardown, "4 KiB random read from vda"},
+    {"vblk-rand-4k-x32", bench_vblk_batch, 0, 16, BENCH_IRQS_ON, vblk_setup, vblk_teardown, "32 random 4 KiB reads from vda in one batch"},
+    {"int3",         bench_int3,      0, 1024, 0, int3_setup, int3_teardown, "IDT dispatch round trip through int3"},
+    {"proc-spawn",   bench_program,   &program_cases[0], 64, BENCH_IRQS_ON, program_setup, 0, "run bin/true as a user process"},
+    {"syscall-null-x1000", bench_program, &program_cases[1], 16, BENCH_IRQS_ON, program_setup, 0, "bin/nullcall: proc-spawn plus 1000 sysenter null calls"},
+    {"memcpy-64",         bench_copy, &copy_cases[0], 1024, 0, copy_setup, copy_teardown, "64 bytes, rep movsd"},
+    {"memcpy-4k-movsd",   bench_copy, &copy_cases[1], 512, 0, copy_setup, copy_teardown, "4 KiB, rep movsd"},
+    {"memcpy-4k-erms",    bench_copy, &copy_cases[2], 512, 0, copy_setup, copy_teardown, "4 KiB, rep movsb"},
+    {"memcpy-4k-sse2",    bench_copy, &copy_cases[3], 512, 0, copy_setup, copy_teardown, "4 KiB, SSE2"},
+    {"memcpy-64k-movsd",  bench_copy, &copy_cases[4], 128, 0, copy_setup, copy_teardown, "64 KiB, rep movsd"},
+    {"memcpy-64k-erms",   bench_copy, &copy_cases[5], 128, 0, copy_setup, copy_teardown, "64 KiB, rep movsb"},
+    {"memcpy-64k-sse2",   bench_copy, &copy_cases[6], 128, 0, copy_setup, copy_teardown, "64 KiB, SSE2"},
+    {"memcpy-1m",          bench_big_copy,      0, 32, 0, big_copy_setup, copy_teardown, "1 MiB, memcpy"},
+    {"memcpy-1m-parallel", bench_parallel_copy, 0, 32, 0, big_copy_setup, copy_teardown, "1 MiB, parallel_memcpy on all CPUs"},
+};
+
+// Pick the timing fences for this CPU, measure the cost of an empty
+// measurement and register the built-in benchmarks
+void bench_init(void) {
+    uint32_t max_ext, b, c, d;
+    has_lfence = (cpuid_edx(1) & CPUID_EDX_SSE2) != 0;
+    cpuid(0x80000000, &max_ext, &b, &c, &d);
+    if (max_ext >= 0x80000001) {
+        has_rdtscp = (cpuid_edx(0x80000001) & CPUID_EXT_EDX_RDTSCP) != 0;
+    }
+
+    overhead = 0xFFFFFFFF;
+    for (int i = 0; i < 64; i++) {
+        unsigned long flags = irq_save();
+        uint64_t start = tsc_begin();
+        uint64_t end = tsc_end();
+        irq_restore(flags);
+        if (end - start < overhead) overhead = end - start;
+    }
+
+    for (unsigned int i = 0; i < sizeof(builtin) / sizeof(builtin[0]); i++) {
+        bench_register(&builtin[i]);
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+
+#define BENCH_MAX            48
+#define BENCH_MAX_ITERATIONS 1024
+#define BENCH_WARMUP         8
+
+// Longest result line from bench_format_result()
+#define BENCH_LINE_MAX 160
+
+// QEMU/Bochs debug console; `-debugcon file:bench.log` captures it
+#define DEBUGCON_PORT 0xE9
+
+// Leave interrupts enabled while timing, for runs long enough to miss ticks
+#define BENCH_IRQS_ON 0x01
+
+typedef void (*bench_fn_t)(void *arg);
+
+typedef struct {
+    const char *name;
+    bench_fn_t fn;                // one timed iteration
+    void *arg;
+    uint32_t iterations;          // timed runs after BENCH_WARMUP untimed ones
+    uint32_t flags;
+    int (*setup)(void *arg);      // optional; nonzero skips the benchmark
+    void (*teardown)(void *arg);  // optional
+    const char *help;
+} bench_t;
+
+// Cycle statistics over the timed iterations, timer overhead removed
+typedef struct {
+    uint32_t iterations;
+    uint32_t min;
+    uint32_t median;
+    uint32_t p99;
+    uint32_t max;
+} bench_result_t;
+
+void bench_init(void);
+int bench_register(const bench_t *bench);
+int bench_count(void);
+const bench_t *bench_get(int index);
+uint32_t bench_overhead(void);
+int bench_run(const bench_t *bench, bench_result_t *result);
+void bench_format_result(const bench_t *bench, const bench_result_t *result, char *line);
+int bench_run_matching(const char *pattern);
+void bench_list(void);
+void debugcon_write(const char *str);
+
+#endif // BENCH_H
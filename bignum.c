@@ -0,0 +1,519 @@
+#include "bignum.h"
+#include "heap.h"
+#include "klib.h"
+#include "task.h"
+
+// Decimal conversion works in chunks of nine digits
+#define DECIMAL_CHUNK        1000000000u
+#define DECIMAL_CHUNK_DIGITS 9
+
+// Most powers 10^(9*2^k) kept during conversion; enough for any number
+// that fits in memory
+#define DECIMAL_LEVELS 24
+
+// Factors multiplied one at a time at the leaves of the product tree
+#define FACTORIAL_LEAF 16
+
+// (hi:lo) / d for hi < d. One divl, so no libgcc 64-bit division.
+static inline uint32_t div_2by1(uint32_t hi, uint32_t lo, uint32_t d, uint32_t *rem) {
+    uint32_t q, r;
+    __asm__ ("divl %4" : "=a"(q), "=d"(r) : "a"(lo), "d"(hi), "rm"(d));
+    *rem = r;
+    return q;
+}
+
+static uint32_t *limbs_alloc(uint32_t n) {
+    return kmalloc((n ? n : 1) * sizeof(uint32_t));
+}
+
+static void limbs_zero(uint32_t *r, uint32_t n) {
+    memset(r, 0, n * sizeof(uint32_t));
+}
+
+static void limbs_copy(uint32_t *r, const uint32_t *a, uint32_t n) {
+    memcpy(r, a, n * sizeof(uint32_t));
+}
+
+// Length without leading zero limbs
+static uint32_t limbs_trim(const uint32_t *a, uint32_t n) {
+    while (n && a[n - 1] == 0) n--;
+    return n;
+}
+
+// Compare trimmed numbers
+static int limbs_cmp(const uint32_t *a, uint32_t an, const uint32_t *b, uint32_t bn) {
+    if (an != bn) return an < bn ? -1 : 1;
+    while (an--) {
+        if (a[an] != b[an]) return a[an] < b[an] ? -1 : 1;
+    }
+    return 0;
+}
+
+// r = a + b for n limbs each; returns the carry
+static uint32_t add_n(uint32_t *r, const uint32_t *a, const uint32_t *b, uint32_t n) {
+    uint64_t carry = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        carry += (uint64_t)a[i] + b[i];
+        r[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+    return (uint32_t)carry;
+}
+
+// r = a + b with an >= bn; returns the carry out of limb an - 1
+static uint32_t add(uint32_t *r, const uint32_t *a, uint32_t an, const uint32_t *b, uint32_t bn) {
+    uint32_t carry = add_n(r, a, b, bn);
+    for (uint32_t i = bn; i < an; i++) {
+        uint32_t sum = a[i] + carry;
+        carry = sum < carry;
+        r[i] = sum;
+    }
+    return carry;
+}
+
+// r = a - b with an >= bn; returns the borrow
+static uint32_t sub(uint32_t *r, const uint32_t *a, uint32_t an, const uint32_t *b, uint32_t bn) {
+    uint32_t borrow = 0;
+    for (uint32_t i = 0; i < bn; i++) {
+        uint64_t diff = (uint64_t)a[i] - b[i] - borrow;
+        r[i] = (uint32_t)diff;
+        borrow = (uint32_t)(diff >> 32) & 1;
+    }
+    for (uint32_t i = bn; i < an; i++) {
+        uint32_t v = a[i];
+        r[i] = v - borrow;
+        borrow = v < borrow;
+    }
+    return borrow;
+}
+
+// r += a * m over n limbs; returns the carry limb
+static uint32_t addmul_1(uint32_t *r, const uint32_t *a, uint32_t n, uint32_t m) {
+    uint64_t carry = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        carry += (uint64_t)a[i] * m + r[i];
+        r[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+    return (uint32_t)carry;
+}
+
+// r -= a * m over n limbs; returns the borrow limb
+static uint32_t submul_1(uint32_t *r, const uint32_t *a, uint32_t n, uint32_t m) {
+    uint32_t borrow = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        uint64_t p = (uint64_t)a[i] * m + borrow;
+        uint32_t lo = (uint32_t)p;
+        uint32_t v = r[i];
+        borrow = (uint32_t)(p >> 32) + (v < lo);
+        r[i] = v - lo;
+    }
+    return borrow;
+}
+
+// a /= d in place; returns the remainder
+static uint32_t div_1(uint32_t *a, uint32_t n, uint32_t d) {
+    uint32_t rem = 0;
+    while (n--) {
+        a[n] = div_2by1(rem, a[n], d, &rem);
+    }
+    return rem;
+}
+
+// r[0..an+bn) = a * b, one row of b at a time
+static void mul_basecase(uint32_t *r, const uint32_t *a, uint32_t an,
+                         const uint32_t *b, uint32_t bn) {
+    limbs_zero(r, an);
+    for (uint32_t j = 0; j < bn; j++) {
+        r[an + j] = addmul_1(r + j, a, an, b[j]);
+    }
+}
+
+static int mul_limbs(uint32_t *r, const uint32_t *a, uint32_t an,
+                     const uint32_t *b, uint32_t bn);
+
+typedef struct {
+    uint32_t *r;
+    const uint32_t *a;
+    uint32_t an;
+    const uint32_t *b;
+    uint32_t bn;
+    int err;
+} mul_job_t;
+
+static void mul_task(void *arg) {
+    mul_job_t *job = arg;
+    job->err = mul_limbs(job->r, job->a, job->an, job->b, job->bn);
+}
+
+// Karatsuba step for an >= bn > h, where h = ceil(an / 2):
+// a*b = z2*B^2h + ((a0+a1)(b0+b1) - z0 - z2)*B^h + z0
+static int mul_karatsuba(uint32_t *r, const uint32_t *a, uint32_t an,
+                         const uint32_t *b, uint32_t bn) {
+    uint32_t h = (an + 1) / 2;
+    uint32_t a1n = an - h, b1n = bn - h;
+    uint32_t *tmp = limbs_alloc(4 * h + 4);
+    if (!tmp) return -1;
+    uint32_t *sa = tmp;
+    uint32_t *sb = tmp + h + 1;
+    uint32_t *t = tmp + 2 * h + 2;
+    int err = -1;
+
+    // z0 fills r[0..2h) and z2 fills r[2h..an+bn). The three products are
+    // independent; for large operands z0 goes to the task pool.
+    mul_job_t z0 = {r, a, h, b, h, 0};
+    task_t task;
+    if (h >= BN_KARATSUBA_SPAWN_MIN) {
+        task_spawn(&task, mul_task, &z0);
+    } else {
+        mul_task(&z0);
+    }
+    int z2 = mul_limbs(r + 2 * h, a + h, a1n, b + h, b1n);
+
+    sa[h] = add(sa, a, h, a + h, a1n);
+    sb[h] = add(sb, b, h, b + h, b1n);
+    int mid = mul_limbs(t, sa, h + 1, sb, h + 1);
+    if (h >= BN_KARATSUBA_SPAWN_MIN) task_join(&task);
+    if (z0.err < 0 || z2 < 0 || mid < 0) goto out;
+    sub(t, t, 2 * h + 2, r, 2 * h);
+    sub(t, t, 2 * h + 2, r + 2 * h, a1n + b1n);
+
+    // The middle term is a0*b1 + a1*b0 < 2*B^an, so it fits above B^h
+    add(r + h, r + h, an + bn - h, t, limbs_trim(t, 2 * h + 2));
+    err = 0;
+out:
+    kfree(tmp);
+    return err;
+}
+
+// r[0..an+bn) = a * b. r must not overlap the operands.
+static int mul_limbs(uint32_t *r, const uint32_t *a, uint32_t an,
+                     const uint32_t *b, uint32_t bn) {
+    if (an < bn) {
+        const uint32_t *p = a; a = b; b = p;
+        uint32_t n = an; an = bn; bn = n;
+    }
+    if (bn < BN_KARATSUBA_THRESHOLD) {
+        mul_basecase(r, a, an, b, bn);
+        return 0;
+    }
+    if (bn > (an + 1) / 2) {
+        return mul_karatsuba(r, a, an, b, bn);
+    }
+
+    // Unbalanced: multiply b by bn-limb slices of a and add them up
+    uint32_t *tmp = limbs_alloc(2 * bn);
+    if (!tmp) return -1;
+    limbs_zero(r, an + bn);
+    for (uint32_t off = 0; off < an; off += bn) {
+        uint32_t n = an - off < bn ? an - off : bn;
+        if (mul_limbs(tmp, b, bn, a + off, n) < 0) {
+            kfree(tmp);
+            return -1;
+        }
+        add(r + off, r + off, an + bn - off, tmp, n + bn);
+    }
+    kfree(tmp);
+    return 0;
+}
+
+// Knuth's algorithm D: q[0..un-vn] = u / v and r[0..vn) = u % v, for
+// un >= vn and v trimmed
+static int divmod(uint32_t *q, uint32_t *r, const uint32_t *u, uint32_t un,
+                  const uint32_t *v, uint32_t vn) {
+    if (vn == 1) {
+        limbs_copy(q, u, un);
+        r[0] = div_1(q, un, v[0]);
+        return 0;
+    }
+
+    uint32_t *vnorm = limbs_alloc(vn);
+    uint32_t *unorm = limbs_alloc(un + 1);
+    if (!vnorm || !unorm) {
+        kfree(vnorm);
+        kfree(unorm);
+        return -1;
+    }
+
+    // Shift so the top bit of the divisor is set, which keeps each
+    // estimated quotient digit at most two too large
+    int s = __builtin_clz(v[vn - 1]);
+    for (uint32_t i = vn - 1; i > 0; i--) {
+        vnorm[i] = s ? (v[i] << s) | (v[i - 1] >> (32 - s)) : v[i];
+    }
+    vnorm[0] = v[0] << s;
+    unorm[un] = s ? u[un - 1] >> (32 - s) : 0;
+    for (uint32_t i = un - 1; i > 0; i--) {
+        unorm[i] = s ? (u[i] << s) | (u[i - 1] >> (32 - s)) : u[i];
+    }
+    unorm[0] = u[0] << s;
+
+    uint32_t vtop = vnorm[vn - 1];
+    uint32_t vnext = vnorm[vn - 2];
+    for (uint32_t j = un - vn + 1; j-- > 0;) {
+        uint32_t top = unorm[j + vn];
+        uint32_t qhat, rhat;
+        int rhat_big = 0;
+
+        if (top >= vtop) {
+            qhat = 0xFFFFFFFF;
+            uint64_t rh = (uint64_t)unorm[j + vn - 1] + vtop;
+            rhat = (uint32_t)rh;
+            rhat_big = (rh >> 32) != 0;
+        } else {
+            qhat = div_2by1(top, unorm[j + vn - 1], vtop, &rhat);
+        }
+        while (!rhat_big &&
+               (uint64_t)qhat * vnext > (((uint64_t)rhat << 32) | unorm[j + vn - 2])) {
+            qhat--;
+            uint64_t rh = (uint64_t)rhat + vtop;
+            rhat = (uint32_t)rh;
+            rhat_big = (rh >> 32) != 0;
+        }
+
+        uint32_t borrow = submul_1(unorm + j, vnorm, vn, qhat);
+        unorm[j + vn] = top - borrow;
+        if (top < borrow) {
+            // Rare: the estimate was still one too large
+            qhat--;
+            unorm[j + vn] += add_n(unorm + j, unorm + j, vnorm, vn);
+        }
+        q[j] = qhat;
+    }
+
+    for (uint32_t i = 0; i < vn - 1; i++) {
+        r[i] = s ? (unorm[i] >> s) | (unorm[i + 1] << (32 - s)) : unorm[i];
+    }
+    r[vn - 1] = unorm[vn - 1] >> s;
+
+    kfree(vnorm);
+    kfree(unorm);
+    return 0;
+}
+
+int bn_init(bignum_t *n, uint32_t cap) {
+    if (cap == 0) cap = 1;
+    n->limb = limbs_alloc(cap);
+    n->len = 0;
+    n->cap = n->limb ? cap : 0;
+    return n->limb ? 0 : -1;
+}
+
+void bn_free(bignum_t *n) {
+    kfree(n->limb);
+    n->limb = 0;
+    n->len = n->cap = 0;
+}
+
+static int bn_reserve(bignum_t *n, uint32_t cap) {
+    if (cap <= n->cap) return 0;
+    uint32_t *limb = limbs_alloc(cap);
+    if (!limb) return -1;
+    limbs_copy(limb, n->limb, n->len);
+    kfree(n->limb);
+    n->limb = limb;
+    n->cap = cap;
+    return 0;
+}
+
+int bn_set_u32(bignum_t *n, uint32_t value) {
+    if (bn_reserve(n, 1) < 0) return -1;
+    n->limb[0] = value;
+    n->len = value ? 1 : 0;
+    return 0;
+}
+
+// r = a * b; r must be a different bignum from a and b
+int bn_mul(bignum_t *r, const bignum_t *a, const bignum_t *b) {
+    if (a->len == 0 || b->len == 0) {
+        r->len = 0;
+        return 0;
+    }
+    if (bn_reserve(r, a->len + b->len) < 0) return -1;
+    if (mul_limbs(r->limb, a->limb, a->len, b->limb, b->len) < 0) return -1;
+    r->len = limbs_trim(r->limb, a->len + b->len);
+    return 0;
+}
+
+int bn_mul_u32(bignum_t *n, uint32_t m) {
+    if (m == 0) {
+        n->len = 0;
+        return 0;
+    }
+    uint64_t carry = 0;
+    for (uint32_t i = 0; i < n->len; i++) {
+        carry += (uint64_t)n->limb[i] * m;
+        n->limb[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+    if (carry) {
+        uint32_t cap = n->cap * 2 > n->len + 1 ? n->cap * 2 : n->len + 1;
+        if (bn_reserve(n, cap) < 0) return -1;
+        n->limb[n->len++] = (uint32_t)carry;
+    }
+    return 0;
+}
+
+static int product(bignum_t *r, uint32_t lo, uint32_t hi);
+
+typedef struct {
+    bignum_t *r;
+    uint32_t lo, hi;
+    int err;
+} product_job_t;
+
+static void product_task(void *arg) {
+    product_job_t *job = arg;
+    job->err = product(job->r, job->lo, job->hi);
+}
+
+// Product of lo..hi as a balanced tree, so the big multiplications see
+// operands of similar size and Karatsuba pays off. Large ranges build the
+// left subtree as a task, so the tree spreads over all CPUs.
+static int product(bignum_t *r, uint32_t lo, uint32_t hi) {
+    if (hi - lo < FACTORIAL_LEAF) {
+        uint32_t acc = 1;
+        if (bn_set_u32(r, 1) < 0) return -1;
+        for (uint32_t i = lo; i <= hi; i++) {
+            if ((uint64_t)acc * i > 0xFFFFFFFFu) {
+                if (bn_mul_u32(r, acc) < 0) return -1;
+                acc = 1;
+            }
+            acc *= i;
+        }
+        return bn_mul_u32(r, acc);
+    }
+
+    uint32_t mid = lo + (hi - lo) / 2;
+    bignum_t left, right;
+    int err = -1;
+    if (bn_init(&left, 1) < 0) return -1;
+    if (bn_init(&right, 1) < 0) goto free_left;
+
+    product_job_t job = {&left, lo, mid, 0};
+    task_t task;
+    int spawn = hi - lo >= BN_PRODUCT_SPAWN_MIN;
+    if (spawn) {
+        task_spawn(&task, product_task, &job);
+    } else {
+        product_task(&job);
+    }
+    int right_err = product(&right, mid + 1, hi);
+    if (spawn) task_join(&task);
+    if (job.err < 0 || right_err < 0) goto free_right;
+    err = bn_mul(r, &left, &right);
+free_right:
+    bn_free(&right);
+free_left:
+    bn_free(&left);
+    return err;
+}
+
+int bn_factorial(bignum_t *r, uint32_t n) {
+    if (n < 2) return bn_set_u32(r, 1);
+    return product(r, 2, n);
+}
+
+// Small numbers: peel off nine digits at a time. Writes exactly `width`
+// digits when width is nonzero, otherwise the minimal representation.
+static int32_t decimal_basecase(char *out, const uint32_t *n, uint32_t len, uint32_t width) {
+    uint32_t tmp[BN_DECIMAL_THRESHOLD];
+    char buf[BN_DECIMAL_THRESHOLD * 10 + DECIMAL_CHUNK_DIGITS];
+    uint32_t pos = sizeof(buf);
+
+    limbs_copy(tmp, n, len);
+    while (len) {
+        uint32_t chunk = div_1(tmp, len, DECIMAL_CHUNK);
+        len = limbs_trim(tmp, len);
+        for (int i = 0; i < DECIMAL_CHUNK_DIGITS; i++) {
+            buf[--pos] = '0' + chunk % 10;
+            chunk /= 10;
+        }
+    }
+    while (pos < sizeof(buf) && buf[pos] == '0') pos++;
+
+    uint32_t count = sizeof(buf) - pos;
+    uint32_t written = 0;
+    if (width == 0 && count == 0) {
+        out[written++] = '0';
+    }
+    while (written + count < width) {
+        out[written++] = '0';
+    }
+    for (uint32_t i = pos; i < sizeof(buf); i++) {
+        out[written++] = buf[i];
+    }
+    return written;
+}
+
+// Divide and conquer: split n by pw[k] = 10^(9*2^k) into a high and a low
+// half of digits and convert each recursively. Requires n < pw[k]^2.
+static int32_t to_decimal(char *out, const uint32_t *n, uint32_t len, int k,
+                          uint32_t width, uint32_t **pw, const uint32_t *pwn) {
+    len = limbs_trim(n, len);
+    if (k < 0 || len <= BN_DECIMAL_THRESHOLD) {
+        return decimal_basecase(out, n, len, width);
+    }
+    if (limbs_cmp(n, len, pw[k], pwn[k]) < 0) {
+        return to_decimal(out, n, len, k - 1, width, pw, pwn);
+    }
+
+    uint32_t dn = pwn[k];
+    uint32_t low_digits = (uint32_t)DECIMAL_CHUNK_DIGITS << k;
+    uint32_t *q = limbs_alloc(len - dn + 1);
+    uint32_t *r = limbs_alloc(dn);
+    int32_t high = -1, low = -1;
+
+    if (q && r && divmod(q, r, n, len, pw[k], dn) == 0) {
+        high = to_decimal(out, q, len - dn + 1, k - 1,
+                          width ? width - low_digits : 0, pw, pwn);
+        if (high >= 0) {
+            low = to_decimal(out + high, r, dn, k - 1, low_digits, pw, pwn);
+        }
+    }
+    kfree(q);
+    kfree(r);
+    return low < 0 ? -1 : high + low;
+}
+
+// Decimal string of n, allocated with kmalloc. Returns 0 when out of
+// memory; the digit count goes to *digits.
+char *bn_to_decimal(const bignum_t *n, uint32_t *digits) {
+    uint32_t *pw[DECIMAL_LEVELS];
+    uint32_t pwn[DECIMAL_LEVELS];
+    char *out = 0;
+    int k = 0;
+
+    // 10^9, 10^18, 10^36, ... until the square of the last one exceeds n
+    pw[0] = limbs_alloc(1);
+    if (!pw[0]) return 0;
+    pw[0][0] = DECIMAL_CHUNK;
+    pwn[0] = 1;
+    while (2 * pwn[k] < n->len + 2 && k + 1 < DECIMAL_LEVELS) {
+        pw[k + 1] = limbs_alloc(2 * pwn[k]);
+        if (!pw[k + 1] || mul_limbs(pw[k + 1], pw[k], pwn[k], pw[k], pwn[k]) < 0) {
+            kfree(pw[k + 1]);
+            goto out;
+        }
+        pwn[k + 1] = limbs_trim(pw[k + 1], 2 * pwn[k]);
+        k++;
+    }
+
+    // 32 * log10(2) < 10 digits per limb
+    out = kmalloc(n->len * 10 + 2);
+    if (out) {
+        int32_t count = to_decimal(out, n->limb, n->len, k, 0, pw, pwn);
+        if (count < 0) {
+            kfree(out);
+            out = 0;
+        } else {
+            out[count] = '\0';
+            *digits = count;
+        }
+    }
+out:
+    for (int i = 0; i <= k; i++) {
+        kfree(pw[i]);
+    }
+    return out;
+}
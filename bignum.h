@@ -0,0 +1,39 @@
+#ifndef BIGNUM_H
+#define BIGNUM_H
+
+#include <stdint.h>
+
+// Operand size in limbs from which multiplication switches from schoolbook
+// to Karatsuba
+#define BN_KARATSUBA_THRESHOLD 32
+
+// Limb count below which decimal conversion divides by 10^9 directly
+// instead of splitting the number
+#define BN_DECIMAL_THRESHOLD 32
+
+// Largest factorial the shell computes
+#define BN_FACTORIAL_MAX 100000
+
+// Product tree ranges of at least this many factors, and Karatsuba steps
+// with halves of at least this many limbs, hand one branch to the task
+// pool (task.c) so idle CPUs can take it
+#define BN_PRODUCT_SPAWN_MIN   256
+#define BN_KARATSUBA_SPAWN_MIN 256
+
+// Unsigned integer in base 2^32, least significant limb first
+typedef struct {
+    uint32_t *limb;
+    uint32_t len;   // limbs in use, 0 for zero
+    uint32_t cap;
+} bignum_t;
+
+// Functions returning int give 0 on success and -1 when out of memory
+int bn_init(bignum_t *n, uint32_t cap);
+void bn_free(bignum_t *n);
+int bn_set_u32(bignum_t *n, uint32_t value);
+int bn_mul(bignum_t *r, const bignum_t *a, const bignum_t *b);
+int bn_mul_u32(bignum_t *n, uint32_t m);
+int bn_factorial(bignum_t *r, uint32_t n);
+char *bn_to_decimal(const bignum_t *n, uint32_t *digits);
+
+#endif // BIGNUM_H
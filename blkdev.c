@@ -0,0 +1,111 @@
+#include "blkdev.h"
+#include "klib.h"
+#include "klog.h"
+
+// Registry of disks, indexed in registration order. The index is what the
+// block cache and the shell call a device.
+
+static blkdev_t *devices[BLKDEV_MAX];
+static int device_count = 0;
+
+// Returns the new device's index, or -1 when the table is full
+int blkdev_register(blkdev_t *dev) {
+    if (device_count >= BLKDEV_MAX) return -1;
+    devices[device_count] = dev;
+    klog(KLOG_INFO, KLOG_KERNEL, "%s: %s, %u MiB, %s", (uint32_t)dev->name,
+         (uint32_t)dev->model, dev->sectors / 2048, (uint32_t)dev->mode);
+    return device_count++;
+}
+
+int blkdev_count(void) {
+    return device_count;
+}
+
+// 0 when there is no device at that index
+blkdev_t *blkdev_get(int index) {
+    if (index < 0 || index >= device_count) return 0;
+    return devices[index];
+}
+
+int blkdev_find(const char *name) {
+    for (int i = 0; i < device_count; i++) {
+        if (strcmp(devices[i]->name, name) == 0) return i;
+    }
+    return -1;
+}
+
+static int request_valid(const blkdev_t *dev, const blk_request_t *req) {
+    if (req->count <= 0 || req->count > dev->max_segments) return 0;
+    uint32_t sectors = 0;
+    for (int i = 0; i < req->count; i++) {
+        uint32_t len = req->segs[i].len;
+        if (len == 0 || len % BLKDEV_SECTOR_SIZE) return 0;
+        sectors += len / BLKDEV_SECTOR_SIZE;
+    }
+    return sectors <= dev->max_sectors && req->lba < dev->sectors &&
+           sectors <= dev->sectors - req->lba;
+}
+
+// Run a batch of requests on one device. Returns 0 when all of them
+// succeeded; each request's status says which did not.
+int blkdev_submit(int index, blk_request_t *reqs, int count) {
+    blkdev_t *dev = blkdev_get(index);
+    if (!dev || count <= 0) return -1;
+    for (int i = 0; i < count; i++) {
+        if (!request_valid(dev, &reqs[i])) return -1;
+        reqs[i].status = -1;
+    }
+    int err = dev->submit(dev, reqs, count);
+    dev->batches++;
+    for (int i = 0; i < count; i++) {
+        if (reqs[i].write) {
+            dev->writes++;
+        } else {
+            dev->reads++;
+        }
+        if (reqs[i].status < 0) {
+            dev->errors++;
+            err = -1;
+            klog(KLOG_ERR, KLOG_KERNEL, "%s: %s at sector %u failed", (uint32_t)dev->name,
+                 (uint32_t)(reqs[i].write ? "write" : "read"), reqs[i].lba);
+        }
+    }
+    return err;
+}
+
+// A single request
+int blkdev_transfer(int dev, int write, uint32_t lba, const blk_segment_t *segs, int count) {
+    blk_request_t req = {write, lba, segs, count, -1};
+    return blkdev_submit(dev, &req, 1);
+}
+
+static int transfer_linear(int index, int write, uint32_t lba, uint32_t sectors, void *buf) {
+    blkdev_t *dev = blkdev_get(index);
+    if (!dev) return -1;
+    uint8_t *p = buf;
+    while (sectors) {
+        uint32_t n = sectors < dev->max_sectors ? sectors : dev->max_sectors;
+        blk_segment_t seg = {p, n * BLKDEV_SECTOR_SIZE};
+        if (blkdev_transfer(index, write, lba, &seg, 1) < 0) return -1;
+        lba += n;
+        sectors -= n;
+        p += n * BLKDEV_SECTOR_SIZE;
+    }
+    return 0;
+}
+
+// Plain buffer versions, split into as many requests as needed
+int blkdev_read(int dev, uint32_t lba, uint32_t sectors, void *buf) {
+    return transfer_linear(dev, 0, lba, sectors, buf);
+}
+
+int blkdev_write(int dev, uint32_t lba, uint32_t sectors, const void *buf) {
+    return transfer_linear(dev, 1, lba, sectors, (void *)buf);
+}
+
+// Write the device's own cache to the medium
+int blkdev_flush(int index) {
+    blkdev_t *dev = blkdev_get(index);
+    if (!dev) return -1;
+    return dev->flush ? dev->flush(dev) : 0;
+}
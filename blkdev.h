@@ -0,0 +1,55 @@
+#ifndef BLKDEV_H
+#define BLKDEV_H
+
+#include <stdint.h>
+
+#define BLKDEV_SECTOR_SIZE 512
+#define BLKDEV_MAX         8
+#define BLKDEV_NAME_LEN    8
+
+// One piece of a transfer: a multiple of the sector size, in the kernel's
+// direct map so it is physically contiguous
+typedef struct {
+    void *buf;
+    uint32_t len;
+} blk_segment_t;
+
+// One command: the sectors from `lba` into or out of the segments
+typedef struct {
+    int write;
+    uint32_t lba;
+    const blk_segment_t *segs;
+    int count;
+    int status;       // set by the driver: 0 or -1
+} blk_request_t;
+
+// A disk as the block cache sees it. Drivers fill in the geometry and the
+// two operations and register it; submit runs every request and returns
+// once all of them are done, so a driver that can queue several commands
+// sends them together.
+typedef struct blkdev {
+    char name[BLKDEV_NAME_LEN];
+    const char *model;
+    const char *mode;         // how data moves, for `disk`
+    uint32_t sectors;
+    uint32_t max_sectors;     // per request
+    int max_segments;         // per request
+    int (*submit)(struct blkdev *dev, blk_request_t *reqs, int count);
+    int (*flush)(struct blkdev *dev);
+    void *priv;
+    uint32_t reads, writes;   // requests completed
+    uint32_t errors;
+    uint32_t batches;         // submit calls
+} blkdev_t;
+
+int blkdev_register(blkdev_t *dev);
+int blkdev_count(void);
+blkdev_t *blkdev_get(int index);
+int blkdev_find(const char *name);
+int blkdev_submit(int dev, blk_request_t *reqs, int count);
+int blkdev_transfer(int dev, int write, uint32_t lba, const blk_segment_t *segs, int count);
+int blkdev_read(int dev, uint32_t lba, uint32_t sectors, void *buf);
+int blkdev_write(int dev, uint32_t lba, uint32_t sectors, const void *buf);
+int blkdev_flush(int dev);
+
+#endif // BLKDEV_H
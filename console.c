@@ -0,0 +1,230 @@
+#include "console.h"
+#include "io.h"
+#include "klib.h"
+#include "serial.h"
+
+// Output is kept in a ring of CONSOLE_HISTORY lines in normal RAM. The live
+// screen is the CONSOLE_ROWS lines starting at screen_top; scrolling just
+// advances screen_top, and paging back through history moves the view
+// window. Each screen row remembers the column span changed since the last
+// flush, and console_flush() copies only those spans to VGA memory.
+// Everything except cells drawn with console_put_at() is also mirrored to
+// the serial line.
+static uint16_t history[CONSOLE_HISTORY][CONSOLE_COLS] __attribute__((aligned(4)));
+static uint8_t dirty_lo[CONSOLE_ROWS]; // first dirty column, CONSOLE_COLS if clean
+static uint8_t dirty_hi[CONSOLE_ROWS]; // one past the last dirty column
+static volatile int dirty = 0;
+
+static volatile uint16_t *vga = (volatile uint16_t *)VGA_TEXT_BASE;
+
+static unsigned int screen_top = 0;  // absolute line number of live row 0
+static unsigned int view = 0;        // lines scrolled back from the live screen
+static unsigned int cur_row = 0;     // cursor row on the live screen
+static unsigned int cur_col = 0;     // cursor column
+static unsigned int hw_cursor = ~0u; // position last written to the CRTC
+
+static inline uint16_t make_cell(char c, unsigned char color) {
+    return (uint16_t)(unsigned char)c | ((uint16_t)color << 8);
+}
+
+static inline uint16_t *line_at(unsigned int line) {
+    return history[line & (CONSOLE_HISTORY - 1)];
+}
+
+static inline void mark_dirty(unsigned int row, unsigned int col) {
+    if (view != 0) return; // the changed row is not on screen
+    if (col < dirty_lo[row]) dirty_lo[row] = col;
+    if (col + 1 > dirty_hi[row]) dirty_hi[row] = col + 1;
+    dirty = 1;
+}
+
+static void mark_all_dirty(void) {
+    for (unsigned int row = 0; row < CONSOLE_ROWS; row++) {
+        dirty_lo[row] = 0;
+        dirty_hi[row] = CONSOLE_COLS;
+    }
+    dirty = 1;
+}
+
+static void blank_line(unsigned int line) {
+    memsetw(line_at(line), make_cell(' ', CONSOLE_DEFAULT_COLOR), CONSOLE_COLS);
+}
+
+static inline void put_cell(unsigned int row, unsigned int col, uint16_t cell) {
+    uint16_t *cells = line_at(screen_top + row);
+    if (cells[col] != cell) {
+        cells[col] = cell;
+        mark_dirty(row, col);
+    }
+}
+
+// Return to the live screen if the user paged back
+static void snap_to_live(void) {
+    if (view != 0) {
+        view = 0;
+        mark_all_dirty();
+    }
+}
+
+// Program the hardware cursor through the CRTC
+void update_cursor(int position) {
+    unsigned short pos = (unsigned short)position;
+    outb(VGA_CRTC_INDEX, 0x0F);
+    outb(VGA_CRTC_DATA, (unsigned char)(pos & 0xFF));
+    outb(VGA_CRTC_INDEX, 0x0E);
+    outb(VGA_CRTC_DATA, (unsigned char)((pos >> 8) & 0xFF));
+}
+
+void console_init(void) {
+    for (unsigned int row = 0; row < CONSOLE_ROWS; row++) {
+        blank_line(row);
+    }
+    mark_all_dirty();
+    console_flush();
+}
+
+// Move to the start of the next line, scrolling the live screen by one line
+// when the cursor is already on the last row
+static void advance_line(void) {
+    cur_col = 0;
+    if (cur_row < CONSOLE_ROWS - 1) {
+        cur_row++;
+        return;
+    }
+    screen_top++;
+    blank_line(screen_top + CONSOLE_ROWS - 1);
+    mark_all_dirty();
+}
+
+void console_putc(char c, unsigned char color) {
+    unsigned long flags = irq_save();
+    snap_to_live();
+    serial_console_putc(c, color);
+    if (c == '\n') {
+        advance_line();
+    } else {
+        put_cell(cur_row, cur_col, make_cell(c, color));
+        if (++cur_col >= CONSOLE_COLS) {
+            advance_line();
+        }
+    }
+    irq_restore(flags);
+}
+
+// Interrupts are only held off per character, so long output (a big
+// factorial) does not delay the tick or the keyboard
+void console_write(const char *str, unsigned char color) {
+    while (*str) {
+        console_putc(*str++, color);
+    }
+}
+
+// Draw a cell on the live screen without moving the cursor
+void console_put_at(unsigned int pos, char c, unsigned char color) {
+    if (pos >= CONSOLE_CELLS) return;
+    unsigned long flags = irq_save();
+    put_cell(pos / CONSOLE_COLS, pos % CONSOLE_COLS, make_cell(c, color));
+    irq_restore(flags);
+}
+
+void console_newline(void) {
+    unsigned long flags = irq_save();
+    snap_to_live();
+    serial_console_putc('\n', CONSOLE_DEFAULT_COLOR);
+    advance_line();
+    irq_restore(flags);
+}
+
+void console_backspace(void) {
+    unsigned long flags = irq_save();
+    snap_to_live();
+    if (cur_col > 0) {
+        cur_col--;
+    } else if (cur_row > 0) {
+        cur_row--;
+        cur_col = CONSOLE_COLS - 1;
+    } else {
+        irq_restore(flags);
+        return;
+    }
+    put_cell(cur_row, cur_col, make_cell(' ', CONSOLE_DEFAULT_COLOR));
+    serial_console_backspace();
+    irq_restore(flags);
+}
+
+// Start a fresh screen below the current output; the old screen stays in
+// the scrollback history
+void console_clear(void) {
+    unsigned long flags = irq_save();
+    view = 0;
+    screen_top += cur_row + 1;
+    for (unsigned int row = 0; row < CONSOLE_ROWS; row++) {
+        blank_line(screen_top + row);
+    }
+    cur_row = 0;
+    cur_col = 0;
+    mark_all_dirty();
+    serial_console_clear();
+    irq_restore(flags);
+}
+
+unsigned int console_get_pos(void) {
+    return cur_row * CONSOLE_COLS + cur_col;
+}
+
+// Page through history: positive counts scroll back, negative forward
+void console_scroll(int count) {
+    unsigned int max_view = screen_top;
+    if (max_view > CONSOLE_HISTORY - CONSOLE_ROWS) {
+        max_view = CONSOLE_HISTORY - CONSOLE_ROWS;
+    }
+
+    unsigned long flags = irq_save();
+    int target = (int)view + count;
+    if (target < 0) target = 0;
+    if ((unsigned int)target > max_view) target = max_view;
+    if ((unsigned int)target != view) {
+        view = target;
+        mark_all_dirty();
+    }
+    irq_restore(flags);
+}
+
+unsigned int console_scroll_offset(void) {
+    return view;
+}
+
+// Copy one row span to VGA memory
+static void flush_span(unsigned int row, const uint16_t *cells,
+                       unsigned int lo, unsigned int hi) {
+    memcpy((uint16_t *)vga + row * CONSOLE_COLS + lo, cells + lo, (hi - lo) * sizeof(uint16_t));
+}
+
+// Push pending changes to the screen and move the hardware cursor once
+void console_flush(void) {
+    unsigned long flags = irq_save();
+    if (dirty) {
+        dirty = 0;
+        unsigned int first = screen_top - view;
+        for (unsigned int row = 0; row < CONSOLE_ROWS; row++) {
+            if (dirty_lo[row] < dirty_hi[row]) {
+                flush_span(row, line_at(first + row), dirty_lo[row], dirty_hi[row]);
+                dirty_lo[row] = CONSOLE_COLS;
+                dirty_hi[row] = 0;
+            }
+        }
+    }
+    // Park the cursor off screen while looking at history
+    unsigned int pos = view ? CONSOLE_CELLS : console_get_pos();
+    if (pos != hw_cursor) {
+        update_cursor(pos);
+        hw_cursor = pos;
+    }
+    irq_restore(flags);
+}
+
+// Called from the timer interrupt. Every update runs with interrupts off,
+// so the tick never sees a half-written change.
+void console_tick(void) {
+    console_flush();
+}
@@ -0,0 +1,36 @@
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+#include <stdint.h>
+
+#define CONSOLE_COLS 80
+#define CONSOLE_ROWS 25
+#define CONSOLE_CELLS (CONSOLE_COLS * CONSOLE_ROWS)
+#define CONSOLE_DEFAULT_COLOR 0x07
+
+// Lines kept for scrollback (must be a power of two)
+#define CONSOLE_HISTORY 4096
+
+// VGA text memory and CRTC ports
+#define VGA_TEXT_BASE 0xb8000
+#define VGA_CRTC_INDEX 0x3D4
+#define VGA_CRTC_DATA  0x3D5
+
+// The timer flushes pending output every this many ticks
+#define CONSOLE_FLUSH_TICKS 16
+
+void console_init(void);
+void console_putc(char c, unsigned char color);
+void console_write(const char *str, unsigned char color);
+void console_put_at(unsigned int pos, char c, unsigned char color);
+void console_newline(void);
+void console_backspace(void);
+void console_clear(void);
+unsigned int console_get_pos(void);
+void console_scroll(int count);
+unsigned int console_scroll_offset(void);
+void console_flush(void);
+void console_tick(void);
+void update_cursor(int position);
+
+#endif // CONSOLE_H
@@ -0,0 +1,121 @@
+#ifndef CPU_H
+#define CPU_H
+
+#include <stdint.h>
+
+// CPUID leaf 1 EDX feature bits
+#define CPUID_EDX_PSE   (1 << 3)
+#define CPUID_EDX_TSC   (1 << 4)
+#define CPUID_EDX_MSR   (1 << 5)
+#define CPUID_EDX_APIC  (1 << 9)
+#define CPUID_EDX_SEP   (1 << 11)
+#define CPUID_EDX_PGE   (1 << 13)
+#define CPUID_EDX_FXSR  (1 << 24)
+#define CPUID_EDX_SSE   (1 << 25)
+#define CPUID_EDX_SSE2  (1 << 26)
+
+// CPUID leaf 7 EBX feature bits
+#define CPUID_7_EBX_ERMS (1 << 9)
+
+// CPUID leaf 0x80000001 EDX feature bits
+#define CPUID_EXT_EDX_RDTSCP (1 << 27)
+
+// Control register bits
+#define CR0_MP  0x002
+#define CR0_EM  0x004
+#define CR0_TS  0x008
+#define CR0_NE  0x020
+#define CR4_PSE 0x010
+#define CR4_PGE 0x080
+#define CR4_OSFXSR     0x200
+#define CR4_OSXMMEXCPT 0x400
+
+// Model specific registers
+#define MSR_APIC_BASE   0x1B
+#define MSR_SYSENTER_CS  0x174
+#define MSR_SYSENTER_ESP 0x175
+#define MSR_SYSENTER_EIP 0x176
+
+static inline void cpuid(uint32_t leaf, uint32_t *a, uint32_t *b, uint32_t *c, uint32_t *d) {
+    __asm__ volatile ("cpuid"
+                      : "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d)
+                      : "a"(leaf), "c"(0));
+}
+
+static inline uint32_t cpuid_edx(uint32_t leaf) {
+    uint32_t a, b, c, d;
+    cpuid(leaf, &a, &b, &c, &d);
+    return d;
+}
+
+static inline uint64_t rdtsc(void) {
+    uint32_t lo, hi;
+    __asm__ volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+// Waits for earlier instructions to finish before reading the TSC; the
+// processor id it also returns in ecx is discarded
+static inline uint64_t rdtscp(void) {
+    uint32_t lo, hi;
+    __asm__ volatile ("rdtscp" : "=a"(lo), "=d"(hi) :: "ecx");
+    return ((uint64_t)hi << 32) | lo;
+}
+
+// Keeps later instructions from starting early (needs SSE2)
+static inline void lfence(void) {
+    __asm__ volatile ("lfence" ::: "memory");
+}
+
+static inline uint64_t rdmsr(uint32_t msr) {
+    uint32_t lo, hi;
+    __asm__ volatile ("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t value) {
+    __asm__ volatile ("wrmsr" :: "c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)));
+}
+
+static inline uint32_t read_cr0(void) {
+    uint32_t value;
+    __asm__ volatile ("mov %%cr0, %0" : "=r"(value));
+    return value;
+}
+
+static inline void write_cr0(uint32_t value) {
+    __asm__ volatile ("mov %0, %%cr0" :: "r"(value) : "memory");
+}
+
+static inline void clts(void) {
+    __asm__ volatile ("clts" ::: "memory");
+}
+
+static inline uint32_t read_cr4(void) {
+    uint32_t value;
+    __asm__ volatile ("mov %%cr4, %0" : "=r"(value));
+    return value;
+}
+
+static inline void write_cr4(uint32_t value) {
+    __asm__ volatile ("mov %0, %%cr4" :: "r"(value) : "memory");
+}
+
+// Divide *n by base in place and return the remainder. Two 32-bit divl
+// instructions, so no libgcc __udivdi3 is needed.
+static inline uint32_t div64_32(uint64_t *n, uint32_t base) {
+    uint32_t high = (uint32_t)(*n >> 32);
+    uint32_t low = (uint32_t)*n;
+    uint32_t rem;
+    uint32_t qhigh = high / base;
+    high %= base;
+    __asm__ ("divl %4" : "=a"(low), "=d"(rem) : "a"(low), "d"(high), "rm"(base));
+    *n = ((uint64_t)qhigh << 32) | low;
+    return rem;
+}
+
+static inline void cpu_relax(void) {
+    __asm__ volatile ("pause" ::: "memory");
+}
+
+#endif // CPU_H
@@ -0,0 +1,81 @@
+#include "elf.h"
+#include "paging.h"
+#include "pmm.h"
+#include "klib.h"
+#include "klog.h"
+
+// Segments are copied rather than mapped in place: file data in the initrd
+// is only 512-byte aligned, and a process may write its data pages. The
+// programs are a few pages each.
+
+static int header_valid(const elf_header_t *eh, uint32_t size) {
+    if (size < sizeof(elf_header_t)) return 0;
+    if (eh->magic != ELF_MAGIC || eh->class != ELF_CLASS32 || eh->data != ELF_DATA_LSB) return 0;
+    if (eh->type != ELF_TYPE_EXEC || eh->machine != ELF_MACHINE_386) return 0;
+    if (eh->phentsize != sizeof(elf_phdr_t) || eh->phnum == 0) return 0;
+    return eh->phoff < size && eh->phnum <= (size - eh->phoff) / sizeof(elf_phdr_t);
+}
+
+// Page of `pd` at `virt`, allocated zeroed on first use. Segments sharing
+// a page share the frame, writable if either of them is.
+static uint8_t *segment_page(uint32_t *pd, uint32_t virt, uint32_t flags) {
+    uint32_t pte = paging_lookup(pd, virt);
+    uint32_t phys = pte & ~0xFFF;
+    if (!(pte & PTE_PRESENT)) {
+        phys = pmm_alloc_frame();
+        if (!phys) return 0;
+        memset(phys_to_virt(phys), 0, PAGE_SIZE);
+    }
+    if (paging_map_user(pd, virt, phys, flags | (pte & PTE_WRITE)) < 0) {
+        if (!(pte & PTE_PRESENT)) pmm_free_frame(phys);
+        return 0;
+    }
+    return phys_to_virt(phys);
+}
+
+static int load_segment(uint32_t *pd, const uint8_t *image, const elf_phdr_t *ph) {
+    uint32_t flags = ph->flags & ELF_PF_W ? PTE_WRITE : 0;
+    uint32_t end = ph->vaddr + ph->memsz;
+    for (uint32_t page = ph->vaddr & ~(PAGE_SIZE - 1); page < end; page += PAGE_SIZE) {
+        uint8_t *dst = segment_page(pd, page, flags);
+        if (!dst) return -1;
+        // The part of this page the file provides; the rest stays zero
+        uint32_t from = page > ph->vaddr ? page : ph->vaddr;
+        uint32_t to = page + PAGE_SIZE;
+        if (to > ph->vaddr + ph->filesz) to = ph->vaddr + ph->filesz;
+        if (from < to) {
+            memcpy(dst + (from - page), image + ph->offset + (from - ph->vaddr), to - from);
+        }
+    }
+    return 0;
+}
+
+uint32_t elf_load(uint32_t *pd, const uint8_t *image, uint32_t size, uint32_t limit) {
+    const elf_header_t *eh = (const elf_header_t *)image;
+    if (!header_valid(eh, size)) {
+        klog(KLOG_WARN, KLOG_KERNEL, "elf: not an i386 executable");
+        return 0;
+    }
+
+    const elf_phdr_t *phdrs = (const elf_phdr_t *)(image + eh->phoff);
+    int entry_mapped = 0;
+    for (int i = 0; i < eh->phnum; i++) {
+        const elf_phdr_t *ph = &phdrs[i];
+        if (ph->type != ELF_PT_LOAD || ph->memsz == 0) continue;
+        if (ph->filesz > ph->memsz || ph->offset > size || ph->filesz > size - ph->offset ||
+            ph->vaddr < USER_BASE || ph->vaddr >= limit || ph->memsz > limit - ph->vaddr) {
+            klog(KLOG_WARN, KLOG_KERNEL, "elf: segment %d at %08x out of range", i, ph->vaddr);
+            return 0;
+        }
+        if (load_segment(pd, image, ph) < 0) {
+            klog(KLOG_WARN, KLOG_KERNEL, "elf: out of memory");
+            return 0;
+        }
+        if (eh->entry >= ph->vaddr && eh->entry - ph->vaddr < ph->memsz) entry_mapped = 1;
+    }
+    if (!entry_mapped) {
+        klog(KLOG_WARN, KLOG_KERNEL, "elf: entry point %08x not in a segment", eh->entry);
+        return 0;
+    }
+    return eh->entry;
+}
@@ -0,0 +1,56 @@
+#ifndef ELF_H
+#define ELF_H
+
+#include <stdint.h>
+
+// ELF32 executables for i386, as the user programs under user/ are linked
+#define ELF_MAGIC    0x464C457F  // "\x7fELF" read little-endian
+#define ELF_CLASS32  1
+#define ELF_DATA_LSB 1
+#define ELF_TYPE_EXEC 2
+#define ELF_MACHINE_386 3
+
+#define ELF_PT_LOAD 1
+#define ELF_PF_X 0x1
+#define ELF_PF_W 0x2
+#define ELF_PF_R 0x4
+
+typedef struct {
+    uint32_t magic;
+    uint8_t class;
+    uint8_t data;
+    uint8_t version;
+    uint8_t pad[9];
+    uint16_t type;
+    uint16_t machine;
+    uint32_t version2;
+    uint32_t entry;
+    uint32_t phoff;
+    uint32_t shoff;
+    uint32_t flags;
+    uint16_t ehsize;
+    uint16_t phentsize;
+    uint16_t phnum;
+    uint16_t shentsize;
+    uint16_t shnum;
+    uint16_t shstrndx;
+} __attribute__((packed)) elf_header_t;
+
+typedef struct {
+    uint32_t type;
+    uint32_t offset;
+    uint32_t vaddr;
+    uint32_t paddr;
+    uint32_t filesz;
+    uint32_t memsz;
+    uint32_t flags;
+    uint32_t align;
+} __attribute__((packed)) elf_phdr_t;
+
+// Copy the PT_LOAD segments of `image` into fresh pages of the process
+// directory `pd`. Returns the entry point, or 0 if the image is not a
+// usable executable or memory ran out (pages already mapped are released
+// with the directory).
+uint32_t elf_load(uint32_t *pd, const uint8_t *image, uint32_t size, uint32_t limit);
+
+#endif // ELF_H
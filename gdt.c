@@ -0,0 +1,46 @@
+#include "gdt.h"
+#include "smp.h"
+
+// Load a new GDT and reload every segment register (kernel.asm)
+extern void gdt_flush(struct gdt_ptr *ptr);
+
+static void gdt_set_entry(struct gdt_entry *gdt, int i, uint32_t base, uint32_t limit,
+                          uint8_t access, uint8_t granularity) {
+    gdt[i].base_low = base & 0xFFFF;
+    gdt[i].base_middle = (base >> 16) & 0xFF;
+    gdt[i].base_high = (base >> 24) & 0xFF;
+    gdt[i].limit_low = limit & 0xFFFF;
+    gdt[i].granularity = ((limit >> 16) & 0x0F) | (granularity & 0xF0);
+    gdt[i].access = access;
+}
+
+// Flat 4 GiB code and data segments for rings 0 and 3, a byte-granular data
+// segment over the CPU's cpu_t for %gs, and the CPU's TSS. The boot loader's GDT lives in
+// low memory that is not mapped once paging is on, so the kernel needs its
+// own.
+void gdt_init_cpu(cpu_t *cpu) {
+    struct gdt_entry *gdt = cpu->gdt;
+
+    cpu->self = cpu;
+    cpu->tss.ss0 = GDT_KERNEL_DATA;
+    cpu->tss.iomap_base = sizeof(struct tss); // no I/O permission bitmap
+
+    gdt_set_entry(gdt, 0, 0, 0, 0, 0);
+    gdt_set_entry(gdt, 1, 0, 0xFFFFF, 0x9A, 0xCF);
+    gdt_set_entry(gdt, 2, 0, 0xFFFFF, 0x92, 0xCF);
+    gdt_set_entry(gdt, 3, 0, 0xFFFFF, 0xFA, 0xCF);
+    gdt_set_entry(gdt, 4, 0, 0xFFFFF, 0xF2, 0xCF);
+    gdt_set_entry(gdt, 5, (uint32_t)cpu, sizeof(cpu_t) - 1, 0x92, 0x40);
+    gdt_set_entry(gdt, 6, (uint32_t)&cpu->tss, sizeof(struct tss) - 1, 0x89, 0x00);
+
+    cpu->gdt_ptr.limit = sizeof(cpu->gdt) - 1;
+    cpu->gdt_ptr.base = (uint32_t)gdt;
+    gdt_flush(&cpu->gdt_ptr);
+    __asm__ volatile ("mov %0, %%gs" :: "r"((uint16_t)GDT_PERCPU) : "memory");
+    __asm__ volatile ("ltr %w0" :: "r"(GDT_TSS));
+}
+
+// The boot CPU is cpu 0
+void gdt_init(void) {
+    gdt_init_cpu(smp_cpu(0));
+}
@@ -0,0 +1,55 @@
+#ifndef GDT_H
+#define GDT_H
+
+#include <stdint.h>
+
+// Segment selectors. sysenter/sysexit derive the kernel stack segment and
+// both user segments from GDT_KERNEL_CODE, which fixes the order of the
+// first four.
+#define GDT_KERNEL_CODE 0x08
+#define GDT_KERNEL_DATA 0x10
+#define GDT_USER_CODE   0x18
+#define GDT_USER_DATA   0x20
+#define GDT_PERCPU      0x28 // %gs, based at the CPU's cpu_t (smp.h)
+#define GDT_TSS         0x30
+
+// Requested privilege level of the selectors ring 3 code uses
+#define GDT_RPL_USER 3
+
+// Every CPU has its own GDT, since the per-CPU segment and the TSS differ
+#define GDT_ENTRIES 7
+
+struct gdt_entry {
+    uint16_t limit_low;
+    uint16_t base_low;
+    uint8_t base_middle;
+    uint8_t access;
+    uint8_t granularity;
+    uint8_t base_high;
+} __attribute__((packed));
+
+struct gdt_ptr {
+    uint16_t limit;
+    uint32_t base;
+} __attribute__((packed));
+
+// 32-bit task state segment. Only the ring 0 stack fields are used: esp0
+// is the running thread's kernel stack, where interrupts from ring 3 land.
+struct tss {
+    uint32_t prev_tss;
+    uint32_t esp0, ss0;
+    uint32_t esp1, ss1;
+    uint32_t esp2, ss2;
+    uint32_t cr3, eip, eflags;
+    uint32_t eax, ecx, edx, ebx, esp, ebp, esi, edi;
+    uint32_t es, cs, ss, ds, fs, gs, ldt;
+    uint16_t trap;
+    uint16_t iomap_base;
+} __attribute__((packed));
+
+struct cpu;
+
+void gdt_init(void);
+void gdt_init_cpu(struct cpu *cpu);
+
+#endif // GDT_H
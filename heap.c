@@ -0,0 +1,213 @@
+#include "heap.h"
+#include "pmm.h"
+#include "spinlock.h"
+
+static kmem_cache_t caches[HEAP_CLASSES];
+static spinlock_t heap_lock = SPINLOCK_INIT;
+
+static uint32_t total_allocs = 0;
+static uint32_t total_frees = 0;
+static uint32_t failures = 0;
+static uint32_t large_frames = 0;
+static uint32_t large_allocs = 0;
+
+// Size class index for a small request: 16 -> 0, 32 -> 1, ..., 2048 -> 7
+static inline int size_class(size_t size) {
+    if (size <= (1u << HEAP_MIN_SHIFT)) return 0;
+    return 32 - __builtin_clz(size - 1) - HEAP_MIN_SHIFT;
+}
+
+static void list_add(slab_t **head, slab_t *slab) {
+    slab->prev = 0;
+    slab->next = *head;
+    if (*head) (*head)->prev = slab;
+    *head = slab;
+}
+
+static void list_del(slab_t **head, slab_t *slab) {
+    if (slab->prev) slab->prev->next = slab->next;
+    else *head = slab->next;
+    if (slab->next) slab->next->prev = slab->prev;
+    slab->next = slab->prev = 0;
+}
+
+void heap_init(void) {
+    for (int i = 0; i < HEAP_CLASSES; i++) {
+        kmem_cache_t *cache = &caches[i];
+        uint32_t size = 1u << (i + HEAP_MIN_SHIFT);
+        uint32_t align = size < 64 ? size : 64;
+
+        cache->size = size;
+        cache->offset = (sizeof(slab_t) + align - 1) & ~(align - 1);
+        // Grow the slab until at least eight objects fit
+        cache->order = 0;
+        while (cache->order < 3 &&
+               ((PAGE_SIZE << cache->order) - cache->offset) / size < 8) {
+            cache->order++;
+        }
+        cache->per_slab = ((PAGE_SIZE << cache->order) - cache->offset) / size;
+        cache->partial = cache->full = cache->empty = 0;
+        cache->slabs = cache->empty_slabs = cache->inuse = 0;
+        cache->allocs = cache->frees = 0;
+    }
+}
+
+// Carve a fresh slab into free objects. Every frame of the slab points back
+// to it, so kfree() finds the slab from any object address.
+static slab_t *slab_create(kmem_cache_t *cache) {
+    uint32_t phys = pmm_alloc_frames(cache->order);
+    if (!phys) return 0;
+
+    for (uint32_t i = 0; i < (1u << cache->order); i++) {
+        page_t *page = pmm_page(phys + i * PAGE_SIZE);
+        page->flags |= PAGE_SLAB;
+        page->owner = phys_to_virt(phys);
+    }
+
+    slab_t *slab = phys_to_virt(phys);
+    slab->cache = cache;
+    slab->inuse = 0;
+    slab->free = 0;
+    char *obj = (char *)slab + cache->offset + (cache->per_slab - 1) * cache->size;
+    for (uint32_t i = 0; i < cache->per_slab; i++) {
+        *(void **)obj = slab->free;
+        slab->free = obj;
+        obj -= cache->size;
+    }
+    cache->slabs++;
+    return slab;
+}
+
+static void slab_destroy(kmem_cache_t *cache, slab_t *slab) {
+    uint32_t phys = virt_to_phys(slab);
+    for (uint32_t i = 0; i < (1u << cache->order); i++) {
+        page_t *page = pmm_page(phys + i * PAGE_SIZE);
+        page->flags &= ~PAGE_SLAB;
+        page->owner = 0;
+    }
+    cache->slabs--;
+    pmm_free_frames(phys, cache->order);
+}
+
+static void *cache_alloc(kmem_cache_t *cache) {
+    slab_t *slab = cache->partial;
+
+    if (!slab) {
+        slab = cache->empty;
+        if (slab) {
+            list_del(&cache->empty, slab);
+            cache->empty_slabs--;
+        } else {
+            slab = slab_create(cache);
+            if (!slab) return 0;
+        }
+        list_add(&cache->partial, slab);
+    }
+
+    void *obj = slab->free;
+    slab->free = *(void **)obj;
+    slab->inuse++;
+    if (slab->inuse == cache->per_slab) {
+        list_del(&cache->partial, slab);
+        list_add(&cache->full, slab);
+    }
+    cache->inuse++;
+    cache->allocs++;
+    return obj;
+}
+
+static void cache_free(kmem_cache_t *cache, slab_t *slab, void *obj) {
+    if (slab->inuse == cache->per_slab) {
+        list_del(&cache->full, slab);
+        list_add(&cache->partial, slab);
+    }
+    *(void **)obj = slab->free;
+    slab->free = obj;
+    slab->inuse--;
+    cache->inuse--;
+    cache->frees++;
+
+    if (slab->inuse == 0) {
+        list_del(&cache->partial, slab);
+        if (cache->empty_slabs >= HEAP_KEEP_EMPTY) {
+            slab_destroy(cache, slab);
+        } else {
+            list_add(&cache->empty, slab);
+            cache->empty_slabs++;
+        }
+    }
+}
+
+static void *large_alloc(size_t size) {
+    uint32_t frames = (size + PAGE_SIZE - 1) >> PAGE_SHIFT;
+    uint32_t phys = pmm_alloc_contiguous(frames);
+    if (!phys) return 0;
+
+    page_t *page = pmm_page(phys);
+    page->flags |= PAGE_LARGE;
+    page->count = frames;
+    large_frames += frames;
+    large_allocs++;
+    return phys_to_virt(phys);
+}
+
+void *kmalloc(size_t size) {
+    void *ptr;
+    if (size == 0) return 0;
+
+    unsigned long flags = spin_lock_irqsave(&heap_lock);
+    if (size <= HEAP_MAX_SMALL) {
+        ptr = cache_alloc(&caches[size_class(size)]);
+    } else {
+        ptr = large_alloc(size);
+    }
+    if (ptr) total_allocs++;
+    else failures++;
+    spin_unlock_irqrestore(&heap_lock, flags);
+    return ptr;
+}
+
+void kfree(void *ptr) {
+    if (!ptr) return;
+
+    uint32_t phys = virt_to_phys(ptr);
+    page_t *page = pmm_page(phys);
+    if (!page) return;
+
+    unsigned long flags = spin_lock_irqsave(&heap_lock);
+    if (page->flags & PAGE_SLAB) {
+        slab_t *slab = page->owner;
+        cache_free(slab->cache, slab, ptr);
+        total_frees++;
+    } else if ((page->flags & PAGE_LARGE) && !(phys & (PAGE_SIZE - 1))) {
+        uint32_t frames = page->count;
+        page->flags &= ~PAGE_LARGE;
+        page->count = 0;
+        large_frames -= frames;
+        large_allocs--;
+        pmm_free_contiguous(phys, frames);
+        total_frees++;
+    }
+    spin_unlock_irqrestore(&heap_lock, flags);
+}
+
+const kmem_cache_t *heap_cache(int index) {
+    return (index >= 0 && index < HEAP_CLASSES) ? &caches[index] : 0;
+}
+
+void heap_get_stats(heap_stats_t *stats) {
+    stats->allocs = total_allocs;
+    stats->frees = total_frees;
+    stats->failures = failures;
+    stats->slab_frames = 0;
+    stats->large_frames = large_frames;
+    stats->large_allocs = large_allocs;
+    stats->used_bytes = large_frames * PAGE_SIZE;
+    stats->free_bytes = 0;
+    for (int i = 0; i < HEAP_CLASSES; i++) {
+        kmem_cache_t *cache = &caches[i];
+        stats->slab_frames += cache->slabs << cache->order;
+        stats->used_bytes += cache->inuse * cache->size;
+        stats->free_bytes += (cache->slabs * cache->per_slab - cache->inuse) * cache->size;
+    }
+}
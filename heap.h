@@ -0,0 +1,57 @@
+#ifndef HEAP_H
+#define HEAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Small objects come from per-size-class slab caches of 16..2048 bytes;
+// anything larger is a run of whole frames from the PMM
+#define HEAP_MIN_SHIFT 4
+#define HEAP_MAX_SHIFT 11
+#define HEAP_CLASSES   (HEAP_MAX_SHIFT - HEAP_MIN_SHIFT + 1)
+#define HEAP_MAX_SMALL (1 << HEAP_MAX_SHIFT)
+
+// Empty slabs kept per cache before frames go back to the PMM
+#define HEAP_KEEP_EMPTY 1
+
+typedef struct slab {
+    struct slab *next;
+    struct slab *prev;
+    struct kmem_cache *cache;
+    void *free;       // singly linked free objects
+    uint32_t inuse;
+} slab_t;
+
+typedef struct kmem_cache {
+    uint32_t size;     // object size
+    uint32_t order;    // slab size is 2^order frames
+    uint32_t offset;   // first object offset inside the slab
+    uint32_t per_slab; // objects per slab
+    slab_t *partial;   // slabs with both used and free objects
+    slab_t *full;
+    slab_t *empty;
+    uint32_t slabs;
+    uint32_t empty_slabs;
+    uint32_t inuse;
+    uint32_t allocs;
+    uint32_t frees;
+} kmem_cache_t;
+
+typedef struct {
+    uint32_t allocs;
+    uint32_t frees;
+    uint32_t failures;
+    uint32_t slab_frames;  // frames held by slab caches
+    uint32_t large_frames; // frames held by large allocations
+    uint32_t large_allocs; // live large allocations
+    uint32_t used_bytes;   // object slots and large runs handed out
+    uint32_t free_bytes;   // unused object slots inside slabs
+} heap_stats_t;
+
+void heap_init(void);
+void *kmalloc(size_t size);
+void kfree(void *ptr);
+const kmem_cache_t *heap_cache(int index);
+void heap_get_stats(heap_stats_t *stats);
+
+#endif // HEAP_H
@@ -0,0 +1,196 @@
+#include "idt.h"
+#include "gdt.h"
+#include "io.h"
+#include "apic.h"
+#include "ioapic.h"
+#include "kernel.h"
+#include "sched.h"
+#include "klog.h"
+#include "process.h"
+
+struct IDT_entry {
+    unsigned short int offset_lowerbits;
+    unsigned short int selector;
+    unsigned char zero;
+    unsigned char type_attr;
+    unsigned short int offset_higherbits;
+};
+
+// Entry points generated in kernel.asm
+extern void (*isr_stub_table[ISR_STUB_COUNT])(void);
+extern void apic_spurious_handler(void);
+extern void load_idt(unsigned long *idt_ptr);
+
+static struct IDT_entry IDT[IDT_SIZE];
+static unsigned long idt_ptr[2];
+
+// Handler per vector; dispatch is a single table lookup
+static irq_handler_t handlers[IDT_SIZE];
+static uint32_t counts[IDT_SIZE];
+static uint32_t spurious = 0;
+
+static const char *exception_names[EXCEPTION_COUNT] = {
+    "Divide error", "Debug", "NMI", "Breakpoint", "Overflow",
+    "Bound range exceeded", "Invalid opcode", "Device not available",
+    "Double fault", "Coprocessor segment overrun", "Invalid TSS",
+    "Segment not present", "Stack fault", "General protection fault",
+    "Page fault", "Reserved", "x87 floating point error", "Alignment check",
+    "Machine check", "SIMD floating point error", "Virtualization",
+    "Control protection", "Reserved", "Reserved", "Reserved", "Reserved",
+    "Reserved", "Reserved", "Hypervisor injection", "VMM communication",
+    "Security exception", "Reserved"
+};
+
+void idt_set_gate(int vector, void (*handler)(void), uint8_t type) {
+    unsigned long address = (unsigned long)handler;
+    IDT[vector].offset_lowerbits = address & 0xffff;
+    IDT[vector].selector = GDT_KERNEL_CODE;
+    IDT[vector].zero = 0;
+    IDT[vector].type_attr = type;
+    IDT[vector].offset_higherbits = (address & 0xffff0000) >> 16;
+}
+
+void register_irq_handler(int vector, irq_handler_t handler) {
+    if (vector >= 0 && vector < IDT_SIZE) {
+        handlers[vector] = handler;
+    }
+}
+
+void irq_mask(int irq) {
+    if (ioapic_active()) {
+        ioapic_mask_irq(irq);
+    } else if (irq < 8) {
+        write_port(PIC1_DATA, read_port(PIC1_DATA) | (1 << irq));
+    } else {
+        write_port(PIC2_DATA, read_port(PIC2_DATA) | (1 << (irq - 8)));
+    }
+}
+
+void irq_unmask(int irq) {
+    if (ioapic_active()) {
+        ioapic_unmask_irq(irq);
+    } else if (irq < 8) {
+        write_port(PIC1_DATA, read_port(PIC1_DATA) & ~(1 << irq));
+    } else {
+        // Slave IRQs also need the cascade line open on the master
+        write_port(PIC2_DATA, read_port(PIC2_DATA) & ~(1 << (irq - 8)));
+        write_port(PIC1_DATA, read_port(PIC1_DATA) & ~(1 << 2));
+    }
+}
+
+uint32_t irq_count(int vector) {
+    return (vector >= 0 && vector < IDT_SIZE) ? counts[vector] : 0;
+}
+
+uint32_t irq_spurious_count(void) {
+    return spurious;
+}
+
+// IRQ7 and IRQ15 double as the PICs' spurious vectors. A real interrupt has
+// its in-service bit set; a spurious one does not and must not be EOI'd
+// (except for the cascade on the master when the slave raised it).
+static int pic_spurious(uint32_t vector) {
+    if (vector == IRQ_VECTOR(7)) {
+        write_port(PIC1_COMMAND, PIC_READ_ISR);
+        if (!((unsigned char)read_port(PIC1_COMMAND) & 0x80)) {
+            return 1;
+        }
+    } else if (vector == IRQ_VECTOR(15)) {
+        write_port(PIC2_COMMAND, PIC_READ_ISR);
+        if (!((unsigned char)read_port(PIC2_COMMAND) & 0x80)) {
+            write_port(PIC1_COMMAND, PIC_EOI);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void pic_eoi(uint32_t vector) {
+    if (vector >= IRQ_VECTOR(8)) {
+        write_port(PIC2_COMMAND, PIC_EOI);
+    }
+    write_port(PIC1_COMMAND, PIC_EOI);
+}
+
+static void unhandled_exception(struct regs *r) {
+    klog(KLOG_ERR, KLOG_IRQ, "%s (vector %u, error %x, eip %08x)",
+         (uint32_t)exception_names[r->int_no], r->int_no, r->err_code, r->eip);
+    print_colored("\n", COLOR_LIGHT_RED);
+    print_colored(exception_names[r->int_no], COLOR_LIGHT_RED);
+    print(" (vector ");
+    printn(r->int_no);
+    print(", error ");
+    printx(r->err_code);
+    print(", eip ");
+    printx(r->eip);
+    print(")");
+    panic("unhandled exception");
+}
+
+// Common C entry for every stub in kernel.asm
+void isr_dispatch(struct regs *r) {
+    uint32_t vector = r->int_no;
+
+    if ((vector == IRQ_VECTOR(7) || vector == IRQ_VECTOR(15)) && !ioapic_active() &&
+        pic_spurious(vector)) {
+        spurious++;
+        klog(KLOG_DEBUG, KLOG_IRQ, "spurious IRQ%u", vector - IRQ_BASE);
+        return;
+    }
+    counts[vector]++;
+
+    irq_handler_t handler = handlers[vector];
+    if (handler) {
+        handler(r);
+    } else if (vector < EXCEPTION_COUNT) {
+        if ((r->cs & 3) == GDT_RPL_USER) {
+            process_fault(r, exception_names[vector]);
+        }
+        unhandled_exception(r);
+    }
+
+    if (vector >= IRQ_BASE && vector < IRQ_BASE + IRQ_COUNT && !ioapic_active()) {
+        pic_eoi(vector);
+    } else if (vector >= IRQ_BASE) {
+        lapic_eoi();
+    }
+
+    // A handler may have woken a higher-priority thread or ended the time
+    // slice; switch now that the interrupt is acknowledged
+    if (vector >= IRQ_BASE) {
+        sched_preempt();
+    }
+}
+
+void idt_init(void) {
+    unsigned long idt_address;
+
+    for (int vector = 0; vector < ISR_STUB_COUNT; vector++) {
+        idt_set_gate(vector, isr_stub_table[vector], INTERRUPT_GATE);
+    }
+    idt_set_gate(LAPIC_SPURIOUS_VECTOR, apic_spurious_handler, INTERRUPT_GATE);
+
+    // Remap the PICs to IRQ_BASE..IRQ_BASE+15, slave cascaded on IRQ2
+    write_port(PIC1_COMMAND, 0x11);
+    write_port(PIC2_COMMAND, 0x11);
+    write_port(PIC1_DATA, IRQ_BASE);
+    write_port(PIC2_DATA, IRQ_BASE + 8);
+    write_port(PIC1_DATA, 0x04);
+    write_port(PIC2_DATA, 0x02);
+    write_port(PIC1_DATA, 0x01);
+    write_port(PIC2_DATA, 0x01);
+
+    // Every line stays masked until its driver calls irq_unmask()
+    write_port(PIC1_DATA, 0xff);
+    write_port(PIC2_DATA, 0xff);
+
+    idt_address = (unsigned long)IDT;
+    idt_ptr[0] = (sizeof(struct IDT_entry) * IDT_SIZE) + ((idt_address & 0xffff) << 16);
+    idt_ptr[1] = idt_address >> 16;
+    load_idt(idt_ptr);
+}
+
+// Load the IDT built by idt_init() on another CPU, leaving interrupts off
+void idt_load(void) {
+    __asm__ volatile ("lidt (%0)" :: "r"(idt_ptr) : "memory");
+}
@@ -0,0 +1,54 @@
+#ifndef IDT_H
+#define IDT_H
+
+#include <stdint.h>
+
+#define IDT_SIZE 256
+#define INTERRUPT_GATE 0x8e
+
+// Vector layout: CPU exceptions, then the 16 PIC IRQs, then vectors
+// delivered by the local APIC (which take a LAPIC EOI)
+#define EXCEPTION_COUNT 32
+#define EXCEPTION_BREAKPOINT 3
+#define EXCEPTION_DEVICE_NOT_AVAILABLE 7
+#define EXCEPTION_PAGE_FAULT 14
+#define IRQ_BASE        0x20
+#define IRQ_COUNT       16
+#define IRQ_VECTOR(irq) (IRQ_BASE + (irq))
+#define LAPIC_VECTOR_BASE 0x30
+
+// Vectors with an assembly stub in kernel.asm (exceptions, IRQs, the
+// local APIC timer and the wakeup IPI, then the MSI vectors pci.c hands
+// out)
+#define ISR_STUB_COUNT 64
+
+// 8259 PIC ports and commands
+#define PIC1_COMMAND 0x20
+#define PIC1_DATA    0x21
+#define PIC2_COMMAND 0xA0
+#define PIC2_DATA    0xA1
+#define PIC_EOI      0x20
+#define PIC_READ_ISR 0x0B
+
+// Register state pushed by isr_common in kernel.asm
+struct regs {
+    uint32_t gs, fs, es, ds;
+    uint32_t edi, esi, ebp, esp_dummy, ebx, edx, ecx, eax;
+    uint32_t int_no, err_code;
+    uint32_t eip, cs, eflags;
+    uint32_t useresp, ss; // only present when coming from ring 3
+};
+
+typedef void (*irq_handler_t)(struct regs *r);
+
+void idt_init(void);
+void idt_load(void);
+void idt_set_gate(int vector, void (*handler)(void), uint8_t type);
+void register_irq_handler(int vector, irq_handler_t handler);
+void irq_mask(int irq);
+void irq_unmask(int irq);
+uint32_t irq_count(int vector);
+uint32_t irq_spurious_count(void);
+void isr_dispatch(struct regs *r);
+
+#endif // IDT_H
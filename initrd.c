@@ -0,0 +1,233 @@
+#include <stddef.h>
+#include "initrd.h"
+#include "paging.h"
+#include "heap.h"
+#include "klib.h"
+#include "klog.h"
+
+// Read-only filesystem on a ustar archive. initrd_init() walks the headers
+// once and builds a hash table of paths; after that a lookup hashes the
+// path and returns the entry, whose data pointer is the file in the module.
+
+static const uint8_t *archive = 0;
+static uint32_t archive_size = 0;
+static initrd_file_t *files = 0;
+static int file_count = 0;
+static initrd_file_t **buckets = 0;
+static uint32_t bucket_mask = 0;
+
+// FNV-1a over the first len bytes
+static uint32_t path_hash(const char *s, uint32_t len) {
+    uint32_t h = 2166136261u;
+    for (uint32_t i = 0; i < len; i++) {
+        h ^= (uint8_t)s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// Octal numeric field, terminated by NUL or space
+static uint32_t tar_number(const char *field, int len) {
+    uint32_t value = 0;
+    for (int i = 0; i < len && field[i] >= '0' && field[i] <= '7'; i++) {
+        value = value * 8 + (field[i] - '0');
+    }
+    return value;
+}
+
+static int header_ok(const tar_header_t *h) {
+    if (memcmp(h->magic, "ustar", 5) != 0) return 0;
+    const uint8_t *p = (const uint8_t *)h;
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < TAR_BLOCK_SIZE; i++) {
+        int in_field = i >= offsetof(tar_header_t, checksum) &&
+                       i < offsetof(tar_header_t, checksum) + sizeof(h->checksum);
+        sum += in_field ? ' ' : p[i];
+    }
+    return sum == tar_number(h->checksum, sizeof(h->checksum));
+}
+
+static uint32_t field_len(const char *field, uint32_t max) {
+    uint32_t len = 0;
+    while (len < max && field[len]) len++;
+    return len;
+}
+
+// Drop leading "/" and "./" and trailing "/"; returns the remaining length
+static uint32_t trim_path(const char **path, uint32_t len) {
+    const char *p = *path;
+    while (len) {
+        if (p[0] == '/') {
+            p++;
+            len--;
+        } else if (len >= 2 && p[0] == '.' && p[1] == '/') {
+            p += 2;
+            len -= 2;
+        } else if (len == 1 && p[0] == '.') {
+            len = 0;
+        } else {
+            break;
+        }
+    }
+    while (len && p[len - 1] == '/') len--;
+    *path = p;
+    return len;
+}
+
+// "prefix/name" of a header, trimmed, as a new string. 0 for the root
+// entry or when out of memory.
+static char *header_path(const tar_header_t *h) {
+    uint32_t plen = field_len(h->prefix, sizeof(h->prefix));
+    uint32_t nlen = field_len(h->name, sizeof(h->name));
+    char *full = kmalloc(plen + nlen + 2);
+    if (!full) return 0;
+    uint32_t len = 0;
+    if (plen) {
+        memcpy(full, h->prefix, plen);
+        full[plen] = '/';
+        len = plen + 1;
+    }
+    memcpy(full + len, h->name, nlen);
+    len += nlen;
+
+    const char *p = full;
+    len = trim_path(&p, len);
+    if (len == 0) {
+        kfree(full);
+        return 0;
+    }
+    memmove(full, p, len);
+    full[len] = '\0';
+    return full;
+}
+
+// Walk the archive, calling back for every file and directory. Returns the
+// number of entries seen.
+static int walk(void (*fn)(const tar_header_t *h, const uint8_t *data, uint32_t size, int type)) {
+    int count = 0;
+    uint32_t off = 0;
+    while (off + TAR_BLOCK_SIZE <= archive_size) {
+        const tar_header_t *h = (const tar_header_t *)(archive + off);
+        if (h->name[0] == '\0') break;   // end of archive: zero blocks
+        if (!header_ok(h)) {
+            klog(KLOG_WARN, KLOG_KERNEL, "initrd: bad header at offset %u", off);
+            break;
+        }
+        uint32_t size = tar_number(h->size, sizeof(h->size));
+        const uint8_t *data = archive + off + TAR_BLOCK_SIZE;
+        if (size > archive_size - off - TAR_BLOCK_SIZE) {
+            klog(KLOG_WARN, KLOG_KERNEL, "initrd: truncated entry at offset %u", off);
+            break;
+        }
+        int type = 0;
+        if (h->typeflag == TAR_TYPE_FILE || h->typeflag == TAR_TYPE_FILE_OLD) {
+            type = INITRD_FILE;
+        } else if (h->typeflag == TAR_TYPE_DIR) {
+            type = INITRD_DIR;
+        }
+        // Links, devices and extension headers are skipped
+        if (type) {
+            if (fn) fn(h, data, size, type);
+            count++;
+        }
+        off += TAR_BLOCK_SIZE + ((size + TAR_BLOCK_SIZE - 1) & ~(TAR_BLOCK_SIZE - 1));
+    }
+    return count;
+}
+
+static initrd_file_t *find(const char *path, uint32_t len) {
+    for (initrd_file_t *f = buckets[path_hash(path, len) & bucket_mask]; f; f = f->next) {
+        if (f->path_len == len && memcmp(f->path, path, len) == 0) return f;
+    }
+    return 0;
+}
+
+static void add_entry(const tar_header_t *h, const uint8_t *data, uint32_t size, int type) {
+    char *path = header_path(h);
+    if (!path) return;
+    uint32_t len = strlen(path);
+
+    // tar appends updated files, so a later copy of a path replaces it
+    initrd_file_t *f = find(path, len);
+    if (f) {
+        kfree(path);
+    } else {
+        f = &files[file_count++];
+        f->path = path;
+        f->path_len = len;
+        f->name = path;
+        for (uint32_t i = 0; i < len; i++) {
+            if (path[i] == '/') f->name = path + i + 1;
+        }
+        uint32_t b = path_hash(path, len) & bucket_mask;
+        f->next = buckets[b];
+        buckets[b] = f;
+    }
+    f->data = data;
+    f->size = type == INITRD_FILE ? size : 0;
+    f->type = type;
+}
+
+int initrd_init(multiboot_info_t *mbi) {
+    if (!(mbi->flags & MULTIBOOT_INFO_MODS) || mbi->mods_count == 0) {
+        klog(KLOG_INFO, KLOG_KERNEL, "initrd: no module");
+        return -1;
+    }
+    multiboot_module_t *mod = phys_to_virt(mbi->mods_addr);
+    if (mod->mod_end <= mod->mod_start || mod->mod_end > KERNEL_DIRECT_MAP_SIZE) {
+        klog(KLOG_WARN, KLOG_KERNEL, "initrd: module at %08x-%08x is not mapped",
+             mod->mod_start, mod->mod_end);
+        return -1;
+    }
+    archive = phys_to_virt(mod->mod_start);
+    archive_size = mod->mod_end - mod->mod_start;
+
+    int count = walk(0);
+    uint32_t nbuckets = 16;
+    while (nbuckets < 2 * (uint32_t)count) nbuckets *= 2;
+    files = kmalloc((count ? count : 1) * sizeof(initrd_file_t));
+    buckets = kmalloc(nbuckets * sizeof(initrd_file_t *));
+    if (!files || !buckets) {
+        kfree(files);
+        kfree(buckets);
+        files = 0;
+        buckets = 0;
+        archive = 0;
+        klog(KLOG_ERR, KLOG_KERNEL, "initrd: out of memory for %d entries", count);
+        return -1;
+    }
+    memset(buckets, 0, nbuckets * sizeof(initrd_file_t *));
+    bucket_mask = nbuckets - 1;
+    walk(add_entry);
+
+    klog(KLOG_INFO, KLOG_KERNEL, "initrd: %d entries, %u KiB at %08x",
+         file_count, archive_size / 1024, mod->mod_start);
+    return file_count;
+}
+
+int initrd_count(void) {
+    return file_count;
+}
+
+uint32_t initrd_size(void) {
+    return archive_size;
+}
+
+const initrd_file_t *initrd_lookup(const char *path) {
+    if (!buckets) return 0;
+    uint32_t len = trim_path(&path, strlen(path));
+    return find(path, len);
+}
+
+const initrd_file_t *initrd_readdir(const char *dir, uint32_t *pos) {
+    uint32_t len = trim_path(&dir, strlen(dir));
+    while (*pos < (uint32_t)file_count) {
+        const initrd_file_t *f = &files[(*pos)++];
+        uint32_t parent = f->name - f->path;   // "dir/" including the slash
+        if (len == 0 ? parent == 0
+                     : parent == len + 1 && memcmp(f->path, dir, len) == 0) {
+            return f;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,60 @@
+#ifndef INITRD_H
+#define INITRD_H
+
+#include <stdint.h>
+#include "multiboot.h"
+
+// The initrd is a ustar archive loaded by GRUB as a Multiboot module. It
+// is indexed once at boot; file data is never copied, lookups return
+// pointers into the module.
+#define TAR_BLOCK_SIZE 512
+
+// tar_header_t.typeflag
+#define TAR_TYPE_FILE     '0'
+#define TAR_TYPE_FILE_OLD '\0'
+#define TAR_TYPE_DIR      '5'
+
+#define INITRD_FILE 1
+#define INITRD_DIR  2
+
+typedef struct {
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];      // octal
+    char mtime[12];
+    char checksum[8];   // octal sum of the header, this field as spaces
+    char typeflag;
+    char linkname[100];
+    char magic[6];      // "ustar\0", or "ustar " from GNU tar
+    char version[2];
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155];   // directory part of long names
+    char pad[12];
+} __attribute__((packed)) tar_header_t;
+
+typedef struct initrd_file {
+    const char *path;          // no leading or trailing '/'
+    uint32_t path_len;
+    const char *name;          // last component of path
+    const uint8_t *data;       // inside the module, read-only
+    uint32_t size;
+    int type;
+    struct initrd_file *next;  // hash chain
+} initrd_file_t;
+
+// Index the first Multiboot module. Needs the heap. Returns the number of
+// entries, or -1 when there is no usable archive.
+int initrd_init(multiboot_info_t *mbi);
+int initrd_count(void);
+uint32_t initrd_size(void);
+const initrd_file_t *initrd_lookup(const char *path);
+// Entries directly inside `dir` ("" or "/" for the root), one per call;
+// *pos starts at 0
+const initrd_file_t *initrd_readdir(const char *dir, uint32_t *pos);
+
+#endif // INITRD_H
@@ -0,0 +1,44 @@
+#ifndef IO_H
+#define IO_H
+
+// Port I/O helpers implemented in kernel.asm
+extern char read_port(unsigned short port);
+extern void write_port(unsigned short port, unsigned char data);
+extern void outb(unsigned short port, unsigned char data);
+extern void outw(unsigned short port, unsigned short data);
+extern unsigned short inw(unsigned short port);
+extern unsigned int inl(unsigned short port);
+extern void outl(unsigned short port, unsigned int data);
+extern void insw(unsigned short port, void *buffer, unsigned int count);
+extern void outsw(unsigned short port, const void *buffer, unsigned int count);
+
+// Interrupt flag control
+static inline void cli(void) {
+    __asm__ volatile ("cli" ::: "memory");
+}
+
+static inline void sti(void) {
+    __asm__ volatile ("sti" ::: "memory");
+}
+
+// Enable interrupts and halt until the next one arrives. The instruction
+// after sti runs before any interrupt is taken, so a wakeup that races with
+// this call is never lost.
+static inline void sti_hlt(void) {
+    __asm__ volatile ("sti; hlt" ::: "memory");
+}
+
+// Disable interrupts and return the previous EFLAGS for irq_restore()
+static inline unsigned long irq_save(void) {
+    unsigned long flags;
+    __asm__ volatile ("pushf; pop %0; cli" : "=r"(flags) :: "memory");
+    return flags;
+}
+
+static inline void irq_restore(unsigned long flags) {
+    if (flags & 0x200) {
+        sti();
+    }
+}
+
+#endif // IO_H
@@ -0,0 +1,103 @@
+#include "ioapic.h"
+#include "acpi.h"
+#include "apic.h"
+#include "idt.h"
+#include "io.h"
+#include "paging.h"
+#include "klog.h"
+
+// Legacy IRQs go through the IOAPIC when the MADT describes one. Each ISA
+// IRQ keeps its vector, IRQ_VECTOR(irq), and is delivered to the boot CPU.
+
+typedef struct {
+    volatile uint32_t *base;
+    uint32_t gsi_base;
+    uint32_t inputs;
+} ioapic_t;
+
+static ioapic_t ioapics[ACPI_MAX_IOAPICS];
+static int ioapic_count = 0;
+static int active = 0;
+static uint32_t boot_apic_id = 0;
+
+static uint32_t ioapic_read(ioapic_t *io, uint32_t reg) {
+    io->base[IOAPIC_IOREGSEL / 4] = reg;
+    return io->base[IOAPIC_IOWIN / 4];
+}
+
+static void ioapic_write(ioapic_t *io, uint32_t reg, uint32_t value) {
+    io->base[IOAPIC_IOREGSEL / 4] = reg;
+    io->base[IOAPIC_IOWIN / 4] = value;
+}
+
+// IOAPIC and input number serving a global system interrupt
+static ioapic_t *find_gsi(uint32_t gsi, uint32_t *pin) {
+    for (int i = 0; i < ioapic_count; i++) {
+        if (gsi >= ioapics[i].gsi_base && gsi < ioapics[i].gsi_base + ioapics[i].inputs) {
+            *pin = gsi - ioapics[i].gsi_base;
+            return &ioapics[i];
+        }
+    }
+    return 0;
+}
+
+static void set_irq(int irq, int masked) {
+    uint16_t flags;
+    uint32_t pin;
+    ioapic_t *io = find_gsi(acpi_isa_gsi(irq, &flags), &pin);
+    if (!io) return;
+
+    uint32_t low = IRQ_VECTOR(irq); // fixed delivery, physical destination
+    if ((flags & ACPI_POLARITY_MASK) == ACPI_POLARITY_LOW) low |= IOAPIC_REDIR_LOW_ACTIVE;
+    if ((flags & ACPI_TRIGGER_MASK) == ACPI_TRIGGER_LEVEL) low |= IOAPIC_REDIR_LEVEL;
+    if (masked) low |= IOAPIC_REDIR_MASKED;
+
+    unsigned long irqflags = irq_save();
+    ioapic_write(io, IOAPIC_REG_REDIR + pin * 2 + 1, boot_apic_id << 24);
+    ioapic_write(io, IOAPIC_REG_REDIR + pin * 2, low);
+    irq_restore(irqflags);
+}
+
+void ioapic_mask_irq(int irq) {
+    set_irq(irq, 1);
+}
+
+void ioapic_unmask_irq(int irq) {
+    set_irq(irq, 0);
+}
+
+int ioapic_active(void) {
+    return active;
+}
+
+// Take over from the 8259 PIC. Call after acpi_init() and idt_init(),
+// while every PIC line is still masked.
+void ioapic_init(void) {
+    if (acpi_ioapic_count() == 0 || !lapic_present()) {
+        klog(KLOG_INFO, KLOG_IRQ, "no IOAPIC, IRQs stay on the 8259 PIC");
+        return;
+    }
+    lapic_init();
+    boot_apic_id = lapic_id();
+
+    for (int i = 0; i < acpi_ioapic_count(); i++) {
+        const acpi_ioapic_t *info = acpi_ioapic(i);
+        ioapic_t *io = &ioapics[ioapic_count];
+        io->base = paging_map_mmio(info->address, 0x20);
+        if (!io->base) continue;
+        io->gsi_base = info->gsi_base;
+        io->inputs = ((ioapic_read(io, IOAPIC_REG_VER) >> 16) & 0xFF) + 1;
+        for (uint32_t pin = 0; pin < io->inputs; pin++) {
+            ioapic_write(io, IOAPIC_REG_REDIR + pin * 2, IOAPIC_REDIR_MASKED);
+        }
+        ioapic_count++;
+        klog(KLOG_INFO, KLOG_IRQ, "IOAPIC %u at %08x, GSI %u-%u", info->id,
+             info->address, io->gsi_base, io->gsi_base + io->inputs - 1);
+    }
+    if (ioapic_count == 0) return;
+
+    // The PIC was remapped and fully masked by idt_init() and stays so
+    write_port(PIC1_DATA, 0xff);
+    write_port(PIC2_DATA, 0xff);
+    active = 1;
+}
@@ -0,0 +1,24 @@
+#ifndef IOAPIC_H
+#define IOAPIC_H
+
+#include <stdint.h>
+
+// Register window: select a register through IOREGSEL, access it at IOWIN
+#define IOAPIC_IOREGSEL 0x00
+#define IOAPIC_IOWIN    0x10
+
+#define IOAPIC_REG_ID    0x00
+#define IOAPIC_REG_VER   0x01
+#define IOAPIC_REG_REDIR 0x10 // two registers per input
+
+// Redirection entry bits (low word)
+#define IOAPIC_REDIR_LOW_ACTIVE 0x02000
+#define IOAPIC_REDIR_LEVEL      0x08000
+#define IOAPIC_REDIR_MASKED     0x10000
+
+void ioapic_init(void);
+int ioapic_active(void);
+void ioapic_mask_irq(int irq);
+void ioapic_unmask_irq(int irq);
+
+#endif // IOAPIC_H
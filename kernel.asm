@@ -2,23 +2,51 @@
 ; License: GPL version 2 or higher http://www.gnu.org/licenses/gpl.html
     
 bits 32
-section .text
+
+MB_MAGIC equ 0x1BADB002
+MB_FLAGS equ 0x03                  ;page-aligned modules, memory map
+
+KERNEL_VIRT_BASE equ 0xC0000000    ;must match link.ld and paging.h
+KERNEL_PDE       equ KERNEL_VIRT_BASE >> 22
+BOOT_MAP_PDES    equ 192           ;768 MiB direct map (KERNEL_DIRECT_MAP_SIZE)
+BOOT_PDE_FLAGS   equ 0x83          ;present, writable, 4 MiB page
+ISR_STUBS        equ 64            ;exceptions, PIC IRQs, LAPIC timer and IPI, MSI (ISR_STUB_COUNT)
+KERNEL_DATA_SEL  equ 0x10          ;selectors, must match gdt.h
+USER_DATA_SEL    equ 0x20 | 3
+PERCPU_SEL       equ 0x28
+SYSCALL_COUNT    equ 4             ;must match syscall.h
+
+section .multiboot
         ;multiboot spec
         align 4
-        dd 0x1BADB002              ;magic
-        dd 0x00                    ;flags
-        dd - (0x1BADB002 + 0x00)   ;checksum. m+f+c should be zero
+        dd MB_MAGIC                ;magic
+        dd MB_FLAGS                ;flags
+        dd - (MB_MAGIC + MB_FLAGS) ;checksum. m+f+c should be zero
+
+section .text
 
 global start
-global keyboard_handler
+global isr_stub_table
+global apic_spurious_handler
 global read_port
 global write_port
 global load_idt
+global gdt_flush
+global switch_context
+global sysenter_entry
+global enter_user
 global outb
 global outw
+global inw
+global inl
+global outl
+global insw
+global outsw
+global boot_page_directory
 
 extern kmain 		;this is defined in the c file
-extern keyboard_handler_main
+extern isr_dispatch
+extern syscall_table
 
 read_port:
 	mov edx, [esp + 4]
@@ -38,10 +66,137 @@ load_idt:
 	sti 				;turn on interrupts
 	ret
 
-keyboard_handler:                 
-	call    keyboard_handler_main
+;Interrupt entry stubs. Each one leaves the same frame (struct regs in
+;idt.h) for isr_common: vectors without a CPU error code push a dummy 0.
+%macro ISR_NOERR 1
+isr_%1:
+	push dword 0
+	push dword %1
+	jmp isr_common
+%endmacro
+
+%macro ISR_ERR 1
+isr_%1:
+	push dword %1
+	jmp isr_common
+%endmacro
+
+%assign vec 0
+%rep ISR_STUBS
+%if vec == 8 || (vec >= 10 && vec <= 14) || vec == 17 || vec == 21 || vec == 29 || vec == 30
+	ISR_ERR vec
+%else
+	ISR_NOERR vec
+%endif
+%assign vec vec + 1
+%endrep
+
+isr_common:
+	pushad
+	push ds
+	push es
+	push fs
+	push gs
+	mov ax, KERNEL_DATA_SEL
+	mov ds, ax
+	mov es, ax
+	mov ax, PERCPU_SEL		;ring 3 may have left anything in gs
+	mov gs, ax
+	cld
+	push esp			;struct regs *
+	call isr_dispatch
+	add esp, 4
+	pop gs
+	pop fs
+	pop es
+	pop ds
+	popad
+	add esp, 8			;vector and error code
 	iretd
 
+apic_spurious_handler:		;spurious APIC interrupts take no EOI
+	iretd
+
+gdt_flush:
+	mov eax, [esp + 4]
+	lgdt [eax]
+	mov ax, 0x10			;kernel data selector
+	mov ds, ax
+	mov es, ax
+	mov fs, ax
+	mov gs, ax
+	mov ss, ax
+	jmp 0x08:.reload_cs		;kernel code selector
+.reload_cs:
+	ret
+
+switch_context:			;(uint32_t *old_esp, uint32_t new_esp)
+	mov eax, [esp + 4]
+	mov edx, [esp + 8]
+	push ebp			;only the callee-saved registers; the
+	push ebx			;caller already assumes eax/ecx/edx die
+	push esi
+	push edi
+	mov [eax], esp
+	mov esp, edx
+	pop edi
+	pop esi
+	pop ebx
+	pop ebp
+	ret
+
+;System calls from ring 3. sysenter arrives with interrupts off, cs/ss from
+;the SYSENTER_CS MSR and esp = the SYSENTER_ESP MSR, which holds the address
+;of this CPU's tss.esp0: one load gives the thread's kernel stack. The user
+;side passes its esp in ecx and its return address in edx (syscall.h).
+;ds and es keep the flat ring 3 data segment, which the kernel can use as
+;it is; only gs has to become the per-CPU segment.
+sysenter_entry:
+	mov esp, [esp]
+	push ecx			;user esp
+	push edx			;user eip
+	mov dx, PERCPU_SEL
+	mov gs, dx
+	cld
+	sti
+	push edi			;arguments, cdecl order
+	push esi
+	push ebx
+	cmp eax, SYSCALL_COUNT
+	jae .bad
+	call [syscall_table + eax * 4]	;keeps ebx, esi, edi and ebp
+.done:
+	add esp, 12
+	cli
+	mov dx, USER_DATA_SEL
+	mov gs, dx
+	pop edx
+	pop ecx
+	sti				;takes effect after sysexit
+	sysexit
+.bad:
+	mov eax, -1
+	jmp .done
+
+enter_user:			;(uint32_t eip, uint32_t esp), never returns
+	cli
+	mov edx, [esp + 4]
+	mov ecx, [esp + 8]
+	mov ax, USER_DATA_SEL
+	mov ds, ax
+	mov es, ax
+	mov fs, ax
+	mov gs, ax
+	push dword 0x002		;flags cleared apart from the reserved bit
+	popfd
+	xor eax, eax			;no kernel values leak to ring 3
+	xor ebx, ebx
+	xor esi, esi
+	xor edi, edi
+	xor ebp, ebp
+	sti				;takes effect after sysexit
+	sysexit
+
 outb:
 	mov dx, [esp + 4]
 	mov al, [esp + 8]
@@ -53,14 +208,87 @@ outw:
 	mov ax, [esp + 8]
 	out dx, ax
 	ret
+
+inw:
+	mov edx, [esp + 4]
+	in ax, dx
+	ret
+
+inl:
+	mov edx, [esp + 4]
+	in eax, dx
+	ret
+
+outl:
+	mov edx, [esp + 4]
+	mov eax, [esp + 8]
+	out dx, eax
+	ret
+
+;insw(port, buffer, count): count 16-bit words from the port to memory
+insw:
+	push edi
+	mov edx, [esp + 8]
+	mov edi, [esp + 12]
+	mov ecx, [esp + 16]
+	rep insw
+	pop edi
+	ret
+
+;outsw(port, buffer, count): count 16-bit words from memory to the port
+outsw:
+	push esi
+	mov edx, [esp + 8]
+	mov esi, [esp + 12]
+	mov ecx, [esp + 16]
+	rep outsw
+	pop esi
+	ret
 	
 
 start:
 	cli 				;block interrupts
+	;paging is still off, so only physical addresses work until the jump
+	mov ecx, boot_page_directory - KERNEL_VIRT_BASE
+	mov cr3, ecx
+	mov ecx, cr4
+	or ecx, 0x10			;PSE: allow 4 MiB pages
+	mov cr4, ecx
+	mov ecx, cr0
+	or ecx, 0x80000000		;PG
+	mov cr0, ecx
+	lea ecx, [higher_half]
+	jmp ecx
+
+higher_half:
 	mov esp, stack_space
+	push ebx			;multiboot info structure (physical)
+	push eax			;multiboot magic
 	call kmain
 	hlt 				;halt the CPU
 
+section .data align=4096
+;Maps the first 4 MiB 1:1 for the jump above, and the first 768 MiB at
+;KERNEL_VIRT_BASE. paging_init() replaces it with the final directory.
+boot_page_directory:
+	dd BOOT_PDE_FLAGS
+	times (KERNEL_PDE - 1) dd 0
+%assign pde 0
+%rep BOOT_MAP_PDES
+	dd (pde << 22) | BOOT_PDE_FLAGS
+%assign pde pde + 1
+%endrep
+	times (1024 - KERNEL_PDE - BOOT_MAP_PDES) dd 0
+
+section .rodata
+;Stub addresses by vector, read by idt_init()
+isr_stub_table:
+%assign vec 0
+%rep ISR_STUBS
+	dd isr_%+vec
+%assign vec vec + 1
+%endrep
+
 section .bss
 resb 8192; 8KB for stack
 stack_space:
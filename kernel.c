@@ -1,47 +1,48 @@
 #include "keyboard_map.h"
-#include "drivers/keyboard.c"
-#include <string.h>
+#include "kernel.h"
+#include "io.h"
+#include "gdt.h"
+#include "paging.h"
+#include "apic.h"
+#include "timer.h"
+#include "console.h"
+#include "multiboot.h"
+#include "pmm.h"
+#include "heap.h"
+#include "idt.h"
+#include "sched.h"
+#include "tty.h"
+#include "shell.h"
+#include "bignum.h"
+#include "cpu.h"
+#include "klib.h"
+#include "serial.h"
+#include "klog.h"
+#include "bench.h"
+#include "selftest.h"
+#include "perf.h"
+#include "acpi.h"
+#include "ioapic.h"
+#include "smp.h"
+#include "task.h"
+#include "initrd.h"
+#include "pci.h"
+#include "ata.h"
+#include "blkdev.h"
+#include "virtio_blk.h"
+#include "bcache.h"
+#include "process.h"
 #include <stdint.h>
-#include <math.h>
-#include <stdarg.h>
 
 // Function prototype for clear_screen
 void clear_screen(void);
-void outb(unsigned short port, unsigned char data);
-void outw(unsigned short port, unsigned short data);
-void update_cursor(int position);
 void reboot(void);
-void print_colored(const char *str, unsigned char color);
-void printn_colored(int num, unsigned char color);
-
-// Colors
-#define COLOR_BLACK 0x00
-#define COLOR_BLUE 0x01
-#define COLOR_GREEN 0x02
-#define COLOR_CYAN 0x03
-#define COLOR_RED 0x04
-#define COLOR_MAGENTA 0x05
-#define COLOR_BROWN 0x06
-#define COLOR_LIGHT_GRAY 0x07
-#define COLOR_DARK_GRAY 0x08
-#define COLOR_LIGHT_BLUE 0x09
-#define COLOR_LIGHT_GREEN 0x0A
-#define COLOR_LIGHT_CYAN 0x0B
-#define COLOR_LIGHT_RED 0x0C
-#define COLOR_LIGHT_MAGENTA 0x0D
-#define COLOR_YELLOW 0x0E
-#define COLOR_WHITE 0x0F
+void shell_thread(void *arg);
 
 unsigned char current_color = COLOR_LIGHT_GRAY; // Current text color
-unsigned char caps_lock = 0;
-unsigned char shift_pressed = 0;
 unsigned char alt_pressed = 0;
 unsigned char ctrl_pressed = 0;
 
-#define LINES 25
-#define COLUMNS_IN_LINE 80
-#define BYTES_FOR_EACH_ELEMENT 2
-#define SCREENSIZE (BYTES_FOR_EACH_ELEMENT * COLUMNS_IN_LINE * LINES)
 // KEYBOARD
 #define KEYBOARD_DATA_PORT 0x60
 #define KEYBOARD_STATUS_PORT 0x64
@@ -68,25 +69,14 @@ unsigned char ctrl_pressed = 0;
 #define F11_KEY_CODE 0x57
 #define F12_KEY_CODE 0x58
 //////////
-#define IDT_SIZE 256
-#define INTERRUPT_GATE 0x8e
-#define KERNEL_CODE_SEGMENT_OFFSET 0x08
 #define MAX_INPUT_SIZE 256 // Максимальная длина ввода
 #define MAX_INPUT_BUFFER_SIZE 256
-#define INT_MAX 2147483647
-#define INT_MIN -2147483648
 
 char input_buffer[MAX_INPUT_BUFFER_SIZE];
 unsigned int input_buffer_index = 0; 
 
-extern unsigned char keyboard_map[128];
-extern unsigned char keyboard_map_caps[128];
 extern unsigned char inb(unsigned short port);
-extern void keyboard_handler(void);
 extern const keyboard_layout_t layout_us;
-extern char read_port(unsigned short port);
-extern void write_port(unsigned short port, unsigned char data);
-extern void load_idt(unsigned long *idt_ptr);
 extern void print(const char *str);
 extern void print_char(char c);
 extern void clear_screen();
@@ -95,96 +85,27 @@ extern void keyboard_init(void);
 extern key_event_t keyboard_read_event(void);
 extern void keyboard_set_layout(const keyboard_layout_t* layout);
 
-unsigned int current_loc = 0;
-char *vidptr = (char*)0xb8000;
-unsigned int lines = 0; // Переменная для отслеживания количества строк
-
-struct IDT_entry {
-    unsigned short int offset_lowerbits;
-    unsigned short int selector;
-    unsigned char zero;
-    unsigned char type_attr;
-    unsigned short int offset_higherbits;
-};
-
-struct IDT_entry IDT[IDT_SIZE];
-
 void set_color(unsigned char color) {
     current_color = color; 
 }
 
-int atoi(const char *str) {
-    int result = 0;
-    int sign = 1;
-
-    while (*str == ' ') str++;
-
-    if (*str == '-' || *str == '+') {
-        if (*str == '-') sign = -1;
-        str++;
-    }
-
-    while (*str >= '0' && *str <= '9') {
-        int digit = *str - '0';
-        if (result > (INT_MAX - digit) / 10) {
-            return (sign == 1) ? INT_MAX : INT_MIN;
-        }
-        result = result * 10 + digit;
-        str++;
-    }
-
-    return sign * result;
-}
-
 void show_cursor() {
-	vidptr[current_loc * 2] = '_'; // Cursor
-	vidptr[current_loc * 2 + 1] = 0x07; // Cursor color
-	update_cursor(current_loc);
+	console_put_at(console_get_pos(), '_', 0x07); // Cursor
 }
 
 void hide_cursor() {
-	vidptr[current_loc * 2] = ' '; // Hiding cursor
-	vidptr[current_loc * 2 + 1] = 0x07; 
-	update_cursor(current_loc);
-}
-
-void update_cursor(int position) {
-	unsigned short pos = (unsigned short)position;
-	outb(0x3D4, 0x0F);
-	outb(0x3D5, (unsigned char)(pos & 0xFF));
-	outb(0x3D4, 0x0E);
-	outb(0x3D5, (unsigned char)((pos >> 8) & 0xFF));
+	console_put_at(console_get_pos(), ' ', 0x07); // Hiding cursor
 }
 
 void print(const char *str) {
     print_colored(str, current_color);
 }
 
+// Output lands in the console's shadow buffer; the screen and the cursor
+// are updated by console_flush() on the next timer tick or input wait. The
+// console also mirrors it to COM1 when a UART is present (see `serial`).
 void print_colored(const char *str, unsigned char color) {
-    unsigned int i = 0;
-    while (str[i] != '\0') {
-        if (str[i] == '\n') {
-            current_loc += 80 - (current_loc % 80);
-            lines++;
-        } else {
-            vidptr[current_loc * 2] = str[i];
-            vidptr[current_loc * 2 + 1] = color;
-            current_loc++;
-        }
-
-        if (current_loc >= 80 * 25) {
-            current_loc = 0;
-        }
-        i++;
-    }
-
-    if (lines >= LINES) {
-        clear_screen();
-        lines = 0;
-    }
-
-    // Updating cursor after printing text
-    update_cursor(current_loc);
+    console_write(str, color);
 }
 
 void printn(int num) {
@@ -209,166 +130,115 @@ void printn_colored(int num, unsigned char color) {
         buffer[i++] = '-';
     }
 
+    char digits[32];
+    int len = 0;
     for (int j = i - 1; j >= 0; j--) {
-        vidptr[current_loc * 2] = buffer[j];
-        vidptr[current_loc * 2 + 1] = color;
-        current_loc++;
-
-        if (current_loc >= 80 * 25) {
-            current_loc = 0;
-        }
-    }
-
-    if (lines >= LINES) {
-        clear_screen();
-        lines = 0;
+        digits[len++] = buffer[j];
     }
+    digits[len] = '\0';
+    console_write(digits, color);
 }
 
-void kprint_newline(void) {
-    current_loc += (80 - (current_loc % 80));
-    lines++; // Увеличиваем количество строк
-}
-
-void clear_screen(void) {
-    unsigned int i = 0;
-    while (i < SCREENSIZE) {
-        vidptr[i++] = ' ';
-        vidptr[i++] = 0x07;
-    }
-    current_loc = 0;
-    lines = 0; // Сбрасываем количество строк
-}
-
-void keyboard_handler_main(void) {
-    key_event_t event = keyboard_read_event();
-    
-    if (!event.is_released && event.ascii) {
-        // Handle normal keypresses
-        vidptr[current_loc * 2] = event.ascii;
-        vidptr[current_loc * 2 + 1] = current_color;
-        current_loc++;
-        
-        if (current_loc >= 80 * 25) {
-            current_loc = 0;
-        }
+void printx(unsigned int num) {
+    char buffer[11] = "0x";
+    for (int i = 0; i < 8; i++) {
+        unsigned int digit = (num >> (28 - i * 4)) & 0xF;
+        buffer[2 + i] = digit < 10 ? '0' + digit : 'a' + digit - 10;
     }
-    
-    // Send End of Interrupt
-    write_port(0x20, 0x20);
+    buffer[10] = '\0';
+    print(buffer);
 }
 
-void keyboard_init() {
-    // initialize keyboard_map
-    for (int i = 0; i < 128; i++) {
-        keyboard_map[i] = 0;
-        keyboard_map_caps[i] = 0;
+// Fixed-width lowercase hex without the 0x prefix
+static void print_hex(uint32_t num, int digits) {
+    char buffer[9];
+    for (int i = 0; i < digits; i++) {
+        unsigned int digit = (num >> ((digits - 1 - i) * 4)) & 0xF;
+        buffer[i] = digit < 10 ? '0' + digit : 'a' + digit - 10;
     }
-    outb(0x21, 0xFD);
+    buffer[digits] = '\0';
+    print(buffer);
 }
 
-void input(char *buffer, int max_size) {
-    unsigned int index = 0;
-    while (index < max_size - 1) {
-        unsigned char status = read_port(KEYBOARD_STATUS_PORT);
-        if (status & 0x01) {
-            unsigned char keycode = read_port(KEYBOARD_DATA_PORT);
-            if (keycode == ENTER_KEY_CODE) {
-                break;
-            }
-            if (keycode < 128) {
-                char c = keyboard_map[keycode];
-                if (c != 0) {
-                    if (c == '\b') {
-                        if (index > 0) {
-                            index--;
-                            vidptr[current_loc * 2 - 2] = ' ';
-                            vidptr[current_loc * 2 - 1] = 0x07;
-                            current_loc--;
-                        }
-                    } else {
-                        // Apply Caps Lock and Shift logic
-                        if (caps_lock ^ shift_pressed) { // XOR: if Caps Lock or Shift is pressed, but not both
-                            if (c >= 'a' && c <= 'z') {
-                                c -= 32; // Convert to uppercase
-                            }
-                        }
-                        buffer[index++] = c;
-                        vidptr[current_loc * 2] = c;
-                        vidptr[current_loc * 2 + 1] = 0x07;
-                        current_loc++;
-                    }
-                }
-            }
-        }
-        // Updating cursor after entering every symbol
-        update_cursor(current_loc);
-    }
-    buffer[index] = '\0';
-    kprint_newline();
+void printu64(uint64_t num) {
+    char buffer[21];
+    int i = sizeof(buffer) - 1;
+    buffer[i] = '\0';
+    do {
+        buffer[--i] = '0' + div64_32(&num, 10);
+    } while (num);
+    print(&buffer[i]);
 }
 
-int inputn() {
-    char buffer[MAX_INPUT_SIZE];
-    input(buffer, MAX_INPUT_SIZE);
-    return atoi(buffer);
+void kprint_newline(void) {
+    console_newline();
 }
 
-void idt_init(void) {
-    unsigned long keyboard_address;
-    unsigned long idt_address;
-    unsigned long idt_ptr[2];
-
-    keyboard_address = (unsigned long)keyboard_handler;
-    IDT[0x21].offset_lowerbits = keyboard_address & 0xffff;
-    IDT[0x21].selector = KERNEL_CODE_SEGMENT_OFFSET;
-    IDT[0x21].zero = 0;
-    IDT[0x21].type_attr = INTERRUPT_GATE;
-    IDT[0x21].offset_higherbits = (keyboard_address & 0xffff0000) >> 16;
-
-    write_port(0x20, 0x11);
-    write_port(0xA0, 0x11);
-    write_port(0x21, 0x20);
-    write_port(0xA1, 0x28);
-    write_port(0x21, 0x00);
-    write_port(0xA1, 0x00);
-    write_port(0x21, 0x01);
-    write_port(0xA1, 0x01);
-
-    write_port(0x21, 0xff);
-    write_port(0xA1, 0xff);
+void clear_screen(void) {
+    console_clear();
+}
 
-    idt_address = (unsigned long)IDT;
-    idt_ptr[0] = (sizeof(struct IDT_entry) * IDT_SIZE) + ((idt_address & 0xffff) << 16);
-    idt_ptr[1] = idt_address >> 16;
-    load_idt(idt_ptr);
+// Read a line typed at the console. Echo and editing happen in the tty
+// thread, so keys typed while a command runs show up immediately.
+void input(char *buffer, int max_size) {
+    tty_read_line(buffer, max_size);
 }
 
 void kb_init(void) {
-    write_port(0x21, 0xFD);
+    register_irq_handler(IRQ_VECTOR(1), keyboard_handler_main);
+    irq_unmask(1);
 }
 
-unsigned long factorial(int n) {
-    if (n < 0) return 0; // Факториал для отрицательных чисел не определен
-    unsigned long result = 1;
-    for (int i = 1; i <= n; i++) {
-        result *= i;
+// Exact n! via the bignum product tree, with the TSC cycles spent on the
+// multiplications and on the decimal conversion
+int factorial_command(int n) {
+    bignum_t result;
+    uint32_t digits = 0;
+
+    if (n < 0 || n > BN_FACTORIAL_MAX) {
+        print_colored("Number must be between 0 and ", COLOR_LIGHT_RED);
+        printn_colored(BN_FACTORIAL_MAX, COLOR_LIGHT_RED);
+        print("\n");
+        return -1;
     }
-    return result;
-}
+    if (bn_init(&result, 1) < 0) {
+        print_colored("Out of memory\n", COLOR_LIGHT_RED);
+        return -1;
+    }
+
+    uint64_t start = rdtsc();
+    int err = bn_factorial(&result, n);
+    uint64_t multiplied = rdtsc();
+    char *text = err < 0 ? 0 : bn_to_decimal(&result, &digits);
+    uint64_t converted = rdtsc();
+    bn_free(&result);
 
-void factorial_calculator(void) {
-    print("\nFACTORIAL CALCULATOR");
-    kprint_newline();
-    int num;
-    print("Please enter a number:");
-    num = inputn();
-    unsigned long result = factorial(num);
-    printn(num);
+    if (!text) {
+        print_colored("Out of memory\n", COLOR_LIGHT_RED);
+        return -1;
+    }
+    printn(n);
     print("! = ");
-    printn(result);
+    print(text);
     print("\n");
-    kprint_newline();
+    kfree(text);
+
+    uint64_t total = converted - start;
+    print_colored("Digits: ", COLOR_LIGHT_CYAN);
+    printn(digits);
+    print(", cycles: ");
+    printu64(multiplied - start);
+    print(" multiply + ");
+    printu64(converted - multiplied);
+    print(" decimal");
+    if (timer_tsc_khz()) {
+        div64_32(&total, timer_tsc_khz());
+        print(" (");
+        printu64(total);
+        print(" ms)");
+    }
+    print("\n");
+    return 0;
 }
 
 void decimal_to_binary(int n) {
@@ -377,24 +247,18 @@ void decimal_to_binary(int n) {
         return;
     }
     char binary[32];
+    char digits[33];
     int index = 0;
     while (n > 0) {
         binary[index++] = (n % 2) + '0';
         n /= 2;
     }
+    int len = 0;
     for (int i = index - 1; i >= 0; i--) {
-        vidptr[current_loc * 2] = binary[i];
-        vidptr[current_loc * 2 + 1] = 0x07;
-        current_loc++;
+        digits[len++] = binary[i];
     }
-}
-
-int strcmp(const char *s1, const char *s2) {
-    while (*s1 && (*s1 == *s2)) {
-        s1++;
-        s2++;
-    }
-    return *(unsigned char *)s1 - *(unsigned char *)s2;
+    digits[len] = '\0';
+    console_write(digits, 0x07);
 }
 
 unsigned int rand() {
@@ -403,10 +267,6 @@ unsigned int rand() {
     return seed % 3; // Получаем число от 0 до 2
 }
 
-void delay(unsigned int count) {
-    for (volatile unsigned int i = 0; i < count; i++);
-}
-
 void welcome_screen(void) {
     clear_screen();
     print_colored("========================================\n", COLOR_LIGHT_BLUE);
@@ -420,12 +280,61 @@ void welcome_screen(void) {
     print_colored("Press any key to continue...\n", COLOR_LIGHT_GREEN);
 
     // Wait for any key press
+    key_event_t event;
+    console_flush();
+    keyboard_wait_event(&event);
+}
+
+static char boot_cmdline[CMDLINE_MAX];
+
+static void save_cmdline(multiboot_info_t *mbi) {
+    if (!(mbi->flags & MULTIBOOT_INFO_CMDLINE) || !mbi->cmdline) return;
+    const char *src = phys_to_virt(mbi->cmdline);
+    int i = 0;
+    for (; src[i] && i < CMDLINE_MAX - 1; i++) boot_cmdline[i] = src[i];
+    boot_cmdline[i] = '\0';
+}
+
+// Whether the Multiboot command line contains `word` as a whole
+// space-separated word. The first word is usually the kernel path.
+int cmdline_has(const char *word) {
+    int len = strlen(word);
+    const char *p = boot_cmdline;
+    while (*p) {
+        while (*p == ' ') p++;
+        const char *start = p;
+        while (*p && *p != ' ') p++;
+        if (p - start == len && memcmp(start, word, len) == 0) return 1;
+    }
+    return 0;
+}
+
+const char *cmdline(void) {
+    return boot_cmdline;
+}
+
+// TSC cycles spent initializing, not counting the welcome animation
+static uint64_t boot_cycles = 0;
+
+uint32_t boot_time_us(void) {
+    uint32_t khz = timer_tsc_khz();
+    if (!khz) return 0;
+    uint64_t us = boot_cycles * 1000;
+    div64_32(&us, khz);
+    return (uint32_t)us;
+}
+
+// Report a fatal error and stop the machine
+void panic(const char *message) {
+    cli();
+    klog(KLOG_ERR, KLOG_KERNEL, "panic: %s", (uint32_t)message);
+    print_colored("\nKernel panic: ", COLOR_LIGHT_RED);
+    print_colored(message, COLOR_LIGHT_RED);
+    print("\n");
+    console_flush();
+    serial_flush();
     while (1) {
-        unsigned char status = read_port(KEYBOARD_STATUS_PORT);
-        if (status & 0x01) {
-            read_port(KEYBOARD_DATA_PORT);
-            break;
-        }
+        __asm__ volatile ("cli; hlt");
     }
 }
 
@@ -442,73 +351,672 @@ void display_date() {
     print_colored("Current date: 2023-10-01\n", COLOR_LIGHT_CYAN);
 }
 
-// New function to echo text
-void echo_command(const char *text) {
-    print_colored(text, COLOR_LIGHT_GREEN);
+// Show physical frame allocator usage
+void mem_command() {
+    print_colored("Physical memory (4 KiB frames):\n", COLOR_LIGHT_GREEN);
+    print("  Total: ");
+    printn(pmm_total_count());
+    print(" (");
+    printn(pmm_total_count() * 4);
+    print(" KiB)\n  Used:  ");
+    printn(pmm_used_count());
+    print("\n  Free:  ");
+    printn(pmm_free_count());
+    print("\n  Free blocks by order:");
+    for (int order = 0; order <= PMM_MAX_ORDER; order++) {
+        print(" ");
+        printn(pmm_free_blocks(order));
+    }
+    print("\n");
+}
+
+// List a directory of the initrd
+int ls_command(const char *dir) {
+    const initrd_file_t *d = initrd_lookup(dir);
+    if (!initrd_count() || (dir[0] && strcmp(dir, "/") != 0 && (!d || d->type != INITRD_DIR))) {
+        print_colored("No such directory: ", COLOR_LIGHT_RED);
+        print_colored(dir, COLOR_LIGHT_RED);
+        print("\n");
+        return -1;
+    }
+    uint32_t pos = 0;
+    const initrd_file_t *f;
+    while ((f = initrd_readdir(dir, &pos))) {
+        print("  ");
+        if (f->type == INITRD_DIR) {
+            print_colored(f->name, COLOR_LIGHT_CYAN);
+            print("/\n");
+        } else {
+            print(f->name);
+            print("  ");
+            printn(f->size);
+            print("\n");
+        }
+    }
+    return 0;
+}
+
+// Print an initrd file, straight from the module
+int cat_command(const char *path) {
+    const initrd_file_t *f = initrd_lookup(path);
+    if (!f || f->type != INITRD_FILE) {
+        print_colored("No such file: ", COLOR_LIGHT_RED);
+        print_colored(path, COLOR_LIGHT_RED);
+        print("\n");
+        return -1;
+    }
+    char chunk[128];
+    for (uint32_t off = 0; off < f->size; off += sizeof(chunk) - 1) {
+        uint32_t n = f->size - off < sizeof(chunk) - 1 ? f->size - off : sizeof(chunk) - 1;
+        memcpy(chunk, f->data + off, n);
+        chunk[n] = '\0';
+        print(chunk);
+    }
+    if (f->size && f->data[f->size - 1] != '\n') print("\n");
+    return 0;
+}
+
+// List PCI functions with their BARs and the driver that took them
+void lspci_command() {
+    print_colored("PCI devices:\n", COLOR_LIGHT_GREEN);
+    if (pci_device_count() == 0) print("  none\n");
+    for (int i = 0; i < pci_device_count(); i++) {
+        const pci_device_t *dev = pci_device(i);
+        print("  ");
+        print_hex(dev->addr.bus, 2);
+        print(":");
+        print_hex(dev->addr.device, 2);
+        print(".");
+        printn(dev->addr.function);
+        print(" ");
+        print_hex(dev->vendor, 4);
+        print(":");
+        print_hex(dev->device, 4);
+        print(" ");
+        print(pci_class_name(dev->class, dev->subclass));
+        if (dev->irq_pin) {
+            print(", irq ");
+            printn(dev->irq_line);
+        }
+        if (dev->msi_cap) print(", MSI");
+        if (dev->msix_cap) print(", MSI-X");
+        if (dev->driver) {
+            print(", driver ");
+            print_colored(dev->driver->name, COLOR_LIGHT_GREEN);
+        }
+        print("\n");
+        for (int b = 0; b < PCI_BARS; b++) {
+            const pci_bar_t *bar = &dev->bar[b];
+            if (!bar->size) continue;
+            print("      BAR");
+            printn(b);
+            print(bar->flags & PCI_BAR_FLAG_IO ? ": I/O at " : ": memory at ");
+            printx(bar->base);
+            print(", ");
+            if (bar->size >= 1024) {
+                printn(bar->size / 1024);
+                print(" KiB");
+            } else {
+                printn(bar->size);
+                print(" bytes");
+            }
+            if (bar->flags & PCI_BAR_FLAG_64) print(", 64-bit");
+            if (bar->flags & PCI_BAR_FLAG_PREFETCH) print(", prefetchable");
+            print("\n");
+        }
+    }
+}
+
+// List the block devices, virtqueue counters and the block cache counters
+void disk_command() {
+    print_colored("Drives:\n", COLOR_LIGHT_GREEN);
+    if (blkdev_count() == 0) print("  none\n");
+    for (int i = 0; i < blkdev_count(); i++) {
+        const blkdev_t *d = blkdev_get(i);
+        print("  ");
+        print(d->name);
+        print(": ");
+        print(d->model);
+        print(", ");
+        printn(d->sectors / 2048);
+        print(" MiB, ");
+        print(d->mode);
+        print(", ");
+        printn(d->reads);
+        print(" reads, ");
+        printn(d->writes);
+        print(" writes in ");
+        printn(d->batches);
+        print(" batches, ");
+        printn(d->errors);
+        print(" errors\n");
+    }
+    for (int i = 0; i < virtio_blk_count(); i++) {
+        virtio_blk_stats_t vs;
+        virtio_blk_stats(i, &vs);
+        print("  ");
+        print(blkdev_get(vs.blkdev)->name);
+        print(" queue: ");
+        printn(vs.queue_size);
+        print(" entries, event index ");
+        print(vs.event_idx ? "on, " : "off, ");
+        printn(vs.kicks);
+        print(" kicks, ");
+        printn(vs.notifies);
+        print(" notifications, ");
+        printn(vs.irqs);
+        print(" interrupts\n");
+    }
+
+    bcache_stats_t stats;
+    bcache_get_stats(&stats);
+    print_colored("Block cache:\n", COLOR_LIGHT_GREEN);
+    print("  Hits: ");
+    printn(stats.hits);
+    print(", misses: ");
+    printn(stats.misses);
+    if (stats.hits + stats.misses > 0) {
+        uint64_t rate = (uint64_t)stats.hits * 100;
+        div64_32(&rate, stats.hits + stats.misses);
+        print(" (");
+        printn((uint32_t)rate);
+        print("% hit rate)");
+    }
+    print("\n  Read ahead: ");
+    printn(stats.readahead);
+    print(" blocks, ");
+    printn(stats.readahead_hits);
+    print(" used\n  Cached: ");
+    printn(stats.cached);
+    print(" of ");
+    printn(BCACHE_BLOCKS);
+    print(", dirty: ");
+    printn(stats.dirty);
+    print(", evictions: ");
+    printn(stats.evictions);
+    print("\n  Written back: ");
+    printn(stats.writebacks);
+    print(" blocks in ");
+    printn(stats.flush_commands);
+    print(" commands\n");
+}
+
+// Show kernel heap counters and per-size-class slab usage
+void heap_command() {
+    heap_stats_t stats;
+    heap_get_stats(&stats);
+
+    print_colored("Kernel heap:\n", COLOR_LIGHT_GREEN);
+    print("  Allocations: ");
+    printn(stats.allocs);
+    print(", frees: ");
+    printn(stats.frees);
+    print(", failed: ");
+    printn(stats.failures);
+    print("\n  Frames: ");
+    printn(stats.slab_frames);
+    print(" slab, ");
+    printn(stats.large_frames);
+    print(" large (");
+    printn(stats.large_allocs);
+    print(" allocations)\n  Bytes in use: ");
+    printn(stats.used_bytes);
+    print(", free in slabs: ");
+    printn(stats.free_bytes);
+    if (stats.used_bytes + stats.free_bytes > 0) {
+        print(" (");
+        printn(stats.free_bytes * 100 / (stats.used_bytes + stats.free_bytes));
+        print("% fragmentation)");
+    }
+    print("\n  Size  Slabs  In use / capacity\n");
+    for (int i = 0; i < HEAP_CLASSES; i++) {
+        const kmem_cache_t *cache = heap_cache(i);
+        print("  ");
+        printn(cache->size);
+        print("  ");
+        printn(cache->slabs);
+        print("  ");
+        printn(cache->inuse);
+        print(" / ");
+        printn(cache->slabs * cache->per_slab);
+        print("\n");
+    }
+}
+
+// List kernel threads and scheduler counters
+void ps_command() {
+    print_colored("  ID  Name            Prio  State     Switches  Ticks\n", COLOR_LIGHT_GREEN);
+    unsigned long flags = irq_save();
+    for (thread_t *t = thread_first(); t; t = t->all_next) {
+        print("  ");
+        printn(t->id);
+        print("  ");
+        print(t->name);
+        print("  ");
+        printn(t->priority);
+        print("  ");
+        print(thread_state_name(t->state));
+        print("  ");
+        printn(t->switches);
+        print("  ");
+        printn(t->run_ticks);
+        print("\n");
+    }
+    irq_restore(flags);
+    print("  Context switches: ");
+    printn(sched_switch_count());
+    print(", FPU traps: ");
+    printn(sched_fpu_traps());
+    print("\n");
+}
+
+// Show the COM1 mirror mode and traffic counters
+void serial_command() {
+    static const char *modes[] = {"off", "plain", "ansi"};
+    print_colored("COM1 (115200 8N1):\n", COLOR_LIGHT_GREEN);
+    print("  Mirror: ");
+    print(modes[serial_mirror()]);
+    print("\n  Sent: ");
+    printn(serial_tx_bytes());
+    print(" bytes, received: ");
+    printn(serial_rx_bytes());
+    print(" bytes, full-buffer waits: ");
+    printn(serial_tx_stalls());
+    print("\n");
+}
+
+// Render the kernel log, oldest first, showing records at `max_level` or
+// more severe
+void dmesg_command(int max_level) {
+    static const unsigned char level_colors[] = {
+        COLOR_LIGHT_RED, COLOR_YELLOW, COLOR_LIGHT_GRAY, COLOR_DARK_GRAY,
+    };
+    char line[KLOG_LINE_MAX];
+    klog_record_t rec;
+
+    uint32_t end = klog_count();
+    uint32_t seq = end > KLOG_RECORDS ? end - KLOG_RECORDS : 0;
+    uint32_t lost = seq;
+    for (; seq != end; seq++) {
+        if (klog_read(seq, &rec) < 0) {
+            lost++;
+            continue;
+        }
+        if (rec.level > max_level) continue;
+        klog_format(&rec, line, sizeof(line));
+        print_colored(line, level_colors[rec.level]);
+        print("\n");
+    }
+    if (lost) {
+        printn(lost);
+        print(" older records overwritten\n");
+    }
+}
+
+// Show how often each interrupt vector has fired
+void irq_command() {
+    print_colored("Interrupts:\n", COLOR_LIGHT_GREEN);
+    for (int vector = 0; vector < IDT_SIZE; vector++) {
+        if (irq_count(vector) == 0) continue;
+        print("  ");
+        printx(vector);
+        if (vector >= IRQ_BASE && vector < IRQ_BASE + IRQ_COUNT) {
+            print(" IRQ");
+            printn(vector - IRQ_BASE);
+        } else if (vector >= PCI_MSI_VECTOR_BASE && vector < PCI_MSI_VECTOR_END) {
+            print(" MSI");
+        }
+        print(": ");
+        printn(irq_count(vector));
+        print("\n");
+    }
+    print("  Spurious PIC interrupts: ");
+    printn(irq_spurious_count());
     print("\n");
+    print(ioapic_active() ? "  Legacy IRQs routed through the IOAPIC\n"
+                          : "  Legacy IRQs routed through the 8259 PIC\n");
 }
 
-void kmain(void) {
+void cpus_command() {
+    uint32_t khz = timer_tsc_khz();
+    print_colored("Processors:\n", COLOR_LIGHT_GREEN);
+    for (int i = 0; i < smp_cpu_count(); i++) {
+        cpu_t *cpu = smp_cpu(i);
+        print("  cpu ");
+        printn(i);
+        print(": APIC id ");
+        printn(cpu->apic_id);
+        if (i == 0) {
+            print(", runs the threads");
+        } else {
+            print(", ");
+            printn(cpu->jobs);
+            print(" jobs");
+            if (khz) {
+                uint64_t ms = cpu->busy_cycles;
+                div64_32(&ms, khz);
+                print(", ");
+                printn((uint32_t)ms);
+                print(" ms busy");
+            }
+        }
+        const task_stats_t *tasks = task_stats(i);
+        print("\n    tasks: ");
+        printn(tasks->spawned);
+        print(" spawned, ");
+        printn(tasks->executed);
+        print(" run, ");
+        printn(tasks->stolen);
+        print(" stolen, ");
+        printn(tasks->inlined);
+        print(" inline, ");
+        printn(tasks->parks);
+        print(" idle\n");
+    }
+}
+
+void kmain(uint32_t magic, multiboot_info_t *mbi) {
+    uint64_t boot_start = rdtsc();
+    klog_init();
+    console_init();
+    gdt_init();
+    if (magic == MULTIBOOT_BOOTLOADER_MAGIC) {
+        // Copied before the frame allocator can hand out the page it is on
+        save_cmdline(phys_to_virt(mbi));
+        pmm_init(phys_to_virt(mbi));
+        klog(KLOG_INFO, KLOG_MEM, "%u KiB usable, %u frames free",
+             pmm_total_count() * 4, pmm_free_count());
+    } else {
+        klog(KLOG_WARN, KLOG_MEM, "no multiboot memory map (magic %08x)", magic);
+    }
+    // Leaves the boot page directory and its low identity mapping behind
+    paging_init();
+    heap_init();
+    if (magic == MULTIBOOT_BOOTLOADER_MAGIC) {
+        initrd_init(phys_to_virt(mbi));
+    }
+    // IDT and PIC first; every IRQ line stays masked until its driver is ready
+    idt_init();
+    // The MADT tells whether an IOAPIC takes over from the PIC, and which
+    // CPUs smp_init() can start
+    acpi_init();
+    ioapic_init();
+    timer_init();
     // initializing keyboard
     keyboard_init();
     keyboard_set_layout(&layout_us);
-    welcome_screen();
-    clear_screen();
+    kb_init();
+    // COM1 mirrors the console and feeds the shell alongside the keyboard
+    serial_init();
+    smp_init();
+    pci_init();
+    ata_init();
+    virtio_blk_init();
+    int selftest = cmdline_has(SELFTEST_FLAG);
+    boot_cycles = rdtsc() - boot_start;
+    if (!selftest) {
+        welcome_screen();
+        clear_screen();
+    }
+    boot_start = rdtsc();
     print_colored("Hello, user\nCoreOS are successfully booted!\n", COLOR_LIGHT_GREEN);
 
+    // From here on the boot context is the idle thread; the shell and the
+    // console line discipline run as kernel threads
+    sched_init();
+    // Ring 3 programs from the initrd's bin/, entered through sysenter
+    process_init();
+    klib_init();
+    bench_init();
+    bcache_init();
+    tty_init();
+    boot_cycles += rdtsc() - boot_start;
+    klog(KLOG_INFO, KLOG_KERNEL, "boot took %u us", boot_time_us());
+    if (selftest) {
+        thread_create("selftest", selftest_thread, 0, SCHED_PRIO_NORMAL);
+    } else {
+        thread_create("shell", shell_thread, 0, SCHED_PRIO_NORMAL);
+    }
+    sched_idle();
+}
+
+int cmd_bench(int argc, char **argv) {
+    if (argc < 2) {
+        bench_list();
+        print("Run with: bench all | bench <name prefix>\n");
+        return 0;
+    }
+    for (int i = 1; i < argc; i++) {
+        if (bench_run_matching(argv[i]) == 0) {
+            print_colored("No benchmark matches ", COLOR_LIGHT_RED);
+            print_colored(argv[i], COLOR_LIGHT_RED);
+            print("\n");
+        }
+    }
+    return 0;
+}
+
+int cmd_binary(int argc, char **argv) {
+    print("Binary: ");
+    decimal_to_binary(atoi(argv[1]));
+    print("\n");
+    return 0;
+}
+
+int cmd_cat(int argc, char **argv) {
+    int err = 0;
+    for (int i = 1; i < argc; i++) {
+        if (cat_command(argv[i]) < 0) err = -1;
+    }
+    return err;
+}
+
+int cmd_clear(int argc, char **argv) {
+    clear_screen();
+    return 0;
+}
+
+int cmd_color(int argc, char **argv) {
+    int color = atoi(argv[1]);
+    if (color < 0 || color > 15) {
+        print_colored("Invalid color!\n", COLOR_LIGHT_RED);
+        return -1;
+    }
+    set_color(color);
+    print_colored("Color changed!\n", color);
+    return 0;
+}
+
+int cmd_cpus(int argc, char **argv) {
+    cpus_command();
+    return 0;
+}
+
+int cmd_date(int argc, char **argv) {
+    display_date();
+    return 0;
+}
+
+int cmd_dmesg(int argc, char **argv) {
+    int level = KLOG_DEBUG;
+    if (argc > 1) {
+        for (level = KLOG_ERR; level <= KLOG_DEBUG; level++) {
+            if (strcmp(argv[1], klog_level_name(level)) == 0) break;
+        }
+        if (level > KLOG_DEBUG) {
+            print_colored("Usage: dmesg [err|warn|info|debug]\n", COLOR_LIGHT_RED);
+            return -1;
+        }
+    }
+    dmesg_command(level);
+    return 0;
+}
+
+int cmd_disk(int argc, char **argv) {
+    if (argc > 1 && strcmp(argv[1], "flush") == 0) {
+        return bcache_flush();
+    }
+    if (argc > 1) {
+        print_colored("Usage: disk [flush]\n", COLOR_LIGHT_RED);
+        return -1;
+    }
+    disk_command();
+    return 0;
+}
+
+int cmd_echo(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        if (i > 1) print_colored(" ", COLOR_LIGHT_GREEN);
+        print_colored(argv[i], COLOR_LIGHT_GREEN);
+    }
+    print("\n");
+    return 0;
+}
+
+int cmd_factorial(int argc, char **argv) {
+    return factorial_command(atoi(argv[1]));
+}
+
+int cmd_heap(int argc, char **argv) {
+    heap_command();
+    return 0;
+}
+
+int cmd_help(int argc, char **argv) {
+    shell_help();
+    return 0;
+}
+
+int cmd_irq(int argc, char **argv) {
+    irq_command();
+    return 0;
+}
+
+int cmd_ls(int argc, char **argv) {
+    return ls_command(argc > 1 ? argv[1] : "");
+}
+
+int cmd_lspci(int argc, char **argv) {
+    lspci_command();
+    return 0;
+}
+
+int cmd_mem(int argc, char **argv) {
+    mem_command();
+    return 0;
+}
+
+int cmd_perf(int argc, char **argv) {
+    if (argc < 2) {
+        if (perf_running()) {
+            print("perf: sampling, ");
+            printn(perf_samples());
+            print(" samples so far\n");
+        } else {
+            print("perf: stopped\n");
+        }
+        print("Usage: perf start [hz] | perf stop [top] | perf report [top]\n");
+        return 0;
+    }
+    if (strcmp(argv[1], "start") == 0) {
+        uint32_t hz = argc > 2 ? atoi(argv[2]) : PERF_DEFAULT_HZ;
+        if (perf_start(hz) < 0) {
+            print_colored("perf: rate must be 1-", COLOR_LIGHT_RED);
+            printn_colored(TIMER_HZ, COLOR_LIGHT_RED);
+            print_colored(" Hz\n", COLOR_LIGHT_RED);
+            return -1;
+        }
+        print("perf: sampling; run commands, then `perf stop`\n");
+        return 0;
+    }
+    int top = argc > 2 ? atoi(argv[2]) : PERF_DEFAULT_TOP;
+    if (strcmp(argv[1], "stop") == 0) {
+        perf_stop();
+        perf_report(top);
+    } else if (strcmp(argv[1], "report") == 0) {
+        perf_report(top);
+    } else {
+        print_colored("Usage: perf start [hz] | perf stop [top] | perf report [top]\n", COLOR_LIGHT_RED);
+        return -1;
+    }
+    return 0;
+}
+
+int cmd_ps(int argc, char **argv) {
+    ps_command();
+    return 0;
+}
+
+int cmd_reboot(int argc, char **argv) {
+    print_colored("Rebooting...\n", COLOR_LIGHT_RED);
+    reboot();
+    return 0;
+}
+
+int cmd_serial(int argc, char **argv) {
+    if (!serial_present()) {
+        print_colored("No UART on COM1\n", COLOR_LIGHT_RED);
+        return -1;
+    }
+    if (argc > 1) {
+        if (strcmp(argv[1], "off") == 0) {
+            serial_set_mirror(SERIAL_MIRROR_OFF);
+        } else if (strcmp(argv[1], "plain") == 0) {
+            serial_set_mirror(SERIAL_MIRROR_PLAIN);
+        } else if (strcmp(argv[1], "ansi") == 0) {
+            serial_set_mirror(SERIAL_MIRROR_ANSI);
+        } else {
+            print_colored("Usage: serial [off|plain|ansi]\n", COLOR_LIGHT_RED);
+            return -1;
+        }
+    }
+    serial_command();
+    return 0;
+}
+
+int cmd_shutdown(int argc, char **argv) {
+    print_colored("Shutting down...\n", COLOR_LIGHT_RED);
+    shutdown();
+    return 0;
+}
+
+// Shell commands; shell_init() sorts them for lookup and help
+static const shell_command_t commands[] = {
+    {"bench",     cmd_bench,     0, "[all|name...]", "Run microbenchmarks (results also on port 0xE9)"},
+    {"binary",    cmd_binary,    1, "<number>", "Convert a number to binary"},
+    {"cat",       cmd_cat,       1, "<file...>", "Print files from the initrd"},
+    {"clear",     cmd_clear,     0, "",         "Clear the screen"},
+    {"color",     cmd_color,     1, "<0-15>",   "Change text color"},
+    {"cpus",      cmd_cpus,      0, "",         "List processors and the work they ran"},
+    {"date",      cmd_date,      0, "",         "Display current date"},
+    {"dmesg",     cmd_dmesg,     0, "[err|warn|info|debug]", "Show the kernel log"},
+    {"disk",      cmd_disk,      0, "[flush]",  "Show disks and block cache counters, or write back the cache"},
+    {"echo",      cmd_echo,      0, "[text...]", "Echo text"},
+    {"factorial", cmd_factorial, 1, "<number>", "Calculate factorial of a number"},
+    {"heap",      cmd_heap,      0, "",         "Show kernel heap statistics"},
+    {"help",      cmd_help,      0, "",         "Show this help message"},
+    {"irq",       cmd_irq,       0, "",         "Show interrupt counters"},
+    {"ls",        cmd_ls,        0, "[dir]",    "List initrd files"},
+    {"lspci",     cmd_lspci,     0, "",         "List PCI devices and their drivers"},
+    {"mem",       cmd_mem,       0, "",         "Show physical memory usage"},
+    {"perf",      cmd_perf,      0, "[start [hz]|stop|report] [top]", "Sample where the kernel spends its time"},
+    {"ps",        cmd_ps,        0, "",         "List kernel threads"},
+    {"reboot",    cmd_reboot,    0, "",         "Reboot PC"},
+    {"serial",    cmd_serial,    0, "[off|plain|ansi]", "Set or show the COM1 console mirror"},
+    {"shutdown",  cmd_shutdown,  0, "",         "Shutdown PC"},
+};
+
+// Reads a line at a time; several commands can be given at once, separated
+// by ';'
+void shell_thread(void *arg) {
     char input_buffer[MAX_INPUT_SIZE];
+
+    shell_init(commands, sizeof(commands) / sizeof(commands[0]));
     while (1) {
         print_colored("[CoreOS]$ ", COLOR_LIGHT_BLUE);
         show_cursor(); // Showing cursor after prompt
         input(input_buffer, MAX_INPUT_SIZE);
         hide_cursor(); // Hiding cursor after entering symbol
-
-        if (strcmp(input_buffer, "shutdown") == 0) {
-            print_colored("Shutting down...\n", COLOR_LIGHT_RED);
-            shutdown();
-        } else if (strcmp(input_buffer, "reboot") == 0) {
-            print_colored("Rebooting...\n", COLOR_LIGHT_RED);
-            reboot();
-        } else if (strcmp(input_buffer, "clear") == 0) {
-            clear_screen();
-        } else if (strcmp(input_buffer, "factorial") == 0) {
-            factorial_calculator();
-        } else if (strcmp(input_buffer, "binary") == 0) {
-            print("Enter a number: ");
-            int num = inputn();
-            print("Binary: ");
-            decimal_to_binary(num);
-            print("\n");
-        } else if (strcmp(input_buffer, "color") == 0) {
-            print("Enter color (0-15): ");
-            int color = inputn();
-            if (color >= 0 && color <= 15) {
-                set_color(color);
-                print_colored("Color changed!\n", color);
-            } else {
-                print_colored("Invalid color!\n", COLOR_LIGHT_RED);
-            }
-        } else if (strcmp(input_buffer, "date") == 0) {
-            display_date();
-        } else if (strcmp(input_buffer, "echo") == 0) {
-            print("Enter text: ");
-            input(input_buffer, MAX_INPUT_SIZE);
-            echo_command(input_buffer);
-        } else if (strcmp(input_buffer, "help") == 0) {
-            print_colored("Available commands:\n", COLOR_LIGHT_GREEN);
-            print_colored("  clear - Clear the screen\n", COLOR_LIGHT_GRAY);
-            print_colored("  factorial - Calculate factorial of a number\n", COLOR_LIGHT_GRAY);
-            print_colored("  binary - Convert a number to binary\n", COLOR_LIGHT_GRAY);
-            print_colored("  color - Change text color\n", COLOR_LIGHT_GRAY);
-            print_colored("  date - Display current date\n", COLOR_LIGHT_GRAY);
-            print_colored("  echo - Echo text\n", COLOR_LIGHT_GRAY);
-            print_colored("  shutdown - Shutdown PC\n", COLOR_LIGHT_GRAY);
-            print_colored("  reboot - Reboot PC\n", COLOR_LIGHT_GRAY);
-            print_colored("  help - Show this help message\n", COLOR_LIGHT_GRAY);
-        } else {
-            print_colored("Unknown command: ", COLOR_LIGHT_RED);
-            print_colored(input_buffer, COLOR_LIGHT_RED);
-            print("\n");
-        }
+        shell_run_line(input_buffer);
     }
 }
@@ -0,0 +1,45 @@
+#ifndef KERNEL_H
+#define KERNEL_H
+
+#include <stdint.h>
+
+// Colors
+#define COLOR_BLACK 0x00
+#define COLOR_BLUE 0x01
+#define COLOR_GREEN 0x02
+#define COLOR_CYAN 0x03
+#define COLOR_RED 0x04
+#define COLOR_MAGENTA 0x05
+#define COLOR_BROWN 0x06
+#define COLOR_LIGHT_GRAY 0x07
+#define COLOR_DARK_GRAY 0x08
+#define COLOR_LIGHT_BLUE 0x09
+#define COLOR_LIGHT_GREEN 0x0A
+#define COLOR_LIGHT_CYAN 0x0B
+#define COLOR_LIGHT_RED 0x0C
+#define COLOR_LIGHT_MAGENTA 0x0D
+#define COLOR_YELLOW 0x0E
+#define COLOR_WHITE 0x0F
+
+extern unsigned char current_color;
+
+// Text output helpers shared by the rest of the kernel (kernel.c)
+void print(const char *str);
+void print_colored(const char *str, unsigned char color);
+void printn(int num);
+void printn_colored(int num, unsigned char color);
+void printx(unsigned int num);
+void printu64(uint64_t num);
+void kprint_newline(void);
+void clear_screen(void);
+void panic(const char *message);
+
+// Multiboot command line, saved at boot
+#define CMDLINE_MAX 256
+int cmdline_has(const char *word);
+const char *cmdline(void);
+
+// Microseconds kmain spent initializing the kernel
+uint32_t boot_time_us(void);
+
+#endif // KERNEL_H
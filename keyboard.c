@@ -1,10 +1,22 @@
-#include "../keyboard_map.h"
+#include "keyboard_map.h"
+#include "io.h"
+#include "sched.h"
 
 // Current keyboard state
 static keyboard_modifiers_t modifiers = {0};
 static uint8_t extended_key = 0;
 static const keyboard_layout_t* current_layout = &layout_us;
 
+// Key event ring buffer. Events are only added from interrupt handlers
+// (keyboard and serial), which never nest, and the tty thread is the only
+// consumer, so head and tail each have a single writer and no lock
+// is needed.
+static key_event_t kb_buffer[KB_BUFFER_SIZE];
+static volatile uint32_t kb_head = 0;    // next slot to fill (IRQ side)
+static volatile uint32_t kb_tail = 0;    // next slot to read (consumer side)
+static volatile uint32_t kb_dropped = 0; // events lost to a full buffer
+static wait_queue_t kb_waiters;            // threads in keyboard_wait_event()
+
 // US QWERTY layout implementation
 const keyboard_layout_t layout_us = {
     .normal = {
@@ -58,28 +70,56 @@ static const char* key_names[] = {
     [SC_SCROLL_LOCK] = "SCROLL_LOCK"
 };
 
+// Wait until the controller can accept another byte
+static void kb_wait_input(void) {
+    for (int i = 0; i < 100000; i++) {
+        if (!(read_port(KB_STATUS_PORT) & KB_STATUS_INPUT_FULL)) return;
+    }
+}
+
+// Send a command byte to the keyboard itself (not the controller)
+static void kb_send(uint8_t data) {
+    kb_wait_input();
+    write_port(KB_DATA_PORT, data);
+}
+
+// Poll for a byte from the keyboard; only used before IRQ1 is unmasked
+static int kb_poll_byte(uint8_t expected) {
+    for (int i = 0; i < 100000; i++) {
+        if (read_port(KB_STATUS_PORT) & KB_STATUS_OUTPUT_FULL) {
+            if ((uint8_t)read_port(KB_DATA_PORT) == expected) return 1;
+        }
+    }
+    return 0;
+}
+
 // Initialize the keyboard
 void keyboard_init(void) {
     // Reset keyboard
-    write_port(KB_COMMAND_PORT, KB_CMD_RESET);
+    kb_send(KB_CMD_RESET);
     
-    // Wait for acknowledgment
-    while (read_port(KB_DATA_PORT) != 0xFA);
+    // Wait for acknowledgment and self-test result
+    kb_poll_byte(KB_ACK);
+    kb_poll_byte(KB_SELF_TEST_OK);
     
     // Enable scanning
-    write_port(KB_COMMAND_PORT, KB_CMD_ENABLE);
+    kb_send(KB_CMD_ENABLE);
+    kb_poll_byte(KB_ACK);
     
-    // Set default LED state
-    keyboard_set_leds(0);
+    // Drop anything left in the output buffer
+    while (read_port(KB_STATUS_PORT) & KB_STATUS_OUTPUT_FULL) {
+        read_port(KB_DATA_PORT);
+    }
     
     // Clear all modifier states
     modifiers = (keyboard_modifiers_t){0};
+    kb_head = kb_tail = 0;
 }
 
 // Set keyboard LEDs
 void keyboard_set_leds(uint8_t leds) {
-    write_port(KB_COMMAND_PORT, KB_CMD_SET_LED);
-    write_port(KB_DATA_PORT, leds);
+    kb_send(KB_CMD_SET_LED);
+    kb_send(leds);
 }
 
 // Update modifier keys state
@@ -198,16 +238,70 @@ const char* keyboard_get_key_name(uint8_t scancode) {
     return "UNKNOWN";
 }
 
-// Keyboard interrupt handler
-void keyboard_handler(void) {
+// Queue a key event. Called from interrupt handlers only.
+int keyboard_buffer_add(key_event_t event) {
+    uint32_t head = kb_head;
+    if (head - kb_tail >= KB_BUFFER_SIZE) {
+        kb_dropped++;
+        return 0;
+    }
+    kb_buffer[head & (KB_BUFFER_SIZE - 1)] = event;
+    // Publish the slot only after the event is written
+    __asm__ volatile ("" ::: "memory");
+    kb_head = head + 1;
+    return 1;
+}
+
+// Take the oldest queued key event, if any
+int keyboard_buffer_get(key_event_t* event) {
+    uint32_t tail = kb_tail;
+    if (tail == kb_head) {
+        return 0;
+    }
+    *event = kb_buffer[tail & (KB_BUFFER_SIZE - 1)];
+    // Release the slot only after the event is copied out
+    __asm__ volatile ("" ::: "memory");
+    kb_tail = tail + 1;
+    return 1;
+}
+
+// Number of events dropped because the buffer was full
+uint32_t keyboard_buffer_dropped(void) {
+    return kb_dropped;
+}
+
+// Queue an event from any input source and wake the readers. Called from
+// interrupt handlers only, so producers never interleave.
+int keyboard_inject(key_event_t event) {
+    if (!keyboard_buffer_add(event)) return 0;
+    sched_wake_all(&kb_waiters);
+    return 1;
+}
+
+// Block until a key event is available. Threads sleep on kb_waiters; before
+// the scheduler runs the CPU halts until the next interrupt.
+void keyboard_wait_event(key_event_t* event) {
+    while (1) {
+        cli();
+        if (keyboard_buffer_get(event)) {
+            sti();
+            return;
+        }
+        if (sched_active()) {
+            sched_block(&kb_waiters);
+        } else {
+            sti_hlt();
+        }
+    }
+}
+
+// IRQ1 handler, registered by kb_init(); the dispatcher sends the EOI
+void keyboard_handler_main(struct regs *r) {
     key_event_t event = keyboard_read_event();
     
-    // Only process key press events (not releases)
-    if (!event.is_released && event.ascii) {
-        // Add the character to the keyboard buffer
-        keyboard_buffer_add(event.ascii);
+    // Queue key presses; releases only update the modifier state. A zero
+    // scancode is the 0xE0 prefix of an extended key, which carries no event.
+    if (!event.is_released && event.scancode) {
+        keyboard_inject(event);
     }
-    
-    // Send End of Interrupt
-    write_port(0x20, 0x20);
 }
\ No newline at end of file
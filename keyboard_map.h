@@ -8,6 +8,10 @@
 #define KB_STATUS_PORT      0x64
 #define KB_COMMAND_PORT     0x64
 
+// Status register bits
+#define KB_STATUS_OUTPUT_FULL 0x01
+#define KB_STATUS_INPUT_FULL  0x02
+
 // Keyboard commands
 #define KB_CMD_SET_LED   0xED
 #define KB_CMD_ECHO      0xEE
@@ -16,6 +20,13 @@
 #define KB_CMD_ENABLE    0xF4
 #define KB_CMD_RESET     0xFF
 
+// Keyboard replies
+#define KB_ACK           0xFA
+#define KB_SELF_TEST_OK  0xAA
+
+// Key event ring buffer size (must be a power of two)
+#define KB_BUFFER_SIZE   256
+
 // LED masks
 #define LED_SCROLL_LOCK  0x01
 #define LED_NUM_LOCK     0x02
@@ -109,5 +120,12 @@ void keyboard_set_leds(uint8_t leds);
 key_event_t keyboard_read_event(void);
 uint8_t keyboard_get_ascii(key_event_t event);
 const char* keyboard_get_key_name(uint8_t scancode);
+int keyboard_buffer_add(key_event_t event);
+int keyboard_buffer_get(key_event_t* event);
+int keyboard_inject(key_event_t event);
+uint32_t keyboard_buffer_dropped(void);
+void keyboard_wait_event(key_event_t* event);
+struct regs;
+void keyboard_handler_main(struct regs *r);
 
 #endif // KEYBOARD_MAP_H
\ No newline at end of file
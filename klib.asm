@@ -0,0 +1,47 @@
+; SSE2 block loops for klib.c. Callers hold the FPU through
+; kernel_fpu_begin() and pass a 16-byte aligned destination.
+
+bits 32
+
+section .text
+
+global sse2_copy_blocks
+global sse2_fill_blocks
+
+sse2_copy_blocks:		;(void *dst, const void *src, size_t blocks of 64 bytes)
+	push esi
+	push edi
+	mov edi, [esp + 12]
+	mov esi, [esp + 16]
+	mov ecx, [esp + 20]
+.loop:
+	movdqu xmm0, [esi]
+	movdqu xmm1, [esi + 16]
+	movdqu xmm2, [esi + 32]
+	movdqu xmm3, [esi + 48]
+	movdqa [edi], xmm0
+	movdqa [edi + 16], xmm1
+	movdqa [edi + 32], xmm2
+	movdqa [edi + 48], xmm3
+	add esi, 64
+	add edi, 64
+	dec ecx
+	jnz .loop
+	pop edi
+	pop esi
+	ret
+
+sse2_fill_blocks:		;(void *dst, uint32_t pattern, size_t blocks of 64 bytes)
+	mov edx, [esp + 4]
+	movd xmm0, [esp + 8]
+	pshufd xmm0, xmm0, 0		;pattern in all four dwords
+	mov ecx, [esp + 12]
+.loop:
+	movdqa [edx], xmm0
+	movdqa [edx + 16], xmm0
+	movdqa [edx + 32], xmm0
+	movdqa [edx + 48], xmm0
+	add edx, 64
+	dec ecx
+	jnz .loop
+	ret
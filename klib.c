@@ -0,0 +1,277 @@
+#include "klib.h"
+#include "cpu.h"
+#include "sched.h"
+#include "klog.h"
+
+#define INT_MAX 2147483647
+#define INT_MIN (-INT_MAX - 1)
+
+// SSE2 loops in klib.asm
+extern void sse2_copy_blocks(void *dst, const void *src, size_t blocks);
+extern void sse2_fill_blocks(void *dst, uint32_t pattern, size_t blocks);
+
+// Word loads that may alias any object
+typedef uint32_t __attribute__((may_alias)) word_t;
+
+static int impl = KLIB_IMPL_MOVSD;
+
+// Copy with rep movsd after aligning the destination; the remaining
+// 0-3 bytes go with rep movsb
+static void *memcpy_movsd(void *dst, const void *src, size_t n) {
+    void *ret = dst;
+    if (n >= 16) {
+        size_t head = -(uint32_t)dst & 3;
+        n -= head;
+        __asm__ volatile ("rep movsb" : "+D"(dst), "+S"(src), "+c"(head) :: "memory");
+        size_t words = n >> 2;
+        __asm__ volatile ("rep movsl" : "+D"(dst), "+S"(src), "+c"(words) :: "memory");
+        n &= 3;
+    }
+    __asm__ volatile ("rep movsb" : "+D"(dst), "+S"(src), "+c"(n) :: "memory");
+    return ret;
+}
+
+// Enhanced rep movsb: the microcode picks the best strategy by itself
+static void *memcpy_erms(void *dst, const void *src, size_t n) {
+    void *ret = dst;
+    __asm__ volatile ("rep movsb" : "+D"(dst), "+S"(src), "+c"(n) :: "memory");
+    return ret;
+}
+
+static void *memcpy_sse2(void *dst, const void *src, size_t n) {
+    if (n < KLIB_SSE_MIN) return memcpy_movsd(dst, src, n);
+
+    void *ret = dst;
+    size_t head = -(uint32_t)dst & 15;
+    n -= head;
+    __asm__ volatile ("rep movsb" : "+D"(dst), "+S"(src), "+c"(head) :: "memory");
+
+    unsigned long flags = kernel_fpu_begin();
+    sse2_copy_blocks(dst, src, n >> 6);
+    kernel_fpu_end(flags);
+
+    memcpy_movsd((char *)dst + (n & ~63u), (const char *)src + (n & ~63u), n & 63);
+    return ret;
+}
+
+static inline uint32_t byte_pattern(int c) {
+    return (uint8_t)c * 0x01010101u;
+}
+
+static void *memset_stosd(void *dst, uint32_t pattern, size_t n) {
+    void *ret = dst;
+    if (n >= 16) {
+        size_t head = -(uint32_t)dst & 3;
+        n -= head;
+        __asm__ volatile ("rep stosb" : "+D"(dst), "+c"(head) : "a"(pattern) : "memory");
+        size_t words = n >> 2;
+        __asm__ volatile ("rep stosl" : "+D"(dst), "+c"(words) : "a"(pattern) : "memory");
+        n &= 3;
+    }
+    __asm__ volatile ("rep stosb" : "+D"(dst), "+c"(n) : "a"(pattern) : "memory");
+    return ret;
+}
+
+static void *memset_erms(void *dst, uint32_t pattern, size_t n) {
+    void *ret = dst;
+    __asm__ volatile ("rep stosb" : "+D"(dst), "+c"(n) : "a"(pattern) : "memory");
+    return ret;
+}
+
+static void *memset_sse2(void *dst, uint32_t pattern, size_t n) {
+    if (n < KLIB_SSE_MIN) return memset_stosd(dst, pattern, n);
+
+    void *ret = dst;
+    size_t head = -(uint32_t)dst & 15;
+    n -= head;
+    __asm__ volatile ("rep stosb" : "+D"(dst), "+c"(head) : "a"(pattern) : "memory");
+
+    unsigned long flags = kernel_fpu_begin();
+    sse2_fill_blocks(dst, pattern, n >> 6);
+    kernel_fpu_end(flags);
+
+    memset_stosd((char *)dst + (n & ~63u), pattern, n & 63);
+    return ret;
+}
+
+static memcpy_fn_t memcpy_impl = memcpy_movsd;
+static void *(*memset_impl)(void *, uint32_t, size_t) = memset_stosd;
+
+// Choose the copy and fill routines for this CPU. SSE2 needs the FPU set
+// up by sched_init(), so this runs after it; until then rep movsd is used.
+void klib_init(void) {
+    uint32_t max_leaf, b, c, d;
+    cpuid(0, &max_leaf, &b, &c, &d);
+
+    if (max_leaf >= 7) {
+        uint32_t a;
+        cpuid(7, &a, &b, &c, &d);
+        if (b & CPUID_7_EBX_ERMS) {
+            impl = KLIB_IMPL_ERMS;
+            memcpy_impl = memcpy_erms;
+            memset_impl = memset_erms;
+            klog(KLOG_INFO, KLOG_KERNEL, "memcpy/memset: %s", (uint32_t)klib_impl_name());
+            return;
+        }
+    }
+    if ((cpuid_edx(1) & (CPUID_EDX_SSE2 | CPUID_EDX_FXSR)) == (CPUID_EDX_SSE2 | CPUID_EDX_FXSR)) {
+        impl = KLIB_IMPL_SSE2;
+        memcpy_impl = memcpy_sse2;
+        memset_impl = memset_sse2;
+    }
+    klog(KLOG_INFO, KLOG_KERNEL, "memcpy/memset: %s", (uint32_t)klib_impl_name());
+}
+
+int klib_impl(void) {
+    return impl;
+}
+
+const char *klib_impl_name(void) {
+    switch (impl) {
+    case KLIB_IMPL_ERMS: return "rep movsb (ERMS)";
+    case KLIB_IMPL_SSE2: return "SSE2";
+    }
+    return "rep movsd";
+}
+
+// A specific copy routine, for benchmarks; 0 if this CPU cannot run it.
+// rep movsb works everywhere, it is only fast with ERMS.
+memcpy_fn_t klib_memcpy_variant(int impl) {
+    switch (impl) {
+    case KLIB_IMPL_MOVSD: return memcpy_movsd;
+    case KLIB_IMPL_ERMS:  return memcpy_erms;
+    case KLIB_IMPL_SSE2:
+        if ((cpuid_edx(1) & (CPUID_EDX_SSE2 | CPUID_EDX_FXSR)) == (CPUID_EDX_SSE2 | CPUID_EDX_FXSR)) {
+            return memcpy_sse2;
+        }
+        break;
+    }
+    return 0;
+}
+
+void *memcpy(void *dst, const void *src, size_t n) {
+    return memcpy_impl(dst, src, n);
+}
+
+void *memset(void *dst, int c, size_t n) {
+    return memset_impl(dst, byte_pattern(c), n);
+}
+
+// Overlapping copies towards higher addresses run backwards: the odd tail
+// bytes first, then whole words with the direction flag set
+void *memmove(void *dst, const void *src, size_t n) {
+    if ((uintptr_t)dst - (uintptr_t)src >= n) {
+        return memcpy_impl(dst, src, n);
+    }
+
+    char *d = (char *)dst + n;
+    const char *s = (const char *)src + n;
+    size_t tail = n & 3;
+    while (tail--) {
+        *--d = *--s;
+    }
+    size_t words = n >> 2;
+    if (words) {
+        d -= 4;
+        s -= 4;
+        __asm__ volatile ("std; rep movsl; cld" : "+D"(d), "+S"(s), "+c"(words) :: "memory");
+    }
+    return dst;
+}
+
+// Fill `count` 16-bit cells, e.g. VGA text attributes and characters
+void *memsetw(void *dst, uint16_t value, size_t count) {
+    uint16_t *p = dst;
+    if (((uintptr_t)p & 2) && count) {
+        *p++ = value;
+        count--;
+    }
+    // p is now 4-byte aligned, so whole pairs go with rep stosd and the
+    // byte-granular tail of memset_stosd is never reached
+    size_t pairs = count >> 1;
+    uint32_t pattern = value | ((uint32_t)value << 16);
+    __asm__ volatile ("rep stosl" : "+D"(p), "+c"(pairs) : "a"(pattern) : "memory");
+    if (count & 1) {
+        *p = value;
+    }
+    return dst;
+}
+
+int memcmp(const void *a, const void *b, size_t n) {
+    const unsigned char *p = a, *q = b;
+    while (n >= 4 && *(const word_t *)p == *(const word_t *)q) {
+        p += 4;
+        q += 4;
+        n -= 4;
+    }
+    for (; n; n--, p++, q++) {
+        if (*p != *q) return *p - *q;
+    }
+    return 0;
+}
+
+// Nonzero if any byte of v is zero
+static inline uint32_t has_zero(uint32_t v) {
+    return (v - 0x01010101u) & ~v & 0x80808080u;
+}
+
+// Word at a time once aligned; an aligned load never crosses into an
+// unmapped page
+size_t strlen(const char *s) {
+    const char *p = s;
+    while ((uintptr_t)p & 3) {
+        if (!*p) return p - s;
+        p++;
+    }
+    while (!has_zero(*(const word_t *)p)) {
+        p += 4;
+    }
+    while (*p) p++;
+    return p - s;
+}
+
+int strcmp(const char *s1, const char *s2) {
+    // Compare words while both strings share the same alignment
+    if ((((uintptr_t)s1 ^ (uintptr_t)s2) & 3) == 0) {
+        while ((uintptr_t)s1 & 3) {
+            if (*s1 != *s2 || !*s1) goto bytes;
+            s1++;
+            s2++;
+        }
+        while (1) {
+            uint32_t w = *(const word_t *)s1;
+            if (w != *(const word_t *)s2 || has_zero(w)) break;
+            s1 += 4;
+            s2 += 4;
+        }
+    }
+bytes:
+    while (*s1 && (*s1 == *s2)) {
+        s1++;
+        s2++;
+    }
+    return *(unsigned char *)s1 - *(unsigned char *)s2;
+}
+
+int atoi(const char *str) {
+    int result = 0;
+    int sign = 1;
+
+    while (*str == ' ') str++;
+
+    if (*str == '-' || *str == '+') {
+        if (*str == '-') sign = -1;
+        str++;
+    }
+
+    while (*str >= '0' && *str <= '9') {
+        int digit = *str - '0';
+        if (result > (INT_MAX - digit) / 10) {
+            return (sign == 1) ? INT_MAX : INT_MIN;
+        }
+        result = result * 10 + digit;
+        str++;
+    }
+
+    return sign * result;
+}
@@ -0,0 +1,32 @@
+#ifndef KLIB_H
+#define KLIB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Copies and fills at least this large use the SSE2 loops when they are
+// selected; below it saving the FPU state costs more than it gains
+#define KLIB_SSE_MIN 1024
+
+// Implementation picked by klib_init()
+#define KLIB_IMPL_MOVSD 0
+#define KLIB_IMPL_ERMS  1
+#define KLIB_IMPL_SSE2  2
+
+typedef void *(*memcpy_fn_t)(void *dst, const void *src, size_t n);
+
+void klib_init(void);
+int klib_impl(void);
+const char *klib_impl_name(void);
+memcpy_fn_t klib_memcpy_variant(int impl);
+
+void *memcpy(void *dst, const void *src, size_t n);
+void *memmove(void *dst, const void *src, size_t n);
+void *memset(void *dst, int c, size_t n);
+void *memsetw(void *dst, uint16_t value, size_t count);
+int memcmp(const void *a, const void *b, size_t n);
+size_t strlen(const char *s);
+int strcmp(const char *s1, const char *s2);
+int atoi(const char *str);
+
+#endif // KLIB_H
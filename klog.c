@@ -0,0 +1,191 @@
+#include "klog.h"
+#include "timer.h"
+#include "cpu.h"
+#include <stdarg.h>
+
+// Writers claim a record with one atomic fetch-add on head and fill it in
+// place, so logging needs no lock and works from interrupt handlers. seq
+// is cleared while a record is written and set to its number + 1 once it is
+// complete; readers copy a record and keep it only if seq matched before
+// and after the copy.
+static klog_record_t ring[KLOG_RECORDS];
+static volatile uint32_t head = 0;
+static uint64_t tsc_base = 0;
+
+static const char *level_names[] = {"err", "warn", "info", "debug"};
+static const char *subsys_names[KLOG_SUBSYSTEMS] = {
+    "kernel", "mem", "irq", "timer", "sched", "serial",
+};
+
+// Timestamps count from here
+void klog_init(void) {
+    tsc_base = rdtsc();
+}
+
+void klog(int level, int subsys, const char *fmt, ...) {
+    uint32_t seq = __atomic_fetch_add(&head, 1, __ATOMIC_RELAXED);
+    klog_record_t *rec = &ring[seq & (KLOG_RECORDS - 1)];
+
+    rec->seq = 0;
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    rec->tsc = rdtsc();
+    rec->fmt = fmt;
+    rec->level = level;
+    rec->subsys = subsys;
+
+    // Take one argument per conversion, up to KLOG_MAX_ARGS
+    va_list ap;
+    va_start(ap, fmt);
+    int n = 0;
+    for (const char *p = fmt; *p && n < KLOG_MAX_ARGS; p++) {
+        if (*p != '%') continue;
+        p++;
+        while (*p >= '0' && *p <= '9') p++;
+        if (*p && *p != '%') {
+            rec->args[n++] = va_arg(ap, uint32_t);
+        }
+        if (!*p) break;
+    }
+    va_end(ap);
+    rec->nargs = n;
+
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    rec->seq = seq + 1;
+}
+
+// Records written so far; the oldest KLOG_RECORDS of them are kept
+uint32_t klog_count(void) {
+    return head;
+}
+
+// Copy record `seq` out of the ring. Returns -1 if it was overwritten or
+// is still being written.
+int klog_read(uint32_t seq, klog_record_t *out) {
+    const klog_record_t *rec = &ring[seq & (KLOG_RECORDS - 1)];
+    if (rec->seq != seq + 1) return -1;
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    *out = *rec;
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    if (rec->seq != seq + 1) return -1;
+    return 0;
+}
+
+const char *klog_level_name(int level) {
+    if (level < 0 || level > KLOG_DEBUG) return "?";
+    return level_names[level];
+}
+
+const char *klog_subsys_name(int subsys) {
+    if (subsys < 0 || subsys >= KLOG_SUBSYSTEMS) return "?";
+    return subsys_names[subsys];
+}
+
+typedef struct {
+    char *buf;
+    int size;
+    int len;
+} out_t;
+
+static void out_char(out_t *o, char c) {
+    if (o->len < o->size - 1) o->buf[o->len++] = c;
+}
+
+static void out_str(out_t *o, const char *s) {
+    while (*s) out_char(o, *s++);
+}
+
+static void out_number(out_t *o, uint64_t value, uint32_t base, int width, char pad, int negative) {
+    char digits[24];
+    int n = 0;
+    do {
+        uint32_t d = div64_32(&value, base);
+        digits[n++] = d < 10 ? '0' + d : 'a' + d - 10;
+    } while (value);
+    if (negative) {
+        if (pad == '0') {
+            out_char(o, '-');
+        } else {
+            digits[n++] = '-';
+        }
+        width--;
+    }
+    for (int i = n; i < width; i++) out_char(o, pad);
+    while (n) out_char(o, digits[--n]);
+}
+
+// Render a record as "[seconds.micros] subsys: message". Supports %d %u %x
+// %s %c and %%, with an optional zero flag and width.
+int klog_format(const klog_record_t *rec, char *buf, int size) {
+    out_t o = {buf, size, 0};
+
+    uint64_t cycles = rec->tsc - tsc_base;
+    uint32_t khz = timer_tsc_khz();
+    out_char(&o, '[');
+    if (khz) {
+        uint64_t ms = cycles;
+        uint32_t rem = div64_32(&ms, khz);
+        uint64_t frac = (uint64_t)rem * 1000;
+        div64_32(&frac, khz);
+        uint32_t ms_part = div64_32(&ms, 1000);
+        out_number(&o, ms, 10, 5, ' ', 0);
+        out_char(&o, '.');
+        out_number(&o, ms_part * 1000 + (uint32_t)frac, 10, 6, '0', 0);
+    } else {
+        // No calibrated TSC: raw cycles
+        out_number(&o, cycles, 10, 12, ' ', 0);
+    }
+    out_str(&o, "] ");
+    out_str(&o, klog_subsys_name(rec->subsys));
+    out_str(&o, ": ");
+
+    int arg = 0;
+    for (const char *p = rec->fmt; *p; p++) {
+        if (*p != '%') {
+            out_char(&o, *p);
+            continue;
+        }
+        p++;
+        char pad = ' ';
+        int width = 0;
+        if (*p == '0') {
+            pad = '0';
+            p++;
+        }
+        while (*p >= '0' && *p <= '9') {
+            width = width * 10 + (*p++ - '0');
+        }
+        if (!*p) break;
+        if (*p == '%') {
+            out_char(&o, '%');
+            continue;
+        }
+        uint32_t v = arg < rec->nargs ? rec->args[arg] : 0;
+        arg++;
+        switch (*p) {
+        case 'd':
+            if ((int32_t)v < 0) {
+                out_number(&o, -(int64_t)(int32_t)v, 10, width, pad, 1);
+            } else {
+                out_number(&o, v, 10, width, pad, 0);
+            }
+            break;
+        case 'u':
+            out_number(&o, v, 10, width, pad, 0);
+            break;
+        case 'x':
+            out_number(&o, v, 16, width, pad, 0);
+            break;
+        case 'c':
+            out_char(&o, (char)v);
+            break;
+        case 's':
+            out_str(&o, v ? (const char *)v : "(null)");
+            break;
+        default:
+            out_char(&o, '%');
+            out_char(&o, *p);
+        }
+    }
+    o.buf[o.len] = '\0';
+    return o.len;
+}
@@ -0,0 +1,49 @@
+#ifndef KLOG_H
+#define KLOG_H
+
+#include <stdint.h>
+
+// Records kept in the log ring (must be a power of two)
+#define KLOG_RECORDS  1024
+#define KLOG_MAX_ARGS 6
+
+// Longest line klog_format() produces
+#define KLOG_LINE_MAX 160
+
+// Levels; a lower number is more severe
+#define KLOG_ERR   0
+#define KLOG_WARN  1
+#define KLOG_INFO  2
+#define KLOG_DEBUG 3
+
+// Subsystems a record is tagged with
+#define KLOG_KERNEL 0
+#define KLOG_MEM    1
+#define KLOG_IRQ    2
+#define KLOG_TIMER  3
+#define KLOG_SCHED  4
+#define KLOG_SERIAL 5
+#define KLOG_SUBSYSTEMS 6
+
+// One binary record. The format string and arguments are stored as given
+// and only rendered when the log is read, so arguments are 32-bit values
+// and %s must point to a string that outlives the record (a literal).
+typedef struct {
+    uint64_t tsc;
+    const char *fmt;
+    uint32_t args[KLOG_MAX_ARGS];
+    uint8_t level;
+    uint8_t subsys;
+    uint8_t nargs;
+    volatile uint32_t seq; // sequence number + 1 once complete, 0 while written
+} klog_record_t;
+
+void klog_init(void);
+void klog(int level, int subsys, const char *fmt, ...);
+uint32_t klog_count(void);
+int klog_read(uint32_t seq, klog_record_t *out);
+int klog_format(const klog_record_t *rec, char *buf, int size);
+const char *klog_level_name(int level);
+const char *klog_subsys_name(int subsys);
+
+#endif // KLOG_H
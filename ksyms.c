@@ -0,0 +1,27 @@
+#include "ksyms.h"
+
+extern char kernel_text_end[];
+
+int ksym_find(uint32_t addr) {
+    if (ksyms_count == 0 || addr < ksyms_addr[0] || addr >= (uint32_t)kernel_text_end) {
+        return -1;
+    }
+    // Last symbol at or below addr
+    uint32_t lo = 0, hi = ksyms_count;
+    while (hi - lo > 1) {
+        uint32_t mid = (lo + hi) / 2;
+        if (ksyms_addr[mid] <= addr) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+const char *ksym_lookup(uint32_t addr, uint32_t *offset) {
+    int i = ksym_find(addr);
+    if (i < 0) return 0;
+    if (offset) *offset = addr - ksyms_addr[i];
+    return ksyms_name[i];
+}
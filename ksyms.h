@@ -0,0 +1,17 @@
+#ifndef KSYMS_H
+#define KSYMS_H
+
+#include <stdint.h>
+
+// Kernel function symbols, generated from the linked kernel by ksyms.sh and
+// linked into a second pass (see Makefile). Sorted by address.
+extern const uint32_t ksyms_count;
+extern const uint32_t ksyms_addr[];
+extern const char *const ksyms_name[];
+
+// Index of the function containing `addr`, or -1 outside the kernel text
+int ksym_find(uint32_t addr);
+// Name of the function containing `addr`, with the offset into it
+const char *ksym_lookup(uint32_t addr, uint32_t *offset);
+
+#endif // KSYMS_H
@@ -0,0 +1,40 @@
+#!/bin/bash
+#
+# Usage: ./ksyms.sh [kernel.elf] > ksyms.S
+#
+# Emits the kernel's function symbols, sorted by address, as an assembly
+# table for ksyms.h. Without an argument the table is empty; the first link
+# pass uses that to find the addresses the second pass embeds. The table
+# lives in .rodata after .text, so embedding it moves no function.
+
+emit() {
+    awk '
+        BEGIN { n = 0 }
+        # Functions only; GCC clone suffixes fold into the original name
+        NF == 3 && $2 ~ /^[tTwW]$/ && $3 !~ /^\./ {
+            name = $3
+            while (sub(/\.(constprop|isra|part|lto_priv)\.[0-9]+/, "", name)) {}
+            if ($1 == last) next  # first name at an address wins
+            last = $1
+            addr[n] = $1
+            sym[n++] = name
+        }
+        END {
+            print "\t.section .rodata"
+            print "\t.p2align 2"
+            print "\t.globl ksyms_count, ksyms_addr, ksyms_name"
+            print "ksyms_count:\n\t.long " n
+            print "ksyms_addr:"
+            for (i = 0; i < n; i++) print "\t.long 0x" addr[i]
+            print "ksyms_name:"
+            for (i = 0; i < n; i++) print "\t.long .Lksym" i
+            for (i = 0; i < n; i++) print ".Lksym" i ":\n\t.asciz \"" sym[i] "\""
+            print "\t.section .note.GNU-stack,\"\",@progbits"
+        }'
+}
+
+if [ -n "$1" ]; then
+    nm -n "$1" | emit
+else
+    emit < /dev/null
+fi
@@ -0,0 +1,61 @@
+#ifndef MULTIBOOT_H
+#define MULTIBOOT_H
+
+#include <stdint.h>
+
+// Value left in eax by a Multiboot compliant boot loader
+#define MULTIBOOT_BOOTLOADER_MAGIC 0x2BADB002
+
+// Header flags requested in kernel.asm
+#define MULTIBOOT_PAGE_ALIGN  0x00000001
+#define MULTIBOOT_MEMORY_INFO 0x00000002
+
+// multiboot_info_t.flags bits
+#define MULTIBOOT_INFO_MEMORY  0x00000001
+#define MULTIBOOT_INFO_CMDLINE 0x00000004
+#define MULTIBOOT_INFO_MODS    0x00000008
+#define MULTIBOOT_INFO_MEM_MAP 0x00000040
+
+// Memory map entry types
+#define MULTIBOOT_MEMORY_AVAILABLE 1
+
+typedef struct {
+    uint32_t flags;
+    uint32_t mem_lower;   // KiB below 1 MiB
+    uint32_t mem_upper;   // KiB above 1 MiB
+    uint32_t boot_device;
+    uint32_t cmdline;
+    uint32_t mods_count;
+    uint32_t mods_addr;
+    uint32_t syms[4];
+    uint32_t mmap_length;
+    uint32_t mmap_addr;
+    uint32_t drives_length;
+    uint32_t drives_addr;
+    uint32_t config_table;
+    uint32_t boot_loader_name;
+    uint32_t apm_table;
+    uint32_t vbe_control_info;
+    uint32_t vbe_mode_info;
+    uint16_t vbe_mode;
+    uint16_t vbe_interface_seg;
+    uint16_t vbe_interface_off;
+    uint16_t vbe_interface_len;
+} __attribute__((packed)) multiboot_info_t;
+
+// `size` does not count itself, so the next entry is at +size+4
+typedef struct {
+    uint32_t size;
+    uint64_t addr;
+    uint64_t len;
+    uint32_t type;
+} __attribute__((packed)) multiboot_mmap_entry_t;
+
+typedef struct {
+    uint32_t mod_start;
+    uint32_t mod_end;
+    uint32_t cmdline;
+    uint32_t reserved;
+} __attribute__((packed)) multiboot_module_t;
+
+#endif // MULTIBOOT_H
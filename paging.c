@@ -0,0 +1,230 @@
+#include "paging.h"
+#include "pmm.h"
+#include "cpu.h"
+#include "console.h"
+#include "kernel.h"
+#include "idt.h"
+#include "klog.h"
+#include "process.h"
+
+// End of the VGA text buffer kept identity mapped
+#define VGA_TEXT_END 0xc0000
+
+// Kernel page directory. Everything at KERNEL_VIRT_BASE and above is the
+// kernel's; the first 4 MiB only map the VGA text buffer.
+static uint32_t kernel_pd[1024] __attribute__((aligned(PAGE_SIZE)));
+static uint32_t low_pt[1024] __attribute__((aligned(PAGE_SIZE)));
+
+static uint32_t global_flag = 0;
+static uint32_t ioremap_next = IOREMAP_BASE;
+
+// Directory in CR3: kernel_pd or a process's (user threads only run on the
+// boot CPU)
+static uint32_t *loaded_pd = kernel_pd;
+
+static inline void load_cr3(uint32_t phys) {
+    __asm__ volatile ("mov %0, %%cr3" :: "r"(phys) : "memory");
+}
+
+void paging_init(void) {
+    uint32_t top = pmm_max_address();
+
+    // Global pages survive CR3 reloads, which suits kernel mappings
+    if (cpuid_edx(1) & CPUID_EDX_PGE) {
+        write_cr4(read_cr4() | CR4_PGE);
+        global_flag = PTE_GLOBAL;
+    }
+
+    // Direct map of RAM, kernel image included, with 4 MiB pages: one TLB
+    // entry covers the whole kernel
+    if (top == 0 || top > KERNEL_DIRECT_MAP_SIZE) {
+        top = KERNEL_DIRECT_MAP_SIZE;
+    }
+    for (uint32_t phys = 0; phys < top; phys += LARGE_PAGE_SIZE) {
+        kernel_pd[PDE_INDEX(KERNEL_VIRT_BASE + phys)] =
+            phys | PTE_PRESENT | PTE_WRITE | PTE_LARGE | global_flag;
+    }
+
+    // VGA text memory stays at its physical address with 4 KiB pages;
+    // the rest of the low 4 MiB faults, which catches null pointers
+    for (uint32_t addr = VGA_TEXT_BASE; addr < VGA_TEXT_END; addr += PAGE_SIZE) {
+        low_pt[PTE_INDEX(addr)] = addr | PTE_PRESENT | PTE_WRITE | global_flag;
+    }
+    kernel_pd[0] = virt_to_phys(low_pt) | PTE_PRESENT | PTE_WRITE;
+
+    load_cr3(virt_to_phys(kernel_pd));
+    register_irq_handler(EXCEPTION_PAGE_FAULT, page_fault_handler_main);
+}
+
+// Move an application processor from the boot page directory, which the
+// start-up code needs for its 1:1 mapping, to the kernel's
+void paging_init_ap(void) {
+    if (global_flag) {
+        write_cr4(read_cr4() | CR4_PGE);
+    }
+    load_cr3(virt_to_phys(kernel_pd));
+}
+
+// Page table covering `virt` in directory `pd`, allocated on demand when
+// `create` is set
+static uint32_t *get_table(uint32_t *pd, uint32_t virt, int create, uint32_t flags) {
+    uint32_t *pde = &pd[PDE_INDEX(virt)];
+
+    if (*pde & PTE_PRESENT) {
+        if (*pde & PTE_LARGE) return 0;
+        return phys_to_virt(*pde & ~0xFFF);
+    }
+    if (!create) return 0;
+
+    uint32_t phys = pmm_alloc_frame();
+    if (!phys) return 0;
+    uint32_t *table = phys_to_virt(phys);
+    for (int i = 0; i < 1024; i++) {
+        table[i] = 0;
+    }
+    *pde = phys | PTE_PRESENT | PTE_WRITE | (flags & PTE_USER);
+    return table;
+}
+
+// Map one 4 KiB page. Fails inside a 4 MiB mapping.
+int paging_map(uint32_t virt, uint32_t phys, uint32_t flags) {
+    uint32_t *table = get_table(kernel_pd, virt, 1, flags);
+    if (!table) return -1;
+    table[PTE_INDEX(virt)] = (phys & ~0xFFF) | (flags & 0xFFF) | PTE_PRESENT;
+    invlpg(virt);
+    return 0;
+}
+
+void paging_unmap(uint32_t virt) {
+    uint32_t *table = get_table(kernel_pd, virt, 0, 0);
+    if (!table) return;
+    table[PTE_INDEX(virt)] = 0;
+    invlpg(virt);
+}
+
+// Physical address behind `virt`, or 0 if it is not mapped
+uint32_t paging_translate(uint32_t virt) {
+    uint32_t pde = kernel_pd[PDE_INDEX(virt)];
+    if (!(pde & PTE_PRESENT)) return 0;
+    if (pde & PTE_LARGE) {
+        return (pde & ~(LARGE_PAGE_SIZE - 1)) | (virt & (LARGE_PAGE_SIZE - 1));
+    }
+    uint32_t *table = phys_to_virt(pde & ~0xFFF);
+    uint32_t pte = table[PTE_INDEX(virt)];
+    if (!(pte & PTE_PRESENT)) return 0;
+    return (pte & ~0xFFF) | (virt & 0xFFF);
+}
+
+// Map device registers uncached and return their kernel address
+void *paging_map_mmio(uint32_t phys, uint32_t size) {
+    uint32_t start = phys & ~(PAGE_SIZE - 1);
+    uint32_t end = (phys + size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    uint32_t virt;
+
+    if (start >= MMIO_IDENTITY_BASE) {
+        virt = start;
+    } else {
+        if (ioremap_next + (end - start) > MMIO_IDENTITY_BASE) return 0;
+        virt = ioremap_next;
+        ioremap_next += end - start;
+    }
+
+    for (uint32_t off = 0; off < end - start; off += PAGE_SIZE) {
+        if (paging_translate(virt + off) == start + off) continue;
+        if (paging_map(virt + off, start + off,
+                       PTE_WRITE | PTE_PCD | PTE_PWT | global_flag) < 0) {
+            return 0;
+        }
+    }
+    return (void *)(virt + (phys & (PAGE_SIZE - 1)));
+}
+
+// Page directory for a process: the kernel half and the VGA table are
+// shared with kernel_pd, everything from USER_BASE up to KERNEL_VIRT_BASE
+// starts out empty. 0 when out of memory.
+uint32_t *paging_create_directory(void) {
+    uint32_t phys = pmm_alloc_frame();
+    if (!phys) return 0;
+    uint32_t *pd = phys_to_virt(phys);
+    for (uint32_t i = 0; i < 1024; i++) {
+        pd[i] = i == 0 || i >= PDE_INDEX(KERNEL_VIRT_BASE) ? kernel_pd[i] : 0;
+    }
+    return pd;
+}
+
+// Release a process directory, its page tables and every page mapped below
+// KERNEL_VIRT_BASE; user pages are never shared. Must not be loaded.
+void paging_free_directory(uint32_t *pd) {
+    for (uint32_t i = PDE_INDEX(USER_BASE); i < PDE_INDEX(KERNEL_VIRT_BASE); i++) {
+        if (!(pd[i] & PTE_PRESENT)) continue;
+        uint32_t *table = phys_to_virt(pd[i] & ~0xFFF);
+        for (int j = 0; j < 1024; j++) {
+            if (table[j] & PTE_PRESENT) pmm_free_frame(table[j] & ~0xFFF);
+        }
+        pmm_free_frame(pd[i] & ~0xFFF);
+    }
+    pmm_free_frame(virt_to_phys(pd));
+}
+
+// Map one user page into a process directory. Page tables are created
+// user-accessible; the PTE decides what ring 3 may do.
+int paging_map_user(uint32_t *pd, uint32_t virt, uint32_t phys, uint32_t flags) {
+    if (virt < USER_BASE || virt >= KERNEL_VIRT_BASE) return -1;
+    uint32_t *table = get_table(pd, virt, 1, PTE_USER);
+    if (!table) return -1;
+    table[PTE_INDEX(virt)] = (phys & ~0xFFF) | (flags & 0xFFF) | PTE_PRESENT | PTE_USER;
+    if (pd == loaded_pd) invlpg(virt);
+    return 0;
+}
+
+// Page table entry for `virt` in `pd` (0 for the kernel's), 0 if unmapped
+uint32_t paging_lookup(const uint32_t *pd, uint32_t virt) {
+    if (!pd) pd = kernel_pd;
+    uint32_t pde = pd[PDE_INDEX(virt)];
+    if (!(pde & PTE_PRESENT) || (pde & PTE_LARGE)) return 0;
+    const uint32_t *table = phys_to_virt(pde & ~0xFFF);
+    return table[PTE_INDEX(virt)];
+}
+
+// Load `pd` (0 for the kernel's) unless it is already in CR3. Kernel
+// mappings are global, so only user entries leave the TLB.
+void paging_switch(uint32_t *pd) {
+    if (!pd) pd = kernel_pd;
+    if (pd == loaded_pd) return;
+    loaded_pd = pd;
+    load_cr3(virt_to_phys(pd));
+}
+
+uint32_t *paging_current_directory(void) {
+    return loaded_pd == kernel_pd ? 0 : loaded_pd;
+}
+
+void page_fault_handler_main(struct regs *r) {
+    uint32_t addr = read_cr2();
+    uint32_t error = r->err_code;
+    uint32_t eip = r->eip;
+
+    // Kernel page tables added after a process directory was copied, such
+    // as a later ioremap: pick the entry up from kernel_pd
+    uint32_t index = PDE_INDEX(addr);
+    if (addr >= KERNEL_VIRT_BASE && !(loaded_pd[index] & PTE_PRESENT) &&
+        (kernel_pd[index] & PTE_PRESENT)) {
+        loaded_pd[index] = kernel_pd[index];
+        return;
+    }
+    if (error & PF_USER) {
+        klog(KLOG_DEBUG, KLOG_MEM, "user page fault at %08x, error %x", addr, error);
+        process_fault(r, "Page fault");
+    }
+
+    klog(KLOG_ERR, KLOG_MEM, "page fault at %08x, eip %08x, error %x", addr, eip, error);
+    print_colored("\nPage fault at ", COLOR_LIGHT_RED);
+    printx(addr);
+    print(" (eip ");
+    printx(eip);
+    print(error & PF_PRESENT ? ", protection violation" : ", page not present");
+    print(error & PF_WRITE ? ", write" : ", read");
+    if (error & PF_USER) print(", user mode");
+    print(")");
+    panic("unhandled page fault");
+}
@@ -0,0 +1,68 @@
+#ifndef PAGING_H
+#define PAGING_H
+
+#include <stdint.h>
+
+// The kernel is linked at KERNEL_VIRT_BASE + 1 MiB, and all physical
+// memory below KERNEL_DIRECT_MAP_SIZE is mapped at KERNEL_VIRT_BASE
+#define KERNEL_VIRT_BASE       0xC0000000
+#define KERNEL_DIRECT_MAP_SIZE 0x30000000
+
+// Device memory at or above this address is mapped 1:1; lower device
+// addresses get a slot in the ioremap window below it
+#define MMIO_IDENTITY_BASE 0xF8000000
+#define IOREMAP_BASE       (KERNEL_VIRT_BASE + KERNEL_DIRECT_MAP_SIZE)
+
+// Process address spaces use USER_BASE up to KERNEL_VIRT_BASE; the first
+// 4 MiB stay the kernel's (VGA text buffer, null pointer guard)
+#define USER_BASE 0x00400000
+
+#define phys_to_virt(addr) ((void *)((uintptr_t)(addr) + KERNEL_VIRT_BASE))
+#define virt_to_phys(ptr)  ((uint32_t)((uintptr_t)(ptr) - KERNEL_VIRT_BASE))
+
+// Page directory/table entry bits
+#define PTE_PRESENT  0x001
+#define PTE_WRITE    0x002
+#define PTE_USER     0x004
+#define PTE_PWT      0x008
+#define PTE_PCD      0x010
+#define PTE_ACCESSED 0x020
+#define PTE_DIRTY    0x040
+#define PTE_LARGE    0x080 // 4 MiB page (PDE only)
+#define PTE_GLOBAL   0x100
+
+#define PDE_INDEX(addr) ((uint32_t)(addr) >> 22)
+#define PTE_INDEX(addr) (((uint32_t)(addr) >> 12) & 0x3FF)
+#define LARGE_PAGE_SIZE 0x400000
+
+// Page fault error code bits
+#define PF_PRESENT 0x1
+#define PF_WRITE   0x2
+#define PF_USER    0x4
+
+static inline void invlpg(uint32_t virt) {
+    __asm__ volatile ("invlpg (%0)" :: "r"(virt) : "memory");
+}
+
+static inline uint32_t read_cr2(void) {
+    uint32_t value;
+    __asm__ volatile ("mov %%cr2, %0" : "=r"(value));
+    return value;
+}
+
+void paging_init(void);
+void paging_init_ap(void);
+int paging_map(uint32_t virt, uint32_t phys, uint32_t flags);
+void paging_unmap(uint32_t virt);
+uint32_t paging_translate(uint32_t virt);
+void *paging_map_mmio(uint32_t phys, uint32_t size);
+uint32_t *paging_create_directory(void);
+void paging_free_directory(uint32_t *pd);
+int paging_map_user(uint32_t *pd, uint32_t virt, uint32_t phys, uint32_t flags);
+uint32_t paging_lookup(const uint32_t *pd, uint32_t virt);
+void paging_switch(uint32_t *pd);
+uint32_t *paging_current_directory(void);
+struct regs;
+void page_fault_handler_main(struct regs *r);
+
+#endif // PAGING_H
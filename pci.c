@@ -0,0 +1,337 @@
+#include "pci.h"
+#include "apic.h"
+#include "io.h"
+#include "klog.h"
+#include "paging.h"
+
+// Configuration space through ports 0xCF8/0xCFC. Every access is an
+// address write followed by a data access, so the pair runs with
+// interrupts off.
+//
+// pci_init() walks the bus tree once, from bus 0 through every
+// PCI-to-PCI bridge, and keeps each function with its BAR sizes and MSI
+// capabilities. Drivers register afterwards and are offered every
+// unclaimed function they match.
+
+static pci_device_t devices[PCI_MAX_FOUND];
+static int device_count = 0;
+static const pci_driver_t *drivers[PCI_MAX_DRIVERS];
+static int driver_count = 0;
+static uint8_t bus_scanned[PCI_MAX_BUSES / 8];
+static int next_vector = PCI_MSI_VECTOR_BASE;
+
+static uint32_t config_address(pci_addr_t addr, uint8_t offset) {
+    return 0x80000000u | ((uint32_t)addr.bus << 16) | ((uint32_t)addr.device << 11) |
+           ((uint32_t)addr.function << 8) | (offset & 0xFC);
+}
+
+uint32_t pci_read32(pci_addr_t addr, uint8_t offset) {
+    unsigned long flags = irq_save();
+    outl(PCI_CONFIG_ADDRESS, config_address(addr, offset));
+    uint32_t value = inl(PCI_CONFIG_DATA);
+    irq_restore(flags);
+    return value;
+}
+
+uint16_t pci_read16(pci_addr_t addr, uint8_t offset) {
+    return (uint16_t)(pci_read32(addr, offset) >> ((offset & 2) * 8));
+}
+
+uint8_t pci_read8(pci_addr_t addr, uint8_t offset) {
+    return (uint8_t)(pci_read32(addr, offset) >> ((offset & 3) * 8));
+}
+
+void pci_write32(pci_addr_t addr, uint8_t offset, uint32_t value) {
+    unsigned long flags = irq_save();
+    outl(PCI_CONFIG_ADDRESS, config_address(addr, offset));
+    outl(PCI_CONFIG_DATA, value);
+    irq_restore(flags);
+}
+
+// Read-modify-write of the containing dword
+void pci_write16(pci_addr_t addr, uint8_t offset, uint16_t value) {
+    unsigned long flags = irq_save();
+    uint32_t shift = (offset & 2) * 8;
+    outl(PCI_CONFIG_ADDRESS, config_address(addr, offset));
+    uint32_t dword = inl(PCI_CONFIG_DATA);
+    dword = (dword & ~(0xFFFFu << shift)) | ((uint32_t)value << shift);
+    outl(PCI_CONFIG_DATA, dword);
+    irq_restore(flags);
+}
+
+// Size every BAR by writing all ones and reading back the bits that
+// stuck, with decoding off so the device does not answer at a bogus
+// address meanwhile. A 64-bit BAR takes two slots; only the low half is
+// kept, as nothing is mapped above 4 GiB.
+static void size_bars(pci_device_t *dev, int count) {
+    uint16_t command = pci_read16(dev->addr, PCI_COMMAND);
+    pci_write16(dev->addr, PCI_COMMAND, command & ~(PCI_COMMAND_IO | PCI_COMMAND_MEMORY));
+    for (int i = 0; i < count; i++) {
+        uint8_t offset = PCI_BAR0 + 4 * i;
+        uint32_t bar = pci_read32(dev->addr, offset);
+        pci_write32(dev->addr, offset, 0xFFFFFFFF);
+        uint32_t mask = pci_read32(dev->addr, offset);
+        pci_write32(dev->addr, offset, bar);
+
+        pci_bar_t *b = &dev->bar[i];
+        if (bar & PCI_BAR_IO) {
+            b->flags = PCI_BAR_FLAG_IO;
+            b->base = bar & PCI_BAR_IO_MASK;
+            mask &= PCI_BAR_IO_MASK & 0xFFFF;
+            b->size = mask ? (~mask + 1) & 0xFFFF : 0;
+        } else {
+            b->base = bar & PCI_BAR_MEM_MASK;
+            mask &= PCI_BAR_MEM_MASK;
+            b->size = mask ? ~mask + 1 : 0;
+            if (bar & PCI_BAR_PREFETCH) b->flags |= PCI_BAR_FLAG_PREFETCH;
+            if ((bar & PCI_BAR_TYPE_MASK) == PCI_BAR_TYPE_64 && i + 1 < count) {
+                b->flags |= PCI_BAR_FLAG_64;
+                // Out of reach when the firmware placed it above 4 GiB
+                if (pci_read32(dev->addr, offset + 4)) b->size = 0;
+                i++;
+            }
+        }
+    }
+    pci_write16(dev->addr, PCI_COMMAND, command);
+}
+
+// Offset of the first capability `id` after the one at `after` (0 for
+// the start of the list), or 0 when there is none
+uint8_t pci_next_capability(const pci_device_t *dev, uint8_t id, uint8_t after) {
+    if (!(pci_read16(dev->addr, PCI_STATUS) & PCI_STATUS_CAP_LIST)) return 0;
+    uint8_t offset = after ? pci_read8(dev->addr, after + 1) & 0xFC
+                           : pci_read8(dev->addr, PCI_CAPABILITIES) & 0xFC;
+    // The list lives in the 192 bytes after the header; bound the walk in
+    // case a broken device links it into a loop
+    for (int n = 0; offset >= 0x40 && n < 48; n++) {
+        if (pci_read8(dev->addr, offset) == id) return offset;
+        offset = pci_read8(dev->addr, offset + 1) & 0xFC;
+    }
+    return 0;
+}
+
+static void find_capabilities(pci_device_t *dev) {
+    dev->msi_cap = pci_next_capability(dev, PCI_CAP_MSI, 0);
+    dev->msix_cap = pci_next_capability(dev, PCI_CAP_MSIX, 0);
+    if (dev->msix_cap) {
+        dev->msix_entries = (pci_read16(dev->addr, dev->msix_cap + PCI_MSIX_CONTROL) &
+                             PCI_MSIX_SIZE_MASK) + 1;
+    }
+}
+
+static void scan_bus(uint8_t bus);
+
+static void scan_function(pci_addr_t addr) {
+    if (device_count >= PCI_MAX_FOUND) return;
+    pci_device_t *dev = &devices[device_count++];
+    dev->addr = addr;
+    dev->vendor = pci_read16(addr, PCI_VENDOR_ID);
+    dev->device = pci_read16(addr, PCI_DEVICE_ID);
+    dev->class = pci_read8(addr, PCI_CLASS);
+    dev->subclass = pci_read8(addr, PCI_SUBCLASS);
+    dev->prog_if = pci_read8(addr, PCI_PROG_IF);
+    dev->revision = pci_read8(addr, PCI_REVISION);
+    dev->header_type = pci_read8(addr, PCI_HEADER_TYPE) & PCI_HEADER_MASK;
+    dev->irq_line = pci_read8(addr, PCI_INTERRUPT_LINE);
+    dev->irq_pin = pci_read8(addr, PCI_INTERRUPT_PIN);
+
+    if (dev->header_type == PCI_HEADER_NORMAL) {
+        size_bars(dev, PCI_BARS);
+    } else if (dev->header_type == PCI_HEADER_BRIDGE) {
+        size_bars(dev, 2);
+    }
+    find_capabilities(dev);
+
+    if (dev->header_type == PCI_HEADER_BRIDGE) {
+        uint8_t secondary = pci_read8(addr, PCI_SECONDARY_BUS);
+        if (secondary) scan_bus(secondary);
+    }
+}
+
+static void scan_device(uint8_t bus, uint8_t device) {
+    pci_addr_t addr = {bus, device, 0};
+    if (pci_read16(addr, PCI_VENDOR_ID) == PCI_VENDOR_NONE) return;
+    int functions = pci_read8(addr, PCI_HEADER_TYPE) & PCI_HEADER_MULTIFUNCTION
+                        ? PCI_MAX_FUNCTIONS : 1;
+    for (uint8_t fn = 0; fn < functions; fn++) {
+        addr.function = fn;
+        if (pci_read16(addr, PCI_VENDOR_ID) != PCI_VENDOR_NONE) scan_function(addr);
+    }
+}
+
+static void scan_bus(uint8_t bus) {
+    // A misprogrammed bridge could point back up the tree
+    if (bus_scanned[bus / 8] & (1 << (bus % 8))) return;
+    bus_scanned[bus / 8] |= 1 << (bus % 8);
+    for (uint8_t device = 0; device < PCI_MAX_DEVICES; device++) {
+        scan_device(bus, device);
+    }
+}
+
+// Enumerate every function. A multifunction host bridge means several
+// host controllers, function n owning bus n.
+void pci_init(void) {
+    pci_addr_t host = {0, 0, 0};
+    if (pci_read16(host, PCI_VENDOR_ID) == PCI_VENDOR_NONE) {
+        klog(KLOG_INFO, KLOG_KERNEL, "pci: no host bridge");
+        return;
+    }
+    if (pci_read8(host, PCI_HEADER_TYPE) & PCI_HEADER_MULTIFUNCTION) {
+        for (uint8_t fn = 0; fn < PCI_MAX_FUNCTIONS; fn++) {
+            host.function = fn;
+            if (pci_read16(host, PCI_VENDOR_ID) != PCI_VENDOR_NONE) scan_bus(fn);
+        }
+    } else {
+        scan_bus(0);
+    }
+    for (int i = 0; i < device_count; i++) {
+        pci_device_t *dev = &devices[i];
+        klog(KLOG_DEBUG, KLOG_KERNEL, "pci %02x:%02x.%u %04x:%04x %s", dev->addr.bus,
+             dev->addr.device, dev->addr.function, dev->vendor, dev->device,
+             (uint32_t)pci_class_name(dev->class, dev->subclass));
+    }
+    klog(KLOG_INFO, KLOG_KERNEL, "pci: %d functions", device_count);
+}
+
+int pci_device_count(void) {
+    return device_count;
+}
+
+pci_device_t *pci_device(int index) {
+    if (index < 0 || index >= device_count) return 0;
+    return &devices[index];
+}
+
+static int matches(const pci_driver_t *drv, const pci_device_t *dev) {
+    return (drv->vendor == PCI_ANY || drv->vendor == dev->vendor) &&
+           (drv->device == PCI_ANY || drv->device == dev->device) &&
+           (drv->class == PCI_ANY || drv->class == dev->class) &&
+           (drv->subclass == PCI_ANY || drv->subclass == dev->subclass);
+}
+
+// Add a driver and probe it on every unclaimed function it matches.
+// Returns how many functions it took, or -1 when the table is full.
+int pci_register_driver(const pci_driver_t *driver) {
+    if (driver_count >= PCI_MAX_DRIVERS) return -1;
+    drivers[driver_count++] = driver;
+    int bound = 0;
+    for (int i = 0; i < device_count; i++) {
+        pci_device_t *dev = &devices[i];
+        if (dev->driver || !matches(driver, dev)) continue;
+        if (driver->probe(dev) == 0) {
+            dev->driver = driver;
+            bound++;
+            klog(KLOG_INFO, KLOG_KERNEL, "pci %02x:%02x.%u bound to %s", dev->addr.bus,
+                 dev->addr.device, dev->addr.function, (uint32_t)driver->name);
+        }
+    }
+    return bound;
+}
+
+// Decode the function's I/O and memory BARs and let it master the bus
+void pci_enable_master(pci_device_t *dev) {
+    pci_write16(dev->addr, PCI_COMMAND, pci_read16(dev->addr, PCI_COMMAND) |
+                PCI_COMMAND_IO | PCI_COMMAND_MEMORY | PCI_COMMAND_MASTER);
+}
+
+// A vector of its own for an MSI user, -1 once they run out
+int pci_alloc_vector(void) {
+    unsigned long flags = irq_save();
+    int vector = next_vector < PCI_MSI_VECTOR_END ? next_vector++ : -1;
+    irq_restore(flags);
+    return vector;
+}
+
+// Have the function signal `vector` as a message to the boot CPU's local
+// APIC instead of pulling its INTx line, which the PIC or IOAPIC may share
+// with other devices. Only single-message MSI. Threads run on the boot
+// CPU, so call this from there.
+int pci_enable_msi(pci_device_t *dev, int vector) {
+    if (!dev->msi_cap || vector < 0 || !lapic_present()) return -1;
+    uint8_t cap = dev->msi_cap;
+    uint16_t control = pci_read16(dev->addr, cap + PCI_MSI_CONTROL);
+    pci_write32(dev->addr, cap + PCI_MSI_ADDRESS,
+                PCI_MSI_ADDRESS_BASE | (lapic_id() << PCI_MSI_DEST_SHIFT));
+    if (control & PCI_MSI_64BIT) {
+        pci_write32(dev->addr, cap + PCI_MSI_ADDRESS + 4, 0);
+        pci_write16(dev->addr, cap + PCI_MSI_DATA_64, vector);
+    } else {
+        pci_write16(dev->addr, cap + PCI_MSI_DATA_32, vector);
+    }
+    control = (control & ~PCI_MSI_MULTI_MASK) | PCI_MSI_ENABLE;
+    pci_write16(dev->addr, cap + PCI_MSI_CONTROL, control);
+    pci_write16(dev->addr, PCI_COMMAND,
+                pci_read16(dev->addr, PCI_COMMAND) | PCI_COMMAND_INTX_DISABLE);
+    return 0;
+}
+
+// Point MSI-X table entry `entry` at `vector` on the boot CPU and turn
+// MSI-X on. The table lives in one of the function's memory BARs and is
+// mapped on first use; entries not set up stay masked.
+int pci_enable_msix(pci_device_t *dev, int entry, int vector) {
+    if (!dev->msix_cap || entry < 0 || entry >= dev->msix_entries || vector < 0 ||
+        !lapic_present()) {
+        return -1;
+    }
+    uint8_t cap = dev->msix_cap;
+    if (!dev->msix_table) {
+        uint32_t table = pci_read32(dev->addr, cap + PCI_MSIX_TABLE);
+        uint32_t bir = table & PCI_MSIX_BIR_MASK;
+        if (bir >= PCI_BARS) return -1;
+        const pci_bar_t *bar = &dev->bar[bir];
+        if (!bar->size || (bar->flags & PCI_BAR_FLAG_IO)) return -1;
+        dev->msix_table = paging_map_mmio(bar->base + (table & ~PCI_MSIX_BIR_MASK),
+                                          dev->msix_entries * PCI_MSIX_ENTRY_SIZE);
+        if (!dev->msix_table) return -1;
+    }
+    volatile uint32_t *e = dev->msix_table + entry * PCI_MSIX_ENTRY_SIZE / 4;
+    e[0] = PCI_MSI_ADDRESS_BASE | (lapic_id() << PCI_MSI_DEST_SHIFT);
+    e[1] = 0;
+    e[2] = vector;
+    e[3] = 0;   // unmasked
+
+    uint16_t control = pci_read16(dev->addr, cap + PCI_MSIX_CONTROL);
+    pci_write16(dev->addr, cap + PCI_MSIX_CONTROL,
+                (control | PCI_MSIX_ENABLE) & ~PCI_MSIX_FUNCTION_MASK);
+    pci_write16(dev->addr, PCI_COMMAND,
+                pci_read16(dev->addr, PCI_COMMAND) | PCI_COMMAND_INTX_DISABLE);
+    return 0;
+}
+
+typedef struct {
+    uint8_t class;
+    uint8_t subclass;   // 0xFF for the class as a whole
+    const char *name;
+} class_name_t;
+
+static const class_name_t class_names[] = {
+    {0x01, 0x01, "IDE controller"},
+    {0x01, 0x06, "SATA controller"},
+    {0x01, 0x08, "NVMe controller"},
+    {0x01, 0xFF, "Storage controller"},
+    {0x02, 0x00, "Ethernet controller"},
+    {0x02, 0xFF, "Network controller"},
+    {0x03, 0x00, "VGA controller"},
+    {0x03, 0xFF, "Display controller"},
+    {0x04, 0xFF, "Multimedia controller"},
+    {0x05, 0xFF, "Memory controller"},
+    {0x06, 0x00, "Host bridge"},
+    {0x06, 0x01, "ISA bridge"},
+    {0x06, 0x04, "PCI bridge"},
+    {0x06, 0xFF, "Bridge"},
+    {0x07, 0xFF, "Communication controller"},
+    {0x08, 0xFF, "System peripheral"},
+    {0x0C, 0x03, "USB controller"},
+    {0x0C, 0x05, "SMBus controller"},
+    {0x0C, 0xFF, "Serial bus controller"},
+};
+
+const char *pci_class_name(uint8_t class, uint8_t subclass) {
+    for (uint32_t i = 0; i < sizeof(class_names) / sizeof(class_names[0]); i++) {
+        const class_name_t *c = &class_names[i];
+        if (c->class == class && (c->subclass == subclass || c->subclass == 0xFF)) {
+            return c->name;
+        }
+    }
+    return "Unclassified device";
+}
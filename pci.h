@@ -0,0 +1,166 @@
+#ifndef PCI_H
+#define PCI_H
+
+#include <stdint.h>
+
+// Configuration mechanism #1
+#define PCI_CONFIG_ADDRESS 0xCF8
+#define PCI_CONFIG_DATA    0xCFC
+
+#define PCI_MAX_BUSES     256
+#define PCI_MAX_DEVICES   32
+#define PCI_MAX_FUNCTIONS 8
+
+// Functions and drivers the kernel keeps track of
+#define PCI_MAX_FOUND   64
+#define PCI_MAX_DRIVERS 16
+
+// Configuration space header
+#define PCI_VENDOR_ID   0x00
+#define PCI_DEVICE_ID   0x02
+#define PCI_COMMAND     0x04
+#define PCI_STATUS      0x06
+#define PCI_REVISION    0x08
+#define PCI_PROG_IF     0x09
+#define PCI_SUBCLASS    0x0A
+#define PCI_CLASS       0x0B
+#define PCI_HEADER_TYPE 0x0E
+#define PCI_BAR0        0x10
+#define PCI_CAPABILITIES 0x34
+#define PCI_INTERRUPT_LINE 0x3C
+#define PCI_INTERRUPT_PIN  0x3D
+
+// PCI-to-PCI bridge header (type 1)
+#define PCI_SECONDARY_BUS 0x19
+
+#define PCI_VENDOR_NONE 0xFFFF
+#define PCI_HEADER_MASK  0x7F
+#define PCI_HEADER_NORMAL 0x00
+#define PCI_HEADER_BRIDGE 0x01
+#define PCI_HEADER_MULTIFUNCTION 0x80
+
+// PCI_COMMAND bits
+#define PCI_COMMAND_IO     0x0001
+#define PCI_COMMAND_MEMORY 0x0002
+#define PCI_COMMAND_MASTER 0x0004
+#define PCI_COMMAND_INTX_DISABLE 0x0400
+
+// PCI_STATUS bits
+#define PCI_STATUS_CAP_LIST 0x0010
+
+// BAR low bits
+#define PCI_BAR_IO        0x1
+#define PCI_BAR_IO_MASK   0xFFFFFFFC
+#define PCI_BAR_MEM_MASK  0xFFFFFFF0
+#define PCI_BAR_TYPE_MASK 0x6
+#define PCI_BAR_TYPE_64   0x4
+#define PCI_BAR_PREFETCH  0x8
+#define PCI_BARS          6
+
+// Capability IDs
+#define PCI_CAP_MSI    0x05
+#define PCI_CAP_VENDOR 0x09
+#define PCI_CAP_MSIX   0x11
+
+// MSI capability: control word, then the address and data, with the
+// address upper half in between for 64-bit capable functions
+#define PCI_MSI_CONTROL    2
+#define PCI_MSI_ADDRESS    4
+#define PCI_MSI_DATA_32    8
+#define PCI_MSI_DATA_64    12
+#define PCI_MSI_ENABLE     0x0001
+#define PCI_MSI_MULTI_MASK 0x0070
+#define PCI_MSI_64BIT      0x0080
+
+// MSI-X capability: control word and the table's BAR and offset; each
+// table entry is address low/high, data and a mask bit
+#define PCI_MSIX_CONTROL       2
+#define PCI_MSIX_TABLE         4
+#define PCI_MSIX_SIZE_MASK     0x07FF
+#define PCI_MSIX_FUNCTION_MASK 0x4000
+#define PCI_MSIX_ENABLE        0x8000
+#define PCI_MSIX_BIR_MASK      0x7
+#define PCI_MSIX_ENTRY_SIZE    16
+
+// Messages go to the local APIC of the CPU in the address
+#define PCI_MSI_ADDRESS_BASE 0xFEE00000
+#define PCI_MSI_DEST_SHIFT   12
+
+// Vectors handed out to MSI users, after the local APIC's own and up to
+// the last assembly stub (ISR_STUB_COUNT)
+#define PCI_MSI_VECTOR_BASE 0x32
+#define PCI_MSI_VECTOR_END  0x40
+
+#define PCI_CLASS_STORAGE 0x01
+#define PCI_SUBCLASS_IDE  0x01
+#define PCI_CLASS_BRIDGE  0x06
+
+// Wildcard for pci_driver_t matching
+#define PCI_ANY 0xFFFF
+
+typedef struct {
+    uint8_t bus;
+    uint8_t device;
+    uint8_t function;
+} pci_addr_t;
+
+#define PCI_BAR_FLAG_IO       0x1
+#define PCI_BAR_FLAG_64       0x2
+#define PCI_BAR_FLAG_PREFETCH 0x4
+
+typedef struct {
+    uint32_t base;
+    uint32_t size;   // 0 for an unimplemented or unreachable BAR
+    uint32_t flags;
+} pci_bar_t;
+
+struct pci_driver;
+
+typedef struct {
+    pci_addr_t addr;
+    uint16_t vendor;
+    uint16_t device;
+    uint8_t class;
+    uint8_t subclass;
+    uint8_t prog_if;
+    uint8_t revision;
+    uint8_t header_type;
+    uint8_t irq_line;
+    uint8_t irq_pin;
+    uint8_t msi_cap;    // capability offsets, 0 when absent
+    uint8_t msix_cap;
+    uint16_t msix_entries;
+    volatile uint32_t *msix_table;   // mapped by pci_enable_msix()
+    pci_bar_t bar[PCI_BARS];
+    const struct pci_driver *driver;
+} pci_device_t;
+
+// A driver matches on vendor/device and class/subclass, PCI_ANY for any;
+// probe returns 0 when it takes the device
+typedef struct pci_driver {
+    const char *name;
+    uint16_t vendor;
+    uint16_t device;
+    uint16_t class;
+    uint16_t subclass;
+    int (*probe)(pci_device_t *dev);
+} pci_driver_t;
+
+uint32_t pci_read32(pci_addr_t addr, uint8_t offset);
+uint16_t pci_read16(pci_addr_t addr, uint8_t offset);
+uint8_t pci_read8(pci_addr_t addr, uint8_t offset);
+void pci_write32(pci_addr_t addr, uint8_t offset, uint32_t value);
+void pci_write16(pci_addr_t addr, uint8_t offset, uint16_t value);
+
+void pci_init(void);
+int pci_device_count(void);
+pci_device_t *pci_device(int index);
+int pci_register_driver(const pci_driver_t *driver);
+void pci_enable_master(pci_device_t *dev);
+int pci_alloc_vector(void);
+uint8_t pci_next_capability(const pci_device_t *dev, uint8_t id, uint8_t after);
+int pci_enable_msi(pci_device_t *dev, int vector);
+int pci_enable_msix(pci_device_t *dev, int entry, int vector);
+const char *pci_class_name(uint8_t class, uint8_t subclass);
+
+#endif // PCI_H
@@ -0,0 +1,161 @@
+#include "perf.h"
+#include "ksyms.h"
+#include "kernel.h"
+#include "timer.h"
+#include "heap.h"
+#include "klog.h"
+#include "cpu.h"
+#include "io.h"
+
+// Sampling profiler. While it runs, every `period`-th timer tick stores the
+// interrupted EIP; nothing is resolved until the report, so a sample costs
+// a decrement and a store.
+
+volatile uint32_t perf_countdown = 0;
+
+static uint32_t eips[PERF_MAX_SAMPLES];
+static volatile uint32_t sample_count = 0;
+static volatile uint32_t dropped = 0;
+static uint32_t period = 1;
+static uint64_t start_tsc = 0;
+static uint64_t elapsed_tsc = 0;
+
+// Called from the timer interrupt while perf_countdown is nonzero
+void perf_sample(struct regs *r) {
+    if (--perf_countdown) return;
+    perf_countdown = period;
+    if (sample_count < PERF_MAX_SAMPLES) {
+        eips[sample_count++] = r->eip;
+    } else {
+        dropped++;
+    }
+}
+
+// Start a new session sampling `hz` times a second, rounded to a whole
+// number of ticks. Earlier samples are discarded.
+int perf_start(uint32_t hz) {
+    if (hz < PERF_MIN_HZ || hz > TIMER_HZ) return -1;
+
+    unsigned long flags = irq_save();
+    period = TIMER_HZ / hz;
+    sample_count = 0;
+    dropped = 0;
+    elapsed_tsc = 0;
+    start_tsc = rdtsc();
+    perf_countdown = period;
+    irq_restore(flags);
+    klog(KLOG_INFO, KLOG_KERNEL, "perf: sampling at %u Hz", TIMER_HZ / period);
+    return 0;
+}
+
+void perf_stop(void) {
+    if (!perf_countdown) return;
+    perf_countdown = 0;
+    elapsed_tsc = rdtsc() - start_tsc;
+    klog(KLOG_INFO, KLOG_KERNEL, "perf: %u samples, %u dropped", sample_count, dropped);
+}
+
+int perf_running(void) {
+    return perf_countdown != 0;
+}
+
+uint32_t perf_samples(void) {
+    return sample_count;
+}
+
+static void print_right(uint32_t v, int width) {
+    uint32_t digits = 1;
+    for (uint32_t t = v; t >= 10; t /= 10) digits++;
+    for (int i = digits; i < width; i++) print(" ");
+    printn(v);
+}
+
+// Tenths of a percent, right-aligned as "100.0%"
+static void print_percent(uint32_t part, uint32_t total) {
+    // Both are at most PERF_MAX_SAMPLES, so this stays in 32 bits
+    uint32_t tenths = total ? part * 1000 / total : 0;
+    print_right(tenths / 10, 4);
+    print(".");
+    printn(tenths % 10);
+    print("%");
+}
+
+// Resolve the samples of the last session and list the `top` functions
+// that were interrupted most often
+void perf_report(int top) {
+    uint32_t total = sample_count;
+    if (perf_running()) {
+        print_colored("perf: still sampling; run `perf stop` first\n", COLOR_LIGHT_RED);
+        return;
+    }
+    if (total == 0) {
+        print("perf: no samples\n");
+        return;
+    }
+
+    print("Samples: ");
+    printn(total);
+    print(" at ");
+    printn(TIMER_HZ / period);
+    print(" Hz");
+    uint32_t khz = timer_tsc_khz();
+    if (khz) {
+        uint64_t ms = elapsed_tsc;
+        div64_32(&ms, khz);
+        print(" over ");
+        printn((uint32_t)ms);
+        print(" ms");
+    }
+    if (dropped) {
+        print(", ");
+        printn(dropped);
+        print(" dropped (buffer full)");
+    }
+    print("\n");
+
+    if (ksyms_count == 0) {
+        print_colored("perf: kernel has no symbol table\n", COLOR_LIGHT_RED);
+        return;
+    }
+    uint32_t *hits = kmalloc(ksyms_count * sizeof(uint32_t));
+    if (!hits) {
+        print_colored("perf: out of memory\n", COLOR_LIGHT_RED);
+        return;
+    }
+    for (uint32_t i = 0; i < ksyms_count; i++) hits[i] = 0;
+    uint32_t unknown = 0;
+    for (uint32_t i = 0; i < total; i++) {
+        int sym = ksym_find(eips[i]);
+        if (sym < 0) {
+            unknown++;
+        } else {
+            hits[sym]++;
+        }
+    }
+
+    print_colored(" Overhead  Samples  Function\n", COLOR_LIGHT_GREEN);
+    // Repeated selection; top is small next to the symbol count
+    for (int n = 0; n < top; n++) {
+        uint32_t best = 0;
+        for (uint32_t i = 1; i < ksyms_count; i++) {
+            if (hits[i] > hits[best]) best = i;
+        }
+        if (hits[best] == 0) break;
+        print("  ");
+        print_percent(hits[best], total);
+        print(" ");
+        print_right(hits[best], 8);
+        print("  ");
+        print(ksyms_name[best]);
+        print("\n");
+        hits[best] = 0;
+    }
+    if (unknown) {
+        print("  ");
+        print_percent(unknown, total);
+        print(" ");
+        print_right(unknown, 8);
+        print("  [outside kernel text]\n");
+    }
+    kfree(hits);
+}
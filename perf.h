@@ -0,0 +1,28 @@
+#ifndef PERF_H
+#define PERF_H
+
+#include <stdint.h>
+#include "idt.h"
+
+// Samples kept per session; later ticks are counted as dropped
+#define PERF_MAX_SAMPLES 16384
+
+// Sample rate bounds; the rate is the timer tick divided by a whole number
+#define PERF_DEFAULT_HZ 1000
+#define PERF_MIN_HZ     1
+
+// Functions listed by perf_report() unless told otherwise
+#define PERF_DEFAULT_TOP 10
+
+// Ticks until the next sample, 0 while the profiler is off. Read by the
+// timer interrupt before it calls perf_sample().
+extern volatile uint32_t perf_countdown;
+
+int perf_start(uint32_t hz);
+void perf_stop(void);
+int perf_running(void);
+uint32_t perf_samples(void);
+void perf_sample(struct regs *r);
+void perf_report(int top);
+
+#endif // PERF_H
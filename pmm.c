@@ -0,0 +1,341 @@
+#include "pmm.h"
+#include "spinlock.h"
+#include "klib.h"
+
+// Boundaries of the loaded kernel image, from link.ld
+extern char kernel_start[];
+extern char kernel_end[];
+
+#define PMM_MAX_REGIONS  32
+#define PMM_MAX_RESERVED 32
+
+typedef struct {
+    uint32_t start;
+    uint32_t end;
+} range_t;
+
+// Usable RAM reported by the boot loader, clipped to PMM_MAX_MEMORY
+static range_t regions[PMM_MAX_REGIONS];
+static int region_count = 0;
+
+// Ranges inside usable RAM that must never be handed out
+static range_t reserved[PMM_MAX_RESERVED];
+static int reserved_count = 0;
+
+// Buddy allocator state. Each free block is linked into the list for its
+// order through the descriptor of its first frame.
+static page_t *pages = 0;
+static uint32_t max_frame = 0;
+static uint32_t free_head[PMM_MAX_ORDER + 1];
+static uint32_t free_blocks[PMM_MAX_ORDER + 1];
+static uint32_t total_frames = 0;
+static uint32_t free_frames = 0;
+// Taken by the public allocation calls; the heap calls in with its own lock
+// held, never the other way round
+static spinlock_t pmm_lock = SPINLOCK_INIT;
+
+static inline uint32_t align_up(uint32_t addr) {
+    return (addr + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+}
+
+static inline uint32_t align_down(uint32_t addr) {
+    return addr & ~(PAGE_SIZE - 1);
+}
+
+static void add_region(uint64_t addr, uint64_t len) {
+    uint64_t end = addr + len;
+    if (addr >= PMM_MAX_MEMORY || region_count >= PMM_MAX_REGIONS) return;
+    if (end > PMM_MAX_MEMORY) end = PMM_MAX_MEMORY;
+    regions[region_count].start = align_up((uint32_t)addr);
+    regions[region_count].end = align_down((uint32_t)end);
+    if (regions[region_count].start < regions[region_count].end) {
+        region_count++;
+    }
+}
+
+static void reserve_range(uint32_t start, uint32_t end) {
+    if (reserved_count >= PMM_MAX_RESERVED || start >= end) return;
+    reserved[reserved_count].start = align_down(start);
+    reserved[reserved_count].end = align_up(end);
+    reserved_count++;
+}
+
+// End of the reserved range containing `addr`, or 0 if it is not reserved
+static uint32_t reserved_end(uint32_t addr) {
+    for (int i = 0; i < reserved_count; i++) {
+        if (addr >= reserved[i].start && addr < reserved[i].end) {
+            return reserved[i].end;
+        }
+    }
+    return 0;
+}
+
+static void list_push(unsigned int order, uint32_t frame) {
+    page_t *page = &pages[frame];
+    page->flags = PAGE_FREE;
+    page->order = order;
+    page->prev = PMM_NONE;
+    page->next = free_head[order];
+    if (free_head[order] != PMM_NONE) {
+        pages[free_head[order]].prev = frame;
+    }
+    free_head[order] = frame;
+    free_blocks[order]++;
+}
+
+static void list_remove(unsigned int order, uint32_t frame) {
+    page_t *page = &pages[frame];
+    if (page->prev != PMM_NONE) {
+        pages[page->prev].next = page->next;
+    } else {
+        free_head[order] = page->next;
+    }
+    if (page->next != PMM_NONE) {
+        pages[page->next].prev = page->prev;
+    }
+    page->flags &= ~PAGE_FREE;
+    page->next = page->prev = PMM_NONE;
+    free_blocks[order]--;
+}
+
+// Return a block to the free lists, merging with its buddy while the buddy
+// is a free block of the same order
+static void free_block(uint32_t frame, unsigned int order) {
+    free_frames += 1u << order;
+    while (order < PMM_MAX_ORDER) {
+        uint32_t buddy = frame ^ (1u << order);
+        if (buddy >= max_frame) break;
+        if (!(pages[buddy].flags & PAGE_FREE) || pages[buddy].order != order) break;
+        list_remove(order, buddy);
+        frame &= ~(1u << order);
+        order++;
+    }
+    list_push(order, frame);
+}
+
+// Free an arbitrary run of frames as the largest aligned blocks that fit
+static void free_range(uint32_t frame, uint32_t count) {
+    while (count) {
+        unsigned int order = 0;
+        while (order < PMM_MAX_ORDER && !(frame & (1u << order)) &&
+               (2u << order) <= count) {
+            order++;
+        }
+        free_block(frame, order);
+        frame += 1u << order;
+        count -= 1u << order;
+    }
+}
+
+// Take a block of 2^order frames, splitting a larger one if needed.
+// At most PMM_MAX_ORDER list operations, i.e. O(log n).
+static uint32_t alloc_block(unsigned int order) {
+    unsigned int k = order;
+    while (k <= PMM_MAX_ORDER && free_head[k] == PMM_NONE) {
+        k++;
+    }
+    if (k > PMM_MAX_ORDER) {
+        return PMM_NONE;
+    }
+
+    uint32_t frame = free_head[k];
+    list_remove(k, frame);
+    while (k > order) {
+        k--;
+        list_push(k, frame + (1u << k));
+    }
+    pages[frame].order = order;
+    free_frames -= 1u << order;
+    return frame;
+}
+
+// Hand the usable frames of [start, end) to the allocator, skipping
+// reserved ranges
+static void add_free_memory(uint32_t start, uint32_t end) {
+    uint32_t addr = start;
+    while (addr < end) {
+        uint32_t skip = reserved_end(addr);
+        if (skip) {
+            addr = skip;
+            continue;
+        }
+        uint32_t run = addr;
+        while (run < end && !reserved_end(run)) {
+            pages[run >> PAGE_SHIFT].flags = 0;
+            run += PAGE_SIZE;
+        }
+        total_frames += (run - addr) >> PAGE_SHIFT;
+        free_range(addr >> PAGE_SHIFT, (run - addr) >> PAGE_SHIFT);
+        addr = run;
+    }
+}
+
+// Find room for `size` bytes of usable, unreserved memory
+static uint32_t find_free_area(uint32_t size) {
+    for (int i = 0; i < region_count; i++) {
+        uint32_t addr = regions[i].start;
+        while (addr < regions[i].end && regions[i].end - addr >= size) {
+            uint32_t skip = 0;
+            for (uint32_t a = addr; a < addr + size; a += PAGE_SIZE) {
+                skip = reserved_end(a);
+                if (skip) break;
+            }
+            if (!skip) return addr;
+            addr = skip;
+        }
+    }
+    return 0;
+}
+
+void pmm_init(multiboot_info_t *mbi) {
+    uint32_t highest = 0;
+
+    for (int i = 0; i <= PMM_MAX_ORDER; i++) {
+        free_head[i] = PMM_NONE;
+        free_blocks[i] = 0;
+    }
+
+    // Real mode IVT, BIOS data, VGA memory and option ROMs
+    reserve_range(0, 0x100000);
+    reserve_range(virt_to_phys(kernel_start), virt_to_phys(kernel_end));
+    reserve_range(virt_to_phys(mbi), virt_to_phys(mbi) + sizeof(multiboot_info_t));
+
+    // Modules (the initrd) stay where the boot loader put them
+    if (mbi->flags & MULTIBOOT_INFO_MODS) {
+        multiboot_module_t *mods = phys_to_virt(mbi->mods_addr);
+        reserve_range(mbi->mods_addr, mbi->mods_addr + mbi->mods_count * sizeof(multiboot_module_t));
+        for (uint32_t i = 0; i < mbi->mods_count; i++) {
+            reserve_range(mods[i].mod_start, mods[i].mod_end);
+            if (mods[i].cmdline) {
+                reserve_range(mods[i].cmdline, mods[i].cmdline + strlen(phys_to_virt(mods[i].cmdline)) + 1);
+            }
+        }
+    }
+
+    if (mbi->flags & MULTIBOOT_INFO_MEM_MAP) {
+        uint32_t addr = mbi->mmap_addr;
+        uint32_t end = mbi->mmap_addr + mbi->mmap_length;
+        reserve_range(addr, end);
+        while (addr < end) {
+            multiboot_mmap_entry_t *entry = phys_to_virt(addr);
+            if (entry->type == MULTIBOOT_MEMORY_AVAILABLE) {
+                add_region(entry->addr, entry->len);
+            }
+            addr += entry->size + sizeof(entry->size);
+        }
+    } else if (mbi->flags & MULTIBOOT_INFO_MEMORY) {
+        add_region(0x100000, (uint64_t)mbi->mem_upper * 1024);
+    }
+
+    for (int i = 0; i < region_count; i++) {
+        if (regions[i].end > highest) highest = regions[i].end;
+    }
+    max_frame = highest >> PAGE_SHIFT;
+    if (max_frame == 0) return;
+
+    // The descriptor array lives in the first free area large enough for it
+    uint32_t size = align_up(max_frame * sizeof(page_t));
+    uint32_t base = find_free_area(size);
+    if (base == 0) {
+        max_frame = 0;
+        return;
+    }
+    reserve_range(base, base + size);
+    pages = phys_to_virt(base);
+
+    for (uint32_t i = 0; i < max_frame; i++) {
+        pages[i].next = PMM_NONE;
+        pages[i].prev = PMM_NONE;
+        pages[i].order = 0;
+        pages[i].flags = PAGE_RESERVED;
+        pages[i].count = 0;
+        pages[i].owner = 0;
+    }
+
+    for (int i = 0; i < region_count; i++) {
+        add_free_memory(regions[i].start, regions[i].end);
+    }
+}
+
+uint32_t pmm_alloc_frames(unsigned int order) {
+    if (order > PMM_MAX_ORDER) return 0;
+    unsigned long flags = spin_lock_irqsave(&pmm_lock);
+    uint32_t frame = alloc_block(order);
+    spin_unlock_irqrestore(&pmm_lock, flags);
+    return frame == PMM_NONE ? 0 : frame << PAGE_SHIFT;
+}
+
+void pmm_free_frames(uint32_t addr, unsigned int order) {
+    uint32_t frame = addr >> PAGE_SHIFT;
+    if (addr == 0 || frame >= max_frame || order > PMM_MAX_ORDER) return;
+    unsigned long flags = spin_lock_irqsave(&pmm_lock);
+    free_block(frame, order);
+    spin_unlock_irqrestore(&pmm_lock, flags);
+}
+
+uint32_t pmm_alloc_frame(void) {
+    return pmm_alloc_frames(0);
+}
+
+void pmm_free_frame(uint32_t addr) {
+    pmm_free_frames(addr, 0);
+}
+
+// Smallest order whose block holds `bytes`
+unsigned int pmm_order_for(uint32_t bytes) {
+    unsigned int order = 0;
+    while (order < PMM_MAX_ORDER && ((uint32_t)PAGE_SIZE << order) < bytes) {
+        order++;
+    }
+    return order;
+}
+
+// Allocate `count` physically contiguous frames. The unused tail of the
+// rounded-up buddy block goes straight back to the free lists.
+uint32_t pmm_alloc_contiguous(uint32_t count) {
+    unsigned int order = 0;
+    if (count == 0 || count > (1u << PMM_MAX_ORDER)) return 0;
+    while ((1u << order) < count) order++;
+
+    unsigned long flags = spin_lock_irqsave(&pmm_lock);
+    uint32_t frame = alloc_block(order);
+    if (frame != PMM_NONE && (1u << order) > count) {
+        free_range(frame + count, (1u << order) - count);
+    }
+    spin_unlock_irqrestore(&pmm_lock, flags);
+    return frame == PMM_NONE ? 0 : frame << PAGE_SHIFT;
+}
+
+void pmm_free_contiguous(uint32_t addr, uint32_t count) {
+    uint32_t frame = addr >> PAGE_SHIFT;
+    if (addr == 0 || frame + count > max_frame) return;
+    unsigned long flags = spin_lock_irqsave(&pmm_lock);
+    free_range(frame, count);
+    spin_unlock_irqrestore(&pmm_lock, flags);
+}
+
+page_t *pmm_page(uint32_t addr) {
+    uint32_t frame = addr >> PAGE_SHIFT;
+    return frame < max_frame ? &pages[frame] : 0;
+}
+
+// End of the highest managed frame
+uint32_t pmm_max_address(void) {
+    return max_frame << PAGE_SHIFT;
+}
+
+uint32_t pmm_total_count(void) {
+    return total_frames;
+}
+
+uint32_t pmm_free_count(void) {
+    return free_frames;
+}
+
+uint32_t pmm_used_count(void) {
+    return total_frames - free_frames;
+}
+
+uint32_t pmm_free_blocks(unsigned int order) {
+    return order <= PMM_MAX_ORDER ? free_blocks[order] : 0;
+}
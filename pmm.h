@@ -0,0 +1,52 @@
+#ifndef PMM_H
+#define PMM_H
+
+#include <stdint.h>
+#include "multiboot.h"
+#include "paging.h"
+
+#define PAGE_SIZE  4096
+#define PAGE_SHIFT 12
+
+// Largest buddy block is 2^PMM_MAX_ORDER frames (4 MiB)
+#define PMM_MAX_ORDER 10
+
+// Memory above this physical address is left unmanaged, so every managed
+// frame is reachable through the kernel's direct map
+#define PMM_MAX_MEMORY KERNEL_DIRECT_MAP_SIZE
+
+// Frame number meaning "no frame" in free list links
+#define PMM_NONE 0xFFFFFFFF
+
+// page_t.flags
+#define PAGE_FREE     0x01  // heads a free buddy block
+#define PAGE_RESERVED 0x02  // never handed out (firmware, kernel image, ...)
+#define PAGE_SLAB     0x04  // part of a heap slab, owner is the slab
+#define PAGE_LARGE    0x08  // first frame of a large heap allocation
+
+// One descriptor per physical frame
+typedef struct {
+    uint32_t next;  // free list links (frame numbers)
+    uint32_t prev;
+    uint8_t order;  // order of the block this frame heads
+    uint8_t flags;
+    uint16_t count; // free for the owner's use
+    void *owner;    // free for the owner's use
+} page_t;
+
+void pmm_init(multiboot_info_t *mbi);
+uint32_t pmm_alloc_frames(unsigned int order);
+void pmm_free_frames(uint32_t addr, unsigned int order);
+uint32_t pmm_alloc_frame(void);
+void pmm_free_frame(uint32_t addr);
+uint32_t pmm_alloc_contiguous(uint32_t count);
+void pmm_free_contiguous(uint32_t addr, uint32_t count);
+unsigned int pmm_order_for(uint32_t bytes);
+page_t *pmm_page(uint32_t addr);
+uint32_t pmm_max_address(void);
+uint32_t pmm_total_count(void);
+uint32_t pmm_free_count(void);
+uint32_t pmm_used_count(void);
+uint32_t pmm_free_blocks(unsigned int order);
+
+#endif // PMM_H
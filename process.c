@@ -0,0 +1,204 @@
+#include "process.h"
+#include "syscall.h"
+#include "elf.h"
+#include "initrd.h"
+#include "pmm.h"
+#include "heap.h"
+#include "klib.h"
+#include "klog.h"
+#include "kernel.h"
+#include "idt.h"
+#include "io.h"
+#include "smp.h"
+
+// Drop to ring 3 at `eip` with stack `esp` through sysexit, with the user
+// data segments loaded and interrupts enabled (kernel.asm)
+extern void enter_user(uint32_t eip, uint32_t esp) __attribute__((noreturn));
+
+static int supported = 0;
+static uint32_t next_pid = 1;
+
+// Needs the scheduler's boot CPU to be the calling one
+int process_init(void) {
+    supported = syscall_init() == 0;
+    return supported ? 0 : -1;
+}
+
+int process_supported(void) {
+    return supported;
+}
+
+process_t *process_current(void) {
+    return thread_current()->process;
+}
+
+// Stack pages below USER_STACK_TOP, with argc and argv on top laid out as
+// a cdecl call frame for the program's _start: [return 0][argc][argv].
+// Returns the initial esp, or 0.
+static uint32_t setup_stack(uint32_t *pd, int argc, char **argv) {
+    uint32_t top_frame = 0;
+    for (uint32_t i = 1; i <= USER_STACK_PAGES; i++) {
+        uint32_t phys = pmm_alloc_frame();
+        if (!phys) return 0;
+        memset(phys_to_virt(phys), 0, PAGE_SIZE);
+        if (paging_map_user(pd, USER_STACK_TOP - i * PAGE_SIZE, phys, PTE_WRITE) < 0) {
+            pmm_free_frame(phys);
+            return 0;
+        }
+        if (i == 1) top_frame = phys;
+    }
+
+    // Written through the direct map; `page` is USER_STACK_TOP - PAGE_SIZE
+    uint8_t *page = phys_to_virt(top_frame);
+    uint32_t base = USER_STACK_TOP - PAGE_SIZE;
+    uint32_t sp = USER_STACK_TOP;
+    uint32_t ptrs[PROCESS_MAX_ARGS];
+    for (int i = argc - 1; i >= 0; i--) {
+        uint32_t len = strlen(argv[i]) + 1;
+        if (len > sp - base - PAGE_SIZE / 2) return 0;
+        sp -= len;
+        memcpy(page + (sp - base), argv[i], len);
+        ptrs[i] = sp;
+    }
+    sp &= ~3;
+    sp -= (argc + 1) * 4;
+    uint32_t argv_addr = sp;
+    uint32_t *vec = (uint32_t *)(page + (sp - base));
+    for (int i = 0; i < argc; i++) vec[i] = ptrs[i];
+    vec[argc] = 0;
+
+    // esp + 4 is 16-byte aligned at entry, as GCC expects after a call
+    sp = ((sp - 8) & ~15) - 4;
+    uint32_t *frame = (uint32_t *)(page + (sp - base));
+    frame[0] = 0;
+    frame[1] = argc;
+    frame[2] = argv_addr;
+    return sp;
+}
+
+// First code of a process's thread: take on the address space, then leave
+// for ring 3 for good. The kernel stack is entered again from the top on
+// every system call and interrupt.
+static void process_start(void *arg) {
+    process_t *p = arg;
+    thread_t *t = thread_current();
+    cli();
+    p->thread = t;
+    t->process = p;
+    t->page_directory = p->page_directory;
+    paging_switch(p->page_directory);
+    this_cpu()->tss.esp0 = (uint32_t)t->stack + THREAD_STACK_SIZE;
+    enter_user(p->entry, p->stack);
+}
+
+// Load the program at `path` in the initrd and start it with the given
+// arguments (argv[0] by convention its name). 0 if it could not be
+// started; otherwise process_wait() must collect it.
+process_t *process_spawn(const char *path, int argc, char **argv) {
+    if (!supported || argc > PROCESS_MAX_ARGS) return 0;
+    const initrd_file_t *file = initrd_lookup(path);
+    if (!file || file->type != INITRD_FILE) return 0;
+
+    process_t *p = kmalloc(sizeof(process_t));
+    if (!p) return 0;
+    memset(p, 0, sizeof(*p));
+    p->page_directory = paging_create_directory();
+    if (!p->page_directory) {
+        kfree(p);
+        return 0;
+    }
+    p->entry = elf_load(p->page_directory, file->data, file->size,
+                        USER_STACK_TOP - USER_STACK_PAGES * PAGE_SIZE);
+    p->stack = p->entry ? setup_stack(p->page_directory, argc, argv) : 0;
+    if (!p->stack) {
+        klog(KLOG_WARN, KLOG_KERNEL, "%s: cannot start", (uint32_t)file->path);
+        paging_free_directory(p->page_directory);
+        kfree(p);
+        return 0;
+    }
+
+    int i = 0;
+    for (; file->name[i] && i < THREAD_NAME_LEN - 1; i++) p->name[i] = file->name[i];
+    p->name[i] = '\0';
+    p->image = file->name;
+    p->pid = next_pid++;
+    if (!thread_create(p->name, process_start, p, SCHED_PRIO_NORMAL)) {
+        paging_free_directory(p->page_directory);
+        kfree(p);
+        return 0;
+    }
+    klog(KLOG_DEBUG, KLOG_KERNEL, "process %u: %s", p->pid, (uint32_t)file->path);
+    return p;
+}
+
+// Sleep until `p` exits, free it and return its exit status
+int process_wait(process_t *p) {
+    while (1) {
+        cli();
+        if (p->exited) {
+            sti();
+            break;
+        }
+        if (sched_active()) {
+            sched_block(&p->waiters);
+        } else {
+            sti_hlt();
+        }
+    }
+    int status = p->status;
+    kfree(p);
+    return status;
+}
+
+// Spawn and wait: the exit status, or -1 if the program did not start
+int process_run(const char *path, int argc, char **argv) {
+    process_t *p = process_spawn(path, argc, argv);
+    return p ? process_wait(p) : -1;
+}
+
+// End the calling process. Its address space goes right away; the thread
+// and its kernel stack are reaped by the scheduler.
+void process_exit(int status) {
+    thread_t *t = thread_current();
+    process_t *p = t->process;
+
+    cli();
+    t->page_directory = 0;
+    paging_switch(0);
+    sti();
+    paging_free_directory(p->page_directory);
+    p->page_directory = 0;
+
+    cli();
+    t->process = 0;
+    p->status = status;
+    p->exited = 1;
+    sched_wake_all(&p->waiters);
+    klog(KLOG_DEBUG, KLOG_KERNEL, "process %u exited, status %d", p->pid, status);
+    thread_exit();
+}
+
+// An exception in ring 3 kills the process instead of the kernel
+void process_fault(struct regs *r, const char *what) {
+    process_t *p = process_current();
+    klog(KLOG_WARN, KLOG_KERNEL, "process %u (%s): %s at eip %08x, killed", p->pid,
+         (uint32_t)p->image, (uint32_t)what, r->eip);
+    print_colored(p->name, COLOR_LIGHT_RED);
+    print_colored(": ", COLOR_LIGHT_RED);
+    print_colored(what, COLOR_LIGHT_RED);
+    print_colored(", killed\n", COLOR_LIGHT_RED);
+    sti();
+    process_exit(-1);
+}
+
+// 0 when the calling process may read (or write) all of [ptr, ptr + len)
+int process_check_user(const void *ptr, uint32_t len, int write) {
+    uint32_t start = (uint32_t)ptr;
+    if (len == 0) return 0;
+    if (start < USER_BASE || start >= USER_STACK_TOP || len > USER_STACK_TOP - start) return -1;
+    uint32_t need = PTE_PRESENT | PTE_USER | (write ? PTE_WRITE : 0);
+    for (uint32_t page = start & ~(PAGE_SIZE - 1); page < start + len; page += PAGE_SIZE) {
+        if ((paging_lookup(process_current()->page_directory, page) & need) != need) return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,46 @@
+#ifndef PROCESS_H
+#define PROCESS_H
+
+#include <stdint.h>
+#include "sched.h"
+#include "paging.h"
+
+// User programs run in ring 3, one thread each, in an address space of
+// their own: the ELF segments from USER_BASE up and a stack ending at
+// USER_STACK_TOP. The kernel half of every directory is shared.
+#define USER_STACK_TOP   KERNEL_VIRT_BASE
+#define USER_STACK_PAGES 4
+
+// Arguments passed on the initial stack: at most this many, and their
+// strings within half of the top stack page
+#define PROCESS_MAX_ARGS 16
+
+// Where the shell looks for programs in the initrd
+#define PROCESS_BIN_DIR "bin"
+
+typedef struct process {
+    uint32_t pid;
+    char name[THREAD_NAME_LEN];
+    const char *image;         // initrd file name; outlives the process, for klog
+    uint32_t *page_directory;
+    uint32_t entry;            // user eip and esp for the first entry
+    uint32_t stack;
+    thread_t *thread;
+    volatile int exited;
+    int status;                // exit status, -1 when killed
+    wait_queue_t waiters;      // process_wait()
+} process_t;
+
+struct regs;
+
+int process_init(void);
+int process_supported(void);
+process_t *process_spawn(const char *path, int argc, char **argv);
+int process_wait(process_t *p);
+int process_run(const char *path, int argc, char **argv);
+process_t *process_current(void);
+void process_exit(int status) __attribute__((noreturn));
+void process_fault(struct regs *r, const char *what) __attribute__((noreturn));
+int process_check_user(const void *ptr, uint32_t len, int write);
+
+#endif // PROCESS_H
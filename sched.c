@@ -0,0 +1,486 @@
+#include "sched.h"
+#include "heap.h"
+#include "idt.h"
+#include "cpu.h"
+#include "io.h"
+#include "kernel.h"
+#include "klog.h"
+#include "smp.h"
+#include "paging.h"
+
+// Saves ebp/ebx/esi/edi on the old stack, stores esp in *old_esp and
+// resumes the thread whose stack pointer is new_esp (kernel.asm)
+extern void switch_context(uint32_t *old_esp, uint32_t new_esp);
+
+// The boot context becomes the idle thread; it keeps the kernel.asm stack
+static thread_t idle_thread;
+static thread_t *current = 0;
+static thread_t *all_threads = 0;
+static thread_t *zombies = 0;
+static uint32_t next_id = 0;
+
+// One FIFO per priority plus a bitmap of non-empty levels, so picking the
+// next thread is a bsr and a list pop
+static thread_t *run_head[SCHED_PRIORITIES];
+static thread_t *run_tail[SCHED_PRIORITIES];
+static uint32_t run_bitmap = 0;
+
+// Sleeping threads, earliest wake_tick first
+static thread_t *sleepers = 0;
+
+// Threads blocked on a wait queue until at most their wake_tick; few at a
+// time (disk commands), so unsorted
+static thread_t *timed = 0;
+
+static volatile int need_resched = 0;
+static uint32_t switch_count = 0;
+
+// Lazy FPU switching: CR0.TS is set whenever the running thread does not own
+// the FPU registers, and the first FPU instruction raises #NM to swap them
+static thread_t *fpu_owner = 0;
+static int fpu_fxsr = 0;
+static uint32_t fpu_traps = 0;
+static uint8_t fpu_initial[FPU_STATE_SIZE] __attribute__((aligned(16)));
+
+static inline void stts(void) {
+    write_cr0(read_cr0() | CR0_TS);
+}
+
+static void fpu_save(void *state) {
+    if (fpu_fxsr) {
+        __asm__ volatile ("fxsave (%0)" :: "r"(state) : "memory");
+    } else {
+        __asm__ volatile ("fnsave (%0)" :: "r"(state) : "memory");
+    }
+}
+
+static void fpu_restore(const void *state) {
+    if (fpu_fxsr) {
+        __asm__ volatile ("fxrstor (%0)" :: "r"(state) : "memory");
+    } else {
+        __asm__ volatile ("frstor (%0)" :: "r"(state) : "memory");
+    }
+}
+
+// Enable the FPU and SSE on the calling CPU and reset the FPU registers
+void fpu_init_cpu(void) {
+    uint32_t cr0 = read_cr0();
+    cr0 &= ~(CR0_EM | CR0_TS);
+    cr0 |= CR0_MP | CR0_NE;
+    write_cr0(cr0);
+
+    fpu_fxsr = (cpuid_edx(1) & CPUID_EDX_FXSR) != 0;
+    if (fpu_fxsr) {
+        write_cr4(read_cr4() | CR4_OSFXSR | CR4_OSXMMEXCPT);
+    }
+    __asm__ volatile ("fninit");
+}
+
+static void fpu_init(void) {
+    fpu_init_cpu();
+    // Snapshot of a freshly initialised FPU, loaded for first-time users
+    fpu_save(fpu_initial);
+    stts();
+}
+
+// #NM: hand the FPU to the current thread
+static void fpu_trap(struct regs *r) {
+    clts();
+    fpu_traps++;
+    if (fpu_owner == current) return;
+
+    if (fpu_owner) {
+        fpu_save(fpu_owner->fpu_state);
+    }
+    if (!current->fpu_state) {
+        current->fpu_state = kmalloc(FPU_STATE_SIZE);
+        if (!current->fpu_state) panic("no memory for FPU state");
+        klog(KLOG_DEBUG, KLOG_SCHED, "thread %u uses the FPU", current->id);
+        fpu_restore(fpu_initial);
+    } else {
+        fpu_restore(current->fpu_state);
+    }
+    fpu_owner = current;
+}
+
+// Let kernel code use the SSE registers: the owner's state is written back
+// first and every thread reloads its own on its next FPU instruction.
+// Interrupts stay off until kernel_fpu_end(). Threads only run on the boot
+// CPU, so other CPUs have no thread state to save.
+unsigned long kernel_fpu_begin(void) {
+    unsigned long flags = irq_save();
+    clts();
+    if (fpu_owner && cpu_index() == 0) {
+        fpu_save(fpu_owner->fpu_state);
+        fpu_owner = 0;
+    }
+    return flags;
+}
+
+void kernel_fpu_end(unsigned long flags) {
+    stts();
+    irq_restore(flags);
+}
+
+static void run_push(thread_t *t) {
+    int prio = t->priority;
+    t->next = 0;
+    if (run_tail[prio]) {
+        run_tail[prio]->next = t;
+    } else {
+        run_head[prio] = t;
+    }
+    run_tail[prio] = t;
+    run_bitmap |= 1u << prio;
+}
+
+static thread_t *run_pop(void) {
+    if (!run_bitmap) return 0;
+    int prio = 31 - __builtin_clz(run_bitmap);
+    thread_t *t = run_head[prio];
+    run_head[prio] = t->next;
+    if (!run_head[prio]) {
+        run_tail[prio] = 0;
+        run_bitmap &= ~(1u << prio);
+    }
+    t->next = 0;
+    return t;
+}
+
+// Make a thread runnable, asking for a reschedule if it outranks the
+// running one
+static void make_ready(thread_t *t) {
+    t->state = THREAD_READY;
+    run_push(t);
+    if (t->priority > current->priority) {
+        need_resched = 1;
+    }
+}
+
+void sched_init(void) {
+    for (int i = 0; i < SCHED_PRIORITIES; i++) {
+        run_head[i] = run_tail[i] = 0;
+    }
+    idle_thread.id = next_id++;
+    const char *name = "idle";
+    for (int i = 0; name[i]; i++) idle_thread.name[i] = name[i];
+    idle_thread.priority = SCHED_PRIO_IDLE;
+    idle_thread.state = THREAD_RUNNING;
+    idle_thread.all_next = 0;
+    all_threads = &idle_thread;
+    current = &idle_thread;
+
+    fpu_init();
+    register_irq_handler(EXCEPTION_DEVICE_NOT_AVAILABLE, fpu_trap);
+}
+
+int sched_active(void) {
+    return current != 0;
+}
+
+thread_t *thread_current(void) {
+    return current;
+}
+
+thread_t *thread_first(void) {
+    return all_threads;
+}
+
+const char *thread_state_name(int state) {
+    switch (state) {
+    case THREAD_RUNNING:  return "running";
+    case THREAD_READY:    return "ready";
+    case THREAD_BLOCKED:  return "blocked";
+    case THREAD_SLEEPING: return "sleeping";
+    case THREAD_DEAD:     return "dead";
+    }
+    return "?";
+}
+
+// Free threads that have exited. A thread cannot release the stack it is
+// running on, so this happens later from another thread.
+static void reap(void) {
+    unsigned long flags = irq_save();
+    thread_t *dead = zombies;
+    zombies = 0;
+    for (thread_t *t = dead; t; t = t->next) {
+        thread_t **link = &all_threads;
+        while (*link != t) link = &(*link)->all_next;
+        *link = t->all_next;
+    }
+    irq_restore(flags);
+
+    while (dead) {
+        thread_t *next = dead->next;
+        kfree(dead->fpu_state);
+        kfree(dead->stack);
+        kfree(dead);
+        dead = next;
+    }
+}
+
+// First code run by a new thread, entered from switch_context's ret with
+// interrupts still disabled by schedule()
+static void thread_start(void) {
+    sti();
+    current->entry(current->arg);
+    thread_exit();
+}
+
+thread_t *thread_create(const char *name, thread_entry_t entry, void *arg, int priority) {
+    reap();
+    if (priority <= SCHED_PRIO_IDLE) priority = SCHED_PRIO_IDLE + 1;
+    if (priority >= SCHED_PRIORITIES) priority = SCHED_PRIORITIES - 1;
+
+    thread_t *t = kmalloc(sizeof(thread_t));
+    if (!t) return 0;
+    t->stack = kmalloc(THREAD_STACK_SIZE);
+    if (!t->stack) {
+        kfree(t);
+        return 0;
+    }
+
+    int i = 0;
+    for (; name[i] && i < THREAD_NAME_LEN - 1; i++) t->name[i] = name[i];
+    t->name[i] = '\0';
+    t->priority = priority;
+    t->slice = SCHED_SLICE_TICKS;
+    t->wake_tick = 0;
+    t->fpu_state = 0;
+    t->entry = entry;
+    t->arg = arg;
+    t->switches = 0;
+    t->run_ticks = 0;
+    t->page_directory = 0;
+    t->process = 0;
+    t->timed_next = 0;
+    t->timed_queue = 0;
+
+    // Initial frame popped by switch_context: edi, esi, ebx, ebp, then the
+    // return address, with a null return address above it for thread_start
+    uint32_t *sp = (uint32_t *)((char *)t->stack + THREAD_STACK_SIZE);
+    *--sp = 0;
+    *--sp = (uint32_t)thread_start;
+    *--sp = 0; // ebp
+    *--sp = 0; // ebx
+    *--sp = 0; // esi
+    *--sp = 0; // edi
+    t->esp = (uint32_t)sp;
+
+    unsigned long flags = irq_save();
+    t->id = next_id++;
+    t->all_next = all_threads;
+    all_threads = t;
+    make_ready(t);
+    irq_restore(flags);
+    klog(KLOG_DEBUG, KLOG_SCHED, "thread %u created, priority %d", t->id, priority);
+    return t;
+}
+
+void thread_exit(void) {
+    cli();
+    klog(KLOG_DEBUG, KLOG_SCHED, "thread %u exited", current->id);
+    if (fpu_owner == current) {
+        fpu_owner = 0;
+    }
+    current->state = THREAD_DEAD;
+    current->next = zombies;
+    zombies = current;
+    schedule();
+    panic("dead thread scheduled");
+    while (1);
+}
+
+// Pick the highest-priority ready thread and switch to it. The outgoing
+// thread is queued again unless it blocked, slept or exited.
+void schedule(void) {
+    unsigned long flags = irq_save();
+    thread_t *prev = current;
+
+    need_resched = 0;
+    if (prev->state == THREAD_RUNNING && prev != &idle_thread) {
+        prev->state = THREAD_READY;
+        run_push(prev);
+    }
+
+    thread_t *next = run_pop();
+    if (!next) next = &idle_thread;
+    next->state = THREAD_RUNNING;
+    if (next->slice == 0) next->slice = SCHED_SLICE_TICKS;
+
+    if (next != prev) {
+        current = next;
+        next->switches++;
+        switch_count++;
+        // Trap on the first FPU instruction unless the registers are already
+        // this thread's
+        if (next == fpu_owner) {
+            clts();
+        } else {
+            stts();
+        }
+        // A user thread needs its address space, and its kernel stack for
+        // entries from ring 3 (interrupts through the TSS, sysenter through
+        // the SYSENTER_ESP MSR, which points at esp0). Kernel threads run
+        // on whichever directory is loaded: they only touch kernel memory.
+        if (next->page_directory) {
+            paging_switch(next->page_directory);
+            this_cpu()->tss.esp0 = (uint32_t)next->stack + THREAD_STACK_SIZE;
+        }
+        switch_context(&prev->esp, next->esp);
+    }
+    irq_restore(flags);
+}
+
+void yield(void) {
+    current->slice = 0;
+    schedule();
+}
+
+// Called from the timer interrupt with the new tick count
+void sched_tick(uint64_t now) {
+    if (!current) return;
+
+    while (sleepers && sleepers->wake_tick <= now) {
+        thread_t *t = sleepers;
+        sleepers = t->next;
+        make_ready(t);
+    }
+
+    // Timed out: off the wait queue, back to the run queue
+    thread_t **link = &timed;
+    while (*link) {
+        thread_t *t = *link;
+        if (t->wake_tick > now) {
+            link = &t->timed_next;
+            continue;
+        }
+        *link = t->timed_next;
+        wait_queue_t *queue = t->timed_queue;
+        thread_t *prev = 0;
+        for (thread_t *w = queue->head; w != t; w = w->next) prev = w;
+        if (prev) {
+            prev->next = t->next;
+        } else {
+            queue->head = t->next;
+        }
+        if (queue->tail == t) queue->tail = prev;
+        t->timed_queue = 0;
+        make_ready(t);
+    }
+
+    current->run_ticks++;
+    if (current == &idle_thread) {
+        if (run_bitmap) need_resched = 1;
+    } else if (current->slice && --current->slice == 0) {
+        // Round robin among equals; a lone thread just gets a new slice
+        if (run_bitmap >> current->priority) {
+            need_resched = 1;
+        } else {
+            current->slice = SCHED_SLICE_TICKS;
+        }
+    }
+}
+
+// Called by isr_dispatch once an IRQ has been acknowledged. Threads only
+// run on the boot CPU; the others take nothing but wakeup IPIs.
+void sched_preempt(void) {
+    if (need_resched && current && cpu_index() == 0) {
+        schedule();
+    }
+}
+
+void sched_sleep_until(uint64_t tick) {
+    unsigned long flags = irq_save();
+    thread_t **link = &sleepers;
+    while (*link && (*link)->wake_tick <= tick) {
+        link = &(*link)->next;
+    }
+    current->wake_tick = tick;
+    current->state = THREAD_SLEEPING;
+    current->next = *link;
+    *link = current;
+    schedule();
+    irq_restore(flags);
+}
+
+// Block the current thread on `queue`. The caller disables interrupts while
+// checking its wait condition so a wakeup cannot slip in before this.
+void sched_block(wait_queue_t *queue) {
+    current->state = THREAD_BLOCKED;
+    current->next = 0;
+    if (queue->tail) {
+        queue->tail->next = current;
+    } else {
+        queue->head = current;
+    }
+    queue->tail = current;
+    schedule();
+}
+
+// Like sched_block(), but the thread is made ready again at `tick` if
+// nothing woke it by then. The caller rechecks its condition and deadline.
+void sched_block_timeout(wait_queue_t *queue, uint64_t tick) {
+    current->wake_tick = tick;
+    current->timed_queue = queue;
+    current->timed_next = timed;
+    timed = current;
+    sched_block(queue);
+}
+
+void sched_wake_one(wait_queue_t *queue) {
+    thread_t *t = queue->head;
+    if (!t) return;
+    queue->head = t->next;
+    if (!queue->head) queue->tail = 0;
+    if (t->timed_queue) {
+        thread_t **link = &timed;
+        while (*link != t) link = &(*link)->timed_next;
+        *link = t->timed_next;
+        t->timed_queue = 0;
+    }
+    make_ready(t);
+}
+
+void sched_wake_all(wait_queue_t *queue) {
+    while (queue->head) {
+        sched_wake_one(queue);
+    }
+}
+
+void mutex_lock(mutex_t *mutex) {
+    unsigned long flags = irq_save();
+    if (mutex->locked) {
+        // mutex_unlock() hands the lock over without releasing it
+        sched_block(&mutex->waiters);
+    } else {
+        mutex->locked = 1;
+    }
+    irq_restore(flags);
+}
+
+void mutex_unlock(mutex_t *mutex) {
+    unsigned long flags = irq_save();
+    if (mutex->waiters.head) {
+        sched_wake_one(&mutex->waiters);
+    } else {
+        mutex->locked = 0;
+    }
+    irq_restore(flags);
+}
+
+// The boot thread ends up here once the kernel threads are running
+void sched_idle(void) {
+    while (1) {
+        reap();
+        sti_hlt();
+    }
+}
+
+uint32_t sched_switch_count(void) {
+    return switch_count;
+}
+
+uint32_t sched_fpu_traps(void) {
+    return fpu_traps;
+}
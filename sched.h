@@ -0,0 +1,93 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdint.h>
+
+// Priority levels; higher runs first. Level 0 belongs to the idle thread.
+#define SCHED_PRIORITIES  8
+#define SCHED_PRIO_IDLE   0
+#define SCHED_PRIO_LOW    2
+#define SCHED_PRIO_NORMAL 4
+#define SCHED_PRIO_HIGH   6
+
+// Timer ticks a thread runs before yielding to peers of the same priority
+#define SCHED_SLICE_TICKS 10
+
+#define THREAD_STACK_SIZE 16384
+#define THREAD_NAME_LEN   16
+
+// Size of the FXSAVE image kept for threads that used the FPU
+#define FPU_STATE_SIZE 512
+
+#define THREAD_RUNNING  0
+#define THREAD_READY    1
+#define THREAD_BLOCKED  2
+#define THREAD_SLEEPING 3
+#define THREAD_DEAD     4
+
+typedef void (*thread_entry_t)(void *arg);
+
+typedef struct thread {
+    uint32_t esp;            // saved stack pointer; switch_context relies on it being first
+    uint32_t id;
+    char name[THREAD_NAME_LEN];
+    int priority;
+    int state;
+    uint32_t slice;          // ticks left in the current time slice
+    uint64_t wake_tick;      // for THREAD_SLEEPING, and blocking with a timeout
+    void *stack;
+    void *fpu_state;         // FPU_STATE_SIZE bytes, allocated on first FPU use
+    thread_entry_t entry;
+    void *arg;
+    uint32_t switches;       // times switched in
+    uint32_t run_ticks;      // timer ticks spent running
+    uint32_t *page_directory; // user threads: their process's, loaded on switch-in
+    struct process *process; // user threads: the process they run
+    struct thread *next;     // run queue, wait queue or sleep list link
+    struct thread *all_next; // list of every thread
+    struct thread *timed_next; // list of threads blocked with a timeout
+    struct wait_queue *timed_queue; // the queue such a thread is blocked on
+} thread_t;
+
+// Threads blocked on an event, woken in FIFO order
+typedef struct wait_queue {
+    thread_t *head;
+    thread_t *tail;
+} wait_queue_t;
+
+// Sleeping lock for code that blocks while holding it (disk I/O). Threads
+// only; waiters get it in FIFO order, each handed the lock by the unlock
+// that wakes it, so later arrivals cannot barge in.
+typedef struct {
+    volatile int locked;
+    wait_queue_t waiters;
+} mutex_t;
+
+#define MUTEX_INIT {0, {0, 0}}
+
+void sched_init(void);
+void sched_idle(void) __attribute__((noreturn));
+int sched_active(void);
+thread_t *thread_create(const char *name, thread_entry_t entry, void *arg, int priority);
+void thread_exit(void) __attribute__((noreturn));
+thread_t *thread_current(void);
+thread_t *thread_first(void);
+const char *thread_state_name(int state);
+void schedule(void);
+void yield(void);
+void sched_tick(uint64_t now);
+void sched_preempt(void);
+void sched_sleep_until(uint64_t tick);
+void sched_block(wait_queue_t *queue);
+void sched_block_timeout(wait_queue_t *queue, uint64_t tick);
+void sched_wake_one(wait_queue_t *queue);
+void sched_wake_all(wait_queue_t *queue);
+void mutex_lock(mutex_t *mutex);
+void mutex_unlock(mutex_t *mutex);
+void fpu_init_cpu(void);
+unsigned long kernel_fpu_begin(void);
+void kernel_fpu_end(unsigned long flags);
+uint32_t sched_switch_count(void);
+uint32_t sched_fpu_traps(void);
+
+#endif // SCHED_H
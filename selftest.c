@@ -0,0 +1,546 @@
+#include "selftest.h"
+#include "kernel.h"
+#include "bench.h"
+#include "bignum.h"
+#include "serial.h"
+#include "sched.h"
+#include "timer.h"
+#include "heap.h"
+#include "klib.h"
+#include "klog.h"
+#include "pmm.h"
+#include "idt.h"
+#include "io.h"
+#include "perf.h"
+#include "ksyms.h"
+#include "smp.h"
+#include "task.h"
+#include "initrd.h"
+#include "pci.h"
+#include "blkdev.h"
+#include "virtio_blk.h"
+#include "bcache.h"
+#include "process.h"
+
+// Boot-time test suite for headless runs. Every line it prints is mirrored
+// to COM1 without colors; a host script reads
+//   test <name> ok
+//   test <name> FAIL: <reason>
+//   bench name=... (see bench_format_result)
+//   boot us=<n>
+//   selftest passed=<n> failed=<n>
+// and QEMU exits through isa-debug-exit with the overall result.
+
+// A test returns 0 on success or a short failure reason
+typedef const char *(*selftest_fn_t)(void);
+
+typedef struct {
+    const char *name;
+    selftest_fn_t fn;
+} selftest_t;
+
+static int contains(const char *s, const char *word) {
+    int len = strlen(s);
+    int n = strlen(word);
+    for (int i = 0; i + n <= len; i++) {
+        if (memcmp(s + i, word, n) == 0) return 1;
+    }
+    return 0;
+}
+
+static const char *test_klib(void) {
+    static unsigned char src[300], dst[300];
+
+    for (int n = 0; n < 260; n += 7) {
+        for (int off = 0; off < 4; off++) {
+            for (int i = 0; i < 300; i++) {
+                src[i] = i * 7 + 1;
+                dst[i] = 0;
+            }
+            memcpy(dst + off, src + 3, n);
+            for (int i = 0; i < n; i++) {
+                if (dst[off + i] != src[3 + i]) return "memcpy";
+            }
+            if (dst[off + n] != 0) return "memcpy overrun";
+
+            memset(dst + off, 0xA5, n);
+            for (int i = 0; i < n; i++) {
+                if (dst[off + i] != 0xA5) return "memset";
+            }
+
+            // Overlapping moves both ways
+            memmove(src + off + 5, src + off, n);
+            for (int i = 0; i < n; i++) {
+                if (src[off + 5 + i] != (unsigned char)((off + i) * 7 + 1)) return "memmove up";
+            }
+            memmove(src + off, src + off + 5, n);
+            for (int i = 0; i < n; i++) {
+                if (src[off + i] != (unsigned char)((off + i) * 7 + 1)) return "memmove down";
+            }
+        }
+    }
+
+    for (int off = 0; off < 4; off++) {
+        for (int n = 0; n < 20; n++) {
+            memset(dst, 'x', 40);
+            dst[off + n] = '\0';
+            if (strlen((char *)dst + off) != (size_t)n) return "strlen";
+        }
+    }
+    if (strcmp("abc", "abc") != 0) return "strcmp equal";
+    if (strcmp("abc", "abd") >= 0) return "strcmp less";
+    if (strcmp("abcd", "abc") <= 0) return "strcmp prefix";
+    if (memcmp("abcdefgh", "abcdefgi", 8) >= 0) return "memcmp";
+    if (atoi("  -42") != -42) return "atoi";
+    if (atoi("99999999999") != 2147483647) return "atoi overflow";
+
+    // Every copy routine this CPU runs, past the SSE2 threshold
+    unsigned char *a = kmalloc(3 * KLIB_SSE_MIN);
+    unsigned char *b = kmalloc(3 * KLIB_SSE_MIN);
+    if (!a || !b) {
+        kfree(a);
+        kfree(b);
+        return "out of memory";
+    }
+    const char *err = 0;
+    for (int impl = KLIB_IMPL_MOVSD; impl <= KLIB_IMPL_SSE2 && !err; impl++) {
+        memcpy_fn_t copy = klib_memcpy_variant(impl);
+        if (!copy) continue;
+        for (int i = 0; i < 3 * KLIB_SSE_MIN; i++) {
+            a[i] = i ^ (i >> 8);
+            b[i] = 0;
+        }
+        copy(b + 3, a + 1, 2 * KLIB_SSE_MIN + 5);
+        for (int i = 0; i < 2 * KLIB_SSE_MIN + 5; i++) {
+            if (b[3 + i] != a[1 + i]) {
+                err = "memcpy variant";
+                break;
+            }
+        }
+    }
+    kfree(a);
+    kfree(b);
+    return err;
+}
+
+// Digit count and digit sum of n!
+static const char *check_factorial(uint32_t n, uint32_t want_digits, uint32_t want_sum) {
+    bignum_t r;
+    uint32_t digits;
+    if (bn_factorial(&r, n) < 0) return "out of memory";
+    char *text = bn_to_decimal(&r, &digits);
+    bn_free(&r);
+    if (!text) return "out of memory";
+
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < digits; i++) sum += text[i] - '0';
+    kfree(text);
+    if (digits != want_digits) return "digit count";
+    if (want_sum && sum != want_sum) return "digit sum";
+    return 0;
+}
+
+static const char *test_bignum(void) {
+    bignum_t r;
+    uint32_t digits;
+    if (bn_factorial(&r, 30) < 0) return "out of memory";
+    char *text = bn_to_decimal(&r, &digits);
+    bn_free(&r);
+    if (!text) return "out of memory";
+    int ok = strcmp(text, "265252859812191058636308480000000") == 0;
+    kfree(text);
+    if (!ok) return "30!";
+
+    const char *err = check_factorial(100, 158, 648);
+    if (!err) err = check_factorial(1000, 2568, 10539);
+    // Large enough for Karatsuba and the split decimal conversion
+    if (!err) err = check_factorial(5000, 16326, 0);
+    return err;
+}
+
+static const char *test_heap(void) {
+    void *blocks[32];
+    heap_stats_t before, after;
+
+    heap_get_stats(&before);
+    for (int i = 0; i < 32; i++) {
+        uint32_t size = 1 + i * 397;
+        blocks[i] = kmalloc(size);
+        if (!blocks[i]) return "kmalloc failed";
+        if ((uint32_t)blocks[i] & 15) return "misaligned";
+        memset(blocks[i], i, size);
+    }
+    for (int i = 0; i < 32; i++) {
+        unsigned char *p = blocks[i];
+        if (p[0] != i || p[i * 397] != i) return "corrupted";
+    }
+    for (int i = 31; i >= 0; i--) {
+        kfree(blocks[i]);
+    }
+    heap_get_stats(&after);
+    if (after.used_bytes != before.used_bytes) return "bytes leaked";
+    return 0;
+}
+
+static const char *test_pmm(void) {
+    uint32_t free_before = pmm_free_count();
+    uint32_t frame = pmm_alloc_frame();
+    uint32_t block = pmm_alloc_frames(3);
+    if (!frame || !block) return "allocation failed";
+    if (block & ((8 << 12) - 1)) return "block misaligned";
+    if (pmm_free_count() != free_before - 9) return "free count";
+    pmm_free_frame(frame);
+    pmm_free_frames(block, 3);
+    if (pmm_free_count() != free_before) return "frames leaked";
+    return 0;
+}
+
+static const char *test_timer(void) {
+    uint64_t start = timer_ticks();
+    sleep_ms(20);
+    uint64_t elapsed = timer_ticks() - start;
+    if (elapsed < 20 * TIMER_HZ / 1000) return "woke early";
+    if (elapsed > 200 * TIMER_HZ / 1000) return "woke late";
+    return 0;
+}
+
+static volatile int worker_ran = 0;
+
+static void worker(void *arg) {
+    worker_ran = (int)(uintptr_t)arg;
+}
+
+static const char *test_sched(void) {
+    worker_ran = 0;
+    if (!thread_create("selftest-worker", worker, (void *)42, SCHED_PRIO_LOW)) {
+        return "thread_create failed";
+    }
+    for (int i = 0; i < 100 && !worker_ran; i++) {
+        sleep_ms(1);
+    }
+    if (worker_ran != 42) return "worker did not run";
+    return 0;
+}
+
+static volatile uint32_t breakpoints = 0;
+
+static void count_breakpoint(struct regs *r) {
+    breakpoints++;
+}
+
+static const char *test_idt(void) {
+    uint32_t count = irq_count(EXCEPTION_BREAKPOINT);
+    breakpoints = 0;
+    register_irq_handler(EXCEPTION_BREAKPOINT, count_breakpoint);
+    __asm__ volatile ("int3" ::: "memory");
+    __asm__ volatile ("int3" ::: "memory");
+    register_irq_handler(EXCEPTION_BREAKPOINT, 0);
+    if (breakpoints != 2) return "handler not called";
+    if (irq_count(EXCEPTION_BREAKPOINT) != count + 2) return "vector count";
+    return 0;
+}
+
+static const char *test_klog(void) {
+    char line[KLOG_LINE_MAX];
+    klog_record_t rec;
+    klog(KLOG_DEBUG, KLOG_KERNEL, "selftest %d %x %s", -1234, 0xBEEF, (uint32_t)"marker");
+    if (klog_read(klog_count() - 1, &rec) < 0) return "record lost";
+    klog_format(&rec, line, sizeof(line));
+    if (!contains(line, "kernel: selftest -1234 beef marker")) return "format";
+    return 0;
+}
+
+static const char *test_perf(void) {
+    uint32_t offset = 1;
+    const char *name = ksym_lookup((uint32_t)selftest_thread, &offset);
+    if (!name || strcmp(name, "selftest_thread") != 0 || offset != 0) return "symbol table";
+
+    if (perf_start(PERF_DEFAULT_HZ) < 0) return "start";
+    uint64_t end = timer_ticks() + 20 * TIMER_HZ / 1000;
+    while (timer_ticks() < end) {
+        __asm__ volatile ("pause");
+    }
+    perf_stop();
+    if (perf_samples() < 10) return "too few samples";
+    return 0;
+}
+
+static volatile uint32_t cpus_seen = 0;
+
+static void mark_cpu(void *arg) {
+    __atomic_fetch_or(&cpus_seen, 1u << cpu_index(), __ATOMIC_RELAXED);
+}
+
+static const char *test_smp(void) {
+    int cpus = smp_cpu_count();
+    if (cpu_index() != 0) return "not on the boot CPU";
+    for (int round = 0; round < 3; round++) {
+        cpus_seen = 0;
+        smp_run_all(mark_cpu, 0);
+        if (cpus_seen != (1u << cpus) - 1) return "a CPU did not run its work";
+    }
+    return 0;
+}
+
+#define TASK_TEST_ITEMS 4096
+
+static uint32_t task_items[TASK_TEST_ITEMS];
+
+static void square_range(uint32_t lo, uint32_t hi, void *arg) {
+    for (uint32_t i = lo; i < hi; i++) {
+        task_items[i] = i * i;
+    }
+}
+
+// Naive Fibonacci: a deep tree of small tasks
+static void fib_task(void *arg) {
+    uint32_t *n = arg;
+    if (*n < 2) return;
+    uint32_t a = *n - 1, b = *n - 2;
+    task_t task;
+    task_spawn(&task, fib_task, &a);
+    fib_task(&b);
+    task_join(&task);
+    *n = a + b;
+}
+
+static const char *test_task(void) {
+    memset(task_items, 0, sizeof(task_items));
+    parallel_for(0, TASK_TEST_ITEMS, 64, square_range, 0);
+    for (uint32_t i = 0; i < TASK_TEST_ITEMS; i++) {
+        if (task_items[i] != i * i) return "parallel_for missed an item";
+    }
+
+    uint32_t n = 20;
+    fib_task(&n);
+    if (n != 6765) return "nested spawn/join gave a wrong result";
+
+    // Odd size, so the last piece is a short one
+    uint32_t size = 4 * TASK_MEM_GRAIN + 3;
+    uint8_t *src = kmalloc(size);
+    uint8_t *dst = kmalloc(size);
+    const char *err = 0;
+    if (!src || !dst) {
+        err = "out of memory";
+    } else {
+        for (uint32_t i = 0; i < size; i++) src[i] = i * 7;
+        parallel_memset(dst, 0xEE, size);
+        if (dst[0] != 0xEE || dst[size - 1] != 0xEE) err = "parallel_memset missed bytes";
+        parallel_memcpy(dst, src, size);
+        if (memcmp(dst, src, size) != 0) err = "parallel_memcpy copied wrong bytes";
+    }
+    kfree(src);
+    kfree(dst);
+    return err;
+}
+
+// Needs the initrd that selftest.sh passes with the kernel
+static const char *test_initrd(void) {
+    if (initrd_count() <= 0) return "no initrd";
+    const initrd_file_t *f = initrd_lookup("etc/motd");
+    if (!f || f->type != INITRD_FILE) return "etc/motd not found";
+    if (initrd_lookup("/etc/motd/") != f) return "path not normalized";
+    if (f->size < 7 || memcmp(f->data, "Welcome", 7) != 0) return "etc/motd has wrong data";
+    if (initrd_lookup("etc/none")) return "found a missing file";
+
+    int found = 0;
+    uint32_t pos = 0;
+    const initrd_file_t *e;
+    while ((e = initrd_readdir("", &pos))) {
+        if (strcmp(e->name, "etc") == 0 && e->type == INITRD_DIR) found++;
+        if (e->name != e->path) return "readdir went into a subdirectory";
+    }
+    if (found != 1) return "etc missing from the root";
+    return 0;
+}
+
+// QEMU's PC machine has a host bridge on bus 0 and an IDE function the
+// ATA driver must have claimed
+static const char *test_pci(void) {
+    int host = 0, ide = 0;
+    for (int i = 0; i < pci_device_count(); i++) {
+        const pci_device_t *dev = pci_device(i);
+        if (dev->class == PCI_CLASS_BRIDGE && dev->subclass == 0 && dev->addr.bus == 0) host++;
+        if (dev->class == PCI_CLASS_STORAGE && dev->subclass == PCI_SUBCLASS_IDE) {
+            if (!dev->driver) return "IDE controller has no driver";
+            ide++;
+        }
+        for (int b = 0; b < PCI_BARS; b++) {
+            uint32_t size = dev->bar[b].size;
+            if (size & (size - 1)) return "BAR size not a power of two";
+        }
+    }
+    if (!host) return "no host bridge";
+    if (!ide) return "no IDE controller";
+    return 0;
+}
+
+#define DISK_TEST_BLOCKS 16
+
+// Write through the cache, drop it, then read back sequentially so the
+// reads come from the disk by DMA with read-ahead. Runs on every disk;
+// needs the scratch disks that selftest.sh attaches.
+static const char *test_disk_dev(int dev, uint32_t *buf) {
+    for (uint32_t b = 0; b < DISK_TEST_BLOCKS; b++) {
+        for (uint32_t i = 0; i < BCACHE_BLOCK_SIZE / 4; i++) buf[i] = (b + dev) * 0x10001 + i;
+        if (bcache_write(dev, b, buf) < 0) return "write failed";
+    }
+    if (bcache_drop(dev) < 0) return "flush failed";
+
+    bcache_stats_t before, after;
+    bcache_get_stats(&before);
+    for (uint32_t b = 0; b < DISK_TEST_BLOCKS; b++) {
+        if (bcache_read(dev, b, buf) < 0) return "read failed";
+        for (uint32_t i = 0; i < BCACHE_BLOCK_SIZE / 4; i++) {
+            if (buf[i] != (b + dev) * 0x10001 + i) return "read back wrong data";
+        }
+    }
+    bcache_get_stats(&after);
+    if (after.readahead_hits == before.readahead_hits) return "no read-ahead";
+    return 0;
+}
+
+static const char *test_disk(void) {
+    if (blkdev_count() == 0) return "no disk";
+    uint32_t *buf = kmalloc(BCACHE_BLOCK_SIZE);
+    if (!buf) return "out of memory";
+    const char *err = 0;
+    for (int dev = 0; dev < blkdev_count() && !err; dev++) {
+        err = test_disk_dev(dev, buf);
+    }
+    kfree(buf);
+    return err;
+}
+
+#define VIRTIO_TEST_REQUESTS 8
+
+// Scattered writes, then reads, each batch as one submission: every
+// batch must notify the device at most once
+static const char *test_virtio(void) {
+    virtio_blk_stats_t before, after;
+    if (virtio_blk_stats(0, &before) < 0) return "no virtio disk";
+    int dev = before.blkdev;
+    uint32_t *buf = kmalloc(VIRTIO_TEST_REQUESTS * BCACHE_BLOCK_SIZE);
+    if (!buf) return "out of memory";
+    blk_request_t reqs[VIRTIO_TEST_REQUESTS];
+    blk_segment_t segs[VIRTIO_TEST_REQUESTS];
+    const uint32_t words = BCACHE_BLOCK_SIZE / 4;
+
+    const char *err = 0;
+    for (int pass = 0; pass < 2 && !err; pass++) {
+        for (int r = 0; r < VIRTIO_TEST_REQUESTS; r++) {
+            uint32_t *p = buf + r * words;
+            for (uint32_t i = 0; i < words; i++) p[i] = pass ? 0 : r * 0x01000193 + i;
+            segs[r].buf = p;
+            segs[r].len = BCACHE_BLOCK_SIZE;
+            reqs[r].write = !pass;
+            // Every third block, so nothing merges into one request
+            reqs[r].lba = (64 + 3 * r) * BCACHE_BLOCK_SECTORS;
+            reqs[r].segs = &segs[r];
+            reqs[r].count = 1;
+        }
+        if (blkdev_submit(dev, reqs, VIRTIO_TEST_REQUESTS) < 0) err = "request failed";
+    }
+    for (int r = 0; r < VIRTIO_TEST_REQUESTS && !err; r++) {
+        for (uint32_t i = 0; i < words; i++) {
+            if (buf[r * words + i] != r * 0x01000193 + i) {
+                err = "read back wrong data";
+                break;
+            }
+        }
+    }
+    virtio_blk_stats(0, &after);
+    if (!err && after.notifies - before.notifies > 2) err = "batch notified the device more than once";
+    // With event indexes the device interrupts once per batch; on MSI-X no
+    // other function shares the vector
+    if (!err && after.event_idx && after.msix && after.irqs - before.irqs > 2) {
+        err = "batch raised more than one interrupt";
+    }
+    kfree(buf);
+    return err;
+}
+
+static const char *test_process(void) {
+    if (!process_supported()) return "no sysenter";
+    if (!initrd_lookup("bin/true") || !initrd_lookup("bin/fault")) return "no user programs in the initrd";
+    char *args[] = {"true"};
+    if (process_run("bin/true", 1, args) != 0) return "bin/true failed";
+    // A second run must give back every page the first one's address space took
+    uint32_t free_before = pmm_free_count();
+    if (process_run("bin/true", 1, args) != 0) return "bin/true failed";
+    if (pmm_free_count() != free_before) return "address space leaked";
+    // Writing kernel memory kills the process, not the kernel
+    char *fault_args[] = {"fault"};
+    process_t *p = process_spawn("bin/fault", 1, fault_args);
+    if (!p) return "bin/fault did not start";
+    if (process_wait(p) != -1) return "kernel memory writable from ring 3";
+    return 0;
+}
+
+static const selftest_t tests[] = {
+    {"klib",   test_klib},
+    {"bignum", test_bignum},
+    {"heap",   test_heap},
+    {"pmm",    test_pmm},
+    {"timer",  test_timer},
+    {"sched",  test_sched},
+    {"idt",    test_idt},
+    {"klog",   test_klog},
+    {"perf",   test_perf},
+    {"smp",    test_smp},
+    {"task",   test_task},
+    {"initrd", test_initrd},
+    {"pci",    test_pci},
+    {"disk",   test_disk},
+    {"virtio", test_virtio},
+    {"process", test_process},
+};
+
+// Run the tests, then every benchmark, and leave QEMU with the result
+void selftest_thread(void *arg) {
+    int passed = 0, failed = 0;
+    char line[BENCH_LINE_MAX];
+
+    // Plain text on the serial line for the host script
+    serial_set_mirror(SERIAL_MIRROR_PLAIN);
+    print("selftest start\n");
+
+    for (unsigned int i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        const char *err = tests[i].fn();
+        print("test ");
+        print(tests[i].name);
+        if (err) {
+            print(" FAIL: ");
+            print(err);
+            print("\n");
+            klog(KLOG_ERR, KLOG_KERNEL, "selftest %s failed: %s",
+                 (uint32_t)tests[i].name, (uint32_t)err);
+            failed++;
+        } else {
+            print(" ok\n");
+            passed++;
+        }
+    }
+
+    for (int i = 0; i < bench_count(); i++) {
+        const bench_t *bench = bench_get(i);
+        bench_result_t result;
+        if (bench_run(bench, &result) < 0) continue;
+        bench_format_result(bench, &result, line);
+        print(line);
+    }
+
+    print("boot us=");
+    printn(boot_time_us());
+    print("\n");
+    print("selftest passed=");
+    printn(passed);
+    print(" failed=");
+    printn(failed);
+    print("\n");
+    serial_flush();
+
+    outb(DEBUG_EXIT_PORT, failed ? DEBUG_EXIT_FAIL : DEBUG_EXIT_PASS);
+    // Still running: no isa-debug-exit device
+    print("No isa-debug-exit device; halting\n");
+}
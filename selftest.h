@@ -0,0 +1,15 @@
+#ifndef SELFTEST_H
+#define SELFTEST_H
+
+// Multiboot command line word that boots into the self-test suite
+#define SELFTEST_FLAG "selftest"
+
+// QEMU isa-debug-exit device (-device isa-debug-exit,iobase=0xf4,iosize=4).
+// QEMU exits with status (value << 1) | 1: 33 for pass, 35 for fail.
+#define DEBUG_EXIT_PORT 0xF4
+#define DEBUG_EXIT_PASS 0x10
+#define DEBUG_EXIT_FAIL 0x11
+
+void selftest_thread(void *arg);
+
+#endif // SELFTEST_H
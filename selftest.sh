@@ -0,0 +1,114 @@
+#!/bin/bash
+#
+# Boot CoreOS headless with the "selftest" command line, collect the test
+# and benchmark results from COM1 and compare benchmark medians with a
+# stored baseline.
+#
+# Usage: ./selftest.sh [--no-build] [--update-baseline]
+#
+# Environment:
+#   KERNEL     kernel to boot (default build/release/kernel.bin)
+#   INITRD     initrd module (default initrd.tar next to the kernel)
+#   BASELINE   baseline file (default bench-baseline.txt)
+#   THRESHOLD  percent a median may grow before it counts as a regression
+#              (default 25; TCG timings are noisy)
+#   TIMEOUT    seconds before the run is abandoned (default 300)
+#   SMP        CPUs QEMU provides (default 2)
+#   DISK       scratch IDE disk image for the disk test (default
+#              selftest-disk.img, recreated on every run)
+#   VDISK      scratch virtio disk image (default selftest-vdisk.img, likewise)
+#
+# Exit status: 0 when every test passed and nothing regressed, 1 otherwise.
+
+BUILD=1
+UPDATE=0
+for arg in "$@"; do
+    case "$arg" in
+        --no-build) BUILD=0 ;;
+        --update-baseline) UPDATE=1 ;;
+        *) echo "usage: $0 [--no-build] [--update-baseline]" >&2; exit 2 ;;
+    esac
+done
+
+KERNEL="${KERNEL:-build/release/kernel.bin}"
+LOG="selftest.log"
+BASELINE="${BASELINE:-bench-baseline.txt}"
+THRESHOLD="${THRESHOLD:-25}"
+TIMEOUT="${TIMEOUT:-300}"
+SMP="${SMP:-2}"
+INITRD="${INITRD:-$(dirname "$KERNEL")/initrd.tar}"
+DISK="${DISK:-selftest-disk.img}"
+VDISK="${VDISK:-selftest-vdisk.img}"
+
+if [ $BUILD -eq 1 ]; then
+    make -j"$(nproc)" kernel initrd || exit 1
+fi
+
+# isa-debug-exit turns the kernel's exit byte into QEMU's status:
+# 33 = all tests passed, 35 = a test failed
+rm -f "$LOG" "$DISK" "$VDISK"
+truncate -s 8M "$DISK" || exit 1
+truncate -s 8M "$VDISK" || exit 1
+timeout "$TIMEOUT" qemu-system-i386 -kernel "$KERNEL" -append selftest \
+    -initrd "$INITRD" \
+    -drive file="$DISK",format=raw,if=ide \
+    -drive file="$VDISK",format=raw,if=virtio \
+    -m 128M -smp "$SMP" -display none -no-reboot -monitor none \
+    -serial file:"$LOG" \
+    -debugcon file:selftest-debugcon.log \
+    -device isa-debug-exit,iobase=0xf4,iosize=0x04
+STATUS=$?
+
+sed -i 's/\r$//' "$LOG" 2>/dev/null
+grep '^test ' "$LOG"
+
+case $STATUS in
+    33) RESULT="pass" ;;
+    35) RESULT="fail" ;;
+    124) RESULT="timeout" ;;
+    *) RESULT="crash (qemu status $STATUS)" ;;
+esac
+grep '^selftest passed=' "$LOG"
+echo "self-test: $RESULT"
+size "$KERNEL" | awk 'NR == 2 { printf "image: text=%d data=%d bss=%d\n", $1, $2, $3 }'
+grep '^boot ' "$LOG"
+
+# "name median" for every benchmark
+CURRENT=$(sed -n 's/^bench name=\([^ ]*\) .* median=\([0-9]*\) .*/\1 \2/p' "$LOG")
+
+if [ $UPDATE -eq 1 ] || [ ! -f "$BASELINE" ]; then
+    if [ -n "$CURRENT" ]; then
+        echo "$CURRENT" > "$BASELINE"
+        echo "baseline written to $BASELINE"
+    fi
+    [ "$RESULT" = "pass" ]
+    exit $?
+fi
+
+echo "$CURRENT" | awk -v threshold="$THRESHOLD" -v baseline="$BASELINE" '
+    BEGIN {
+        while ((getline line < baseline) > 0) {
+            split(line, f, " ")
+            base[f[1]] = f[2]
+        }
+    }
+    NF == 2 {
+        if (!($1 in base) || base[$1] == 0) {
+            printf "  %-20s %10d cycles (new)\n", $1, $2
+            next
+        }
+        change = ($2 - base[$1]) * 100.0 / base[$1]
+        tag = ""
+        if (change > threshold) {
+            tag = "  REGRESSION"
+            regressions++
+        }
+        printf "  %-20s %10d cycles, baseline %10d (%+.1f%%)%s\n", $1, $2, base[$1], change, tag
+    }
+    END {
+        printf "%d benchmark regression(s) above %d%%\n", regressions, threshold
+        exit regressions > 0
+    }'
+REGRESSED=$?
+
+[ "$RESULT" = "pass" ] && [ $REGRESSED -eq 0 ]
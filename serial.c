@@ -0,0 +1,270 @@
+#include "serial.h"
+#include "keyboard_map.h"
+#include "idt.h"
+#include "io.h"
+#include "klog.h"
+
+// Output is queued in tx_buf and fed to the UART from the THR-empty
+// interrupt, a FIFO load (16 bytes) at a time, so printing costs a copy
+// instead of waiting on the line. tx_busy is set while the FIFO holds bytes
+// whose THR-empty interrupt is still to come.
+static char tx_buf[SERIAL_TX_SIZE];
+static uint32_t tx_head = 0; // next slot to fill
+static uint32_t tx_tail = 0; // next byte to send
+static int tx_busy = 0;
+
+static int present = 0;
+static int mirror = SERIAL_MIRROR_OFF;
+static int last_color = -1; // color of the last ANSI sequence sent
+
+static uint32_t tx_bytes = 0;
+static uint32_t rx_bytes = 0;
+static uint32_t tx_stalls = 0;
+
+// Input escape sequence state: ESC, then '[' and a number
+static int rx_escape = 0;
+static uint32_t rx_param = 0;
+static char rx_last = 0;
+
+// VGA color index to ANSI color number
+static const uint8_t ansi_colors[8] = {0, 4, 2, 6, 1, 5, 3, 7};
+
+static inline uint8_t uart_read(int reg) {
+    return (uint8_t)read_port(COM1_BASE + reg);
+}
+
+static inline void uart_write(int reg, uint8_t value) {
+    write_port(COM1_BASE + reg, value);
+}
+
+// Move up to one FIFO load from the ring to the UART. Interrupts are off.
+static void tx_fill(void) {
+    int sent = 0;
+    while (sent < UART_FIFO_SIZE && tx_tail != tx_head) {
+        uart_write(UART_DATA, tx_buf[tx_tail & (SERIAL_TX_SIZE - 1)]);
+        tx_tail++;
+        sent++;
+    }
+    tx_bytes += sent;
+    tx_busy = sent != 0;
+}
+
+// Turn a received byte into a key event for the tty. Enter, Backspace and
+// PgUp/PgDn (ESC [ 5 ~ and ESC [ 6 ~) get their scancodes, other escape
+// sequences are dropped.
+static void rx_byte(char c) {
+    key_event_t event = {0};
+    char prev = rx_last;
+    rx_last = c;
+
+    if (rx_escape == 1) {
+        rx_escape = c == '[' ? 2 : 0;
+        rx_param = 0;
+        return;
+    }
+    if (rx_escape == 2) {
+        if (c >= '0' && c <= '9') {
+            rx_param = rx_param * 10 + (c - '0');
+            return;
+        }
+        rx_escape = 0;
+        if (c != '~') return;
+        if (rx_param == 5) event.scancode = SC_PGUP;
+        else if (rx_param == 6) event.scancode = SC_PGDN;
+        else return;
+        keyboard_inject(event);
+        return;
+    }
+
+    if (c == 27) {
+        rx_escape = 1;
+    } else if (c == '\r' || (c == '\n' && prev != '\r')) {
+        event.scancode = SC_ENTER;
+        event.ascii = '\n';
+        keyboard_inject(event);
+    } else if (c == '\b' || c == 127) {
+        event.scancode = SC_BACKSPACE;
+        event.ascii = '\b';
+        keyboard_inject(event);
+    } else if (c >= ' ' && c < 127) {
+        event.ascii = c;
+        keyboard_inject(event);
+    }
+}
+
+// IRQ4: service every pending cause before returning
+static void serial_irq(struct regs *r) {
+    uint8_t iir;
+    while (!((iir = uart_read(UART_IIR)) & UART_IIR_NONE)) {
+        switch (iir & UART_IIR_MASK) {
+        case UART_IIR_RX:
+        case UART_IIR_RX_TMO:
+            while (uart_read(UART_LSR) & UART_LSR_DR) {
+                rx_bytes++;
+                rx_byte((char)uart_read(UART_DATA));
+            }
+            break;
+        case UART_IIR_THRE:
+            tx_fill();
+            break;
+        case UART_IIR_LSR:
+            uart_read(UART_LSR);
+            break;
+        case UART_IIR_MSR:
+            uart_read(UART_MSR);
+            break;
+        }
+    }
+}
+
+// Program COM1 for 115200 8N1 with FIFOs and check that something answers
+// in loopback mode. Returns -1 when there is no UART.
+int serial_init(void) {
+    uint16_t divisor = UART_CLOCK_HZ / SERIAL_BAUD;
+
+    uart_write(UART_IER, 0);
+    uart_write(UART_LCR, UART_LCR_DLAB);
+    uart_write(UART_DATA, divisor & 0xFF);
+    uart_write(UART_IER, divisor >> 8);
+    uart_write(UART_LCR, UART_LCR_8N1);
+    uart_write(UART_FCR, UART_FCR_ENABLE);
+
+    uart_write(UART_MCR, UART_MCR_LOOP | UART_MCR_RTS | UART_MCR_DTR);
+    uart_write(UART_DATA, 0xAE);
+    int echoed = 0;
+    for (int i = 0; i < 10000 && !echoed; i++) {
+        echoed = (uart_read(UART_LSR) & UART_LSR_DR) && uart_read(UART_DATA) == 0xAE;
+    }
+    if (!echoed) {
+        klog(KLOG_WARN, KLOG_SERIAL, "no UART on COM1");
+        return -1;
+    }
+
+    uart_write(UART_MCR, UART_MCR_DTR | UART_MCR_RTS | UART_MCR_OUT2);
+    register_irq_handler(IRQ_VECTOR(COM1_IRQ), serial_irq);
+    uart_write(UART_IER, UART_IER_RX | UART_IER_THRE);
+    present = 1;
+    mirror = SERIAL_MIRROR_ANSI;
+    irq_unmask(COM1_IRQ);
+    klog(KLOG_INFO, KLOG_SERIAL, "COM1 at %u baud, IRQ%u", SERIAL_BAUD, COM1_IRQ);
+    return 0;
+}
+
+int serial_present(void) {
+    return present;
+}
+
+// Queue one byte. Only when the ring is full does this wait for the UART,
+// sending one FIFO load by polling so no output is lost.
+void serial_putc(char c) {
+    if (!present) return;
+    unsigned long flags = irq_save();
+    if (tx_head - tx_tail == SERIAL_TX_SIZE) {
+        tx_stalls++;
+        while (!(uart_read(UART_LSR) & UART_LSR_THRE));
+        tx_fill();
+    }
+    tx_buf[tx_head & (SERIAL_TX_SIZE - 1)] = c;
+    tx_head++;
+    if (!tx_busy) tx_fill();
+    irq_restore(flags);
+}
+
+void serial_write(const char *str) {
+    while (*str) {
+        serial_putc(*str++);
+    }
+}
+
+// Send everything queued by polling; for panic(), where no interrupt will
+// drain the ring
+void serial_flush(void) {
+    if (!present) return;
+    unsigned long flags = irq_save();
+    while (tx_tail != tx_head) {
+        while (!(uart_read(UART_LSR) & UART_LSR_THRE));
+        tx_fill();
+    }
+    irq_restore(flags);
+}
+
+void serial_set_mirror(int mode) {
+    if (mirror == SERIAL_MIRROR_ANSI && mode != SERIAL_MIRROR_ANSI) {
+        serial_write("\033[0m");
+    }
+    mirror = mode;
+    last_color = -1;
+}
+
+int serial_mirror(void) {
+    return mirror;
+}
+
+// SGR sequence for a VGA attribute: bright colors use 90-97/100-107, and a
+// black background is left at the terminal's default
+static void send_color(unsigned char color) {
+    char seq[16];
+    int n = 0;
+    unsigned int fg = color & 0x0F;
+    unsigned int bg = color >> 4;
+
+    seq[n++] = '\033';
+    seq[n++] = '[';
+    seq[n++] = '0';
+    seq[n++] = ';';
+    seq[n++] = fg & 8 ? '9' : '3';
+    seq[n++] = '0' + ansi_colors[fg & 7];
+    if (bg) {
+        seq[n++] = ';';
+        if (bg & 8) {
+            seq[n++] = '1';
+            seq[n++] = '0';
+        } else {
+            seq[n++] = '4';
+        }
+        seq[n++] = '0' + ansi_colors[bg & 7];
+    }
+    seq[n++] = 'm';
+    seq[n] = '\0';
+    serial_write(seq);
+    last_color = color;
+}
+
+// Console mirror, called by console.c with the character's VGA attribute
+void serial_console_putc(char c, unsigned char color) {
+    if (mirror == SERIAL_MIRROR_OFF) return;
+    if (c == '\n') {
+        serial_write("\r\n");
+        return;
+    }
+    if (mirror == SERIAL_MIRROR_ANSI && color != last_color) {
+        send_color(color);
+    }
+    serial_putc(c);
+}
+
+void serial_console_backspace(void) {
+    if (mirror == SERIAL_MIRROR_OFF) return;
+    serial_write("\b \b");
+}
+
+void serial_console_clear(void) {
+    if (mirror == SERIAL_MIRROR_ANSI) {
+        serial_write("\033[0m\033[2J\033[H");
+        last_color = -1;
+    } else if (mirror == SERIAL_MIRROR_PLAIN) {
+        serial_write("\r\n");
+    }
+}
+
+uint32_t serial_tx_bytes(void) {
+    return tx_bytes;
+}
+
+uint32_t serial_rx_bytes(void) {
+    return rx_bytes;
+}
+
+uint32_t serial_tx_stalls(void) {
+    return tx_stalls;
+}
@@ -0,0 +1,73 @@
+#ifndef SERIAL_H
+#define SERIAL_H
+
+#include <stdint.h>
+
+// 16550 UART on COM1
+#define COM1_BASE 0x3F8
+#define COM1_IRQ  4
+
+// Register offsets from the port base (DLAB = 0 unless noted)
+#define UART_DATA 0 // RBR on read, THR on write; divisor low with DLAB
+#define UART_IER  1 // divisor high with DLAB
+#define UART_IIR  2 // read
+#define UART_FCR  2 // write
+#define UART_LCR  3
+#define UART_MCR  4
+#define UART_LSR  5
+#define UART_MSR  6
+
+#define UART_IER_RX   0x01 // received data available
+#define UART_IER_THRE 0x02 // transmit holding register empty
+
+#define UART_IIR_NONE   0x01 // no interrupt pending
+#define UART_IIR_MASK   0x0E
+#define UART_IIR_MSR    0x00
+#define UART_IIR_THRE   0x02
+#define UART_IIR_RX     0x04
+#define UART_IIR_LSR    0x06
+#define UART_IIR_RX_TMO 0x0C
+
+#define UART_LCR_8N1  0x03
+#define UART_LCR_DLAB 0x80
+
+// FIFOs on, both cleared, receive interrupt at 14 bytes
+#define UART_FCR_ENABLE 0xC7
+
+#define UART_MCR_DTR  0x01
+#define UART_MCR_RTS  0x02
+#define UART_MCR_OUT2 0x08 // gates the interrupt line to the PIC
+#define UART_MCR_LOOP 0x10
+
+#define UART_LSR_DR   0x01 // a received byte is waiting
+#define UART_LSR_THRE 0x20
+
+#define UART_CLOCK_HZ 115200
+#define SERIAL_BAUD   115200
+
+// Bytes the transmit FIFO takes after each THR-empty interrupt
+#define UART_FIFO_SIZE 16
+
+// Pending output (must be a power of two)
+#define SERIAL_TX_SIZE 8192
+
+// How the console is mirrored to the serial line
+#define SERIAL_MIRROR_OFF   0
+#define SERIAL_MIRROR_PLAIN 1
+#define SERIAL_MIRROR_ANSI  2 // colors as ANSI escape sequences
+
+int serial_init(void);
+int serial_present(void);
+void serial_putc(char c);
+void serial_write(const char *str);
+void serial_flush(void);
+void serial_set_mirror(int mode);
+int serial_mirror(void);
+void serial_console_putc(char c, unsigned char color);
+void serial_console_backspace(void);
+void serial_console_clear(void);
+uint32_t serial_tx_bytes(void);
+uint32_t serial_rx_bytes(void);
+uint32_t serial_tx_stalls(void);
+
+#endif // SERIAL_H
@@ -0,0 +1,143 @@
+#include "shell.h"
+#include "kernel.h"
+#include "klib.h"
+#include "initrd.h"
+#include "process.h"
+
+// Commands sorted by name, so lookup is a binary search: O(log n) string
+// compares however many commands are registered
+static const shell_command_t *sorted[SHELL_MAX_COMMANDS];
+static int command_count = 0;
+
+void shell_init(const shell_command_t *table, int count) {
+    command_count = 0;
+    for (int i = 0; i < count && command_count < SHELL_MAX_COMMANDS; i++) {
+        // Insertion sort; runs once at boot
+        int j = command_count++;
+        while (j > 0 && strcmp(sorted[j - 1]->name, table[i].name) > 0) {
+            sorted[j] = sorted[j - 1];
+            j--;
+        }
+        sorted[j] = &table[i];
+    }
+}
+
+const shell_command_t *shell_find(const char *name) {
+    int lo = 0, hi = command_count - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        int cmp = strcmp(name, sorted[mid]->name);
+        if (cmp == 0) return sorted[mid];
+        if (cmp < 0) hi = mid - 1;
+        else lo = mid + 1;
+    }
+    return 0;
+}
+
+// Path of the user program implementing `name` ("bin/<name>"), or 0 when
+// there is none and the built-in command runs in the kernel
+static const char *program_path(const char *name, char *path) {
+    static const char dir[] = PROCESS_BIN_DIR "/";
+    uint32_t len = strlen(name);
+    if (!process_supported() || len > SHELL_MAX_PATH - sizeof(dir)) return 0;
+    memcpy(path, dir, sizeof(dir) - 1);
+    memcpy(path + sizeof(dir) - 1, name, len + 1);
+    const initrd_file_t *file = initrd_lookup(path);
+    return file && file->type == INITRD_FILE ? path : 0;
+}
+
+void shell_help(void) {
+    print_colored("Available commands:\n", COLOR_LIGHT_GREEN);
+    for (int i = 0; i < command_count; i++) {
+        print_colored("  ", COLOR_LIGHT_GRAY);
+        print_colored(sorted[i]->name, COLOR_LIGHT_GRAY);
+        if (sorted[i]->usage[0]) {
+            print_colored(" ", COLOR_LIGHT_GRAY);
+            print_colored(sorted[i]->usage, COLOR_LIGHT_GRAY);
+        }
+        print_colored(" - ", COLOR_LIGHT_GRAY);
+        print_colored(sorted[i]->help, COLOR_LIGHT_GRAY);
+        print_colored("\n", COLOR_LIGHT_GRAY);
+    }
+    if (!process_supported()) return;
+    print_colored("User programs (" PROCESS_BIN_DIR "/):", COLOR_LIGHT_GREEN);
+    uint32_t pos = 0;
+    const initrd_file_t *file;
+    while ((file = initrd_readdir(PROCESS_BIN_DIR, &pos))) {
+        print_colored(" ", COLOR_LIGHT_GRAY);
+        print_colored(file->name, COLOR_LIGHT_GRAY);
+    }
+    print("\n");
+}
+
+// Programs under bin/ in the initrd run as user processes and take
+// precedence over a built-in of the same name, which remains the fallback
+// when the program cannot be started
+int shell_exec(int argc, char **argv) {
+    char path[SHELL_MAX_PATH];
+    if (program_path(argv[0], path)) {
+        process_t *p = process_spawn(path, argc, argv);
+        if (p) return process_wait(p);
+        print_colored("Cannot start ", COLOR_LIGHT_RED);
+        print_colored(path, COLOR_LIGHT_RED);
+        print("\n");
+    }
+    const shell_command_t *cmd = shell_find(argv[0]);
+    if (!cmd) {
+        print_colored("Unknown command: ", COLOR_LIGHT_RED);
+        print_colored(argv[0], COLOR_LIGHT_RED);
+        print("\n");
+        return -1;
+    }
+    if (argc - 1 < cmd->min_args) {
+        print_colored("Usage: ", COLOR_LIGHT_RED);
+        print_colored(cmd->name, COLOR_LIGHT_RED);
+        print_colored(" ", COLOR_LIGHT_RED);
+        print_colored(cmd->usage, COLOR_LIGHT_RED);
+        print("\n");
+        return -1;
+    }
+    return cmd->fn(argc, argv);
+}
+
+// Split one command off `line` in place: arguments are separated by spaces,
+// double quotes group words, and an unquoted ';' ends the command. argv
+// points into the line itself. Returns where the next command starts.
+static char *parse_command(char *p, char **argv, int *argc) {
+    *argc = 0;
+    while (1) {
+        while (*p == ' ') p++;
+        if (*p == '\0') return p;
+        if (*p == ';') return p + 1;
+
+        char *start;
+        int end = 0;
+        if (*p == '"') {
+            start = ++p;
+            while (*p && *p != '"') p++;
+        } else {
+            start = p;
+            while (*p && *p != ' ' && *p != ';') p++;
+            end = (*p == ';');
+        }
+        if (*p) *p++ = '\0';
+        if (*argc < SHELL_MAX_ARGS) argv[(*argc)++] = start;
+        if (end) return p;
+    }
+}
+
+// Run every ';'-separated command on the line. Returns the status of the
+// last one.
+int shell_run_line(char *line) {
+    char *argv[SHELL_MAX_ARGS];
+    int argc;
+    int status = 0;
+
+    while (*line) {
+        line = parse_command(line, argv, &argc);
+        if (argc > 0) {
+            status = shell_exec(argc, argv);
+        }
+    }
+    return status;
+}
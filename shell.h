@@ -0,0 +1,25 @@
+#ifndef SHELL_H
+#define SHELL_H
+
+// Most arguments a command receives, name included
+#define SHELL_MAX_ARGS     16
+#define SHELL_MAX_COMMANDS 64
+#define SHELL_MAX_PATH     64 // "bin/<command>"
+
+typedef int (*shell_fn_t)(int argc, char **argv);
+
+typedef struct {
+    const char *name;
+    shell_fn_t fn;
+    int min_args;      // arguments required after the name
+    const char *usage; // argument synopsis shown by help, "" if none
+    const char *help;
+} shell_command_t;
+
+void shell_init(const shell_command_t *table, int count);
+const shell_command_t *shell_find(const char *name);
+int shell_exec(int argc, char **argv);
+int shell_run_line(char *line);
+void shell_help(void);
+
+#endif // SHELL_H
@@ -0,0 +1,195 @@
+#include "smp.h"
+#include "acpi.h"
+#include "apic.h"
+#include "paging.h"
+#include "sched.h"
+#include "timer.h"
+#include "heap.h"
+#include "klib.h"
+#include "klog.h"
+#include "task.h"
+#include "idt.h"
+#include "cpu.h"
+#include "io.h"
+
+// Application processors are started with INIT-SIPI-SIPI and then sit in a
+// work loop: they run what smp_call() hands them, steal spawned tasks
+// (task.c) and otherwise halt until a wakeup IPI. Threads and the
+// scheduler stay on the boot CPU.
+
+// AP start-up code and its parameter block (smpboot.asm)
+extern char ap_trampoline[];
+extern char ap_trampoline_end[];
+extern char ap_boot_params[];
+extern uint32_t boot_page_directory[];
+
+static cpu_t cpus[SMP_MAX_CPUS];
+static volatile int cpu_count = 1;
+
+cpu_t *smp_cpu(int index) {
+    return &cpus[index];
+}
+
+int smp_cpu_count(void) {
+    return cpu_count;
+}
+
+// Only there to end the hlt in ap_loop(); isr_dispatch sends the EOI
+static void ipi_wakeup(struct regs *r) {
+}
+
+static void ap_loop(cpu_t *cpu) __attribute__((noreturn));
+static void ap_loop(cpu_t *cpu) {
+    sti();
+    while (1) {
+        smp_fn_t fn = __atomic_load_n(&cpu->work, __ATOMIC_ACQUIRE);
+        if (fn) {
+            uint64_t start = rdtsc();
+            fn(cpu->work_arg);
+            cpu->busy_cycles += rdtsc() - start;
+            cpu->jobs++;
+            cpu->work = 0;
+            __atomic_store_n(&cpu->busy, 0, __ATOMIC_RELEASE);
+            continue;
+        }
+        if (task_run_stolen()) continue;
+
+        // Checked again with interrupts off and the CPU marked parked: an
+        // IPI after the check still ends the hlt, since sti only takes
+        // effect after it
+        cli();
+        task_park();
+        if (!__atomic_load_n(&cpu->work, __ATOMIC_ACQUIRE) && !task_pending()) {
+            sti_hlt();
+        } else {
+            sti();
+        }
+        task_unpark();
+    }
+}
+
+// First C code on an AP, still on the boot page directory and the
+// trampoline's GDT
+static void ap_main(cpu_t *cpu) {
+    paging_init_ap();
+    gdt_init_cpu(cpu);
+    idt_load();
+    lapic_init();
+    fpu_init_cpu();
+    // Too late if smp_init() gave up on this CPU; it is about to be sent
+    // INIT, which must not find it holding a lock
+    int starting = 0;
+    if (!__atomic_compare_exchange_n(&cpu->online, &starting, 1, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        while (1) __asm__ volatile ("cli; hlt");
+    }
+    klog(KLOG_INFO, KLOG_KERNEL, "cpu %u online, APIC id %u", cpu->index, cpu->apic_id);
+    ap_loop(cpu);
+}
+
+static int start_ap(cpu_t *cpu) {
+    ap_boot_params_t *params = phys_to_virt(AP_TRAMPOLINE_BASE + (ap_boot_params - ap_trampoline));
+    params->page_directory = virt_to_phys(boot_page_directory);
+    params->stack = (uint32_t)cpu->stack + AP_STACK_SIZE;
+    params->entry = (uint32_t)ap_main;
+    params->cpu = (uint32_t)cpu;
+
+    lapic_send_ipi(cpu->apic_id, LAPIC_ICR_INIT | LAPIC_ICR_ASSERT | LAPIC_ICR_LEVEL);
+    sleep_ms(AP_INIT_DELAY_MS);
+    for (int i = 0; i < 2 && !cpu->online; i++) {
+        lapic_send_ipi(cpu->apic_id, LAPIC_ICR_STARTUP | (AP_TRAMPOLINE_BASE >> 12));
+        sleep_us(AP_SIPI_DELAY_US);
+    }
+
+    uint64_t deadline = timer_ticks() + AP_START_TIMEOUT_MS * TIMER_HZ / 1000;
+    while (!__atomic_load_n(&cpu->online, __ATOMIC_ACQUIRE)) {
+        if (timer_ticks() >= deadline) break;
+        cpu_relax();
+    }
+    // Give up, unless the CPU comes online right now. A slow one that
+    // still gets to ap_main() sees -1 there and halts; INIT then parks it
+    // wherever it is, trampoline included, before the parameters and the
+    // slot go to the next CPU.
+    int starting = 0;
+    if (!__atomic_compare_exchange_n(&cpu->online, &starting, -1, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+    lapic_send_ipi(cpu->apic_id, LAPIC_ICR_INIT | LAPIC_ICR_ASSERT | LAPIC_ICR_LEVEL);
+    sleep_ms(AP_INIT_DELAY_MS);
+    return -1;
+}
+
+// Start every processor in the MADT. Needs the local APIC (timer_init),
+// the heap and a running tick.
+void smp_init(void) {
+    cpu_t *boot = &cpus[0];
+    boot->online = 1;
+    if (!lapic_present() || acpi_cpu_count() < 2) {
+        klog(KLOG_INFO, KLOG_KERNEL, "smp: single CPU");
+        return;
+    }
+    boot->apic_id = lapic_id();
+
+    register_irq_handler(LAPIC_IPI_VECTOR, ipi_wakeup);
+    memcpy(phys_to_virt(AP_TRAMPOLINE_BASE), ap_trampoline, ap_trampoline_end - ap_trampoline);
+
+    for (int i = 0; i < acpi_cpu_count() && cpu_count < SMP_MAX_CPUS; i++) {
+        uint32_t apic_id = acpi_cpu_apic_id(i);
+        if (apic_id == boot->apic_id) continue;
+
+        // A CPU that fails to start is parked by start_ap() and its slot
+        // goes to the next one. Its stack does not: should the INIT not
+        // have stopped it, it is still the only CPU using that.
+        cpu_t *cpu = &cpus[cpu_count];
+        cpu->index = cpu_count;
+        cpu->apic_id = apic_id;
+        cpu->online = 0;
+        cpu->stack = kmalloc(AP_STACK_SIZE);
+        if (!cpu->stack) break;
+        if (start_ap(cpu) < 0) {
+            klog(KLOG_WARN, KLOG_KERNEL, "smp: APIC id %u did not start", apic_id);
+            cpu->stack = 0;
+            continue;
+        }
+        cpu_count++;
+    }
+    klog(KLOG_INFO, KLOG_KERNEL, "smp: %d CPUs online", cpu_count);
+}
+
+// Run fn(arg) on CPU `index`, waiting for any earlier work there to finish.
+// Returns -1 for the calling CPU or one that is not online.
+int smp_call(int index, smp_fn_t fn, void *arg) {
+    if (index <= 0 || index >= cpu_count) return -1;
+    cpu_t *cpu = &cpus[index];
+    if ((uint32_t)index == cpu_index()) return -1;
+
+    while (__atomic_exchange_n(&cpu->busy, 1, __ATOMIC_ACQUIRE)) {
+        cpu_relax();
+    }
+    cpu->work_arg = arg;
+    __atomic_store_n(&cpu->work, fn, __ATOMIC_RELEASE);
+    lapic_send_ipi(cpu->apic_id, LAPIC_ICR_FIXED | LAPIC_IPI_VECTOR);
+    return 0;
+}
+
+// Wait until CPU `index` has no work left
+void smp_wait(int index) {
+    if (index <= 0 || index >= cpu_count) return;
+    while (__atomic_load_n(&cpus[index].busy, __ATOMIC_ACQUIRE)) {
+        cpu_relax();
+    }
+}
+
+// Run fn(arg) once on every online CPU, the calling boot CPU included, and
+// return when all are done. fn tells the copies apart with cpu_index().
+void smp_run_all(smp_fn_t fn, void *arg) {
+    int count = cpu_count;
+    for (int i = 1; i < count; i++) {
+        smp_call(i, fn, arg);
+    }
+    fn(arg);
+    for (int i = 1; i < count; i++) {
+        smp_wait(i);
+    }
+}
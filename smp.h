@@ -0,0 +1,63 @@
+#ifndef SMP_H
+#define SMP_H
+
+#include <stdint.h>
+#include "gdt.h"
+
+#define SMP_MAX_CPUS  16
+#define AP_STACK_SIZE 16384
+
+// Physical page the AP start-up code is copied to; the SIPI vector is its
+// page number. Must match TRAMPOLINE_BASE in smpboot.asm.
+#define AP_TRAMPOLINE_BASE 0x8000
+
+// INIT-SIPI-SIPI timing from the MultiProcessor Specification
+#define AP_INIT_DELAY_MS    10
+#define AP_SIPI_DELAY_US    200
+#define AP_START_TIMEOUT_MS 100
+
+typedef void (*smp_fn_t)(void *arg);
+
+// Per-CPU data area, reached through %gs
+typedef struct cpu {
+    struct cpu *self;          // %gs:0; this_cpu() relies on it being first
+    uint32_t index;            // 0 is the boot CPU; online CPUs are 0..count-1
+    uint32_t apic_id;
+    volatile int online;       // 1 once started, -1 if given up on while starting
+    void *stack;
+    volatile int busy;         // claimed by smp_call() until the work is done
+    volatile smp_fn_t work;    // run by the CPU's work loop, then cleared
+    void *work_arg;
+    uint32_t jobs;             // work items completed
+    uint64_t busy_cycles;      // TSC cycles spent running them
+    struct gdt_entry gdt[GDT_ENTRIES];
+    struct gdt_ptr gdt_ptr;
+    struct tss tss;
+} cpu_t;
+
+// Read by the start-up code from the end of its copy (smpboot.asm)
+typedef struct {
+    uint32_t page_directory;   // physical; the boot directory, mapping it 1:1
+    uint32_t stack;
+    uint32_t entry;
+    uint32_t cpu;
+} ap_boot_params_t;
+
+static inline cpu_t *this_cpu(void) {
+    cpu_t *cpu;
+    __asm__ ("mov %%gs:0, %0" : "=r"(cpu));
+    return cpu;
+}
+
+static inline uint32_t cpu_index(void) {
+    return this_cpu()->index;
+}
+
+void smp_init(void);
+int smp_cpu_count(void);
+cpu_t *smp_cpu(int index);
+int smp_call(int index, smp_fn_t fn, void *arg);
+void smp_wait(int index);
+void smp_run_all(smp_fn_t fn, void *arg);
+
+#endif // SMP_H
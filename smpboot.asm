@@ -0,0 +1,70 @@
+; Application processor start-up code. smp_init() copies everything from
+; ap_trampoline to ap_trampoline_end to AP_TRAMPOLINE_BASE and points the
+; SIPI there, so the code only uses addresses relative to that copy.
+
+TRAMPOLINE_BASE equ 0x8000         ;must match AP_TRAMPOLINE_BASE in smp.h
+KERNEL_CODE     equ 0x08
+KERNEL_DATA     equ 0x10
+
+%define TRAMPOLINE(label) (TRAMPOLINE_BASE + (label - ap_trampoline))
+
+section .text
+
+global ap_trampoline
+global ap_trampoline_end
+global ap_boot_params
+
+bits 16
+ap_trampoline:				;real mode, cs:ip = 0x0800:0000
+	cli
+	cld
+	xor ax, ax
+	mov ds, ax
+	lgdt [TRAMPOLINE(ap_gdt_ptr)]
+	mov eax, cr0
+	and eax, 0x9FFFFFFF		;INIT leaves the caches disabled (CD, NW)
+	or eax, 1			;PE
+	mov cr0, eax
+	jmp dword KERNEL_CODE:TRAMPOLINE(ap_protected)
+
+bits 32
+ap_protected:
+	mov ax, KERNEL_DATA
+	mov ds, ax
+	mov es, ax
+	mov fs, ax
+	mov gs, ax
+	mov ss, ax
+	;the boot page directory still maps this page 1:1 next to the kernel
+	mov eax, cr4
+	or eax, 0x10			;PSE: allow 4 MiB pages
+	mov cr4, eax
+	mov eax, [TRAMPOLINE(ap_boot_params)]
+	mov cr3, eax
+	mov eax, cr0
+	or eax, 0x80000000		;PG
+	mov cr0, eax
+	mov esp, [TRAMPOLINE(ap_boot_params) + 4]
+	push dword [TRAMPOLINE(ap_boot_params) + 12]
+	call [TRAMPOLINE(ap_boot_params) + 8]
+.halt:					;ap_main() does not return
+	cli
+	hlt
+	jmp .halt
+
+align 8
+ap_gdt:					;flat code and data, like the kernel's
+	dq 0
+	dq 0x00CF9A000000FFFF
+	dq 0x00CF92000000FFFF
+ap_gdt_ptr:
+	dw 23
+	dd TRAMPOLINE(ap_gdt)
+
+align 4
+ap_boot_params:				;ap_boot_params_t, written before each SIPI
+	dd 0				;page directory (physical)
+	dd 0				;stack top
+	dd 0				;entry
+	dd 0				;cpu_t *
+ap_trampoline_end:
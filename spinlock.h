@@ -0,0 +1,29 @@
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include <stdint.h>
+#include "io.h"
+#include "cpu.h"
+
+// Test-and-test-and-set lock. Interrupts stay off while it is held, so an
+// interrupt handler on the same CPU can never spin on it.
+typedef struct {
+    volatile uint32_t locked;
+} spinlock_t;
+
+#define SPINLOCK_INIT {0}
+
+static inline unsigned long spin_lock_irqsave(spinlock_t *lock) {
+    unsigned long flags = irq_save();
+    while (__atomic_exchange_n(&lock->locked, 1, __ATOMIC_ACQUIRE)) {
+        while (lock->locked) cpu_relax();
+    }
+    return flags;
+}
+
+static inline void spin_unlock_irqrestore(spinlock_t *lock, unsigned long flags) {
+    __atomic_store_n(&lock->locked, 0, __ATOMIC_RELEASE);
+    irq_restore(flags);
+}
+
+#endif // SPINLOCK_H
@@ -0,0 +1,68 @@
+#include "syscall.h"
+#include "process.h"
+#include "gdt.h"
+#include "smp.h"
+#include "cpu.h"
+#include "kernel.h"
+#include "klog.h"
+
+// Entry point for sysenter (kernel.asm)
+extern void sysenter_entry(void);
+
+// Console output is copied through a small kernel buffer, so the user
+// buffer is only read after it has been checked
+#define WRITE_CHUNK 128
+
+static int sys_exit(uint32_t status, uint32_t b, uint32_t c) {
+    process_exit((int)status);
+}
+
+static int sys_write(uint32_t buf, uint32_t len, uint32_t color) {
+    if (process_check_user((const void *)buf, len, 0) < 0) return -1;
+    if (color == 0 || color > 0x0F) color = current_color;
+    const char *src = (const char *)buf;
+    char chunk[WRITE_CHUNK + 1];
+    for (uint32_t done = 0; done < len; ) {
+        uint32_t n = len - done < WRITE_CHUNK ? len - done : WRITE_CHUNK;
+        for (uint32_t i = 0; i < n; i++) {
+            // A NUL would end print_colored early; show it as a space
+            chunk[i] = src[done + i] ? src[done + i] : ' ';
+        }
+        chunk[n] = '\0';
+        print_colored(chunk, color);
+        done += n;
+    }
+    return (int)len;
+}
+
+static int sys_getpid(uint32_t a, uint32_t b, uint32_t c) {
+    return (int)process_current()->pid;
+}
+
+static int sys_null(uint32_t a, uint32_t b, uint32_t c) {
+    return 0;
+}
+
+const syscall_fn_t syscall_table[SYSCALL_COUNT] = {
+    [SYS_EXIT]   = sys_exit,
+    [SYS_WRITE]  = sys_write,
+    [SYS_GETPID] = sys_getpid,
+    [SYS_NULL]   = sys_null,
+};
+
+// Point the SYSENTER MSRs of the calling CPU at the entry code. The stack
+// MSR holds the address of the TSS's esp0 rather than a stack: the entry
+// code loads esp from there, so switching threads never rewrites an MSR.
+// Only the boot CPU runs threads, and only it needs this. -1 without
+// sysenter.
+int syscall_init(void) {
+    if (!(cpuid_edx(1) & CPUID_EDX_SEP)) {
+        klog(KLOG_WARN, KLOG_KERNEL, "no sysenter: user programs disabled");
+        return -1;
+    }
+    cpu_t *cpu = this_cpu();
+    wrmsr(MSR_SYSENTER_CS, GDT_KERNEL_CODE);
+    wrmsr(MSR_SYSENTER_ESP, (uint32_t)&cpu->tss.esp0);
+    wrmsr(MSR_SYSENTER_EIP, (uint32_t)sysenter_entry);
+    return 0;
+}
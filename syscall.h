@@ -0,0 +1,24 @@
+#ifndef SYSCALL_H
+#define SYSCALL_H
+
+#include <stdint.h>
+
+// System call numbers, shared with the user programs (user/user.h). User
+// code enters with sysenter: eax holds the number, ebx, esi and edi the
+// arguments, ecx the stack pointer and edx the address to return to;
+// the result comes back in eax. ebx, esi, edi and ebp are preserved.
+#define SYS_EXIT   0  // (status)
+#define SYS_WRITE  1  // (buf, len, color): console output, color 0 for the current one
+#define SYS_GETPID 2
+#define SYS_NULL   3  // returns 0; for measuring the entry and exit path
+
+#define SYSCALL_COUNT 4  // must match kernel.asm
+
+typedef int (*syscall_fn_t)(uint32_t a, uint32_t b, uint32_t c);
+
+// Indexed by eax in sysenter_entry (kernel.asm)
+extern const syscall_fn_t syscall_table[SYSCALL_COUNT];
+
+int syscall_init(void);
+
+#endif // SYSCALL_H
@@ -0,0 +1,297 @@
+#include "task.h"
+#include "smp.h"
+#include "apic.h"
+#include "klib.h"
+#include "cpu.h"
+#include "io.h"
+
+// Work-stealing task pool. Every CPU owns a Chase-Lev deque: it pushes and
+// takes spawned tasks at the bottom, newest first, while idle CPUs steal
+// the oldest (and so largest) ones from the top. Application processors
+// look for work between smp_call() jobs and halt when there is none; a
+// spawn wakes one of them with the smp wakeup IPI.
+//
+// The boot CPU's deque is shared by all threads, so the owner side runs
+// with interrupts off. Steals only race with each other and with the
+// owner's last take, and settle that with a cmpxchg on top.
+//
+// Chase and Lev, "Dynamic circular work-stealing deque" (SPAA 2005), with
+// the fences from Le et al., "Correct and efficient work-stealing for weak
+// memory models" (PPoPP 2013). Indices only grow and are compared by their
+// difference, so wrap-around is harmless.
+
+#define DEQUE_MASK (TASK_DEQUE_SIZE - 1)
+
+typedef struct {
+    volatile uint32_t top;       // next to steal
+    volatile uint32_t bottom;    // next free slot
+    task_t *volatile slot[TASK_DEQUE_SIZE];
+    uint32_t seed;               // xorshift state for picking victims
+    task_stats_t stats;
+} __attribute__((aligned(64))) task_worker_t;
+
+static task_worker_t workers[SMP_MAX_CPUS];
+
+// CPUs halted in the idle loop, one bit per index
+static volatile uint32_t parked = 0;
+
+static inline task_worker_t *this_worker(void) {
+    return &workers[cpu_index()];
+}
+
+static int deque_push(task_worker_t *w, task_t *task) {
+    uint32_t b = __atomic_load_n(&w->bottom, __ATOMIC_RELAXED);
+    uint32_t t = __atomic_load_n(&w->top, __ATOMIC_ACQUIRE);
+    if ((int32_t)(b - t) >= TASK_DEQUE_SIZE) return -1;
+    w->slot[b & DEQUE_MASK] = task;
+    __atomic_store_n(&w->bottom, b + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static task_t *deque_take(task_worker_t *w) {
+    uint32_t b = __atomic_load_n(&w->bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&w->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    uint32_t t = __atomic_load_n(&w->top, __ATOMIC_RELAXED);
+
+    if ((int32_t)(b - t) < 0) {
+        __atomic_store_n(&w->bottom, b + 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    task_t *task = w->slot[b & DEQUE_MASK];
+    if (b == t) {
+        // Last one: a thief may be after it too
+        if (!__atomic_compare_exchange_n(&w->top, &t, t + 1, 0,
+                                         __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            task = 0;
+        }
+        __atomic_store_n(&w->bottom, b + 1, __ATOMIC_RELAXED);
+    }
+    return task;
+}
+
+static task_t *deque_steal(task_worker_t *w) {
+    uint32_t t = __atomic_load_n(&w->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    uint32_t b = __atomic_load_n(&w->bottom, __ATOMIC_ACQUIRE);
+    if ((int32_t)(b - t) <= 0) return 0;
+
+    task_t *task = w->slot[t & DEQUE_MASK];
+    if (!__atomic_compare_exchange_n(&w->top, &t, t + 1, 0,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+    return task;
+}
+
+static void task_run(task_worker_t *w, task_t *task) {
+    int cpu = cpu_index();
+    __atomic_store_n(&task->cpu, cpu, __ATOMIC_RELAXED);
+    task->fn(task->arg);
+    w->stats.executed++;
+    if (cpu != 0) {
+        __atomic_store_n(&task->done, 1, __ATOMIC_RELEASE);
+        return;
+    }
+    // Joiners on the boot CPU check `done` with interrupts off
+    unsigned long flags = irq_save();
+    __atomic_store_n(&task->done, 1, __ATOMIC_RELEASE);
+    sched_wake_all(&task->joiners);
+    irq_restore(flags);
+}
+
+static uint32_t next_random(task_worker_t *w) {
+    uint32_t x = w->seed ? w->seed : 0x9E3779B9u * (uint32_t)(w - workers + 1);
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    w->seed = x;
+    return x;
+}
+
+// One pass over the other CPUs, starting at a random one so thieves
+// spread out instead of all hitting the same victim
+static task_t *steal_any(task_worker_t *self) {
+    uint32_t cpus = smp_cpu_count();
+    uint32_t start = next_random(self) % cpus;
+    for (uint32_t i = 0; i < cpus; i++) {
+        task_worker_t *victim = &workers[(start + i) % cpus];
+        if (victim == self) continue;
+        task_t *task = deque_steal(victim);
+        if (task) {
+            self->stats.stolen++;
+            return task;
+        }
+    }
+    return 0;
+}
+
+// Wake one halted CPU, if any, to steal what was just pushed. The fence
+// pairs with the one in task_park(): either that CPU sees the new task
+// before it halts, or its bit is visible here.
+static void wake_one(void) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    uint32_t mask = __atomic_load_n(&parked, __ATOMIC_RELAXED);
+    while (mask) {
+        int index = __builtin_ctz(mask);
+        uint32_t bit = 1u << index;
+        if (__atomic_fetch_and(&parked, ~bit, __ATOMIC_ACQ_REL) & bit) {
+            lapic_send_ipi(smp_cpu(index)->apic_id, LAPIC_ICR_FIXED | LAPIC_IPI_VECTOR);
+            return;
+        }
+        mask &= ~bit;
+    }
+}
+
+// Make fn(arg) available to other CPUs. The caller must task_join() it
+// before `task` or anything `arg` points to goes away.
+void task_spawn(task_t *task, task_fn_t fn, void *arg) {
+    task->fn = fn;
+    task->arg = arg;
+    task->done = 0;
+    task->cpu = -1;
+    task->joiners.head = 0;
+    task->joiners.tail = 0;
+
+    task_worker_t *w = this_worker();
+    int queued = -1;
+    if (smp_cpu_count() > 1) {
+        unsigned long flags = irq_save();
+        queued = deque_push(w, task);
+        irq_restore(flags);
+    }
+    if (queued < 0) {
+        w->stats.inlined++;
+        task_run(w, task);
+        return;
+    }
+    w->stats.spawned++;
+    wake_one();
+}
+
+// Wait for a spawned task. Until it is done the CPU runs other tasks: its
+// own newest first, which is usually `task` itself, then stolen ones. With
+// none left, a thread whose task another boot CPU thread is running blocks
+// until it finishes; that thread may have a lower priority and would never
+// get the CPU back from a spinning joiner. Tasks on other CPUs finish
+// regardless, and soon, so those are waited for spinning.
+void task_join(task_t *task) {
+    while (!__atomic_load_n(&task->done, __ATOMIC_ACQUIRE)) {
+        unsigned long flags = irq_save();
+        task_worker_t *w = this_worker();
+        task_t *next = deque_take(w);
+        irq_restore(flags);
+        if (!next) next = steal_any(w);
+        if (next) {
+            task_run(w, next);
+        } else if (cpu_index() == 0 && sched_active() &&
+                   __atomic_load_n(&task->cpu, __ATOMIC_RELAXED) == 0) {
+            flags = irq_save();
+            if (!__atomic_load_n(&task->done, __ATOMIC_ACQUIRE)) sched_block(&task->joiners);
+            irq_restore(flags);
+        } else {
+            cpu_relax();
+        }
+    }
+}
+
+typedef struct {
+    uint32_t lo, hi, grain;
+    task_range_fn_t fn;
+    void *arg;
+} range_job_t;
+
+static void range_task(void *arg) {
+    range_job_t *job = arg;
+    parallel_for(job->lo, job->hi, job->grain, job->fn, job->arg);
+}
+
+// fn(lo', hi', arg) over pieces of [lo, hi) of at most `grain` items,
+// split in halves so thieves take the biggest pieces
+void parallel_for(uint32_t lo, uint32_t hi, uint32_t grain, task_range_fn_t fn, void *arg) {
+    if (grain == 0) grain = 1;
+    if (hi - lo <= grain || smp_cpu_count() == 1) {
+        if (lo < hi) fn(lo, hi, arg);
+        return;
+    }
+    uint32_t mid = lo + (hi - lo) / 2;
+    range_job_t right = {mid, hi, grain, fn, arg};
+    task_t task;
+    task_spawn(&task, range_task, &right);
+    parallel_for(lo, mid, grain, fn, arg);
+    task_join(&task);
+}
+
+typedef struct {
+    uint8_t *dst;
+    const uint8_t *src;
+    int c;
+} mem_job_t;
+
+static void copy_range(uint32_t lo, uint32_t hi, void *arg) {
+    mem_job_t *job = arg;
+    memcpy(job->dst + lo, job->src + lo, hi - lo);
+}
+
+static void set_range(uint32_t lo, uint32_t hi, void *arg) {
+    mem_job_t *job = arg;
+    memset(job->dst + lo, job->c, hi - lo);
+}
+
+// memcpy/memset for large buffers, spread over all CPUs. Only pays off
+// when one CPU cannot saturate the memory bus.
+void parallel_memcpy(void *dst, const void *src, size_t n) {
+    if (n < 2 * TASK_MEM_GRAIN) {
+        memcpy(dst, src, n);
+        return;
+    }
+    mem_job_t job = {dst, src, 0};
+    parallel_for(0, n, TASK_MEM_GRAIN, copy_range, &job);
+}
+
+void parallel_memset(void *dst, int c, size_t n) {
+    if (n < 2 * TASK_MEM_GRAIN) {
+        memset(dst, c, n);
+        return;
+    }
+    mem_job_t job = {dst, 0, c};
+    parallel_for(0, n, TASK_MEM_GRAIN, set_range, &job);
+}
+
+// Steal and run one task for the idle loop of an application processor.
+// Returns 0 when no CPU had any.
+int task_run_stolen(void) {
+    task_worker_t *w = this_worker();
+    task_t *task = steal_any(w);
+    if (!task) return 0;
+    task_run(w, task);
+    return 1;
+}
+
+// Any task waiting on some CPU's deque
+int task_pending(void) {
+    int cpus = smp_cpu_count();
+    for (int i = 0; i < cpus; i++) {
+        task_worker_t *w = &workers[i];
+        uint32_t t = __atomic_load_n(&w->top, __ATOMIC_RELAXED);
+        uint32_t b = __atomic_load_n(&w->bottom, __ATOMIC_RELAXED);
+        if ((int32_t)(b - t) > 0) return 1;
+    }
+    return 0;
+}
+
+// Announce that this CPU is about to halt. Called with interrupts off; the
+// caller checks task_pending() afterwards and only halts if it is still 0.
+void task_park(void) {
+    task_worker_t *w = this_worker();
+    w->stats.parks++;
+    __atomic_fetch_or(&parked, 1u << cpu_index(), __ATOMIC_SEQ_CST);
+}
+
+void task_unpark(void) {
+    __atomic_fetch_and(&parked, ~(1u << cpu_index()), __ATOMIC_RELAXED);
+}
+
+const task_stats_t *task_stats(int cpu) {
+    return &workers[cpu].stats;
+}
@@ -0,0 +1,51 @@
+#ifndef TASK_H
+#define TASK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "sched.h"
+
+// Tasks each CPU can queue before task_spawn() runs new ones inline. A
+// power of two; spawning halves the work at each level, so the depth of a
+// divide-and-conquer computation stays far below this.
+#define TASK_DEQUE_SIZE 256
+
+// parallel_memcpy/parallel_memset split their buffer into pieces of this
+// size, and copy anything below twice that on the calling CPU
+#define TASK_MEM_GRAIN 65536
+
+typedef void (*task_fn_t)(void *arg);
+typedef void (*task_range_fn_t)(uint32_t lo, uint32_t hi, void *arg);
+
+// Owned by the spawner, usually on its stack, until task_join() returns
+typedef struct task {
+    task_fn_t fn;
+    void *arg;
+    volatile int done;
+    volatile int cpu;        // the one running it, -1 until taken
+    wait_queue_t joiners;    // boot CPU threads waiting for it to finish there
+} task_t;
+
+typedef struct {
+    uint32_t spawned;    // pushed on this CPU's deque
+    uint32_t inlined;    // run at once: single CPU or deque full
+    uint32_t executed;   // run on this CPU, stolen ones included
+    uint32_t stolen;     // taken from another CPU's deque
+    uint32_t parks;      // times the CPU went idle waiting for work
+} task_stats_t;
+
+void task_spawn(task_t *task, task_fn_t fn, void *arg);
+void task_join(task_t *task);
+void parallel_for(uint32_t lo, uint32_t hi, uint32_t grain, task_range_fn_t fn, void *arg);
+void parallel_memcpy(void *dst, const void *src, size_t n);
+void parallel_memset(void *dst, int c, size_t n);
+
+// Idle loop of the application processors (smp.c)
+int task_run_stolen(void);
+int task_pending(void);
+void task_park(void);
+void task_unpark(void);
+
+const task_stats_t *task_stats(int cpu);
+
+#endif // TASK_H
@@ -0,0 +1,161 @@
+#include "timer.h"
+#include "apic.h"
+#include "cpu.h"
+#include "io.h"
+#include "idt.h"
+#include "console.h"
+#include "sched.h"
+#include "klog.h"
+#include "perf.h"
+
+// Length of the PIT window used for calibration
+#define CALIBRATE_MS 10
+
+static volatile uint64_t ticks = 0;
+static int source = TIMER_SOURCE_PIT;
+static uint32_t tsc_khz = 0;  // TSC cycles per millisecond
+static uint32_t apic_khz = 0; // local APIC timer counts per millisecond
+
+// Busy-wait on PIT channel 2 for `ms` milliseconds (at most 54). Only used
+// during calibration, before the tick interrupt is running.
+static void pit_wait_ms(uint32_t ms) {
+    uint16_t latch = PIT_HZ * ms / 1000;
+    unsigned char gate = read_port(PIT_GATE_PORT);
+
+    // Gate on, speaker off, channel 2 in mode 0 (interrupt on terminal count)
+    write_port(PIT_GATE_PORT, (gate & ~0x02) | 0x01);
+    write_port(PIT_COMMAND, 0xB0);
+    write_port(PIT_CHANNEL2, latch & 0xFF);
+    write_port(PIT_CHANNEL2, latch >> 8);
+
+    // OUT2 goes high once the count reaches zero
+    while (!(read_port(PIT_GATE_PORT) & 0x20));
+}
+
+// Channel 0 in mode 2 (rate generator) at `hz` interrupts per second
+static void pit_set_frequency(uint32_t hz) {
+    uint32_t divisor = PIT_HZ / hz;
+    write_port(PIT_COMMAND, 0x34);
+    write_port(PIT_CHANNEL0, divisor & 0xFF);
+    write_port(PIT_CHANNEL0, (divisor >> 8) & 0xFF);
+}
+
+// Measure the TSC and, if enabled, the local APIC timer against one PIT window
+static void calibrate(int use_apic) {
+    uint64_t start;
+    uint32_t cycles;
+
+    if (use_apic) {
+        lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIV_16);
+        lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED | LAPIC_TIMER_VECTOR);
+        lapic_write(LAPIC_TIMER_INIT, 0xFFFFFFFF);
+    }
+    start = rdtsc();
+    pit_wait_ms(CALIBRATE_MS);
+    // Ten milliseconds of TSC fits in 32 bits below 400 GHz
+    cycles = (uint32_t)(rdtsc() - start);
+    if (use_apic) {
+        apic_khz = (0xFFFFFFFF - lapic_read(LAPIC_TIMER_CURRENT)) / CALIBRATE_MS;
+        lapic_timer_stop();
+    }
+
+    if (cpuid_edx(1) & CPUID_EDX_TSC) {
+        tsc_khz = cycles / CALIBRATE_MS;
+    }
+}
+
+// Tick handler for both IRQ0 and the local APIC timer vector; the
+// dispatcher sends the matching EOI
+static void timer_irq(struct regs *r) {
+    ticks++;
+    if (perf_countdown) {
+        perf_sample(r);
+    }
+    sched_tick(ticks);
+    if ((uint32_t)ticks % CONSOLE_FLUSH_TICKS == 0) {
+        console_tick();
+    }
+}
+
+void timer_init(void) {
+    int use_apic = lapic_present();
+
+    if (use_apic) {
+        lapic_init();
+    }
+    calibrate(use_apic);
+    pit_set_frequency(TIMER_HZ);
+
+    if (use_apic && apic_khz >= TIMER_HZ / 1000) {
+        // The local APIC timer is cheaper to acknowledge than the PIT, so it
+        // drives the tick and IRQ0 stays masked
+        source = TIMER_SOURCE_APIC;
+        register_irq_handler(LAPIC_TIMER_VECTOR, timer_irq);
+        lapic_timer_start(apic_khz * 1000 / TIMER_HZ);
+    } else {
+        source = TIMER_SOURCE_PIT;
+        register_irq_handler(IRQ_VECTOR(0), timer_irq);
+        irq_unmask(0);
+    }
+    klog(KLOG_INFO, KLOG_TIMER, "%u Hz tick from the %s, TSC %u kHz, APIC timer %u kHz",
+         TIMER_HZ, (uint32_t)(source == TIMER_SOURCE_APIC ? "local APIC" : "PIT"),
+         tsc_khz, apic_khz);
+}
+
+uint64_t timer_ticks(void) {
+    uint64_t a, b;
+    // A 64-bit load is two instructions on i386; retry if a tick split it
+    do {
+        a = ticks;
+        b = ticks;
+    } while (a != b);
+    return a;
+}
+
+uint64_t timer_uptime_ms(void) {
+    return timer_ticks() * (1000 / TIMER_HZ);
+}
+
+int timer_source(void) {
+    return source;
+}
+
+uint32_t timer_tsc_khz(void) {
+    return tsc_khz;
+}
+
+uint32_t timer_apic_khz(void) {
+    return apic_khz;
+}
+
+// Sleep for at least `ms` milliseconds. Threads block until the tick that
+// wakes them; before the scheduler runs the CPU halts between ticks.
+void sleep_ms(uint32_t ms) {
+    if (ms == 0) return;
+    // One extra tick covers the part of the current tick already elapsed
+    uint64_t target = timer_ticks() + ms * TIMER_HZ / 1000 + 1;
+    if (sched_active()) {
+        sched_sleep_until(target);
+        return;
+    }
+    while (timer_ticks() < target) {
+        sti_hlt();
+    }
+}
+
+// Sleep for at least `us` microseconds. Whole ticks are spent halted; the
+// sub-tick remainder is timed with the TSC.
+void sleep_us(uint32_t us) {
+    uint32_t tick_us = 1000000 / TIMER_HZ;
+
+    if (us >= tick_us || tsc_khz == 0) {
+        sleep_ms((us + 999) / 1000);
+        return;
+    }
+
+    uint64_t start = rdtsc();
+    uint64_t cycles = (uint64_t)us * (tsc_khz / 1000);
+    while (rdtsc() - start < cycles) {
+        cpu_relax();
+    }
+}
@@ -0,0 +1,29 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdint.h>
+
+// Tick rate of the system timer
+#define TIMER_HZ 1000
+
+// PIT ports and input clock
+#define PIT_HZ        1193182
+#define PIT_CHANNEL0  0x40
+#define PIT_CHANNEL2  0x42
+#define PIT_COMMAND   0x43
+#define PIT_GATE_PORT 0x61
+
+// Which device drives the tick counter
+#define TIMER_SOURCE_PIT  0
+#define TIMER_SOURCE_APIC 1
+
+void timer_init(void);
+uint64_t timer_ticks(void);
+uint64_t timer_uptime_ms(void);
+int timer_source(void);
+uint32_t timer_tsc_khz(void);
+uint32_t timer_apic_khz(void);
+void sleep_ms(uint32_t ms);
+void sleep_us(uint32_t us);
+
+#endif // TIMER_H
@@ -0,0 +1,86 @@
+#include "tty.h"
+#include "keyboard_map.h"
+#include "console.h"
+#include "sched.h"
+#include "io.h"
+
+// Line discipline thread. Key events are echoed and edited here as soon as
+// they arrive, whatever the shell is doing; finished lines are queued for
+// tty_read_line().
+static char edit[TTY_LINE_MAX];
+static int edit_len = 0;
+
+static char lines[TTY_LINES][TTY_LINE_MAX];
+static uint32_t line_head = 0; // written by the tty thread only
+static uint32_t line_tail = 0; // written by readers only
+static wait_queue_t readers;
+
+static void commit_line(void) {
+    unsigned long flags = irq_save();
+    if (line_head - line_tail < TTY_LINES) {
+        char *line = lines[line_head % TTY_LINES];
+        for (int i = 0; i < edit_len; i++) line[i] = edit[i];
+        line[edit_len] = '\0';
+        line_head++;
+        sched_wake_all(&readers);
+    }
+    irq_restore(flags);
+    edit_len = 0;
+}
+
+static void tty_key(const key_event_t *event) {
+    if (event->scancode == SC_ENTER) {
+        console_newline();
+        commit_line();
+        return;
+    }
+    // PgUp/PgDn page through the scrollback history
+    if (event->scancode == SC_PGUP) {
+        console_scroll(CONSOLE_ROWS - 1);
+        return;
+    }
+    if (event->scancode == SC_PGDN) {
+        console_scroll(-(CONSOLE_ROWS - 1));
+        return;
+    }
+    char c = event->ascii;
+    if (c == '\b') {
+        if (edit_len > 0) {
+            edit_len--;
+            console_backspace();
+        }
+    } else if (c >= ' ' && edit_len < TTY_LINE_MAX - 1) {
+        // Shift and Caps Lock are already applied by keyboard_get_ascii
+        edit[edit_len++] = c;
+        console_putc(c, CONSOLE_DEFAULT_COLOR);
+    }
+}
+
+static void tty_thread(void *arg) {
+    key_event_t event;
+    while (1) {
+        console_flush();
+        keyboard_wait_event(&event);
+        tty_key(&event);
+    }
+}
+
+// Runs above normal priority so typing echoes even while a command computes
+void tty_init(void) {
+    thread_create("tty", tty_thread, 0, SCHED_PRIO_HIGH);
+}
+
+// Block until a full line has been entered and copy it to `buffer`
+void tty_read_line(char *buffer, int max_size) {
+    unsigned long flags = irq_save();
+    while (line_head == line_tail) {
+        console_flush();
+        sched_block(&readers);
+    }
+    const char *line = lines[line_tail % TTY_LINES];
+    int i = 0;
+    for (; line[i] && i < max_size - 1; i++) buffer[i] = line[i];
+    buffer[i] = '\0';
+    line_tail++;
+    irq_restore(flags);
+}
@@ -0,0 +1,11 @@
+#ifndef TTY_H
+#define TTY_H
+
+// Longest input line and number of completed lines buffered for readers
+#define TTY_LINE_MAX 256
+#define TTY_LINES    8
+
+void tty_init(void);
+void tty_read_line(char *buffer, int max_size);
+
+#endif // TTY_H
@@ -0,0 +1,29 @@
+#include "user.h"
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        print_colored("Usage: binary <number>\n", COLOR_LIGHT_RED);
+        return -1;
+    }
+    int n = atoi(argv[1]);
+    char digits[33];
+    int len = 0;
+    if (n <= 0) {
+        digits[len++] = '0';
+    } else {
+        char binary[32];
+        int index = 0;
+        while (n > 0) {
+            binary[index++] = (n % 2) + '0';
+            n /= 2;
+        }
+        for (int i = index - 1; i >= 0; i--) {
+            digits[len++] = binary[i];
+        }
+    }
+    digits[len] = '\0';
+    print("Binary: ");
+    print_colored(digits, COLOR_LIGHT_GRAY);
+    print("\n");
+    return 0;
+}
@@ -0,0 +1,10 @@
+#include "user.h"
+
+int main(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        if (i > 1) print_colored(" ", COLOR_LIGHT_GREEN);
+        print_colored(argv[i], COLOR_LIGHT_GREEN);
+    }
+    print("\n");
+    return 0;
+}
@@ -0,0 +1,9 @@
+#include "user.h"
+
+// Writes to kernel memory. The page is supervisor-only, so the process is
+// killed and the kernel carries on; the self-test checks exactly that.
+int main(int argc, char **argv) {
+    *(volatile uint32_t *)0xC0100000 = 0;
+    print_colored("fault: kernel memory was writable\n", COLOR_LIGHT_RED);
+    return 0;
+}
@@ -0,0 +1,48 @@
+#include "user.h"
+
+// Entered from the kernel with the stack laid out as if called with
+// (argc, argv); main's return value is the exit status
+void _start(int argc, char **argv) {
+    exit(main(argc, argv));
+}
+
+uint32_t strlen(const char *s) {
+    uint32_t n = 0;
+    while (s[n]) n++;
+    return n;
+}
+
+int atoi(const char *s) {
+    int sign = 1, n = 0;
+    if (*s == '-') {
+        sign = -1;
+        s++;
+    }
+    while (*s >= '0' && *s <= '9') n = n * 10 + (*s++ - '0');
+    return sign * n;
+}
+
+void print_colored(const char *str, unsigned char color) {
+    write(str, strlen(str), color);
+}
+
+void print(const char *str) {
+    write(str, strlen(str), 0);
+}
+
+void printn_colored(int num, unsigned char color) {
+    char digits[12];
+    int i = sizeof(digits) - 1;
+    uint32_t n = num < 0 ? -(uint32_t)num : (uint32_t)num;
+    digits[i] = '\0';
+    do {
+        digits[--i] = '0' + n % 10;
+        n /= 10;
+    } while (n);
+    if (num < 0) digits[--i] = '-';
+    print_colored(&digits[i], color);
+}
+
+void printn(int num) {
+    printn_colored(num, 0);
+}
@@ -0,0 +1,31 @@
+#include "user.h"
+
+#define DEFAULT_CALLS 1000
+#define WARMUP_CALLS  16
+
+// Cycles per call of `fn`, averaged over `calls` back-to-back calls
+static uint32_t time_calls(int (*fn)(void), int calls) {
+    for (int i = 0; i < WARMUP_CALLS; i++) fn();
+    uint64_t start = rdtsc();
+    for (int i = 0; i < calls; i++) fn();
+    uint64_t end = rdtsc();
+    return (uint32_t)(end - start) / calls;
+}
+
+// Round trips through sysenter/sysexit: the empty call, and getpid, which
+// reads the calling process. With -q (the benchmark) nothing is printed.
+int main(int argc, char **argv) {
+    int calls = argc > 1 ? atoi(argv[1]) : DEFAULT_CALLS;
+    if (calls <= 0) calls = DEFAULT_CALLS;
+    uint32_t null_cycles = time_calls(null_syscall, calls);
+    if (argc > 2 && argv[2][0] == '-' && argv[2][1] == 'q') return 0;
+    uint32_t getpid_cycles = time_calls(getpid, calls);
+    print_colored("null syscall: ", COLOR_LIGHT_CYAN);
+    printn(null_cycles);
+    print(" cycles, getpid: ");
+    printn(getpid_cycles);
+    print(" cycles (average of ");
+    printn(calls);
+    print(" calls)\n");
+    return 0;
+}
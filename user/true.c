@@ -0,0 +1,6 @@
+#include "user.h"
+
+// Does nothing: the cost of starting a process (the proc-spawn benchmark)
+int main(int argc, char **argv) {
+    return 0;
+}
@@ -0,0 +1,53 @@
+#ifndef USER_H
+#define USER_H
+
+// Runtime for the ring 3 programs in this directory: system call stubs
+// and the few helpers the ported shell commands need, under the kernel's
+// names. Programs define main(); lib.c provides _start around it.
+
+#include <stdint.h>
+#include "../syscall.h"
+#include "../kernel.h"   // colors
+
+// The kernel returns to the label after sysenter, on the stack passed in ecx
+static inline int syscall3(int n, uint32_t a, uint32_t b, uint32_t c) {
+    int ret;
+    __asm__ volatile ("mov %%esp, %%ecx\n\t"
+                      "mov $1f, %%edx\n\t"
+                      "sysenter\n"
+                      "1:"
+                      : "=a"(ret)
+                      : "a"(n), "b"(a), "S"(b), "D"(c)
+                      : "ecx", "edx", "memory");
+    return ret;
+}
+
+static inline void __attribute__((noreturn)) exit(int status) {
+    syscall3(SYS_EXIT, status, 0, 0);
+    __builtin_unreachable();
+}
+
+static inline int write(const char *buf, uint32_t len, unsigned char color) {
+    return syscall3(SYS_WRITE, (uint32_t)buf, len, color);
+}
+
+static inline int getpid(void) {
+    return syscall3(SYS_GETPID, 0, 0, 0);
+}
+
+static inline int null_syscall(void) {
+    return syscall3(SYS_NULL, 0, 0, 0);
+}
+
+static inline uint64_t rdtsc(void) {
+    uint32_t lo, hi;
+    __asm__ volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+uint32_t strlen(const char *s);
+int atoi(const char *s);
+
+int main(int argc, char **argv);
+
+#endif // USER_H
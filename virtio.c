@@ -0,0 +1,329 @@
+#include "virtio.h"
+#include "pmm.h"
+#include "paging.h"
+#include "klib.h"
+#include "io.h"
+#include "cpu.h"
+
+// Virtio over PCI, both the legacy I/O port interface of transitional
+// devices and the modern one mapped through vendor capabilities, with
+// split virtqueues.
+//
+// The driver adds descriptor chains to the avail ring without telling the
+// device, then virtq_kick() publishes all of them at once and notifies
+// only when the device asked for it. With VIRTIO_F_EVENT_IDX both sides
+// say which index they want to hear about next: the device suppresses
+// notifications while it is still working through the ring, and
+// virtq_arm() asks for one interrupt after a given number of completions
+// instead of one per request.
+//
+// A queue belongs to one driver, which keeps interrupts off around
+// virtq_add() and virtq_kick() so its IRQ handler can call virtq_get().
+
+static inline uint8_t inb(uint16_t port) {
+    return (uint8_t)read_port(port);
+}
+
+static inline uint8_t read8(volatile uint8_t *base, uint32_t off) {
+    return *(volatile uint8_t *)(base + off);
+}
+
+static inline uint16_t read16(volatile uint8_t *base, uint32_t off) {
+    return *(volatile uint16_t *)(base + off);
+}
+
+static inline uint32_t read32(volatile uint8_t *base, uint32_t off) {
+    return *(volatile uint32_t *)(base + off);
+}
+
+static inline void write8(volatile uint8_t *base, uint32_t off, uint8_t value) {
+    *(volatile uint8_t *)(base + off) = value;
+}
+
+static inline void write16(volatile uint8_t *base, uint32_t off, uint16_t value) {
+    *(volatile uint16_t *)(base + off) = value;
+}
+
+static inline void write32(volatile uint8_t *base, uint32_t off, uint32_t value) {
+    *(volatile uint32_t *)(base + off) = value;
+}
+
+static uint8_t get_status(virtio_dev_t *vd) {
+    return vd->modern ? read8(vd->common, VIRTIO_COMMON_STATUS)
+                      : inb(vd->io + VIRTIO_LEGACY_STATUS);
+}
+
+static void set_status(virtio_dev_t *vd, uint8_t status) {
+    if (vd->modern) {
+        write8(vd->common, VIRTIO_COMMON_STATUS, status);
+    } else {
+        outb(vd->io + VIRTIO_LEGACY_STATUS, status);
+    }
+}
+
+// Map the structures the modern capabilities point at; the first of each
+// type is the preferred one
+static void find_modern(virtio_dev_t *vd) {
+    pci_device_t *pci = vd->pci;
+    for (uint8_t cap = pci_next_capability(pci, PCI_CAP_VENDOR, 0); cap;
+         cap = pci_next_capability(pci, PCI_CAP_VENDOR, cap)) {
+        uint8_t type = pci_read8(pci->addr, cap + VIRTIO_CAP_TYPE);
+        uint8_t bar = pci_read8(pci->addr, cap + VIRTIO_CAP_BAR);
+        uint32_t offset = pci_read32(pci->addr, cap + VIRTIO_CAP_OFFSET);
+        uint32_t length = pci_read32(pci->addr, cap + VIRTIO_CAP_LENGTH);
+        if (bar >= PCI_BARS || !pci->bar[bar].size || (pci->bar[bar].flags & PCI_BAR_FLAG_IO) ||
+            offset + length > pci->bar[bar].size) {
+            continue;
+        }
+
+        volatile uint8_t **slot = 0;
+        if (type == VIRTIO_CAP_COMMON) slot = &vd->common;
+        if (type == VIRTIO_CAP_ISR) slot = &vd->isr;
+        if (type == VIRTIO_CAP_DEVICE) slot = &vd->device;
+        if (type == VIRTIO_CAP_NOTIFY) {
+            slot = &vd->notify;
+            vd->notify_mult = pci_read32(pci->addr, cap + VIRTIO_CAP_NOTIFY_MULT);
+        }
+        if (slot && !*slot) *slot = paging_map_mmio(pci->bar[bar].base + offset, length);
+    }
+    vd->modern = vd->common && vd->isr && vd->device && vd->notify;
+}
+
+// Find the device's registers, reset it and announce a driver. Prefers
+// the modern interface, falling back to the legacy I/O BAR.
+int virtio_open(virtio_dev_t *vd, pci_device_t *pci) {
+    memset(vd, 0, sizeof(*vd));
+    vd->pci = pci;
+    find_modern(vd);
+    if (!vd->modern) {
+        if (!(pci->bar[0].flags & PCI_BAR_FLAG_IO) || !pci->bar[0].size) return -1;
+        vd->io = pci->bar[0].base;
+    }
+    pci_enable_master(pci);
+
+    set_status(vd, 0);
+    while (vd->modern && get_status(vd) != 0) cpu_relax();
+    set_status(vd, VIRTIO_STATUS_ACKNOWLEDGE);
+    set_status(vd, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+    return 0;
+}
+
+// Accept the wanted features the device offers. A modern device must also
+// take VIRTIO_F_VERSION_1 and confirm the set with FEATURES_OK.
+int virtio_negotiate(virtio_dev_t *vd, uint32_t wanted_lo, uint32_t wanted_hi) {
+    if (vd->modern) {
+        write32(vd->common, VIRTIO_COMMON_DFSELECT, 0);
+        vd->features[0] = read32(vd->common, VIRTIO_COMMON_DF) & wanted_lo;
+        write32(vd->common, VIRTIO_COMMON_DFSELECT, 1);
+        uint32_t hi = read32(vd->common, VIRTIO_COMMON_DF);
+        vd->features[1] = hi & (wanted_hi | 1u << (VIRTIO_F_VERSION_1 - 32));
+        if (!virtio_has_feature(vd, VIRTIO_F_VERSION_1)) return -1;
+
+        write32(vd->common, VIRTIO_COMMON_GFSELECT, 0);
+        write32(vd->common, VIRTIO_COMMON_GF, vd->features[0]);
+        write32(vd->common, VIRTIO_COMMON_GFSELECT, 1);
+        write32(vd->common, VIRTIO_COMMON_GF, vd->features[1]);
+        set_status(vd, get_status(vd) | VIRTIO_STATUS_FEATURES_OK);
+        if (!(get_status(vd) & VIRTIO_STATUS_FEATURES_OK)) return -1;
+    } else {
+        vd->features[0] = inl(vd->io + VIRTIO_LEGACY_HOST_FEATURES) & wanted_lo;
+        outl(vd->io + VIRTIO_LEGACY_GUEST_FEATURES, vd->features[0]);
+    }
+    return 0;
+}
+
+int virtio_has_feature(const virtio_dev_t *vd, int bit) {
+    return (vd->features[bit / 32] >> (bit % 32)) & 1;
+}
+
+// Device-specific configuration. On the legacy interface it moves once
+// MSI-X is on, so enable that first.
+uint32_t virtio_config_read32(virtio_dev_t *vd, uint32_t offset) {
+    if (vd->modern) return read32(vd->device, offset);
+    return inl(vd->io + (vd->msix ? VIRTIO_LEGACY_CONFIG_MSIX : VIRTIO_LEGACY_CONFIG) + offset);
+}
+
+// Deliver queue interrupts as MSI-X table entry 0, raising `vector`.
+// Configuration changes are not signalled. Call before virtq_init().
+int virtio_enable_msix(virtio_dev_t *vd, int vector) {
+    if (pci_enable_msix(vd->pci, 0, vector) < 0) return -1;
+    vd->msix = 1;
+    if (vd->modern) {
+        write16(vd->common, VIRTIO_COMMON_MSIX, VIRTIO_NO_VECTOR);
+    } else {
+        outw(vd->io + VIRTIO_LEGACY_CONFIG_VECTOR, VIRTIO_NO_VECTOR);
+    }
+    return 0;
+}
+
+// Bytes from the start of the ring to the used ring, and in total
+static uint32_t used_offset(uint16_t size) {
+    uint32_t end = sizeof(vring_desc_t) * size + sizeof(vring_avail_t) + 2 * size + 2;
+    return (end + VRING_ALIGN - 1) & ~(VRING_ALIGN - 1);
+}
+
+static uint32_t ring_bytes(uint16_t size) {
+    return used_offset(size) + sizeof(vring_used_t) + sizeof(vring_used_elem_t) * size + 2;
+}
+
+// Allocate queue `index` and hand it to the device
+int virtq_init(virtio_dev_t *vd, virtq_t *vq, uint16_t index) {
+    uint16_t size;
+    if (vd->modern) {
+        write16(vd->common, VIRTIO_COMMON_Q_SELECT, index);
+        size = read16(vd->common, VIRTIO_COMMON_Q_SIZE);
+        // Modern devices take a smaller power of two
+        if (size > VIRTQ_MAX_SIZE) size = VIRTQ_MAX_SIZE;
+    } else {
+        outw(vd->io + VIRTIO_LEGACY_QUEUE_SELECT, index);
+        size = inw(vd->io + VIRTIO_LEGACY_QUEUE_SIZE);
+        if (size > VIRTQ_MAX_SIZE) return -1;
+    }
+    if (size == 0 || (size & (size - 1))) return -1;
+
+    uint32_t pages = (ring_bytes(size) + PAGE_SIZE - 1) / PAGE_SIZE;
+    uint32_t phys = pmm_alloc_contiguous(pages);
+    if (!phys) return -1;
+    uint8_t *ring = phys_to_virt(phys);
+    memset(ring, 0, pages * PAGE_SIZE);
+
+    memset(vq, 0, sizeof(*vq));
+    vq->dev = vd;
+    vq->index = index;
+    vq->size = size;
+    vq->desc = (vring_desc_t *)ring;
+    vq->avail = (vring_avail_t *)(ring + sizeof(vring_desc_t) * size);
+    vq->used = (vring_used_t *)(ring + used_offset(size));
+    vq->used_event = &vq->avail->ring[size];
+    vq->avail_event = (volatile uint16_t *)&vq->used->ring[size];
+    vq->event_idx = virtio_has_feature(vd, VIRTIO_F_EVENT_IDX);
+    for (uint16_t i = 0; i < size; i++) vq->desc[i].next = i + 1;
+    vq->num_free = size;
+
+    uint32_t avail = phys + sizeof(vring_desc_t) * size;
+    uint32_t used = phys + used_offset(size);
+    if (vd->modern) {
+        write16(vd->common, VIRTIO_COMMON_Q_SIZE, size);
+        write32(vd->common, VIRTIO_COMMON_Q_DESC, phys);
+        write32(vd->common, VIRTIO_COMMON_Q_DESC + 4, 0);
+        write32(vd->common, VIRTIO_COMMON_Q_AVAIL, avail);
+        write32(vd->common, VIRTIO_COMMON_Q_AVAIL + 4, 0);
+        write32(vd->common, VIRTIO_COMMON_Q_USED, used);
+        write32(vd->common, VIRTIO_COMMON_Q_USED + 4, 0);
+        if (vd->msix) {
+            // The device answers NO_VECTOR when it cannot take it
+            write16(vd->common, VIRTIO_COMMON_Q_MSIX, 0);
+            if (read16(vd->common, VIRTIO_COMMON_Q_MSIX) != 0) return -1;
+        }
+        uint16_t off = read16(vd->common, VIRTIO_COMMON_Q_NOFF);
+        vq->notify = (volatile uint16_t *)(vd->notify + off * vd->notify_mult);
+        write16(vd->common, VIRTIO_COMMON_Q_ENABLE, 1);
+    } else {
+        outl(vd->io + VIRTIO_LEGACY_QUEUE_PFN, phys / PAGE_SIZE);
+        if (vd->msix) {
+            outw(vd->io + VIRTIO_LEGACY_QUEUE_VECTOR, 0);
+            if (inw(vd->io + VIRTIO_LEGACY_QUEUE_VECTOR) != 0) return -1;
+        }
+    }
+    return 0;
+}
+
+void virtio_driver_ok(virtio_dev_t *vd) {
+    set_status(vd, get_status(vd) | VIRTIO_STATUS_DRIVER_OK);
+}
+
+void virtio_fail(virtio_dev_t *vd) {
+    set_status(vd, get_status(vd) | VIRTIO_STATUS_FAILED);
+}
+
+// Read and clear the interrupt status: bit 0 for a queue, bit 1 for a
+// configuration change. Only meaningful without MSI-X.
+uint8_t virtio_isr(virtio_dev_t *vd) {
+    return vd->modern ? read8(vd->isr, 0) : inb(vd->io + VIRTIO_LEGACY_ISR);
+}
+
+// Chain `out` device-readable buffers followed by `in` device-writable
+// ones and queue the chain. Not visible to the device until virtq_kick().
+// Returns -1 when the ring has too few free descriptors.
+int virtq_add(virtq_t *vq, const virtq_buf_t *bufs, int out, int in, void *cookie) {
+    int n = out + in;
+    if (n == 0 || n > vq->num_free) return -1;
+    uint16_t head = vq->free_head, i = head;
+    for (int k = 0; k < n; k++) {
+        vring_desc_t *d = &vq->desc[i];
+        d->addr = bufs[k].phys;
+        d->len = bufs[k].len;
+        d->flags = (k >= out ? VRING_DESC_F_WRITE : 0) | (k + 1 < n ? VRING_DESC_F_NEXT : 0);
+        i = d->next;
+    }
+    vq->free_head = i;
+    vq->num_free -= n;
+    vq->cookie[head] = cookie;
+    vq->avail->ring[vq->avail_idx & (vq->size - 1)] = head;
+    vq->avail_idx++;
+    return 0;
+}
+
+// Publish everything added since the last kick, then notify the device
+// unless it said it does not need to hear about these entries
+void virtq_kick(virtq_t *vq) {
+    uint16_t old = vq->kicked_idx, now = vq->avail_idx;
+    if (old == now) return;
+    // Descriptors and ring entries before the index; the index before
+    // reading what the device wants (a store-load pair, so a full fence)
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    vq->avail->idx = now;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    vq->kicked_idx = now;
+    vq->kicks++;
+
+    int notify;
+    if (vq->event_idx) {
+        // Notify when avail_event lies in (old, now]
+        notify = (uint16_t)(now - *vq->avail_event - 1) < (uint16_t)(now - old);
+    } else {
+        notify = !(vq->used->flags & VRING_USED_F_NO_NOTIFY);
+    }
+    if (!notify) return;
+    vq->notifies++;
+    if (vq->dev->modern) {
+        *vq->notify = vq->index;
+    } else {
+        outw(vq->dev->io + VIRTIO_LEGACY_QUEUE_NOTIFY, vq->index);
+    }
+}
+
+// Take the next completed chain off the used ring and free its
+// descriptors. Returns its cookie, or 0 when nothing is done yet.
+void *virtq_get(virtq_t *vq, uint32_t *len) {
+    if (vq->last_used == vq->used->idx) return 0;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    volatile vring_used_elem_t *e = &vq->used->ring[vq->last_used & (vq->size - 1)];
+    uint16_t head = e->id;
+    if (len) *len = e->len;
+    void *cookie = vq->cookie[head];
+
+    uint16_t i = head, n = 1;
+    while (vq->desc[i].flags & VRING_DESC_F_NEXT) {
+        i = vq->desc[i].next;
+        n++;
+    }
+    vq->desc[i].next = vq->free_head;
+    vq->free_head = head;
+    vq->num_free += n;
+    vq->last_used++;
+    return cookie;
+}
+
+// Ask for the next interrupt once `pending` more chains are used (with
+// event indexes; otherwise every completion interrupts). Returns nonzero
+// when that many are already there, so no interrupt may come and the
+// caller should collect them now.
+int virtq_arm(virtq_t *vq, uint16_t pending) {
+    if (pending == 0) return 0;
+    if (vq->event_idx) {
+        *vq->used_event = vq->last_used + pending - 1;
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    }
+    return (uint16_t)(vq->used->idx - vq->last_used) >= pending;
+}
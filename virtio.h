@@ -0,0 +1,159 @@
+#ifndef VIRTIO_H
+#define VIRTIO_H
+
+#include <stdint.h>
+#include "pci.h"
+
+#define VIRTIO_PCI_VENDOR 0x1AF4
+// Transitional devices are 0x1000 + n, modern-only ones 0x1040 + type
+#define VIRTIO_PCI_BLK_LEGACY 0x1001
+#define VIRTIO_PCI_MODERN_BASE 0x1040
+#define VIRTIO_TYPE_BLOCK 2
+
+// Device status
+#define VIRTIO_STATUS_ACKNOWLEDGE 0x01
+#define VIRTIO_STATUS_DRIVER      0x02
+#define VIRTIO_STATUS_DRIVER_OK   0x04
+#define VIRTIO_STATUS_FEATURES_OK 0x08
+#define VIRTIO_STATUS_FAILED      0x80
+
+// Transport feature bits
+#define VIRTIO_F_EVENT_IDX 29
+#define VIRTIO_F_VERSION_1 32
+
+// Legacy interface: registers at the start of I/O BAR0. The device
+// configuration follows them, 4 bytes later once MSI-X is on.
+#define VIRTIO_LEGACY_HOST_FEATURES  0
+#define VIRTIO_LEGACY_GUEST_FEATURES 4
+#define VIRTIO_LEGACY_QUEUE_PFN      8
+#define VIRTIO_LEGACY_QUEUE_SIZE     12
+#define VIRTIO_LEGACY_QUEUE_SELECT   14
+#define VIRTIO_LEGACY_QUEUE_NOTIFY   16
+#define VIRTIO_LEGACY_STATUS         18
+#define VIRTIO_LEGACY_ISR            19
+#define VIRTIO_LEGACY_CONFIG_VECTOR  20
+#define VIRTIO_LEGACY_QUEUE_VECTOR   22
+#define VIRTIO_LEGACY_CONFIG         20
+#define VIRTIO_LEGACY_CONFIG_MSIX    24
+
+// Modern interface: vendor capabilities point into memory BARs
+#define VIRTIO_CAP_TYPE   3    // offsets within the capability
+#define VIRTIO_CAP_BAR    4
+#define VIRTIO_CAP_OFFSET 8
+#define VIRTIO_CAP_LENGTH 12
+#define VIRTIO_CAP_NOTIFY_MULT 16
+#define VIRTIO_CAP_COMMON 1
+#define VIRTIO_CAP_NOTIFY 2
+#define VIRTIO_CAP_ISR    3
+#define VIRTIO_CAP_DEVICE 4
+
+// Common configuration structure
+#define VIRTIO_COMMON_DFSELECT     0
+#define VIRTIO_COMMON_DF           4
+#define VIRTIO_COMMON_GFSELECT     8
+#define VIRTIO_COMMON_GF           12
+#define VIRTIO_COMMON_MSIX         16
+#define VIRTIO_COMMON_STATUS       20
+#define VIRTIO_COMMON_Q_SELECT     22
+#define VIRTIO_COMMON_Q_SIZE       24
+#define VIRTIO_COMMON_Q_MSIX       26
+#define VIRTIO_COMMON_Q_ENABLE     28
+#define VIRTIO_COMMON_Q_NOFF       30
+#define VIRTIO_COMMON_Q_DESC       32
+#define VIRTIO_COMMON_Q_AVAIL      40
+#define VIRTIO_COMMON_Q_USED       48
+
+#define VIRTIO_NO_VECTOR 0xFFFF
+
+// Split virtqueue layout; the structures have no padding, so the
+// natural layout is the device's
+#define VRING_DESC_F_NEXT  1
+#define VRING_DESC_F_WRITE 2     // device writes the buffer
+#define VRING_USED_F_NO_NOTIFY 1
+#define VRING_ALIGN 4096         // the used ring starts on a page (legacy)
+
+// Largest queue the driver sets up; the ring is a few pages
+#define VIRTQ_MAX_SIZE 256
+
+typedef struct {
+    uint64_t addr;
+    uint32_t len;
+    uint16_t flags;
+    uint16_t next;
+} vring_desc_t;
+
+// ring[size] is followed by used_event when VIRTIO_F_EVENT_IDX is on
+typedef struct {
+    uint16_t flags;
+    uint16_t idx;
+    uint16_t ring[];
+} vring_avail_t;
+
+typedef struct {
+    uint32_t id;
+    uint32_t len;
+} vring_used_elem_t;
+
+// ring[size] is followed by avail_event when VIRTIO_F_EVENT_IDX is on
+typedef struct {
+    uint16_t flags;
+    uint16_t idx;
+    vring_used_elem_t ring[];
+} vring_used_t;
+
+typedef struct {
+    pci_device_t *pci;
+    int modern;
+    uint16_t io;                     // legacy: I/O BAR0
+    volatile uint8_t *common;        // modern: mapped capabilities
+    volatile uint8_t *isr;
+    volatile uint8_t *device;
+    volatile uint8_t *notify;
+    uint32_t notify_mult;
+    int msix;                        // queue interrupts come by MSI-X
+    uint32_t features[2];            // accepted, bits 0-31 and 32-63
+} virtio_dev_t;
+
+// A buffer to chain: physical address and length
+typedef struct {
+    uint32_t phys;
+    uint32_t len;
+} virtq_buf_t;
+
+typedef struct {
+    virtio_dev_t *dev;
+    uint16_t index;
+    uint16_t size;
+    vring_desc_t *desc;
+    volatile vring_avail_t *avail;
+    volatile vring_used_t *used;
+    volatile uint16_t *used_event;   // in the avail ring, for the device
+    volatile uint16_t *avail_event;  // in the used ring, from the device
+    volatile uint16_t *notify;       // modern notify address
+    int event_idx;
+    uint16_t free_head;
+    uint16_t num_free;
+    uint16_t avail_idx;              // next avail slot, published by kick
+    uint16_t kicked_idx;             // avail idx at the last kick
+    uint16_t last_used;
+    void *cookie[VIRTQ_MAX_SIZE];    // by head descriptor
+    uint32_t kicks;
+    uint32_t notifies;               // kicks the device asked for
+} virtq_t;
+
+int virtio_open(virtio_dev_t *vd, pci_device_t *pci);
+int virtio_negotiate(virtio_dev_t *vd, uint32_t wanted_lo, uint32_t wanted_hi);
+int virtio_has_feature(const virtio_dev_t *vd, int bit);
+uint32_t virtio_config_read32(virtio_dev_t *vd, uint32_t offset);
+int virtio_enable_msix(virtio_dev_t *vd, int vector);
+int virtq_init(virtio_dev_t *vd, virtq_t *vq, uint16_t index);
+void virtio_driver_ok(virtio_dev_t *vd);
+void virtio_fail(virtio_dev_t *vd);
+uint8_t virtio_isr(virtio_dev_t *vd);
+
+int virtq_add(virtq_t *vq, const virtq_buf_t *bufs, int out, int in, void *cookie);
+void virtq_kick(virtq_t *vq);
+void *virtq_get(virtq_t *vq, uint32_t *len);
+int virtq_arm(virtq_t *vq, uint16_t pending);
+
+#endif // VIRTIO_H
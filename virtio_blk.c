@@ -0,0 +1,264 @@
+#include "virtio_blk.h"
+#include "virtio.h"
+#include "blkdev.h"
+#include "idt.h"
+#include "paging.h"
+#include "sched.h"
+#include "klib.h"
+#include "klog.h"
+#include "cpu.h"
+#include "io.h"
+
+// Virtio block devices (QEMU's -drive if=virtio) as vda, vdb, ... A
+// submission puts up to VBLK_QUEUE_DEPTH requests on the queue, kicks
+// once and sleeps until the last one completes; with event indexes the
+// device raises a single interrupt for the whole batch. Interrupts come by
+// MSI-X when the function has it, else on its INTx line, and without
+// either the submitter polls the used ring.
+//
+// One submission at a time per device, like an IDE channel.
+
+typedef struct {
+    vblk_header_t header;
+    volatile uint8_t status;
+} vblk_slot_t;
+
+typedef struct {
+    virtio_dev_t dev;
+    virtq_t vq;
+    blkdev_t blk;
+    mutex_t lock;
+    int vector;                // 0 when polling
+    vblk_slot_t slots[VBLK_QUEUE_DEPTH];
+    volatile int completed;    // of the current batch
+    int expected;
+    wait_queue_t waiters;      // the submitter, waiting for the batch
+    uint32_t irqs;
+} vblk_t;
+
+static vblk_t vblks[VBLK_MAX_DEVICES];
+static int vblk_count = 0;
+
+static const char *const modes[2][3] = {
+    {"legacy, polled", "legacy, INTx", "legacy, MSI-X"},
+    {"modern, polled", "modern, INTx", "modern, MSI-X"},
+};
+
+// Collect finished requests; keep going while more arrive after the
+// interrupt threshold is moved past them
+static void reap(vblk_t *vb) {
+    do {
+        while (virtq_get(&vb->vq, 0)) vb->completed++;
+    } while (vb->completed < vb->expected && virtq_arm(&vb->vq, vb->expected - vb->completed));
+}
+
+static void vblk_irq(struct regs *r) {
+    for (int i = 0; i < VBLK_MAX_DEVICES; i++) {
+        vblk_t *vb = &vblks[i];
+        if (!vb->vector || vb->vector != (int)r->int_no) continue;
+        // INTx may be shared: the ISR read says whether it was us, and
+        // clears the line
+        if (!vb->dev.msix && !(virtio_isr(&vb->dev) & 1)) continue;
+        vb->irqs++;
+        reap(vb);
+        sched_wake_all(&vb->waiters);
+    }
+}
+
+// Sleep until every request of the batch is back
+static void wait_batch(vblk_t *vb) {
+    while (1) {
+        cli();
+        if (!vb->vector) reap(vb);
+        if (vb->completed >= vb->expected) {
+            sti();
+            return;
+        }
+        if (!vb->vector) {
+            sti();
+            cpu_relax();
+        } else if (sched_active()) {
+            sched_block(&vb->waiters);
+        } else {
+            sti_hlt();
+        }
+    }
+}
+
+// Queue one request as header, data, status. -1 when the ring is full.
+static int add_request(vblk_t *vb, vblk_slot_t *slot, const blk_request_t *req) {
+    virtq_buf_t bufs[VBLK_MAX_SEGMENTS + 2];
+    int n = 0;
+    slot->header.type = req->write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+    slot->header.reserved = 0;
+    slot->header.sector = req->lba;
+    slot->status = 0xFF;
+    bufs[n].phys = virt_to_phys(&slot->header);
+    bufs[n++].len = sizeof(slot->header);
+    for (int i = 0; i < req->count; i++) {
+        bufs[n].phys = virt_to_phys(req->segs[i].buf);
+        bufs[n++].len = req->segs[i].len;
+    }
+    bufs[n].phys = virt_to_phys(&slot->status);
+    bufs[n++].len = 1;
+    int out = req->write ? 1 + req->count : 1;
+    return virtq_add(&vb->vq, bufs, out, n - out, slot);
+}
+
+// Publish the `n` queued requests with one kick, asking for one interrupt
+// when all of them are done
+static void run_batch(vblk_t *vb, int n) {
+    vb->completed = 0;
+    vb->expected = n;
+    virtq_arm(&vb->vq, n);
+    virtq_kick(&vb->vq);
+}
+
+static int vblk_submit(blkdev_t *blk, blk_request_t *reqs, int count) {
+    vblk_t *vb = blk->priv;
+    int err = 0;
+    mutex_lock(&vb->lock);
+    for (int i = 0; i < count; ) {
+        unsigned long flags = irq_save();
+        int n = 0;
+        while (i + n < count && n < VBLK_QUEUE_DEPTH &&
+               add_request(vb, &vb->slots[n], &reqs[i + n]) == 0) {
+            n++;
+        }
+        if (n) run_batch(vb, n);
+        irq_restore(flags);
+        if (n == 0) {
+            err = -1;
+            break;
+        }
+        wait_batch(vb);
+        for (int k = 0; k < n; k++) {
+            reqs[i + k].status = vb->slots[k].status == VIRTIO_BLK_S_OK ? 0 : -1;
+        }
+        i += n;
+    }
+    mutex_unlock(&vb->lock);
+    return err;
+}
+
+static int vblk_flush(blkdev_t *blk) {
+    vblk_t *vb = blk->priv;
+    if (!virtio_has_feature(&vb->dev, VIRTIO_BLK_F_FLUSH)) return 0;
+    mutex_lock(&vb->lock);
+    vblk_slot_t *slot = &vb->slots[0];
+    slot->header.type = VIRTIO_BLK_T_FLUSH;
+    slot->header.reserved = 0;
+    slot->header.sector = 0;
+    slot->status = 0xFF;
+    virtq_buf_t bufs[2] = {
+        {virt_to_phys(&slot->header), sizeof(slot->header)},
+        {virt_to_phys(&slot->status), 1},
+    };
+    unsigned long flags = irq_save();
+    int err = virtq_add(&vb->vq, bufs, 1, 1, slot);
+    if (err == 0) run_batch(vb, 1);
+    irq_restore(flags);
+    if (err == 0) {
+        wait_batch(vb);
+        err = slot->status == VIRTIO_BLK_S_OK ? 0 : -1;
+    }
+    mutex_unlock(&vb->lock);
+    return err;
+}
+
+// Interrupts by MSI-X, else the INTx line, else none (polling)
+static void setup_interrupts(vblk_t *vb, pci_device_t *pci) {
+    if (pci->msix_cap) {
+        int vector = pci_alloc_vector();
+        if (vector >= 0 && virtio_enable_msix(&vb->dev, vector) == 0) {
+            vb->vector = vector;
+            register_irq_handler(vector, vblk_irq);
+            return;
+        }
+    }
+    if (pci->irq_pin && pci->irq_line < IRQ_COUNT) {
+        vb->vector = IRQ_VECTOR(pci->irq_line);
+        register_irq_handler(vb->vector, vblk_irq);
+        irq_unmask(pci->irq_line);
+    }
+}
+
+static int vblk_probe(pci_device_t *pci) {
+    if (pci->device != VIRTIO_PCI_BLK_LEGACY &&
+        pci->device != VIRTIO_PCI_MODERN_BASE + VIRTIO_TYPE_BLOCK) {
+        return -1;
+    }
+    if (vblk_count >= VBLK_MAX_DEVICES) return -1;
+    vblk_t *vb = &vblks[vblk_count];
+    virtio_dev_t *vd = &vb->dev;
+    if (virtio_open(vd, pci) < 0) return -1;
+    uint32_t wanted = 1u << VIRTIO_BLK_F_SEG_MAX | 1u << VIRTIO_BLK_F_FLUSH |
+                      1u << VIRTIO_F_EVENT_IDX;
+    if (virtio_negotiate(vd, wanted, 0) < 0) {
+        virtio_fail(vd);
+        return -1;
+    }
+    setup_interrupts(vb, pci);
+    if (virtq_init(vd, &vb->vq, 0) < 0) {
+        klog(KLOG_WARN, KLOG_KERNEL, "virtio-blk: queue setup failed");
+        virtio_fail(vd);
+        vb->vector = 0;
+        return -1;
+    }
+
+    blkdev_t *blk = &vb->blk;
+    memcpy(blk->name, "vda", 4);
+    blk->name[2] += vblk_count;
+    blk->model = "virtio-blk";
+    blk->mode = modes[vd->modern][vb->vector ? 1 + vd->msix : 0];
+    // 32-bit sector numbers: anything past 2 TiB is out of reach
+    uint32_t capacity_hi = virtio_config_read32(vd, VIRTIO_BLK_CFG_CAPACITY + 4);
+    blk->sectors = capacity_hi ? 0xFFFFFFFF : virtio_config_read32(vd, VIRTIO_BLK_CFG_CAPACITY);
+    blk->max_sectors = VBLK_MAX_SECTORS;
+    blk->max_segments = VBLK_MAX_SEGMENTS;
+    if (blk->max_segments > vb->vq.size - 2) blk->max_segments = vb->vq.size - 2;
+    if (virtio_has_feature(vd, VIRTIO_BLK_F_SEG_MAX)) {
+        uint32_t seg_max = virtio_config_read32(vd, VIRTIO_BLK_CFG_SEG_MAX);
+        if (seg_max && seg_max < (uint32_t)blk->max_segments) blk->max_segments = seg_max;
+    }
+    blk->submit = vblk_submit;
+    blk->flush = vblk_flush;
+    blk->priv = vb;
+
+    virtio_driver_ok(vd);
+    vblk_count++;
+    blkdev_register(blk);
+    return 0;
+}
+
+static const pci_driver_t vblk_driver = {
+    .name = "virtio-blk",
+    .vendor = VIRTIO_PCI_VENDOR,
+    .device = PCI_ANY,
+    .class = PCI_ANY,
+    .subclass = PCI_ANY,
+    .probe = vblk_probe,
+};
+
+// Needs pci_init() and the PMM; register before bcache_init()
+void virtio_blk_init(void) {
+    pci_register_driver(&vblk_driver);
+}
+
+int virtio_blk_count(void) {
+    return vblk_count;
+}
+
+int virtio_blk_stats(int index, virtio_blk_stats_t *out) {
+    if (index < 0 || index >= vblk_count) return -1;
+    vblk_t *vb = &vblks[index];
+    out->blkdev = blkdev_find(vb->blk.name);
+    out->modern = vb->dev.modern;
+    out->msix = vb->vector && vb->dev.msix;
+    out->event_idx = vb->vq.event_idx;
+    out->queue_size = vb->vq.size;
+    out->kicks = vb->vq.kicks;
+    out->notifies = vb->vq.notifies;
+    out->irqs = vb->irqs;
+    return 0;
+}
@@ -0,0 +1,48 @@
+#ifndef VIRTIO_BLK_H
+#define VIRTIO_BLK_H
+
+#include <stdint.h>
+
+#define VBLK_MAX_DEVICES 4
+
+// Requests in flight at once, each a header, its data segments and a
+// status byte in one descriptor chain
+#define VBLK_QUEUE_DEPTH  32
+#define VBLK_MAX_SEGMENTS 64
+#define VBLK_MAX_SECTORS  2048   // 1 MiB per request
+
+// Feature bits
+#define VIRTIO_BLK_F_SEG_MAX 2
+#define VIRTIO_BLK_F_FLUSH   9
+
+// Device configuration
+#define VIRTIO_BLK_CFG_CAPACITY 0   // 64-bit, in sectors
+#define VIRTIO_BLK_CFG_SEG_MAX  12
+
+#define VIRTIO_BLK_T_IN    0
+#define VIRTIO_BLK_T_OUT   1
+#define VIRTIO_BLK_T_FLUSH 4
+#define VIRTIO_BLK_S_OK    0
+
+typedef struct {
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t sector;
+} vblk_header_t;
+
+typedef struct {
+    int blkdev;                // index for blkdev_get()
+    int modern;
+    int msix;
+    int event_idx;
+    uint16_t queue_size;
+    uint32_t kicks;            // batches published
+    uint32_t notifies;         // of those, ones the device asked to hear about
+    uint32_t irqs;
+} virtio_blk_stats_t;
+
+void virtio_blk_init(void);
+int virtio_blk_count(void);
+int virtio_blk_stats(int index, virtio_blk_stats_t *stats);
+
+#endif // VIRTIO_BLK_H